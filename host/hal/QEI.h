@@ -0,0 +1,36 @@
+/**
+ * @file QEI.h
+ * @brief Host stand-in for the QEI library: the pulse count of channel A is set by the host
+ *
+ * See host_hal.h (hal::set_encoder() and hal::add_encoder()).
+ *
+ */
+
+#pragma once
+
+#include "mbed.h"
+
+
+class QEI
+{
+public:
+
+    typedef enum
+    {
+        X2_ENCODING,
+        X4_ENCODING
+    } Encoding;
+
+private:
+
+    PinName channel_a;
+    int pulses_per_rev;
+    int offset;                             // host count at the last reset
+
+public:
+
+    QEI(PinName channelA, PinName channelB, PinName index, int pulsesPerRev, Encoding encoding = X2_ENCODING);
+    void reset(void);
+    int getPulses(void);
+    int getRevolutions(void);
+};
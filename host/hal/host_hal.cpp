@@ -0,0 +1,1126 @@
+#include <algorithm>
+#include <deque>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <queue>
+#include <random>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include "host_hal.h"
+#include "QEI.h"
+
+
+#define FLASH_START         0x08000000
+#define FLASH_SIZE          0x80000         // STM32F401RE
+#define FLASH_ERASED        0xFF
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+
+/* One UART, shared by the RawSerial objects on its pins */
+struct Host_uart
+{
+    PinName tx;
+    PinName rx;
+    uint64_t char_ns;                       // 10 bits per byte
+    uint64_t tx_free_ns;                    // transmit register empty
+    uint64_t rx_last_ns;                    // arrival of the last byte sent by the host
+    std::deque<char> rx_fifo;
+    std::string output;
+    std::function<void(char)> receiver;
+    Callback<void()> irq[SerialBase::IrqCnt];
+};
+
+
+namespace
+{
+
+struct Pin_state
+{
+    float analog;
+    std::function<float()> analog_source;
+    int input;
+    int output;
+    float pwm_duty;
+    float pwm_period;
+    int encoder;
+
+    Pin_state(): analog(0), input(1), output(0), pwm_duty(0), pwm_period(0.02f), encoder(0) {}
+};
+
+struct Event
+{
+    uint64_t time_ns;
+    uint64_t order;                         // events due at the same time run in the order posted
+    hal::Action action;
+};
+
+struct Event_later
+{
+    bool operator()(const Event& a, const Event& b) const
+    {
+        return (a.time_ns != b.time_ns) ? a.time_ns > b.time_ns : a.order > b.order;
+    }
+};
+
+/* Thrown at the end of hal::run() to leave the firmware main loop */
+struct Host_stop
+{
+};
+
+struct Host_state
+{
+    uint64_t now_ns;
+    uint64_t end_ns;
+    bool running;
+    bool in_isr;
+    int critical_depth;
+    uint64_t event_order;
+    std::priority_queue<Event, std::vector<Event>, Event_later> events;
+
+    Host_costs costs;
+    std::map<int, Pin_state> pins;
+    std::vector<std::unique_ptr<Host_uart>> uarts;
+    uint8_t* flash;
+    uint64_t cycle_offset;
+
+    uint64_t interrupt_count;
+    uint64_t max_latency_ns;
+    std::mt19937 random;
+
+    Host_state(): now_ns(0), end_ns(0), running(false), in_isr(false), critical_depth(0), event_order(0),
+                  flash(nullptr), cycle_offset(0), interrupt_count(0), max_latency_ns(0)
+    {
+        costs.call_ns = 100;
+        costs.isr_ns = 1000;
+        costs.analog_read_ns = 9000;
+        costs.flash_program_ns = 16000;
+        costs.flash_erase_ns_per_kb = 8000000;
+        costs.core_clock_hz = 84000000;
+        costs.ticker_jitter_ns = 0;
+    }
+};
+
+
+/* Constructed on first use: the firmware globals use the HAL from their constructors */
+Host_state& state(void)
+{
+    static Host_state s;
+    return s;
+}
+
+
+Pin_state& pin_state(PinName pin)
+{
+    return state().pins[(int) pin];
+}
+
+
+void post(uint64_t time_ns, hal::Action action)
+{
+    Host_state& s = state();
+    s.events.push(Event{time_ns, s.event_order++, std::move(action)});
+}
+
+
+bool can_interrupt(void)
+{
+    Host_state& s = state();
+    return !s.in_isr && s.critical_depth == 0;
+}
+
+
+void run_next_event(void)
+{
+    Host_state& s = state();
+    Event event = s.events.top();
+    s.events.pop();
+    if (event.time_ns > s.now_ns)
+    {
+        s.now_ns = event.time_ns;
+    }
+    s.max_latency_ns = std::max(s.max_latency_ns, s.now_ns - event.time_ns);
+    s.interrupt_count++;
+
+    s.in_isr = true;
+    s.now_ns += s.costs.isr_ns;
+    event.action();
+    s.in_isr = false;
+}
+
+
+/* Moves the clock to a time, running the interrupts due on the way when they are enabled */
+void run_until(uint64_t time_ns)
+{
+    Host_state& s = state();
+    if (can_interrupt())
+    {
+        while (!s.events.empty() && s.events.top().time_ns <= time_ns)
+        {
+            run_next_event();
+        }
+    }
+    s.now_ns = std::max(s.now_ns, time_ns);
+}
+
+
+void check_stop(void)
+{
+    Host_state& s = state();
+    if (s.running && !s.in_isr && s.now_ns >= s.end_ns)
+    {
+        throw Host_stop();
+    }
+}
+
+
+/* Time taken by a HAL call */
+void spend(uint64_t ns)
+{
+    run_until(state().now_ns + ns);
+    check_stop();
+}
+
+
+/* The CPU is stalled (flash operations): the interrupts due meanwhile run late */
+void stall(uint64_t ns)
+{
+    Host_state& s = state();
+    s.now_ns += ns;
+    run_until(s.now_ns);
+    check_stop();
+}
+
+
+Host_uart* find_uart(PinName pin)
+{
+    for (auto& uart : state().uarts)
+    {
+        if (uart->tx == pin || uart->rx == pin)
+        {
+            return uart.get();
+        }
+    }
+    return nullptr;
+}
+
+
+Host_uart* get_uart(PinName tx, PinName rx, int baud_rate)
+{
+    Host_uart* uart = find_uart(tx);
+    if (uart == nullptr)
+    {
+        state().uarts.emplace_back(new Host_uart());
+        uart = state().uarts.back().get();
+        uart->tx_free_ns = 0;
+        uart->rx_last_ns = 0;
+    }
+    uart->tx = tx;
+    uart->rx = rx;
+    uart->char_ns = 10000000000ULL / baud_rate;
+    return uart;
+}
+
+
+/* The transmit interrupt is pending while it is attached and the transmit register is empty */
+void post_tx_ready(Host_uart* uart)
+{
+    post(std::max(uart->tx_free_ns, state().now_ns), [uart]()
+    {
+        if (uart->irq[SerialBase::TxIrq] && state().now_ns >= uart->tx_free_ns)
+        {
+            uart->irq[SerialBase::TxIrq]();
+        }
+    });
+}
+
+
+void receive(Host_uart* uart, char c)
+{
+    uart->rx_fifo.push_back(c);
+    // the receive interrupt runs until the bytes are read
+    size_t left = uart->rx_fifo.size() + 1;
+    while (uart->irq[SerialBase::RxIrq] && !uart->rx_fifo.empty() && uart->rx_fifo.size() < left)
+    {
+        left = uart->rx_fifo.size();
+        uart->irq[SerialBase::RxIrq]();
+    }
+}
+
+
+uint8_t* flash_memory(void)
+{
+    Host_state& s = state();
+    if (s.flash == nullptr)
+    {
+        // at the target address, the firmware also reads the flash directly
+        void* flash = mmap((void*) FLASH_START, FLASH_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+        if (flash != (void*) FLASH_START)
+        {
+            fprintf(stderr, "host_hal: cannot map the flash at 0x%08x\n", FLASH_START);
+            abort();
+        }
+        s.flash = (uint8_t*) flash;
+        memset(s.flash, FLASH_ERASED, FLASH_SIZE);
+    }
+    return s.flash;
+}
+
+
+bool flash_range_valid(uint32_t address, uint32_t size)
+{
+    return address >= FLASH_START && size <= FLASH_SIZE && address - FLASH_START <= FLASH_SIZE - size;
+}
+
+
+/* STM32F401RE sectors: 4 x 16 KB, 64 KB, 3 x 128 KB */
+uint32_t sector_size(uint32_t address)
+{
+    uint32_t offset = address - FLASH_START;
+    if (offset < 0x10000)
+    {
+        return 0x4000;
+    }
+    if (offset < 0x20000)
+    {
+        return 0x10000;
+    }
+    return 0x20000;
+}
+
+}
+
+
+/* DigitalOut */
+
+DigitalOut::DigitalOut(PinName pin_, int value): pin(pin_)
+{
+    write(value);
+}
+
+void DigitalOut::write(int value)
+{
+    pin_state(pin).output = value ? 1 : 0;
+    spend(state().costs.call_ns);
+}
+
+int DigitalOut::read(void)
+{
+    return pin_state(pin).output;
+}
+
+DigitalOut& DigitalOut::operator=(int value)
+{
+    write(value);
+    return *this;
+}
+
+DigitalOut& DigitalOut::operator=(DigitalOut& other)
+{
+    write(other.read());
+    return *this;
+}
+
+DigitalOut::operator int()
+{
+    return read();
+}
+
+
+/* DigitalIn */
+
+DigitalIn::DigitalIn(PinName pin_, PinMode mode_): pin(pin_)
+{
+}
+
+int DigitalIn::read(void)
+{
+    spend(state().costs.call_ns);
+    return pin_state(pin).input;
+}
+
+void DigitalIn::mode(PinMode mode_)
+{
+}
+
+DigitalIn::operator int()
+{
+    return read();
+}
+
+
+/* DigitalInOut */
+
+DigitalInOut::DigitalInOut(PinName pin_): pin(pin_), output_mode(false), output_value(0)
+{
+}
+
+void DigitalInOut::write(int value)
+{
+    output_value = value ? 1 : 0;
+    if (output_mode)
+    {
+        pin_state(pin).output = output_value;
+    }
+    spend(state().costs.call_ns);
+}
+
+int DigitalInOut::read(void)
+{
+    spend(state().costs.call_ns);
+    return output_mode ? output_value : pin_state(pin).input;
+}
+
+void DigitalInOut::output(void)
+{
+    output_mode = true;
+    pin_state(pin).output = output_value;
+}
+
+void DigitalInOut::input(void)
+{
+    output_mode = false;
+}
+
+void DigitalInOut::mode(PinMode mode_)
+{
+}
+
+DigitalInOut& DigitalInOut::operator=(int value)
+{
+    write(value);
+    return *this;
+}
+
+DigitalInOut::operator int()
+{
+    return read();
+}
+
+
+/* AnalogIn */
+
+AnalogIn::AnalogIn(PinName pin_): pin(pin_)
+{
+}
+
+float AnalogIn::read(void)
+{
+    spend(state().costs.analog_read_ns);
+    Pin_state& p = pin_state(pin);
+    float value = p.analog_source ? p.analog_source() : p.analog;
+    return std::min(1.0f, std::max(0.0f, value));
+}
+
+unsigned short AnalogIn::read_u16(void)
+{
+    return (unsigned short) (read() * 65535.0f);
+}
+
+AnalogIn::operator float()
+{
+    return read();
+}
+
+
+/* PwmOut */
+
+PwmOut::PwmOut(PinName pin_): pin(pin_)
+{
+}
+
+void PwmOut::period(float seconds)
+{
+    pin_state(pin).pwm_period = seconds;
+    spend(state().costs.call_ns);
+}
+
+void PwmOut::period_ms(int ms)
+{
+    period(ms / 1000.0f);
+}
+
+void PwmOut::period_us(int us)
+{
+    period(us / 1000000.0f);
+}
+
+void PwmOut::write(float duty)
+{
+    pin_state(pin).pwm_duty = std::min(1.0f, std::max(0.0f, duty));
+    spend(state().costs.call_ns);
+}
+
+float PwmOut::read(void)
+{
+    return pin_state(pin).pwm_duty;
+}
+
+PwmOut& PwmOut::operator=(float duty)
+{
+    write(duty);
+    return *this;
+}
+
+PwmOut::operator float()
+{
+    return read();
+}
+
+
+/* Serial */
+
+SerialBase::SerialBase(PinName tx, PinName rx, int baud_rate)
+{
+    uart = get_uart(tx, rx, baud_rate);
+}
+
+void SerialBase::baud(int baud_rate)
+{
+    uart->char_ns = 10000000000ULL / baud_rate;
+}
+
+int SerialBase::readable(void)
+{
+    Host_state& s = state();
+    if (uart->rx_fifo.empty() && can_interrupt())
+    {
+        // polling for input, nothing else happens until the next event
+        uint64_t next = s.events.empty() ? s.end_ns : s.events.top().time_ns;
+        run_until(std::max(next, s.now_ns + s.costs.call_ns));
+        check_stop();
+    }
+    else
+    {
+        spend(s.costs.call_ns);
+    }
+    return !uart->rx_fifo.empty();
+}
+
+int SerialBase::writeable(void)
+{
+    return state().now_ns >= uart->tx_free_ns;
+}
+
+void SerialBase::attach(Callback<void()> func, IrqType type)
+{
+    uart->irq[type] = func;
+    if (type == TxIrq && func)
+    {
+        post_tx_ready(uart);
+    }
+    spend(state().costs.call_ns);
+}
+
+RawSerial::RawSerial(PinName tx, PinName rx, int baud_rate): SerialBase(tx, rx, baud_rate)
+{
+}
+
+int RawSerial::getc(void)
+{
+    // blocks until a byte arrives, like the target
+    while (uart->rx_fifo.empty())
+    {
+        readable();
+    }
+    char c = uart->rx_fifo.front();
+    uart->rx_fifo.pop_front();
+    return (unsigned char) c;
+}
+
+int RawSerial::putc(int c)
+{
+    Host_state& s = state();
+    if (s.now_ns < uart->tx_free_ns)
+    {
+        // waits for the transmit register, the interrupts still run
+        if (s.in_isr)
+        {
+            s.now_ns = uart->tx_free_ns;
+        }
+        else
+        {
+            spend(uart->tx_free_ns - s.now_ns);
+        }
+    }
+    uart->tx_free_ns = s.now_ns + uart->char_ns;
+
+    // the host sees the byte once it has left
+    Host_uart* u = uart;
+    char byte = (char) c;
+    post(uart->tx_free_ns, [u, byte]()
+    {
+        u->output.push_back(byte);
+        if (u->receiver)
+        {
+            u->receiver(byte);
+        }
+    });
+    if (uart->irq[TxIrq])
+    {
+        post_tx_ready(uart);
+    }
+    spend(s.costs.call_ns);
+    return c;
+}
+
+int RawSerial::puts(const char* str)
+{
+    int count = 0;
+    for (; *str != '\0'; str++, count++)
+    {
+        putc(*str);
+    }
+    return count;
+}
+
+int RawSerial::printf(const char* format, ...)
+{
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    puts(buffer);
+    return length;
+}
+
+Serial::Serial(PinName tx, PinName rx, int baud_rate): RawSerial(tx, rx, baud_rate)
+{
+}
+
+
+/* Timer */
+
+Timer::Timer(): running(false), start_ns(0), elapsed_ns(0)
+{
+}
+
+uint64_t Timer::read_ns(void)
+{
+    spend(state().costs.call_ns);
+    return elapsed_ns + (running ? state().now_ns - start_ns : 0);
+}
+
+void Timer::start(void)
+{
+    if (!running)
+    {
+        start_ns = state().now_ns;
+        running = true;
+    }
+}
+
+void Timer::stop(void)
+{
+    elapsed_ns = read_ns();
+    running = false;
+}
+
+void Timer::reset(void)
+{
+    start_ns = state().now_ns;
+    elapsed_ns = 0;
+}
+
+float Timer::read(void)
+{
+    return read_ns() / 1e9f;
+}
+
+int Timer::read_ms(void)
+{
+    return (int) (read_ns() / 1000000);
+}
+
+int Timer::read_us(void)
+{
+    return (int) (read_ns() / 1000);
+}
+
+us_timestamp_t Timer::read_high_resolution_us(void)
+{
+    return read_ns() / 1000;
+}
+
+Timer::operator float()
+{
+    return read();
+}
+
+
+/* Ticker and Timeout */
+
+Ticker::Ticker(): generation(0), period_ns(0), one_shot(false)
+{
+}
+
+Ticker::~Ticker()
+{
+    detach();
+}
+
+void Ticker::schedule(uint64_t time_ns)
+{
+    // a jittered interrupt runs late, the next one is still due a period after this due time
+    Host_state& s = state();
+    uint64_t jitter = s.costs.ticker_jitter_ns ? s.random() % (s.costs.ticker_jitter_ns + 1) : 0;
+    uint32_t event_generation = generation;
+    post(time_ns + jitter, [this, event_generation, time_ns]() { fire(event_generation, time_ns); });
+}
+
+void Ticker::fire(uint32_t event_generation, uint64_t time_ns)
+{
+    if (event_generation != generation)
+    {
+        return;
+    }
+    if (!one_shot)
+    {
+        // from the due time, the period does not drift with the latency
+        schedule(time_ns + period_ns);
+    }
+    handler();
+}
+
+void Ticker::attach(Callback<void()> func, float seconds)
+{
+    attach_us(func, (us_timestamp_t) (seconds * 1e6f));
+}
+
+void Ticker::attach_us(Callback<void()> func, us_timestamp_t us)
+{
+    generation++;
+    handler = func;
+    period_ns = std::max<uint64_t>(us, 1) * 1000;
+    schedule(state().now_ns + period_ns);
+}
+
+void Ticker::detach(void)
+{
+    generation++;
+}
+
+Timeout::Timeout()
+{
+    one_shot = true;
+}
+
+
+/* FlashIAP */
+
+int FlashIAP::init(void)
+{
+    flash_memory();
+    return 0;
+}
+
+int FlashIAP::deinit(void)
+{
+    return 0;
+}
+
+int FlashIAP::read(void* buffer, uint32_t address, uint32_t size)
+{
+    if (!flash_range_valid(address, size))
+    {
+        return -1;
+    }
+    memcpy(buffer, flash_memory() + (address - FLASH_START), size);
+    spend(state().costs.call_ns);
+    return 0;
+}
+
+int FlashIAP::program(const void* buffer, uint32_t address, uint32_t size)
+{
+    if (!flash_range_valid(address, size))
+    {
+        return -1;
+    }
+    uint8_t* target = flash_memory() + (address - FLASH_START);
+    const uint8_t* source = (const uint8_t*) buffer;
+    for (uint32_t i = 0; i < size; i++)
+    {
+        target[i] &= source[i];
+    }
+    stall((uint64_t) size * state().costs.flash_program_ns);
+    return 0;
+}
+
+int FlashIAP::erase(uint32_t address, uint32_t size)
+{
+    if (!flash_range_valid(address, size))
+    {
+        return -1;
+    }
+    // whole sectors only
+    uint32_t sector = FLASH_START;
+    while (sector < address)
+    {
+        sector += sector_size(sector);
+    }
+    uint32_t end = address + size;
+    if (sector != address)
+    {
+        return -1;
+    }
+    while (sector < end)
+    {
+        sector += sector_size(sector);
+    }
+    if (sector != end)
+    {
+        return -1;
+    }
+    memset(flash_memory() + (address - FLASH_START), FLASH_ERASED, size);
+    stall((uint64_t) (size / 1024) * state().costs.flash_erase_ns_per_kb);
+    return 0;
+}
+
+uint32_t FlashIAP::get_page_size(void) const
+{
+    return 1;
+}
+
+uint32_t FlashIAP::get_sector_size(uint32_t address) const
+{
+    return flash_range_valid(address, 1) ? sector_size(address) : 0;
+}
+
+uint32_t FlashIAP::get_flash_start(void) const
+{
+    return FLASH_START;
+}
+
+uint32_t FlashIAP::get_flash_size(void) const
+{
+    return FLASH_SIZE;
+}
+
+uint8_t FlashIAP::get_erase_value(void) const
+{
+    return FLASH_ERASED;
+}
+
+
+/* QEI */
+
+QEI::QEI(PinName channelA, PinName channelB, PinName index, int pulsesPerRev, Encoding encoding):
+    channel_a(channelA), pulses_per_rev(pulsesPerRev)
+{
+    offset = pin_state(channel_a).encoder;
+}
+
+void QEI::reset(void)
+{
+    offset = pin_state(channel_a).encoder;
+}
+
+int QEI::getPulses(void)
+{
+    return pin_state(channel_a).encoder - offset;
+}
+
+int QEI::getRevolutions(void)
+{
+    return getPulses() / pulses_per_rev;
+}
+
+
+/* Waits, critical sections and debug registers */
+
+void wait(float seconds)
+{
+    spend((uint64_t) (seconds * 1e9f));
+}
+
+void wait_ms(int ms)
+{
+    spend((uint64_t) ms * 1000000);
+}
+
+void wait_us(int us)
+{
+    spend((uint64_t) us * 1000);
+}
+
+void core_util_critical_section_enter(void)
+{
+    state().critical_depth++;
+}
+
+void core_util_critical_section_exit(void)
+{
+    Host_state& s = state();
+    if (s.critical_depth > 0 && --s.critical_depth == 0)
+    {
+        run_until(s.now_ns);
+    }
+}
+
+Host_DWT_Type host_dwt;
+Host_CoreDebug_Type host_core_debug;
+uint32_t SystemCoreClock = 84000000;
+
+Host_cycle_counter::operator uint32_t() const
+{
+    Host_state& s = state();
+    return (uint32_t) (s.now_ns * s.costs.core_clock_hz / 1000000000ULL - s.cycle_offset);
+}
+
+Host_cycle_counter& Host_cycle_counter::operator=(uint32_t value)
+{
+    Host_state& s = state();
+    s.cycle_offset = s.now_ns * s.costs.core_clock_hz / 1000000000ULL - value;
+    return *this;
+}
+
+
+/* Host interface */
+
+namespace hal
+{
+
+double run(int (*entry)(void), double seconds)
+{
+    Host_state& s = state();
+    flash_memory();
+    s.end_ns = s.now_ns + (uint64_t) (seconds * 1e9);
+    s.running = true;
+    try
+    {
+        entry();
+    }
+    catch (const Host_stop&)
+    {
+    }
+    s.running = false;
+    s.in_isr = false;
+    s.critical_depth = 0;
+    return now();
+}
+
+void stop(void)
+{
+    Host_state& s = state();
+    s.end_ns = std::min(s.end_ns, s.now_ns);
+}
+
+uint64_t now_ns(void)
+{
+    return state().now_ns;
+}
+
+double now(void)
+{
+    return state().now_ns / 1e9;
+}
+
+void set_costs(const Host_costs& costs)
+{
+    state().costs = costs;
+}
+
+Host_costs get_costs(void)
+{
+    return state().costs;
+}
+
+void set_seed(unsigned seed)
+{
+    state().random.seed(seed);
+}
+
+void at(double seconds, Action action)
+{
+    post((uint64_t) (seconds * 1e9), std::move(action));
+}
+
+void every(double period_s, Action action)
+{
+    uint64_t period_ns = std::max<uint64_t>((uint64_t) (period_s * 1e9), 1);
+    std::shared_ptr<Action> repeat = std::make_shared<Action>();
+    std::weak_ptr<Action> weak = repeat;
+    uint64_t first = state().now_ns + period_ns;
+    *repeat = [weak, action, period_ns, first]() mutable
+    {
+        std::shared_ptr<Action> self = weak.lock();
+        first += period_ns;
+        post(first, [self]() { (*self)(); });
+        action();
+    };
+    post(first, [repeat]() { (*repeat)(); });
+}
+
+void set_analog(PinName pin, float value)
+{
+    pin_state(pin).analog = value;
+    pin_state(pin).analog_source = nullptr;
+}
+
+void set_analog_source(PinName pin, std::function<float()> source)
+{
+    pin_state(pin).analog_source = source;
+}
+
+void set_input(PinName pin, int value)
+{
+    pin_state(pin).input = value ? 1 : 0;
+}
+
+void set_encoder(PinName channel_a, int pulses)
+{
+    pin_state(channel_a).encoder = pulses;
+}
+
+void add_encoder(PinName channel_a, int pulses)
+{
+    pin_state(channel_a).encoder += pulses;
+}
+
+int get_output(PinName pin)
+{
+    return pin_state(pin).output;
+}
+
+float get_pwm(PinName pin)
+{
+    return pin_state(pin).pwm_duty;
+}
+
+float get_pwm_period(PinName pin)
+{
+    return pin_state(pin).pwm_period;
+}
+
+int get_encoder(PinName channel_a)
+{
+    return pin_state(channel_a).encoder;
+}
+
+void serial_send(PinName pin, const std::string& data)
+{
+    Host_state& s = state();
+    Host_uart* uart = find_uart(pin);
+    if (uart == nullptr)
+    {
+        return;
+    }
+    for (char c : data)
+    {
+        uart->rx_last_ns = std::max(uart->rx_last_ns, s.now_ns) + uart->char_ns;
+        post(uart->rx_last_ns, [uart, c]() { receive(uart, c); });
+    }
+}
+
+std::string serial_take_output(PinName pin)
+{
+    Host_uart* uart = find_uart(pin);
+    if (uart == nullptr)
+    {
+        return std::string();
+    }
+    std::string output;
+    output.swap(uart->output);
+    return output;
+}
+
+void on_serial_output(PinName pin, std::function<void(char)> receiver)
+{
+    Host_uart* uart = find_uart(pin);
+    if (uart != nullptr)
+    {
+        uart->receiver = receiver;
+    }
+}
+
+bool set_flash_file(const char* path)
+{
+    Host_state& s = state();
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size < FLASH_SIZE)
+    {
+        // a new image is erased
+        std::vector<uint8_t> erased(FLASH_SIZE - size, FLASH_ERASED);
+        if (pwrite(fd, erased.data(), erased.size(), size) != (ssize_t) erased.size())
+        {
+            close(fd);
+            return false;
+        }
+    }
+    if (s.flash != nullptr)
+    {
+        munmap(s.flash, FLASH_SIZE);
+        s.flash = nullptr;
+    }
+    void* flash = mmap((void*) FLASH_START, FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    close(fd);
+    if (flash != (void*) FLASH_START)
+    {
+        return false;
+    }
+    s.flash = (uint8_t*) flash;
+    return true;
+}
+
+uint64_t get_interrupt_count(void)
+{
+    return state().interrupt_count;
+}
+
+uint64_t get_max_latency_ns(void)
+{
+    return state().max_latency_ns;
+}
+
+const char* pin_name(PinName pin)
+{
+    static const char* const ports[] = {"PA", "PB", "PC"};
+    static char names[3][16][8];
+    int port = (int) pin >> 4;
+    if (pin == NC || port > 2)
+    {
+        return "";
+    }
+    char* name = names[port][pin & 0xF];
+    snprintf(name, 8, "%s_%d", ports[port], pin & 0xF);
+    return name;
+}
+
+PinName pin_from_name(const char* name)
+{
+    static const struct
+    {
+        const char* name;
+        PinName pin;
+    } aliases[] = {{"LED1", LED1}, {"USBTX", USBTX}, {"USBRX", USBRX}, {"USER_BUTTON", USER_BUTTON}};
+
+    for (const auto& alias : aliases)
+    {
+        if (strcmp(name, alias.name) == 0)
+        {
+            return alias.pin;
+        }
+    }
+    for (int pin = PA_0; pin <= PC_15; pin++)
+    {
+        if (strcmp(name, pin_name((PinName) pin)) == 0)
+        {
+            return (PinName) pin;
+        }
+    }
+    return NC;
+}
+
+}
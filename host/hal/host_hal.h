@@ -0,0 +1,123 @@
+/**
+ * @file host_hal.h
+ * @brief Virtual time and scriptable peripherals behind the host mbed.h
+ *
+ * The firmware runs in the main thread against a virtual clock. The clock only moves when the
+ * firmware calls the HAL: each call costs a few hundred nanoseconds, an AnalogIn read takes a
+ * conversion time, wait_us() and flash operations take their duration, and a serial poll that
+ * finds nothing jumps straight to the next event (the main loop would only spin until then).
+ * The interrupts due are run in order at these points, so a second of firmware time usually takes
+ * a few milliseconds.
+ *
+ * The host drives the peripherals from events in the same time line (at(), every()): they run as
+ * interrupts, between two HAL calls of the firmware, and can set the inputs and read the outputs.
+ *
+ */
+
+#pragma once
+
+#include <functional>
+#include <stdint.h>
+#include <string>
+
+#include "mbed.h"
+
+
+/**
+ * @brief Virtual time taken by the HAL operations.
+ */
+struct Host_costs
+{
+    uint32_t call_ns;                   ///< any HAL call
+    uint32_t isr_ns;                    ///< interrupt entry and exit
+    uint32_t analog_read_ns;            ///< one AnalogIn conversion
+    uint32_t flash_program_ns;          ///< per byte programmed (stalls the CPU)
+    uint32_t flash_erase_ns_per_kb;     ///< sector erase (stalls the CPU)
+    uint32_t core_clock_hz;             ///< DWT cycle counter rate
+    uint32_t ticker_jitter_ns;          ///< Ticker interrupts are late by up to this (uniform), 0 for none
+};
+
+
+namespace hal
+{
+
+typedef std::function<void()> Action;
+
+/**
+ * @brief Runs the firmware for a duration of virtual time and returns.
+ *
+ * The firmware never returns from its main loop: the HAL stops it at the first call made after
+ * the end time (a C++ exception unwinds it). Its globals keep their state, so it runs once per
+ * process.
+ *
+ * @return the virtual time reached, in seconds
+ */
+double run(int (*entry)(void), double seconds);
+
+/**
+ * @brief Ends the current run() at the next HAL call of the main thread (from a host event).
+ */
+void stop(void);
+
+uint64_t now_ns(void);                  ///< virtual time since the start
+double now(void);                       ///< virtual time in seconds
+
+void set_costs(const Host_costs& costs);
+Host_costs get_costs(void);
+void set_seed(unsigned seed);           ///< seeds the random delays (ticker jitter)
+
+/**
+ * @brief Runs an action as an interrupt at a virtual time (seconds), or as soon as possible after.
+ */
+void at(double seconds, Action action);
+
+/**
+ * @brief Runs an action as an interrupt periodically, first one period from now.
+ */
+void every(double period_s, Action action);
+
+/* Inputs */
+void set_analog(PinName pin, float value);                          ///< level 0..1 read by AnalogIn
+void set_analog_source(PinName pin, std::function<float()> source); ///< called at each conversion instead
+void set_input(PinName pin, int value);                             ///< DigitalIn and DigitalInOut in input mode
+void set_encoder(PinName channel_a, int pulses);                    ///< QEI count, of the channel A pin
+void add_encoder(PinName channel_a, int pulses);
+
+/* Outputs */
+int get_output(PinName pin);                                        ///< DigitalOut level
+float get_pwm(PinName pin);                                         ///< PwmOut duty cycle
+float get_pwm_period(PinName pin);
+int get_encoder(PinName channel_a);
+
+/**
+ * @brief Sends bytes to a serial port (TX or RX pin), they arrive one by one at its baud rate.
+ */
+void serial_send(PinName pin, const std::string& data);
+
+/**
+ * @brief Returns and clears the bytes the firmware sent on a serial port (TX or RX pin).
+ */
+std::string serial_take_output(PinName pin);
+
+/**
+ * @brief Calls a function for each byte sent on a serial port, when it leaves the UART.
+ */
+void on_serial_output(PinName pin, std::function<void(char)> receiver);
+
+/**
+ * @brief Backs the flash with a file so the parameters and the black box persist between runs.
+ *
+ * Call before run(), the file is created erased if needed.
+ *
+ * @return false if the file could not be mapped
+ */
+bool set_flash_file(const char* path);
+
+/* Counters */
+uint64_t get_interrupt_count(void);     ///< interrupts and host events run
+uint64_t get_max_latency_ns(void);      ///< longest delay of an interrupt after its due time
+
+const char* pin_name(PinName pin);      ///< "PA_0", "" if unknown
+PinName pin_from_name(const char* name); ///< NC if unknown
+
+}
@@ -0,0 +1,440 @@
+/**
+ * @file mbed.h
+ * @brief Host (Linux) stand-in for the part of the Mbed OS 5 API used by the firmware
+ *
+ * The peripherals are simulated in virtual time by host_hal.cpp and driven from the host through
+ * host_hal.h: the firmware sources build unchanged, only main() is renamed firmware_main().
+ *
+ * Interrupts (tickers, serial and script events) run between two HAL calls of the main thread,
+ * never inside a critical section, and do not interrupt each other, like on the single core
+ * target. Only the pin names of the Nucleo-F401RE used by the firmware are defined.
+ *
+ */
+
+#pragma once
+
+#include <functional>
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <type_traits>
+
+
+typedef enum
+{
+    PA_0 = 0x00, PA_1, PA_2, PA_3, PA_4, PA_5, PA_6, PA_7, PA_8, PA_9, PA_10, PA_11, PA_12, PA_13, PA_14, PA_15,
+    PB_0 = 0x10, PB_1, PB_2, PB_3, PB_4, PB_5, PB_6, PB_7, PB_8, PB_9, PB_10, PB_11, PB_12, PB_13, PB_14, PB_15,
+    PC_0 = 0x20, PC_1, PC_2, PC_3, PC_4, PC_5, PC_6, PC_7, PC_8, PC_9, PC_10, PC_11, PC_12, PC_13, PC_14, PC_15,
+
+    LED1 = PA_5,
+    USBTX = PA_2,
+    USBRX = PA_3,
+    USER_BUTTON = PC_13,
+
+    NC = -1
+} PinName;
+
+typedef enum
+{
+    PullNone,
+    PullUp,
+    PullDown,
+    OpenDrain
+} PinMode;
+
+typedef uint64_t us_timestamp_t;
+
+
+void core_util_critical_section_enter(void);    ///< the interrupts due meanwhile run at the exit
+void core_util_critical_section_exit(void);
+
+void wait(float seconds);
+void wait_ms(int ms);
+void wait_us(int us);
+
+
+/**
+ * @brief Function or member function called by the peripherals (Mbed's Callback).
+ */
+template <typename F>
+class Callback;
+
+template <typename R, typename... Args>
+class Callback<R(Args...)>
+{
+private:
+
+    std::function<R(Args...)> function;
+
+public:
+
+    Callback() {}
+
+    Callback(R (*f)(Args...))
+    {
+        if (f != nullptr)
+        {
+            function = f;
+        }
+    }
+
+    template <typename T, typename U>
+    Callback(U* object, R (T::*method)(Args...))
+    {
+        function = [object, method](Args... args) -> R { return (object->*method)(args...); };
+    }
+
+    template <typename F, typename std::enable_if<!std::is_integral<F>::value && !std::is_pointer<F>::value, int>::type = 0>
+    Callback(F f): function(f) {}
+
+    R operator()(Args... args) const
+    {
+        return function(args...);
+    }
+
+    explicit operator bool() const
+    {
+        return static_cast<bool>(function);
+    }
+};
+
+template <typename R, typename... Args>
+Callback<R(Args...)> callback(R (*f)(Args...))
+{
+    return Callback<R(Args...)>(f);
+}
+
+template <typename T, typename U, typename R, typename... Args>
+Callback<R(Args...)> callback(U* object, R (T::*method)(Args...))
+{
+    return Callback<R(Args...)>(object, method);
+}
+
+
+class DigitalOut
+{
+private:
+
+    PinName pin;
+
+public:
+
+    DigitalOut(PinName pin_, int value = 0);
+    void write(int value);
+    int read(void);
+    DigitalOut& operator=(int value);
+    DigitalOut& operator=(DigitalOut& other);
+    operator int();
+};
+
+
+class DigitalIn
+{
+private:
+
+    PinName pin;
+
+public:
+
+    DigitalIn(PinName pin_, PinMode mode_ = PullNone);
+    int read(void);
+    void mode(PinMode mode_);
+    operator int();
+};
+
+
+class DigitalInOut
+{
+private:
+
+    PinName pin;
+    bool output_mode;
+    int output_value;
+
+public:
+
+    DigitalInOut(PinName pin_);
+    void write(int value);
+    int read(void);                         ///< the output level in output mode, the input level set by the host otherwise
+    void output(void);
+    void input(void);
+    void mode(PinMode mode_);
+    DigitalInOut& operator=(int value);
+    operator int();
+};
+
+
+class AnalogIn
+{
+private:
+
+    PinName pin;
+
+public:
+
+    AnalogIn(PinName pin_);
+    float read(void);                       ///< takes a conversion time (Host_costs::analog_read_ns)
+    unsigned short read_u16(void);
+    operator float();
+};
+
+
+class PwmOut
+{
+private:
+
+    PinName pin;
+
+public:
+
+    PwmOut(PinName pin_);
+    void period(float seconds);
+    void period_ms(int ms);
+    void period_us(int us);
+    void write(float duty);
+    float read(void);
+    PwmOut& operator=(float duty);
+    operator float();
+};
+
+
+struct Host_uart;
+
+class SerialBase
+{
+public:
+
+    enum IrqType
+    {
+        RxIrq = 0,
+        TxIrq,
+        IrqCnt
+    };
+
+protected:
+
+    Host_uart* uart;
+
+public:
+
+    SerialBase(PinName tx, PinName rx, int baud_rate);
+    void baud(int baud_rate);
+    int readable(void);                     ///< an empty poll from the main thread jumps to the next event
+    int writeable(void);
+    void attach(Callback<void()> func, IrqType type = RxIrq);
+};
+
+
+class RawSerial: public SerialBase
+{
+public:
+
+    RawSerial(PinName tx, PinName rx, int baud_rate = 9600);
+    int getc(void);
+    int putc(int c);
+    int puts(const char* str);
+    int printf(const char* format, ...);
+};
+
+
+class Serial: public RawSerial
+{
+public:
+
+    Serial(PinName tx, PinName rx, int baud_rate = 9600);
+};
+
+
+class Timer
+{
+private:
+
+    bool running;
+    uint64_t start_ns;
+    uint64_t elapsed_ns;                    // before the last start
+
+    uint64_t read_ns(void);
+
+public:
+
+    Timer();
+    void start(void);
+    void stop(void);
+    void reset(void);
+    float read(void);
+    int read_ms(void);
+    int read_us(void);
+    us_timestamp_t read_high_resolution_us(void);
+    operator float();
+};
+
+
+class Ticker
+{
+protected:
+
+    uint32_t generation;                    // events of a detached callback are ignored
+    uint64_t period_ns;
+    bool one_shot;
+    Callback<void()> handler;
+
+    void schedule(uint64_t time_ns);
+    void fire(uint32_t event_generation, uint64_t time_ns);
+
+public:
+
+    Ticker();
+    virtual ~Ticker();
+    void attach(Callback<void()> func, float seconds);
+    void attach_us(Callback<void()> func, us_timestamp_t us);
+    void detach(void);
+};
+
+
+class Timeout: public Ticker
+{
+public:
+
+    Timeout();
+};
+
+
+/**
+ * @brief STM32F401RE internal flash, memory mapped at its address on the host as well.
+ *
+ * Programming only clears bits and erasing whole sectors sets them, like the real flash. Both
+ * stall the CPU for their duration (Host_costs), the interrupts due meanwhile run late.
+ */
+class FlashIAP
+{
+public:
+
+    int init(void);
+    int deinit(void);
+    int read(void* buffer, uint32_t address, uint32_t size);
+    int program(const void* buffer, uint32_t address, uint32_t size);
+    int erase(uint32_t address, uint32_t size);
+    uint32_t get_page_size(void) const;
+    uint32_t get_sector_size(uint32_t address) const;
+    uint32_t get_flash_start(void) const;
+    uint32_t get_flash_size(void) const;
+    uint8_t get_erase_value(void) const;
+};
+
+
+/**
+ * @brief Fixed size ring buffer, pushing to a full buffer overwrites the oldest element.
+ */
+template <typename T, uint32_t BufferSize, typename CounterType = uint32_t>
+class CircularBuffer
+{
+private:
+
+    T pool[BufferSize];
+    CounterType head;
+    CounterType tail;
+    bool full_;
+
+public:
+
+    CircularBuffer(): head(0), tail(0), full_(false) {}
+
+    void push(const T& data)
+    {
+        core_util_critical_section_enter();
+        if (full_)
+        {
+            tail = (tail + 1) % BufferSize;
+        }
+        pool[head] = data;
+        head = (head + 1) % BufferSize;
+        full_ = (head == tail);
+        core_util_critical_section_exit();
+    }
+
+    bool pop(T& data)
+    {
+        bool popped = false;
+        core_util_critical_section_enter();
+        if (!empty())
+        {
+            data = pool[tail];
+            tail = (tail + 1) % BufferSize;
+            full_ = false;
+            popped = true;
+        }
+        core_util_critical_section_exit();
+        return popped;
+    }
+
+    bool peek(T& data) const
+    {
+        if (empty())
+        {
+            return false;
+        }
+        data = pool[tail];
+        return true;
+    }
+
+    bool empty(void) const
+    {
+        return head == tail && !full_;
+    }
+
+    bool full(void) const
+    {
+        return full_;
+    }
+
+    CounterType size(void) const
+    {
+        if (full_)
+        {
+            return BufferSize;
+        }
+        return (head + BufferSize - tail) % BufferSize;
+    }
+
+    void reset(void)
+    {
+        head = 0;
+        tail = 0;
+        full_ = false;
+    }
+};
+
+
+/* Cortex-M debug registers used by the profiler, CYCCNT counts the virtual CPU clock */
+
+class Host_cycle_counter
+{
+public:
+
+    operator uint32_t() const;
+    Host_cycle_counter& operator=(uint32_t value);
+};
+
+struct Host_DWT_Type
+{
+    volatile uint32_t CTRL;
+    Host_cycle_counter CYCCNT;
+};
+
+struct Host_CoreDebug_Type
+{
+    volatile uint32_t DEMCR;
+};
+
+extern Host_DWT_Type host_dwt;
+extern Host_CoreDebug_Type host_core_debug;
+
+#define DWT                         (&host_dwt)
+#define CoreDebug                   (&host_core_debug)
+#define DWT_CTRL_CYCCNTENA_Msk      (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk  (1UL << 24)
+
+extern uint32_t SystemCoreClock;
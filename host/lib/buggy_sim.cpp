@@ -0,0 +1,306 @@
+#include <math.h>
+
+#include "buggy_sim.h"
+#include "constants.h"
+#include "host_hal.h"
+#include "pin_assignments.h"
+
+
+#define GRAVITY             9.81
+#define SEEN_COVERAGE       0.3         // part of a sensor spot on the line for it to see the line
+#define OFF_TRACK_DISTANCE  0.15        // m, sensor array centre to the line
+#define OFF_TRACK_TIME      0.5         // s, that far from the line ends the run
+#define END_MARGIN          0.005       // m, an open track is finished this close to its end
+
+
+static const PinName sensor_pins[6] = {SENSOR0_IN_PIN, SENSOR1_IN_PIN, SENSOR2_IN_PIN,
+                                       SENSOR3_IN_PIN, SENSOR4_IN_PIN, SENSOR5_IN_PIN};
+static const PinName led_pins[6] = {SENSOR0_OUT_PIN, SENSOR1_OUT_PIN, SENSOR2_OUT_PIN,
+                                    SENSOR3_OUT_PIN, SENSOR4_OUT_PIN, SENSOR5_OUT_PIN};
+
+
+Plant_params default_plant_params(void)
+{
+    Plant_params p;
+    p.mass = 1.2;
+    p.yaw_inertia = 0.012;
+    p.wheel_radius = WHEEL_RADIUS;
+    p.wheel_separation = WHEEL_SEPERATION;
+    p.encoder_counts = 4 * PULSE_PER_REV;
+
+    p.motor_resistance = 2.2;
+    p.motor_constant = 0.0068;
+    p.rotor_inertia = 1.5e-6;
+    p.gear_ratio = 15;
+    p.gear_efficiency = 0.8;
+    p.wheel_scale[0] = 1;
+    p.wheel_scale[1] = 1;
+    p.motor_gain[0] = 1;
+    p.motor_gain[1] = 1;
+
+    p.rolling_resistance = 0.03;
+    p.viscous_drag = 0.2;
+    p.turn_drag = 0.1;
+
+    p.battery_full = 8.0;           // 6 NiMH cells
+    p.battery_empty = 6.6;
+    p.battery_resistance = 0.15;
+    p.battery_capacity = 2.2;
+    p.battery_charge = 0.9;
+    return p;
+}
+
+
+Sensor_params default_sensor_params(void)
+{
+    Sensor_params s;
+    s.ahead = 0.12;
+    s.pitch = 0.016;
+    s.spot = 0.003;
+    s.dark = 0.12;
+    s.bright = 0.92;
+    s.ambient = 0;
+    s.noise = 0.01;
+    return s;
+}
+
+
+BuggySim::BuggySim(const Track& track_, const Plant_params& plant_, const Sensor_params& sensors_, unsigned seed):
+    track(track_), plant(plant_), sensors(sensors_), random_engine(seed), normal(0, 1)
+{
+    // the sensor array starts over the start of the line
+    double heading_;
+    double start_x;
+    double start_y;
+    track.get_start(&start_x, &start_y, &heading_);
+    heading = heading_;
+    x = start_x - cos(heading) * sensors.ahead;
+    y = start_y - sin(heading) * sensors.ahead;
+    velocity = 0;
+    yaw_rate = 0;
+    wheel_angle[0] = 0;
+    wheel_angle[1] = 0;
+    battery_current = 0;
+    charge_used = 0;
+
+    for (int i = 0; i < 6; i++)
+    {
+        sensor_hint[i] = 0;
+    }
+    update_coverage();
+    centre_hint = 0;
+    last_station = 0;
+    progress = 0;
+    start_time = -1;
+    on_line = true;
+    off_line_time = 0;
+
+    lateral_squares = 0;
+    lateral_samples = 0;
+    result.finished = false;
+    result.off_track = false;
+    result.lap_time = 0;
+    result.max_lateral = 0;
+    result.rms_lateral = 0;
+    result.line_losses = 0;
+    result.progress = 0;
+    result.max_speed = 0;
+    result.min_battery = plant.battery_full;
+
+    trace = NULL;
+    trace_period = 0;
+    next_trace = 0;
+    step_dt = 0.0001;
+}
+
+
+void BuggySim::attach(double dt)
+{
+    step_dt = dt;
+    for (int i = 0; i < 6; i++)
+    {
+        hal::set_analog_source(sensor_pins[i], [this, i]() { return sensor_level(i); });
+    }
+    hal::every(dt, [this]() { step(); });
+}
+
+
+void BuggySim::start_lap(double time)
+{
+    start_time = time;
+}
+
+
+void BuggySim::set_trace(FILE* out, double period)
+{
+    trace = out;
+    trace_period = period;
+    next_trace = 0;
+    if (trace != NULL)
+    {
+        fprintf(trace, "time,x,y,heading_deg,velocity,yaw_rate,station,lateral,pwm_l,pwm_r,battery\n");
+    }
+}
+
+
+Sim_result BuggySim::get_result(void)
+{
+    Sim_result copy = result;
+    copy.progress = progress;
+    copy.rms_lateral = lateral_samples > 0 ? sqrt(lateral_squares / lateral_samples) : 0;
+    return copy;
+}
+
+
+void BuggySim::update_coverage(void)
+{
+    double half_width = track.get_width() / 2;
+    double scale = sensors.spot * sqrt(2.0);
+    for (int i = 0; i < 6; i++)
+    {
+        double offset = (2.5 - i) * sensors.pitch;
+        double sx = x + cos(heading) * sensors.ahead - sin(heading) * offset;
+        double sy = y + sin(heading) * sensors.ahead + cos(heading) * offset;
+        Track_position position = track.locate(sx, sy, sensor_hint[i]);
+        sensor_hint[i] = position.index;
+
+        // part of the gaussian spot over the line
+        coverage[i] = 0.5 * (erf((half_width - position.lateral) / scale) + erf((half_width + position.lateral) / scale));
+    }
+}
+
+
+float BuggySim::sensor_level(int sensor)
+{
+    double level = sensors.ambient + sensors.noise * normal(random_engine);
+    if (hal::get_output(led_pins[sensor]))
+    {
+        level += sensors.dark + (sensors.bright - sensors.dark) * coverage[sensor];
+    }
+    return (float) level;
+}
+
+
+void BuggySim::step(void)
+{
+    const Plant_params& p = plant;
+    const PinName pwm_pins[2] = {MOTORL_PWM_PIN, MOTORR_PWM_PIN};
+    const PinName direction_pins[2] = {MOTORL_DIRECTION_PIN, MOTORR_DIRECTION_PIN};
+    const PinName bipolar_pins[2] = {MOTORL_BIPOLAR_PIN, MOTORR_BIPOLAR_PIN};
+    const PinName encoder_pins[2] = {MOTORL_CHA_PIN, MOTORR_CHA_PIN};
+
+    // battery voltage under the load of the previous step
+    double charge = p.battery_charge - charge_used / p.battery_capacity;
+    double open_circuit = p.battery_empty + (p.battery_full - p.battery_empty) * (charge > 0 ? charge : 0);
+    double battery = open_circuit - p.battery_resistance * battery_current;
+    result.min_battery = fmin(result.min_battery, battery);
+
+    // motors: the PWM output is inverted (1 is off), the direction pin sets the polarity
+    bool enabled = hal::get_output(DRIVER_ENABLE_PIN);
+    double force[2];
+    double current_total = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        double radius = p.wheel_radius * p.wheel_scale[i];
+        double motor_constant = p.motor_constant * p.motor_gain[i];
+        double wheel_speed = velocity + (i == 0 ? -1 : 1) * yaw_rate * p.wheel_separation / 2;
+        double motor_speed = wheel_speed / radius * p.gear_ratio;
+        double on_time = 1 - hal::get_pwm(pwm_pins[i]);
+        double drive = hal::get_output(bipolar_pins[i]) ? 2 * on_time - 1
+                                                        : (hal::get_output(direction_pins[i]) ? on_time : -on_time);
+        double current = 0;
+        if (enabled)
+        {
+            current = (drive * battery - motor_constant * motor_speed) / p.motor_resistance;
+        }
+        force[i] = current * motor_constant * p.gear_ratio * p.gear_efficiency / radius;
+        current_total += drive * current;          // the driver takes the motor current during the on time
+    }
+    battery_current = current_total;
+    charge_used += current_total * step_dt / 3600;
+
+    // chassis, the rotors add to the inertia
+    double rotors = 2 * p.rotor_inertia * p.gear_ratio * p.gear_ratio / (p.wheel_radius * p.wheel_radius);
+    double mass = p.mass + rotors;
+    double inertia = p.yaw_inertia + rotors * p.wheel_separation * p.wheel_separation / 4;
+    double resistance = p.rolling_resistance * p.mass * GRAVITY * tanh(velocity / 0.02) + p.viscous_drag * velocity;
+    velocity += (force[0] + force[1] - resistance) / mass * step_dt;
+    yaw_rate += ((force[1] - force[0]) * p.wheel_separation / 2 - p.turn_drag * yaw_rate) / inertia * step_dt;
+
+    heading += yaw_rate * step_dt;
+    x += cos(heading) * velocity * step_dt;
+    y += sin(heading) * velocity * step_dt;
+
+    // encoders, counting up forwards on both wheels
+    for (int i = 0; i < 2; i++)
+    {
+        double wheel_speed = velocity + (i == 0 ? -1 : 1) * yaw_rate * p.wheel_separation / 2;
+        wheel_angle[i] += wheel_speed / (p.wheel_radius * p.wheel_scale[i]) * step_dt;
+        hal::set_encoder(encoder_pins[i], (int) floor(wheel_angle[i] / (2 * M_PI) * p.encoder_counts));
+    }
+
+    update_coverage();
+    update_metrics();
+}
+
+
+void BuggySim::update_metrics(void)
+{
+    double centre_x = x + cos(heading) * sensors.ahead;
+    double centre_y = y + sin(heading) * sensors.ahead;
+    Track_position centre = track.locate(centre_x, centre_y, centre_hint);
+    centre_hint = centre.index;
+
+    double length = track.get_length();
+    double advance = centre.station - last_station;
+    if (track.is_closed())
+    {
+        advance -= (advance > length / 2) ? length : ((advance < -length / 2) ? -length : 0);
+    }
+    last_station = centre.station;
+
+    double now = hal::now();
+    if (trace != NULL && now >= next_trace)
+    {
+        fprintf(trace, "%.4f,%.4f,%.4f,%.2f,%.3f,%.3f,%.4f,%.4f,%.3f,%.3f,%.2f\n", now, x, y, heading * 180 / M_PI,
+                velocity, yaw_rate, centre.station, centre.lateral, hal::get_pwm(MOTORL_PWM_PIN),
+                hal::get_pwm(MOTORR_PWM_PIN), result.min_battery);
+        next_trace = now + trace_period;
+    }
+
+    if (start_time < 0 || result.finished || result.off_track)
+    {
+        return;
+    }
+    progress += advance;
+
+    double lateral = fabs(centre.lateral);
+    result.max_lateral = fmax(result.max_lateral, lateral);
+    result.max_speed = fmax(result.max_speed, velocity);
+    lateral_squares += lateral * lateral;
+    lateral_samples++;
+
+    bool seen = false;
+    for (int i = 0; i < 6 && !seen; i++)
+    {
+        seen = coverage[i] > SEEN_COVERAGE;
+    }
+    if (on_line && !seen)
+    {
+        result.line_losses++;
+    }
+    on_line = seen;
+
+    off_line_time = (lateral > OFF_TRACK_DISTANCE) ? off_line_time + step_dt : 0;
+    if (off_line_time >= OFF_TRACK_TIME)
+    {
+        result.off_track = true;
+        hal::stop();
+    }
+    else if (progress >= length - END_MARGIN)
+    {
+        result.finished = true;
+        result.lap_time = now - start_time;
+        hal::stop();
+    }
+}
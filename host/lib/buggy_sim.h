@@ -0,0 +1,163 @@
+/**
+ * @file buggy_sim.h
+ * @brief Physics of the buggy on a track, closing the loop around the firmware on the host HAL
+ *
+ */
+
+#pragma once
+
+#include <random>
+#include <stdio.h>
+
+#include "track.h"
+
+
+/**
+ * @brief Drive train, chassis and battery.
+ */
+struct Plant_params
+{
+    double mass;                    ///< kg
+    double yaw_inertia;             ///< kg m^2
+    double wheel_radius;            ///< m
+    double wheel_separation;        ///< m
+    int encoder_counts;             ///< encoder counts per wheel revolution (X4)
+
+    double motor_resistance;        ///< ohm
+    double motor_constant;          ///< V s/rad and N m/A
+    double rotor_inertia;           ///< kg m^2
+    double gear_ratio;              ///< motor turns per wheel turn
+    double gear_efficiency;
+    double wheel_scale[2];          ///< left, right wheel radius relative to wheel_radius (tyre wear, mismatch)
+    double motor_gain[2];           ///< left, right motor constant relative to motor_constant (motor spread)
+
+    double rolling_resistance;      ///< coefficient (force / weight)
+    double viscous_drag;            ///< N per m/s
+    double turn_drag;               ///< N m per rad/s (tyre scrub)
+
+    double battery_full;            ///< open circuit voltage when full (V)
+    double battery_empty;           ///< open circuit voltage when empty (V)
+    double battery_resistance;      ///< ohm
+    double battery_capacity;        ///< Ah
+    double battery_charge;          ///< state of charge at the start (0..1)
+};
+
+
+/**
+ * @brief The six TCRT5000 reflective sensors on the sensor array PCB.
+ *
+ * Sensor 0 is the leftmost one (the firmware weights it positively). A sensor sees a gaussian
+ * spot of the track: its level goes from dark to bright with the part of the spot on the line.
+ */
+struct Sensor_params
+{
+    double ahead;                   ///< distance of the array in front of the wheel axle (m)
+    double pitch;                   ///< distance between two sensors (m)
+    double spot;                    ///< standard deviation of the spot seen by a sensor (m)
+    double dark;                    ///< ADC level (0..1) over the track surface
+    double bright;                  ///< ADC level over the line
+    double ambient;                 ///< ADC level added by the ambient light, also with the LEDs off
+    double noise;                   ///< standard deviation of the ADC noise
+};
+
+
+/**
+ * @brief Metrics of one run.
+ */
+struct Sim_result
+{
+    bool finished;                  ///< completed a lap (closed track) or reached the end
+    bool off_track;                 ///< stopped because the buggy left the line for good
+    double lap_time;                ///< from the start command to the end of the lap (s)
+    double max_lateral;             ///< max distance of the sensor array centre to the line (m)
+    double rms_lateral;             ///< m
+    int line_losses;                ///< times all six sensors lost the line
+    double progress;                ///< distance along the track (m)
+    double max_speed;               ///< m/s
+    double min_battery;             ///< lowest battery voltage under load (V)
+};
+
+
+Plant_params default_plant_params(void);
+Sensor_params default_sensor_params(void);
+
+
+/**
+ * @brief Simulates the buggy against the firmware outputs and feeds its inputs.
+ *
+ * attach() connects it to the host HAL: the firmware reads the sensor array levels from the
+ * model, the physics step integrates the motor outputs (PWM, direction, driver enable) into
+ * the pose and sets the encoder counts. The run ends (hal::stop()) at the end of the lap, or when
+ * the sensor array stays too far from the line.
+ */
+class BuggySim
+{
+private:
+
+    const Track& track;
+    Plant_params plant;
+    Sensor_params sensors;
+    std::mt19937 random_engine;
+    std::normal_distribution<double> normal;
+
+    // state, in the track frame (heading counterclockwise)
+    double x;
+    double y;
+    double heading;
+    double velocity;
+    double yaw_rate;
+    double wheel_angle[2];          // left, right (rad)
+    double battery_current;
+    double charge_used;             // Ah
+
+    int sensor_hint[6];
+    double coverage[6];             // part of each sensor spot on the line, updated every step
+    int centre_hint;
+    double last_station;
+    double progress;
+    double start_time;
+    bool on_line;
+    double off_line_time;
+
+    double lateral_squares;
+    long lateral_samples;
+    Sim_result result;
+
+    FILE* trace;
+    double trace_period;
+    double next_trace;
+
+    double step_dt;
+
+    void step(void);
+    void update_metrics(void);
+    void update_coverage(void);
+
+public:
+
+    BuggySim(const Track& track_, const Plant_params& plant_, const Sensor_params& sensors_, unsigned seed);
+
+    /**
+     * @brief Registers the sensor levels and the physics step with the host HAL.
+     *
+     * @param dt physics step (s)
+     */
+    void attach(double dt);
+
+    /**
+     * @brief Starts the lap timer (when the start command is sent).
+     */
+    void start_lap(double time);
+
+    /**
+     * @brief Writes the state as CSV every period (s), NULL to stop.
+     */
+    void set_trace(FILE* out, double period);
+
+    /**
+     * @brief Level read by the ADC of a sensor (0..1), the analog source attach() registers.
+     */
+    float sensor_level(int sensor);
+
+    Sim_result get_result(void);
+};
@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <math.h>
+#include <numeric>
+
+#include "cma_es.h"
+
+
+#define JACOBI_SWEEPS       50
+
+
+CmaEs::CmaEs(const std::vector<double>& start, double sigma_, int lambda_, unsigned seed):
+    random_engine(seed), normal(0, 1)
+{
+    n = (int) start.size();
+    lambda = (lambda_ > 0) ? lambda_ : default_lambda(n);
+    mu = lambda / 2;
+
+    double weight_total = 0;
+    for (int i = 0; i < mu; i++)
+    {
+        weights.push_back(log(mu + 0.5) - log(i + 1.0));
+        weight_total += weights[i];
+    }
+    double square_total = 0;
+    for (int i = 0; i < mu; i++)
+    {
+        weights[i] /= weight_total;
+        square_total += weights[i] * weights[i];
+    }
+    mueff = 1 / square_total;
+
+    cc = (4 + mueff / n) / (n + 4 + 2 * mueff / n);
+    cs = (mueff + 2) / (n + mueff + 5);
+    c1 = 2 / ((n + 1.3) * (n + 1.3) + mueff);
+    cmu = std::min(1 - c1, 2 * (mueff - 2 + 1 / mueff) / ((n + 2) * (n + 2) + mueff));
+    damps = 1 + 2 * std::max(0.0, sqrt((mueff - 1) / (n + 1)) - 1) + cs;
+    chi_n = sqrt((double) n) * (1 - 1.0 / (4 * n) + 1.0 / (21.0 * n * n));
+
+    mean = start;
+    sigma = sigma_;
+    C.assign(n * n, 0);
+    B.assign(n * n, 0);
+    for (int i = 0; i < n; i++)
+    {
+        C[i * n + i] = 1;
+        B[i * n + i] = 1;
+    }
+    D.assign(n, 1);
+    pc.assign(n, 0);
+    ps.assign(n, 0);
+    generation = 0;
+}
+
+
+int CmaEs::default_lambda(int dimensions)
+{
+    return 4 + (int) floor(3 * log((double) dimensions));
+}
+
+
+int CmaEs::get_lambda(void) const
+{
+    return lambda;
+}
+
+
+const std::vector<double>& CmaEs::get_mean(void) const
+{
+    return mean;
+}
+
+
+double CmaEs::get_sigma(void) const
+{
+    return sigma;
+}
+
+
+int CmaEs::get_generation(void) const
+{
+    return generation;
+}
+
+
+std::vector<std::vector<double>> CmaEs::ask(void)
+{
+    // x = mean + sigma B D z
+    std::vector<std::vector<double>> candidates(lambda, std::vector<double>(n));
+    std::vector<double> scaled(n);
+    for (int k = 0; k < lambda; k++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            scaled[j] = D[j] * normal(random_engine);
+        }
+        for (int i = 0; i < n; i++)
+        {
+            double sum = 0;
+            for (int j = 0; j < n; j++)
+            {
+                sum += B[i * n + j] * scaled[j];
+            }
+            candidates[k][i] = mean[i] + sigma * sum;
+        }
+    }
+    return candidates;
+}
+
+
+void CmaEs::tell(const std::vector<std::vector<double>>& candidates, const std::vector<double>& costs)
+{
+    std::vector<int> order(candidates.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&costs](int a, int b) { return costs[a] < costs[b]; });
+
+    std::vector<double> old_mean = mean;
+    for (int i = 0; i < n; i++)
+    {
+        mean[i] = 0;
+        for (int k = 0; k < mu; k++)
+        {
+            mean[i] += weights[k] * candidates[order[k]][i];
+        }
+    }
+
+    // step of the mean in the sampling space, and whitened by C^-1/2 = B D^-1 B^T
+    std::vector<double> step(n);
+    for (int i = 0; i < n; i++)
+    {
+        step[i] = (mean[i] - old_mean[i]) / sigma;
+    }
+    std::vector<double> rotated(n);
+    for (int j = 0; j < n; j++)
+    {
+        double sum = 0;
+        for (int i = 0; i < n; i++)
+        {
+            sum += B[i * n + j] * step[i];
+        }
+        rotated[j] = sum / D[j];
+    }
+    double ps_norm = 0;
+    for (int i = 0; i < n; i++)
+    {
+        double whitened = 0;
+        for (int j = 0; j < n; j++)
+        {
+            whitened += B[i * n + j] * rotated[j];
+        }
+        ps[i] = (1 - cs) * ps[i] + sqrt(cs * (2 - cs) * mueff) * whitened;
+        ps_norm += ps[i] * ps[i];
+    }
+    ps_norm = sqrt(ps_norm);
+    generation++;
+
+    // the rank-one update stalls while the step size grows fast
+    bool hsig = ps_norm / sqrt(1 - pow(1 - cs, 2.0 * generation)) / chi_n < 1.4 + 2.0 / (n + 1);
+    for (int i = 0; i < n; i++)
+    {
+        pc[i] = (1 - cc) * pc[i] + (hsig ? sqrt(cc * (2 - cc) * mueff) : 0) * step[i];
+    }
+
+    double keep = 1 - c1 - cmu + (hsig ? 0 : c1 * cc * (2 - cc));
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j <= i; j++)
+        {
+            double rank_mu = 0;
+            for (int k = 0; k < mu; k++)
+            {
+                const std::vector<double>& x = candidates[order[k]];
+                rank_mu += weights[k] * (x[i] - old_mean[i]) * (x[j] - old_mean[j]);
+            }
+            double value = keep * C[i * n + j] + c1 * pc[i] * pc[j] + cmu * rank_mu / (sigma * sigma);
+            C[i * n + j] = value;
+            C[j * n + i] = value;
+        }
+    }
+
+    sigma *= exp(cs / damps * (ps_norm / chi_n - 1));
+    decompose();
+}
+
+
+void CmaEs::decompose(void)
+{
+    // cyclic Jacobi rotations, fine for the few dimensions searched here
+    std::vector<double> A = C;
+    for (int i = 0; i < n * n; i++)
+    {
+        B[i] = (i % (n + 1) == 0) ? 1 : 0;
+    }
+    for (int sweep = 0; sweep < JACOBI_SWEEPS; sweep++)
+    {
+        double off = 0;
+        for (int p = 0; p < n; p++)
+        {
+            for (int q = p + 1; q < n; q++)
+            {
+                off += A[p * n + q] * A[p * n + q];
+            }
+        }
+        if (off < 1e-30)
+        {
+            break;
+        }
+        for (int p = 0; p < n; p++)
+        {
+            for (int q = p + 1; q < n; q++)
+            {
+                double apq = A[p * n + q];
+                if (fabs(apq) < 1e-300)
+                {
+                    continue;
+                }
+                double theta = (A[q * n + q] - A[p * n + p]) / (2 * apq);
+                double t = (theta >= 0 ? 1 : -1) / (fabs(theta) + sqrt(theta * theta + 1));
+                double c = 1 / sqrt(t * t + 1);
+                double s = t * c;
+                for (int k = 0; k < n; k++)
+                {
+                    double akp = A[k * n + p];
+                    double akq = A[k * n + q];
+                    A[k * n + p] = c * akp - s * akq;
+                    A[k * n + q] = s * akp + c * akq;
+                }
+                for (int k = 0; k < n; k++)
+                {
+                    double apk = A[p * n + k];
+                    double aqk = A[q * n + k];
+                    A[p * n + k] = c * apk - s * aqk;
+                    A[q * n + k] = s * apk + c * aqk;
+                }
+                for (int k = 0; k < n; k++)
+                {
+                    double bkp = B[k * n + p];
+                    double bkq = B[k * n + q];
+                    B[k * n + p] = c * bkp - s * bkq;
+                    B[k * n + q] = s * bkp + c * bkq;
+                }
+            }
+        }
+    }
+    for (int i = 0; i < n; i++)
+    {
+        D[i] = sqrt(std::max(A[i * n + i], 1e-20));
+    }
+}
@@ -0,0 +1,72 @@
+/**
+ * @file cma_es.h
+ * @brief Covariance matrix adaptation evolution strategy, minimises a cost (host side)
+ *
+ */
+
+#pragma once
+
+#include <random>
+#include <vector>
+
+
+/**
+ * @brief CMA-ES with the default settings of Hansen's tutorial ("The CMA Evolution Strategy: A
+ * Tutorial", 2016): weighted recombination of the best half, cumulative step size adaptation,
+ * rank-one and rank-mu covariance updates.
+ *
+ * Each generation, ask() draws the candidates and tell() takes their costs, so a generation can be
+ * evaluated in parallel. The search space is unbounded, bounds are handled by the caller (clamp
+ * the candidate it evaluates and add a penalty to its cost).
+ */
+class CmaEs
+{
+private:
+
+    int n;                              // dimensions
+    int lambda;                         // candidates per generation
+    int mu;                             // candidates recombined
+    std::vector<double> weights;
+    double mueff;
+    double cc, cs, c1, cmu, damps, chi_n;
+
+    std::vector<double> mean;
+    double sigma;
+    std::vector<double> C;              // covariance, n x n row major
+    std::vector<double> B;              // eigenvectors of C (columns)
+    std::vector<double> D;              // square roots of the eigenvalues
+    std::vector<double> pc, ps;         // evolution paths
+    int generation;
+    std::mt19937 random_engine;
+    std::normal_distribution<double> normal;
+
+    void decompose(void);
+
+public:
+
+    /**
+     * @param lambda_ candidates per generation, 0 for the default 4 + 3 ln(n)
+     */
+    CmaEs(const std::vector<double>& start, double sigma_, int lambda_, unsigned seed);
+
+    /**
+     * @brief Default candidates per generation for n dimensions, 4 + 3 ln(n).
+     */
+    static int default_lambda(int dimensions);
+
+    int get_lambda(void) const;
+
+    /**
+     * @brief Draws the candidates of the next generation.
+     */
+    std::vector<std::vector<double>> ask(void);
+
+    /**
+     * @brief Updates the distribution with the costs of the candidates returned by ask().
+     */
+    void tell(const std::vector<std::vector<double>>& candidates, const std::vector<double>& costs);
+
+    const std::vector<double>& get_mean(void) const;
+    double get_sigma(void) const;
+    int get_generation(void) const;
+};
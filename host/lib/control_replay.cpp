@@ -0,0 +1,270 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "control_replay.h"
+#include "host_hal.h"
+#include "pin_assignments.h"
+
+
+#define REPLAY_INPUTS       17
+
+
+const char* const replay_output_names[REPLAY_OUTPUTS] =
+{
+    "sens_out", "s_out", "heading", "a_out", "speed_l", "speed_r", "m_l_out", "m_r_out"
+};
+
+static const char* const input_names[REPLAY_INPUTS] =
+{
+    "time", "reset", "control", "dt_s", "dt_c", "adc0", "adc1", "adc2", "adc3", "adc4", "adc5", "enc_l", "enc_r",
+    "s_sp", "a_sp", "m_l_sp", "m_r_sp"
+};
+
+static const PinName sensor_pins[6] = {SENSOR0_IN_PIN, SENSOR1_IN_PIN, SENSOR2_IN_PIN,
+                                       SENSOR3_IN_PIN, SENSOR4_IN_PIN, SENSOR5_IN_PIN};
+
+
+ReplayTrace::ReplayTrace(void)
+{
+    for (int i = 0; i < REPLAY_OUTPUTS; i++)
+    {
+        recorded[i] = false;
+    }
+}
+
+
+bool ReplayTrace::load(const char* path, std::string* error)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        *error = std::string("cannot open ") + path;
+        return false;
+    }
+
+    // column of each input then each output, -1 if missing
+    int columns[REPLAY_INPUTS + REPLAY_OUTPUTS];
+    for (int i = 0; i < REPLAY_INPUTS + REPLAY_OUTPUTS; i++)
+    {
+        columns[i] = -1;
+    }
+    char line[1024];
+    int column_count = 0;
+    if (fgets(line, sizeof(line), file) != NULL)
+    {
+        for (char* name = strtok(line, ",\r\n"); name != NULL; name = strtok(NULL, ",\r\n"), column_count++)
+        {
+            for (int i = 0; i < REPLAY_INPUTS + REPLAY_OUTPUTS; i++)
+            {
+                const char* known = (i < REPLAY_INPUTS) ? input_names[i] : replay_output_names[i - REPLAY_INPUTS];
+                if (strcmp(name, known) == 0)
+                {
+                    columns[i] = column_count;
+                }
+            }
+        }
+    }
+    for (int i = 0; i < REPLAY_INPUTS; i++)
+    {
+        if (columns[i] < 0)
+        {
+            *error = std::string("no ") + input_names[i] + " column";
+            fclose(file);
+            return false;
+        }
+    }
+    for (int i = 0; i < REPLAY_OUTPUTS; i++)
+    {
+        recorded[i] = (columns[REPLAY_INPUTS + i] >= 0);
+    }
+
+    frames.clear();
+    std::vector<double> values(column_count);
+    int line_number = 1;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line_number++;
+        if (line[0] == '\n' || line[0] == '\r')
+        {
+            continue;
+        }
+        int count = 0;
+        char* cursor = line;
+        while (count < column_count)
+        {
+            char* end;
+            values[count++] = strtod(cursor, &end);
+            if (end == cursor || (*end != ',' && count < column_count))
+            {
+                break;
+            }
+            cursor = end + 1;
+        }
+        if (count < column_count)
+        {
+            *error = "line " + std::to_string(line_number) + ": invalid frame";
+            fclose(file);
+            return false;
+        }
+
+        Replay_frame frame;
+        frame.in.time = values[columns[0]];
+        frame.in.reset = values[columns[1]] != 0;
+        frame.in.control = values[columns[2]] != 0;
+        frame.in.sensor_dt = (float) values[columns[3]];
+        frame.in.control_dt = (float) values[columns[4]];
+        for (int i = 0; i < 6; i++)
+        {
+            frame.in.adc[i] = (float) values[columns[5 + i]];
+        }
+        frame.in.encoder[0] = (int) values[columns[11]];
+        frame.in.encoder[1] = (int) values[columns[12]];
+        frame.in.sensor_sp = (float) values[columns[13]];
+        frame.in.angle_sp = (float) values[columns[14]];
+        frame.in.wheel_sp[0] = (float) values[columns[15]];
+        frame.in.wheel_sp[1] = (float) values[columns[16]];
+        for (int i = 0; i < REPLAY_OUTPUTS; i++)
+        {
+            frame.out.value[i] = recorded[i] ? (float) values[columns[REPLAY_INPUTS + i]] : 0;
+        }
+        frames.push_back(frame);
+    }
+    fclose(file);
+    return true;
+}
+
+
+void ReplayTrace::write_header(FILE* out, const bool* outputs)
+{
+    for (int i = 0; i < REPLAY_INPUTS; i++)
+    {
+        fprintf(out, i == 0 ? "%s" : ",%s", input_names[i]);
+    }
+    for (int i = 0; i < REPLAY_OUTPUTS && outputs != NULL; i++)
+    {
+        if (outputs[i])
+        {
+            fprintf(out, ",%s", replay_output_names[i]);
+        }
+    }
+    fprintf(out, "\n");
+}
+
+
+void ReplayTrace::write_frame(FILE* out, const Replay_frame& frame, const bool* outputs)
+{
+    // 9 significant digits read back to the same float
+    const Replay_inputs& in = frame.in;
+    fprintf(out, "%.6f,%d,%d,%.9g,%.9g", in.time, in.reset ? 1 : 0, in.control ? 1 : 0, in.sensor_dt, in.control_dt);
+    for (int i = 0; i < 6; i++)
+    {
+        fprintf(out, ",%.9g", in.adc[i]);
+    }
+    fprintf(out, ",%d,%d,%.9g,%.9g,%.9g,%.9g", in.encoder[0], in.encoder[1], in.sensor_sp, in.angle_sp,
+            in.wheel_sp[0], in.wheel_sp[1]);
+    for (int i = 0; i < REPLAY_OUTPUTS && outputs != NULL; i++)
+    {
+        if (outputs[i])
+        {
+            fprintf(out, ",%.9g", frame.out.value[i]);
+        }
+    }
+    fprintf(out, "\n");
+}
+
+
+ControlReplay::ControlReplay(void):
+    sensor_array(SENSOR0_IN_PIN, SENSOR1_IN_PIN, SENSOR2_IN_PIN, SENSOR3_IN_PIN, SENSOR4_IN_PIN, SENSOR5_IN_PIN,
+                 SENSOR0_OUT_PIN, SENSOR1_OUT_PIN, SENSOR2_OUT_PIN, SENSOR3_OUT_PIN, SENSOR4_OUT_PIN, SENSOR5_OUT_PIN,
+                 SENS_SAMPLE_COUNT, SENS_DETECT_RANGE, SENS_ANGLE_COEFF),
+    motor_left(MOTORL_PWM_PIN, MOTORL_DIRECTION_PIN, MOTORL_BIPOLAR_PIN, MOTORL_CHA_PIN, MOTORL_CHB_PIN, PULSE_PER_REV,
+               MOTOR_PWM_FREQ, CONTROL_UPDATE_RATE, LP_SPEED_A0, LP_SPEED_B0, LP_SPEED_B1, WHEEL_RADIUS),
+    motor_right(MOTORR_PWM_PIN, MOTORR_DIRECTION_PIN, MOTORR_BIPOLAR_PIN, MOTORR_CHA_PIN, MOTORR_CHB_PIN, PULSE_PER_REV,
+                MOTOR_PWM_FREQ, CONTROL_UPDATE_RATE, LP_SPEED_A0, LP_SPEED_B0, LP_SPEED_B1, WHEEL_RADIUS),
+    odometry(PULSE_PER_REV, WHEEL_RADIUS, WHEEL_SEPERATION),
+    pid_motor_left(PID_M_L_KP, PID_M_L_KI, PID_M_L_KD, PID_M_TAU, PID_M_MIN_OUT, PID_M_MAX_OUT, PID_M_MIN_INT,
+                   PID_M_MAX_INT, CONTROL_UPDATE_PERIOD),
+    pid_motor_right(PID_M_R_KP, PID_M_R_KI, PID_M_R_KD, PID_M_TAU, PID_M_MIN_OUT, PID_M_MAX_OUT, PID_M_MIN_INT,
+                    PID_M_MAX_INT, CONTROL_UPDATE_PERIOD),
+    pid_angle(PID_A_KP, PID_A_KI, PID_A_KD, PID_A_TAU, PID_A_MIN_OUT, PID_A_MAX_OUT, PID_A_MIN_INT, PID_A_MAX_INT,
+              CONTROL_UPDATE_PERIOD),
+    pid_sensor(PID_S_KP, PID_S_KI, PID_S_KD, PID_S_TAU, PID_S_MIN_OUT, PID_S_MAX_OUT, PID_S_MIN_INT, PID_S_MAX_INT,
+               SENSOR_UPDATE_PERIOD)
+{
+    // same set up as main()
+    sensor_array.set_all_led_on(true);
+    motor_left.set_traction_control(TRACTION_ACCEL_WINDOW, TRACTION_ACCEL_MARGIN, TRACTION_SLEW_RATE, STALL_DUTY,
+                                    STALL_TIME, STALL_DUTY_CAP);
+    motor_right.set_traction_control(TRACTION_ACCEL_WINDOW, TRACTION_ACCEL_MARGIN, TRACTION_SLEW_RATE, STALL_DUTY,
+                                     STALL_TIME, STALL_DUTY_CAP);
+    motor_left.set_compensation(MOTOR_L_DEADBAND, NULL, 0, 0);
+    motor_right.set_compensation(MOTOR_R_DEADBAND, NULL, 0, 0);
+    motor_left.set_compensation_enabled(MOTOR_L_DEADBAND > 0);
+    motor_right.set_compensation_enabled(MOTOR_R_DEADBAND > 0);
+}
+
+
+
+void ControlReplay::reset(void)
+{
+    // the encoders count from 0 at power up
+    hal::set_encoder(MOTORL_CHA_PIN, 0);
+    hal::set_encoder(MOTORR_CHA_PIN, 0);
+    sensor_array.reset();
+    motor_left.reset();
+    motor_right.reset();
+    odometry.reset();
+    pid_motor_left.reset();
+    pid_motor_right.reset();
+    pid_angle.reset();
+    pid_sensor.reset();
+}
+
+
+void ControlReplay::step(const Replay_inputs& in, Replay_outputs* out)
+{
+    // sensor task
+    for (int i = 0; i < 6; i++)
+    {
+        hal::set_analog(sensor_pins[i], in.adc[i]);
+    }
+    sensor_array.update();
+    pid_sensor.update(in.sensor_sp, sensor_array.get_filtered_output(), in.sensor_dt);
+
+    // control task, the reset is done first like in control_update_ISR()
+    if (in.control)
+    {
+        hal::set_encoder(MOTORL_CHA_PIN, in.encoder[0]);
+        hal::set_encoder(MOTORR_CHA_PIN, in.encoder[1]);
+        if (in.reset)
+        {
+            motor_left.reset();
+            motor_right.reset();
+            odometry.reset();
+            pid_motor_left.reset();
+            pid_motor_right.reset();
+            pid_angle.reset();
+            pid_sensor.reset();
+        }
+        motor_left.update(in.control_dt);
+        motor_right.update(in.control_dt);
+        odometry.update(motor_left.get_tick_count(), motor_right.get_tick_count());
+        pid_angle.update(in.angle_sp, odometry.get_pose().heading_deg, in.control_dt);
+        motor_left.set_speed_setpoint(in.wheel_sp[0]);
+        motor_right.set_speed_setpoint(in.wheel_sp[1]);
+        pid_motor_left.update(in.wheel_sp[0], motor_left.get_filtered_speed(), in.control_dt);
+        pid_motor_right.update(in.wheel_sp[1], motor_right.get_filtered_speed(), in.control_dt);
+        motor_left.set_duty_cycle(pid_motor_left.get_output());
+        motor_right.set_duty_cycle(pid_motor_right.get_output());
+    }
+
+    out->value[0] = sensor_array.get_filtered_output();
+    out->value[1] = pid_sensor.get_output();
+    out->value[2] = odometry.get_pose().heading_deg;
+    out->value[3] = pid_angle.get_output();
+    out->value[4] = motor_left.get_filtered_speed();
+    out->value[5] = motor_right.get_filtered_speed();
+    out->value[6] = pid_motor_left.get_output();
+    out->value[7] = pid_motor_right.get_output();
+}
@@ -0,0 +1,138 @@
+/**
+ * @file control_replay.h
+ * @brief Replays recorded sensor and encoder frames through the control path classes (host side)
+ *
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "mbed.h"
+#include "PID.h"
+#include "motor.h"
+#include "odometry.h"
+#include "sensor_array.h"
+
+
+#define REPLAY_OUTPUTS      8
+
+
+/**
+ * @brief Inputs of one scheduler tick (sensor update, and control update every second tick).
+ */
+struct Replay_inputs
+{
+    double time;                ///< s
+    bool reset;                 ///< the controllers were reset by the control update of this tick
+    bool control;               ///< the control update ran on this tick
+    float sensor_dt;            ///< dt given to the sensor update by the scheduler (s)
+    float control_dt;           ///< dt given to the control update (s)
+    float adc[6];               ///< sensor levels read by the sensor update (0..1)
+    int encoder[2];             ///< left, right encoder counts (X4) when the tick started
+    float sensor_sp;            ///< sensor PID set point
+    float angle_sp;             ///< angle PID set point (degrees)
+    float wheel_sp[2];          ///< left, right motor PID set points (m/s)
+};
+
+
+/**
+ * @brief Outputs after one tick, in the order of replay_output_names.
+ */
+struct Replay_outputs
+{
+    float value[REPLAY_OUTPUTS];
+};
+
+
+/**
+ * @brief CSV column names of the outputs: sens_out, s_out, heading, a_out, speed_l, speed_r, m_l_out, m_r_out.
+ */
+extern const char* const replay_output_names[REPLAY_OUTPUTS];
+
+
+struct Replay_frame
+{
+    Replay_inputs in;
+    Replay_outputs out;
+};
+
+
+/**
+ * @brief A recorded trace: the frames and the output columns it has.
+ *
+ * The CSV file has a header line. The input columns are time, reset, control, dt_s, dt_c, adc0
+ * to adc5, enc_l, enc_r, s_sp, a_sp, m_l_sp and m_r_sp, any of the output columns can follow
+ * (those recorded from the firmware or by a previous replay, the golden outputs).
+ */
+class ReplayTrace
+{
+public:
+
+    std::vector<Replay_frame> frames;
+    bool recorded[REPLAY_OUTPUTS];          ///< true for the output columns present in the file
+
+    ReplayTrace(void);
+
+    /**
+     * @brief Loads a trace file.
+     *
+     * @param error set to the reason (with the line number) if it fails
+     * @return false if the file cannot be read, misses an input column or has an invalid line
+     */
+    bool load(const char* path, std::string* error);
+
+    /**
+     * @brief Writes the CSV header.
+     *
+     * @param outputs the output columns to write (REPLAY_OUTPUTS flags), NULL for none
+     */
+    static void write_header(FILE* out, const bool* outputs);
+
+    /**
+     * @brief Writes one frame as a CSV line, the values are exact when read back.
+     */
+    static void write_frame(FILE* out, const Replay_frame& frame, const bool* outputs);
+};
+
+
+/**
+ * @brief The sensor array, motors, odometry and the four PIDs, updated like the sensor and control tasks.
+ *
+ * The objects are built and configured like the firmware globals, on the pins of the firmware:
+ * the frame inputs are fed through the host HAL (analog levels, encoder counts) so the classes run
+ * unmodified. They keep the default parameters, like the firmware until a parameter is set (a trace
+ * recorded after a parameter change replays within about 1e-5). Each tick updates the sensor array
+ * and the sensor PID, then on control ticks the motors, the odometry, the angle PID and the motor
+ * PIDs, whose outputs set the motor duty cycles. Unlike the firmware, every PID runs on every control tick whatever the
+ * mode, the outputs of the PIDs the firmware did not run are only meaningful against a replay.
+ */
+class ControlReplay
+{
+private:
+
+    SensorArray sensor_array;
+    Motor motor_left;
+    Motor motor_right;
+    Odometry odometry;
+    PID pid_motor_left;
+    PID pid_motor_right;
+    PID pid_angle;
+    PID pid_sensor;
+
+public:
+
+    ControlReplay(void);
+
+    /**
+     * @brief Resets every object, as after power up.
+     */
+    void reset(void);
+
+    /**
+     * @brief Runs one tick.
+     */
+    void step(const Replay_inputs& in, Replay_outputs* out);
+};
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <errno.h>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "host_hal.h"
+#include "lap_runner.h"
+
+
+#define PARAMS_TIME         0.05        // s, parameters sent after the boot messages
+#define START_TIME          0.2         // s, line following started
+#define PHYSICS_STEP        0.0001      // s
+#define START_GAP           0.05        // s, min time between the last command and the start
+
+int firmware_main(void);
+
+
+Lap_job default_lap_job(const Track& track)
+{
+    Lap_job job;
+    job.track = &track;
+    job.plant = default_plant_params();
+    job.sensors = default_sensor_params();
+    job.seed = 1;
+    job.max_time = 60;
+    job.command_port = USBTX;
+    job.command_jitter = 0;
+    job.ticker_jitter_ns = 0;
+    return job;
+}
+
+
+static Sim_result simulate(const Lap_job& job)
+{
+    Host_costs costs = hal::get_costs();
+    costs.ticker_jitter_ns = job.ticker_jitter_ns;
+    hal::set_costs(costs);
+    hal::set_seed(job.seed);
+
+    BuggySim sim(*job.track, job.plant, job.sensors, job.seed);
+    sim.attach(PHYSICS_STEP);
+
+    // the commands keep their order, the start follows them
+    std::mt19937 random_engine(job.seed);
+    std::uniform_real_distribution<double> delay(0, job.command_jitter);
+    std::vector<double> delays;
+    for (size_t i = 0; i < job.commands.size(); i++)
+    {
+        delays.push_back(delay(random_engine));
+    }
+    std::sort(delays.begin(), delays.end());
+    PinName port = job.command_port;
+    double last = PARAMS_TIME;
+    for (size_t i = 0; i < job.commands.size(); i++)
+    {
+        std::string command = job.commands[i];
+        last = PARAMS_TIME + delays[i];
+        hal::at(last, [port, command]() { hal::serial_send(port, command + "\n"); });
+    }
+    double start = std::max(START_TIME, last + START_GAP) + delay(random_engine);
+    hal::at(start, [&sim, port]()
+    {
+        hal::serial_send(port, "EF\n");
+        sim.start_lap(hal::now());
+    });
+    hal::run(firmware_main, job.max_time);
+    return sim.get_result();
+}
+
+
+Lap_outcome run_lap(const Lap_job& job)
+{
+    Lap_outcome outcome;
+    memset(&outcome, 0, sizeof(outcome));
+
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        return outcome;
+    }
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return outcome;
+    }
+    if (pid == 0)
+    {
+        close(fds[0]);
+        Sim_result result = simulate(job);
+        ssize_t written = write(fds[1], &result, sizeof(result));
+        _exit(written == (ssize_t) sizeof(result) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    size_t received = 0;
+    char* buffer = (char*) &outcome.result;
+    while (received < sizeof(outcome.result))
+    {
+        ssize_t count = read(fds[0], buffer + received, sizeof(outcome.result) - received);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            break;
+        }
+        received += count;
+    }
+    close(fds[0]);
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+    {
+    }
+    outcome.ran = (received == sizeof(outcome.result)) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    return outcome;
+}
+
+
+bool load_commands(const char* path, std::vector<std::string>* commands)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] != '\0' && line[0] != '#')
+        {
+            commands->push_back(line);
+        }
+    }
+    fclose(file);
+    return true;
+}
@@ -0,0 +1,62 @@
+/**
+ * @file lap_runner.h
+ * @brief Runs simulated laps of the firmware in child processes (host side)
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "buggy_sim.h"
+#include "mbed.h"
+#include "track.h"
+
+
+/**
+ * @brief One closed loop lap: the buggy, the track and the commands sent to the firmware.
+ */
+struct Lap_job
+{
+    const Track* track;
+    Plant_params plant;
+    Sensor_params sensors;
+    unsigned seed;                          ///< sensor noise and random delays
+    double max_time;                        ///< s of firmware time
+    std::vector<std::string> commands;      ///< sent before the start, one per line
+    PinName command_port;                   ///< USBTX, or BT_TX_PIN to send the commands and the start over bluetooth
+    double command_jitter;                  ///< s, the commands and the start are sent late by up to this (uniform)
+    uint32_t ticker_jitter_ns;              ///< Ticker interrupts late by up to this (Host_costs::ticker_jitter_ns)
+};
+
+
+/**
+ * @brief The default buggy on a track: commands on the USB serial port, no jitter, 60 s.
+ */
+Lap_job default_lap_job(const Track& track);
+
+
+struct Lap_outcome
+{
+    bool ran;                               ///< false if the child process failed
+    Sim_result result;
+};
+
+
+/**
+ * @brief Runs a lap like track_sim and returns its metrics.
+ *
+ * The firmware globals only start once per process (hal::run()), each lap runs in a child
+ * process forked for it and sends its result back through a pipe. Can be called from several
+ * threads at once, the child only uses the memory copied from the caller.
+ */
+Lap_outcome run_lap(const Lap_job& job);
+
+
+/**
+ * @brief Reads a command script: one command per line, '#' comments and blank lines skipped.
+ *
+ * @return false if the file cannot be read
+ */
+bool load_commands(const char* path, std::vector<std::string>* commands);
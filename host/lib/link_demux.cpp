@@ -0,0 +1,126 @@
+#include <string.h>
+
+#include "link_demux.h"
+
+
+LinkDemux::LinkDemux(LinkHandler& handler_):
+    handler(handler_)
+{
+    length = 0;
+    last_seq = -1;
+    text_lines = 0;
+    frames = 0;
+    crc_errors = 0;
+    lost = 0;
+}
+
+
+bool LinkDemux::is_text(const uint8_t* data, int size)
+{
+    // newlines in front are empty lines, a line can only end with a carriage return
+    int i = 0;
+    while (i < size && (data[i] == '\n' || data[i] == '\r'))
+    {
+        i++;
+    }
+    for (; i < size; i++)
+    {
+        bool printable = (data[i] >= 0x20 && data[i] <= 0x7E);
+        if (!printable && !(data[i] == '\r' && i == size - 1))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+void LinkDemux::emit_text(const uint8_t* data, int size)
+{
+    // one or more lines separated by newlines, carriage returns are dropped
+    char line[buffer_size + 1];
+    int line_length = 0;
+    for (int i = 0; i <= size; i++)
+    {
+        if (i == size || data[i] == '\n')
+        {
+            if (line_length > 0)
+            {
+                line[line_length] = '\0';
+                handler.on_text(line);
+                text_lines++;
+            }
+            line_length = 0;
+        }
+        else if (data[i] != '\r')
+        {
+            line[line_length++] = (char) data[i];
+        }
+    }
+}
+
+
+void LinkDemux::end_of_frame(void)
+{
+    Telemetry_frame frame;
+
+    // the frame may follow text lines, try the whole buffer then after each newline
+    for (int start = 0; start < length; start++)
+    {
+        if (start > 0 && buffer[start - 1] != '\n')
+        {
+            continue;
+        }
+        if (telemetry_decode_frame(buffer + start, length - start, &frame))
+        {
+            emit_text(buffer, start);
+            if (last_seq >= 0)
+            {
+                lost += (uint8_t) (frame.seq - last_seq - 1);
+            }
+            last_seq = frame.seq;
+            frames++;
+            handler.on_frame(frame);
+            length = 0;
+            return;
+        }
+    }
+
+    if (length > 0)
+    {
+        crc_errors++;
+    }
+    length = 0;
+}
+
+
+void LinkDemux::feed(const uint8_t* data, int size)
+{
+    for (int i = 0; i < size; i++)
+    {
+        uint8_t byte = data[i];
+        if (byte == TELEMETRY_DELIMITER)
+        {
+            end_of_frame();
+            continue;
+        }
+
+        if (byte == '\n' && length > 0 && is_text(buffer, length))
+        {
+            emit_text(buffer, length);
+            length = 0;
+            continue;
+        }
+
+        if (length == buffer_size)
+        {
+            // no delimiter for too long: not a frame, keep what looks like text
+            if (is_text(buffer, length))
+            {
+                emit_text(buffer, length);
+            }
+            length = 0;
+        }
+        buffer[length++] = byte;
+    }
+}
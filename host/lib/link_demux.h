@@ -0,0 +1,62 @@
+/**
+ * @file link_demux.h
+ * @brief Splits the bytes received from the buggy into text replies and telemetry frames
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "telemetry.h"
+
+
+/**
+ * @brief Receives the demultiplexed text lines and frames.
+ */
+class LinkHandler
+{
+public:
+
+    virtual ~LinkHandler(void) {}
+    virtual void on_text(const char* line) = 0;
+    virtual void on_frame(const Telemetry_frame& frame) = 0;
+};
+
+
+/**
+ * @brief Separates text lines and binary telemetry frames sent on the same link.
+ *
+ * Text replies end with a newline and only contain printable characters, frames end with the
+ * 0x00 delimiter. Text received just before a frame (without anything in between) is recognised
+ * because the frame CRC only matches once the text lines in front of it are removed.
+ */
+class LinkDemux
+{
+private:
+
+    static const int buffer_size = 256;
+
+    LinkHandler& handler;
+    uint8_t buffer[buffer_size];
+    int length;
+    int last_seq;
+
+    bool is_text(const uint8_t* data, int size);
+    void emit_text(const uint8_t* data, int size);
+    void end_of_frame(void);
+
+public:
+
+    int text_lines;         ///< text lines received
+    int frames;             ///< valid frames received
+    int crc_errors;         ///< data ending with a delimiter that is not a valid frame
+    int lost;               ///< frames missing according to the sequence numbers
+
+    LinkDemux(LinkHandler& handler_);
+
+    /**
+     * @brief Feeds the received bytes, the handler is called for each line or frame completed.
+     */
+    void feed(const uint8_t* data, int size);
+};
@@ -0,0 +1,186 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "serial_port.h"
+
+
+static speed_t baud_constant(int baud)
+{
+    switch (baud)
+    {
+        case 9600:      return B9600;
+        case 19200:     return B19200;
+        case 38400:     return B38400;
+        case 57600:     return B57600;
+        case 115200:    return B115200;
+        case 230400:    return B230400;
+        case 460800:    return B460800;
+        case 921600:    return B921600;
+        default:        return 0;
+    }
+}
+
+
+static bool set_raw(int fd, speed_t speed)
+{
+    struct termios tio;
+    if (tcgetattr(fd, &tio) != 0)
+    {
+        return false;
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    if (speed != 0)
+    {
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+    }
+    return tcsetattr(fd, TCSANOW, &tio) == 0;
+}
+
+
+SerialPort::SerialPort(void)
+{
+    fd = -1;
+    slave_fd = -1;
+    slave_path[0] = '\0';
+}
+
+
+SerialPort::~SerialPort(void)
+{
+    close();
+}
+
+
+bool SerialPort::open(const char* path, int baud)
+{
+    speed_t speed = baud_constant(baud);
+    if (speed == 0)
+    {
+        fprintf(stderr, "unsupported baud rate %d\n", baud);
+        return false;
+    }
+
+    fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0)
+    {
+        perror(path);
+        return false;
+    }
+    if (!set_raw(fd, speed))
+    {
+        perror(path);
+        close();
+        return false;
+    }
+    tcflush(fd, TCIOFLUSH);
+    return true;
+}
+
+
+bool SerialPort::open_pty(void)
+{
+    fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0)
+    {
+        perror("posix_openpt");
+        close();
+        return false;
+    }
+    snprintf(slave_path, sizeof(slave_path), "%s", ptsname(fd));
+
+    slave_fd = ::open(slave_path, O_RDWR | O_NOCTTY);
+    if (slave_fd < 0 || !set_raw(slave_fd, 0))
+    {
+        perror(slave_path);
+        close();
+        return false;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return true;
+}
+
+
+const char* SerialPort::get_slave_path(void)
+{
+    return slave_path;
+}
+
+
+void SerialPort::close(void)
+{
+    if (slave_fd >= 0)
+    {
+        ::close(slave_fd);
+        slave_fd = -1;
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+
+int SerialPort::get_fd(void)
+{
+    return fd;
+}
+
+
+int SerialPort::read(uint8_t* buffer, int size, int timeout_ms)
+{
+    struct pollfd pfd = {fd, POLLIN, 0};
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready <= 0)
+    {
+        return (ready < 0 && errno != EINTR) ? -1 : 0;
+    }
+
+    ssize_t count = ::read(fd, buffer, size);
+    if (count < 0)
+    {
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    }
+    return (int) count;
+}
+
+
+bool SerialPort::write_all(const uint8_t* data, int length)
+{
+    while (length > 0)
+    {
+        ssize_t count = ::write(fd, data, length);
+        if (count < 0)
+        {
+            if (errno == EAGAIN || errno == EINTR)
+            {
+                struct pollfd pfd = {fd, POLLOUT, 0};
+                poll(&pfd, 1, 100);
+                continue;
+            }
+            return false;
+        }
+        data += count;
+        length -= count;
+    }
+    return true;
+}
+
+
+int64_t host_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,76 @@
+/**
+ * @file serial_port.h
+ * @brief Raw serial port (tty or pseudo-terminal) for the host tools
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+
+/**
+ * @brief A serial device opened in raw 8N1 mode, or the master side of a new pseudo-terminal.
+ *
+ * The bluetooth module (through a USB serial adapter or rfcomm) and the Nucleo USB serial
+ * both show up as ttys, the firmware stand-in uses a pseudo-terminal instead.
+ */
+class SerialPort
+{
+private:
+
+    int fd;
+    int slave_fd;                   // pty only: kept open so the master does not see hangups
+    char slave_path[64];
+
+public:
+
+    SerialPort(void);
+    ~SerialPort(void);
+
+    /**
+     * @brief Opens a serial device.
+     *
+     * @param path device path, e.g. /dev/ttyACM0 or /dev/pts/3
+     * @param baud baud rate (ignored by pseudo-terminals)
+     * @return false if the device could not be opened or the baud rate is not supported
+     */
+    bool open(const char* path, int baud);
+
+    /**
+     * @brief Creates a pseudo-terminal and opens its master side.
+     *
+     * @return false if the pseudo-terminal could not be created
+     */
+    bool open_pty(void);
+
+    /**
+     * @brief Path of the pseudo-terminal to give to the other program.
+     */
+    const char* get_slave_path(void);
+
+    void close(void);
+
+    /**
+     * @brief File descriptor, for poll().
+     */
+    int get_fd(void);
+
+    /**
+     * @brief Reads the bytes available, waiting up to timeout_ms for the first one.
+     *
+     * @return number of bytes read, 0 on timeout, -1 on error
+     */
+    int read(uint8_t* buffer, int size, int timeout_ms);
+
+    /**
+     * @brief Writes all the bytes.
+     */
+    bool write_all(const uint8_t* data, int length);
+};
+
+
+/**
+ * @brief Monotonic time in microseconds.
+ */
+int64_t host_time_us(void);
@@ -0,0 +1,82 @@
+#include "telemetry_csv.h"
+
+
+static const char* speed_burst_columns = "speed_l,speed_r";
+static const char* sensor_burst_columns = "filtered";
+
+
+void telemetry_csv_header(FILE* out, uint8_t type)
+{
+    fprintf(out, "type,seq,sample");
+    if (type == tm_speed_burst)
+    {
+        fprintf(out, ",%s", speed_burst_columns);
+    }
+    else if (type == tm_sensor_burst)
+    {
+        fprintf(out, ",%s", sensor_burst_columns);
+    }
+    else
+    {
+        int count;
+        const Telemetry_field* fields = telemetry_frame_fields(type, &count);
+        for (int i = 0; i < count; i++)
+        {
+            fprintf(out, ",%s", fields[i].name);
+        }
+    }
+    fprintf(out, "\n");
+}
+
+
+int telemetry_csv_frame(FILE* out, const Telemetry_frame& frame)
+{
+    const char* name = telemetry_frame_name(frame.type);
+
+    if (frame.type == tm_speed_burst || frame.type == tm_sensor_burst)
+    {
+        int channels = (frame.type == tm_speed_burst) ? 2 : 1;
+        float scale = (frame.type == tm_speed_burst) ? 1000 : 100;
+        int samples[TELEMETRY_MAX_PAYLOAD * 2];
+        int count = TelemetryBurst::decode(frame, channels, samples, TELEMETRY_MAX_PAYLOAD);
+
+        for (int i = 0; i < count; i++)
+        {
+            fprintf(out, "%s,%d,%d", name, frame.seq, i);
+            for (int c = 0; c < channels; c++)
+            {
+                fprintf(out, ",%.3f", samples[i * channels + c] / scale);
+            }
+            fprintf(out, "\n");
+        }
+        return count;
+    }
+
+    int count;
+    const Telemetry_field* fields = telemetry_frame_fields(frame.type, &count);
+    TelemetryReader reader(frame);
+
+    fprintf(out, "%s,%d,0", name, frame.seq);
+    for (int i = 0; i < count; i++)
+    {
+        long value;
+        switch (fields[i].kind)
+        {
+            case 'b': value = reader.read_u8(); break;
+            case 'c': value = reader.read_i8(); break;
+            case 'w': value = reader.read_u16(); break;
+            case 'h': value = reader.read_i16(); break;
+            default:  value = reader.read_i32(); break;
+        }
+        if (fields[i].scale == 1)
+        {
+            fprintf(out, ",%ld", value);
+        }
+        else
+        {
+            fprintf(out, ",%.3f", value / fields[i].scale);
+        }
+    }
+    fprintf(out, "\n");
+    return 1;
+}
@@ -0,0 +1,28 @@
+/**
+ * @file telemetry_csv.h
+ * @brief Converts decoded telemetry frames to CSV lines (host side)
+ *
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+#include "telemetry.h"
+
+
+/**
+ * @brief Writes the CSV header of a frame type.
+ *
+ * Columns are: type, seq, sample (index within a burst, 0 for fixed frames), then the frame fields.
+ */
+void telemetry_csv_header(FILE* out, uint8_t type);
+
+/**
+ * @brief Writes a decoded frame as CSV, one line per sample (bursts have several).
+ *
+ * Fields are converted back to physical units.
+ *
+ * @return number of lines written
+ */
+int telemetry_csv_frame(FILE* out, const Telemetry_frame& frame);
@@ -0,0 +1,272 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "track.h"
+
+
+#define TRACK_STEP          0.005       // centre line sampling (m)
+#define TRACK_CLOSE_GAP     0.01        // end to start distance of a closed loop (m)
+#define TRACK_SEARCH        20          // segments searched each side of the hint
+#define TRACK_MAX_POINTS    2000000
+
+
+Track::Track(void)
+{
+    width = 0.019;
+    start_x = 0;
+    start_y = 0;
+    start_heading = 0;
+    closed = false;
+}
+
+
+void Track::add_point(double x, double y)
+{
+    double station = 0;
+    if (!points.empty())
+    {
+        const Point& last = points.back();
+        station = last.station + hypot(x - last.x, y - last.y);
+    }
+    points.push_back(Point{x, y, station});
+}
+
+
+bool Track::load(const char* path, std::string* error)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        *error = std::string("cannot open ") + path;
+        return false;
+    }
+    std::string text;
+    char buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        text.append(buffer, length);
+    }
+    fclose(file);
+    return load_text(text.c_str(), error);
+}
+
+
+bool Track::load_text(const char* text, std::string* error)
+{
+    points.clear();
+    closed = false;
+    if (!parse(text, error))
+    {
+        points.clear();
+        return false;
+    }
+    if (points.size() < 2)
+    {
+        *error = "the track has no line or arc";
+        points.clear();
+        return false;
+    }
+
+    const Point& first = points.front();
+    const Point& last = points.back();
+    if (hypot(last.x - first.x, last.y - first.y) < TRACK_CLOSE_GAP)
+    {
+        // the last point becomes the start again
+        points.pop_back();
+        add_point(first.x, first.y);
+        closed = true;
+    }
+    return true;
+}
+
+
+bool Track::parse(const char* text, std::string* error)
+{
+    double x = 0;
+    double y = 0;
+    double heading = 0;
+    bool started = false;
+    int line_number = 0;
+
+    while (*text != '\0')
+    {
+        const char* end = strchr(text, '\n');
+        std::string line = end ? std::string(text, end - text) : std::string(text);
+        text = end ? end + 1 : text + line.size();
+        line_number++;
+
+        char keyword[16];
+        double a = 0;
+        double b = 0;
+        double c = 0;
+        int fields = sscanf(line.c_str(), "%15s %lf %lf %lf", keyword, &a, &b, &c);
+        if (fields < 1 || keyword[0] == '#')
+        {
+            continue;
+        }
+
+        bool valid = true;
+        if (strcmp(keyword, "width") == 0)
+        {
+            valid = (fields == 2 && a > 0);
+            width = a;
+        }
+        else if (strcmp(keyword, "start") == 0)
+        {
+            valid = (fields == 4 && !started);
+            x = start_x = a;
+            y = start_y = b;
+            heading = start_heading = c * M_PI / 180;
+        }
+        else if (strcmp(keyword, "line") == 0 || strcmp(keyword, "to") == 0)
+        {
+            double length = a;
+            if (keyword[0] == 't')
+            {
+                valid = (fields == 3 && (a != x || b != y));
+                length = hypot(a - x, b - y);
+                heading = atan2(b - y, a - x);
+            }
+            else
+            {
+                valid = (fields == 2 && a > 0);
+            }
+            if (valid)
+            {
+                if (!started)
+                {
+                    start_heading = heading;
+                    add_point(x, y);
+                    started = true;
+                }
+                int steps = (int) ceil(length / TRACK_STEP);
+                double x0 = x;
+                double y0 = y;
+                for (int i = 1; i <= steps && points.size() < TRACK_MAX_POINTS; i++)
+                {
+                    add_point(x0 + cos(heading) * length * i / steps, y0 + sin(heading) * length * i / steps);
+                }
+                x = x0 + cos(heading) * length;
+                y = y0 + sin(heading) * length;
+            }
+        }
+        else if (strcmp(keyword, "arc") == 0)
+        {
+            valid = (fields == 3 && a > 0 && b != 0);
+            if (valid)
+            {
+                if (!started)
+                {
+                    add_point(x, y);
+                    started = true;
+                }
+                // centre on the inside of the turn
+                double angle = b * M_PI / 180;
+                double side = (angle > 0) ? 1 : -1;
+                double cx = x - sin(heading) * a * side;
+                double cy = y + cos(heading) * a * side;
+                double start_angle = heading - side * M_PI / 2;
+                int steps = (int) ceil(fabs(angle) * a / TRACK_STEP);
+                for (int i = 1; i <= steps && points.size() < TRACK_MAX_POINTS; i++)
+                {
+                    double t = start_angle + angle * i / steps;
+                    add_point(cx + a * cos(t), cy + a * sin(t));
+                }
+                heading += angle;
+                x = cx + a * cos(start_angle + angle);
+                y = cy + a * sin(start_angle + angle);
+            }
+        }
+        else
+        {
+            valid = false;
+        }
+
+        if (!valid || points.size() >= TRACK_MAX_POINTS)
+        {
+            char message[64];
+            snprintf(message, sizeof(message), "line %d: invalid %s", line_number, keyword);
+            *error = message;
+            return false;
+        }
+    }
+    return true;
+}
+
+
+Track_position Track::locate(double x, double y, int hint) const
+{
+    Track_position best = {0, 0, 0};
+    int segments = (int) points.size() - 1;
+    if (segments < 1)
+    {
+        return best;
+    }
+
+    int first = 0;
+    int count = segments;
+    if (hint >= 0 && 2 * TRACK_SEARCH + 1 < segments)
+    {
+        first = hint - TRACK_SEARCH;
+        count = 2 * TRACK_SEARCH + 1;
+        if (!closed)
+        {
+            first = (first < 0) ? 0 : (first + count > segments ? segments - count : first);
+        }
+    }
+
+    double best_distance = -1;
+    for (int k = 0; k < count; k++)
+    {
+        int i = ((first + k) % segments + segments) % segments;
+        const Point& a = points[i];
+        const Point& b = points[i + 1];
+        double dx = b.x - a.x;
+        double dy = b.y - a.y;
+        double length_squared = dx * dx + dy * dy;
+        double t = ((x - a.x) * dx + (y - a.y) * dy) / length_squared;
+        t = (t < 0) ? 0 : (t > 1 ? 1 : t);
+        double px = a.x + t * dx - x;
+        double py = a.y + t * dy - y;
+        double distance = px * px + py * py;
+        if (best_distance < 0 || distance < best_distance)
+        {
+            best_distance = distance;
+            best.index = i;
+            best.station = a.station + t * (b.station - a.station);
+            // left of the direction of travel is positive
+            double cross = dx * (y - a.y) - dy * (x - a.x);
+            best.lateral = (cross >= 0 ? 1 : -1) * sqrt(distance);
+        }
+    }
+    return best;
+}
+
+
+double Track::get_length(void) const
+{
+    return points.empty() ? 0 : points.back().station;
+}
+
+
+double Track::get_width(void) const
+{
+    return width;
+}
+
+
+bool Track::is_closed(void) const
+{
+    return closed;
+}
+
+
+void Track::get_start(double* x, double* y, double* heading) const
+{
+    *x = start_x;
+    *y = start_y;
+    *heading = start_heading;
+}
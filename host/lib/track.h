@@ -0,0 +1,88 @@
+/**
+ * @file track.h
+ * @brief Line following track made of straights and arcs (host side)
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+
+/**
+ * @brief Position of a point relative to the track centre line.
+ */
+struct Track_position
+{
+    double station;             ///< distance along the centre line from the start (m)
+    double lateral;             ///< signed distance to the centre line, positive to the left (m)
+    int index;                  ///< nearest centre line point, hint for the next locate()
+};
+
+
+/**
+ * @brief Track centre line, sampled every few millimetres.
+ *
+ * A track file has one element per line, the centre line starts at the start pose and each
+ * element continues from the end of the previous one:
+ *
+ *     # comment
+ *     width 0.019                 line width (m)
+ *     start 0 0 90                start x, y (m) and heading (degrees, counterclockwise from x)
+ *     line 1.5                    straight (m)
+ *     arc 0.4 90                  arc of radius (m) and angle (degrees, positive to the left)
+ *     to 2.0 1.0                  straight to a point (polyline)
+ *
+ * The track is a closed loop when it ends within a centimetre of the start.
+ */
+class Track
+{
+private:
+
+    struct Point
+    {
+        double x;
+        double y;
+        double station;
+    };
+
+    std::vector<Point> points;
+    double width;
+    double start_x;
+    double start_y;
+    double start_heading;       // rad
+    bool closed;
+
+    void add_point(double x, double y);
+    bool parse(const char* text, std::string* error);
+
+public:
+
+    Track(void);
+
+    /**
+     * @brief Loads a track file.
+     *
+     * @param error set to the reason (with the line number) if it fails
+     * @return false if the file cannot be read or has an invalid line
+     */
+    bool load(const char* path, std::string* error);
+
+    /**
+     * @brief Builds the track from the text of a track file.
+     */
+    bool load_text(const char* text, std::string* error);
+
+    /**
+     * @brief Finds the nearest centre line point.
+     *
+     * @param hint index returned by the previous call for a nearby point, -1 to search everything
+     */
+    Track_position locate(double x, double y, int hint) const;
+
+    double get_length(void) const;
+    double get_width(void) const;
+    bool is_closed(void) const;
+    void get_start(double* x, double* y, double* heading) const;      ///< heading in rad
+};
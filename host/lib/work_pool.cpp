@@ -0,0 +1,140 @@
+#include "work_pool.h"
+
+
+WorkPool::WorkPool(int thread_count)
+{
+    if (thread_count <= 0)
+    {
+        thread_count = (int) std::thread::hardware_concurrency();
+        thread_count = (thread_count > 0) ? thread_count : 1;
+    }
+    queued = 0;
+    pending = 0;
+    stopping = false;
+    next_queue = 0;
+    steals = 0;
+    for (int i = 0; i < thread_count; i++)
+    {
+        queues.emplace_back(new Queue);
+    }
+    for (int i = 0; i < thread_count; i++)
+    {
+        threads.emplace_back(&WorkPool::worker, this, i);
+    }
+}
+
+
+WorkPool::~WorkPool(void)
+{
+    wait();
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+
+void WorkPool::submit(Job job)
+{
+    int index;
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        index = next_queue;
+        next_queue = (next_queue + 1) % (int) queues.size();
+        pending++;
+    }
+    {
+        std::lock_guard<std::mutex> guard(queues[index]->lock);
+        queues[index]->jobs.push_back(std::move(job));
+    }
+    // counted once it is in a queue, so a worker woken for it always finds a job
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        queued++;
+    }
+    work_ready.notify_one();
+}
+
+
+void WorkPool::wait(void)
+{
+    std::unique_lock<std::mutex> guard(state_lock);
+    all_done.wait(guard, [this]() { return pending == 0; });
+}
+
+
+int WorkPool::get_thread_count(void) const
+{
+    return (int) threads.size();
+}
+
+
+uint64_t WorkPool::get_steals(void) const
+{
+    return steals;
+}
+
+
+bool WorkPool::take(int worker, Job* job)
+{
+    // newest job of its own queue first, then the oldest job of the next non empty queue
+    int count = (int) queues.size();
+    for (int i = 0; i < count; i++)
+    {
+        Queue& queue = *queues[(worker + i) % count];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.jobs.empty())
+        {
+            continue;
+        }
+        if (i == 0)
+        {
+            *job = std::move(queue.jobs.back());
+            queue.jobs.pop_back();
+        }
+        else
+        {
+            *job = std::move(queue.jobs.front());
+            queue.jobs.pop_front();
+            steals++;
+        }
+        return true;
+    }
+    return false;
+}
+
+
+void WorkPool::worker(int index)
+{
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> guard(state_lock);
+            work_ready.wait(guard, [this]() { return queued > 0 || stopping; });
+            if (queued == 0)
+            {
+                return;
+            }
+            queued--;
+        }
+
+        // the claimed job is in one of the queues, another worker may have taken this one's
+        Job job;
+        while (!take(index, &job))
+        {
+            std::this_thread::yield();
+        }
+        job();
+
+        std::lock_guard<std::mutex> guard(state_lock);
+        if (--pending == 0)
+        {
+            all_done.notify_all();
+        }
+    }
+}
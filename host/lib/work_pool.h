@@ -0,0 +1,81 @@
+/**
+ * @file work_pool.h
+ * @brief Thread pool with a job queue per worker and work stealing (host side)
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+
+/**
+ * @brief Runs jobs on a fixed set of worker threads.
+ *
+ * Each worker has its own queue: submit() deals the jobs round robin, a worker takes the newest
+ * job of its queue and, when it is empty, steals the oldest job of another one. Jobs of uneven
+ * length (a simulated lap that leaves the track ends early) keep every worker busy until the
+ * last ones.
+ */
+class WorkPool
+{
+public:
+
+    typedef std::function<void()> Job;
+
+private:
+
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<Job> jobs;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::mutex state_lock;
+    std::condition_variable work_ready;
+    std::condition_variable all_done;
+    int queued;                         // jobs in the queues not claimed by a worker
+    int pending;                        // jobs submitted and not finished
+    bool stopping;
+    int next_queue;
+    std::atomic<uint64_t> steals;
+
+    bool take(int worker, Job* job);
+    void worker(int index);
+
+public:
+
+    /**
+     * @param thread_count workers, 0 for one per CPU core
+     */
+    WorkPool(int thread_count);
+
+    /**
+     * @brief Finishes the submitted jobs and stops the workers.
+     */
+    ~WorkPool(void);
+
+    /**
+     * @brief Queues a job, the jobs may run in any order.
+     */
+    void submit(Job job);
+
+    /**
+     * @brief Waits until every submitted job has run.
+     */
+    void wait(void);
+
+    int get_thread_count(void) const;
+
+    uint64_t get_steals(void) const;    ///< jobs run by another worker than the one they were dealt to
+};
@@ -0,0 +1,66 @@
+#!/bin/sh
+# Runs a ground_station script against firmware_standin on a pseudo-terminal and checks the
+# replies (:expect), the round trip times (:latency) and the telemetry CSV.
+#
+# Usage: ground_station_session.sh firmware_standin ground_station script work_dir
+
+standin=$1
+station=$2
+script=$3
+work=$4
+mkdir -p "$work"
+rm -f "$work/standin.txt" "$work/replies.txt" "$work/station.txt" "$work/telemetry.csv"
+
+"$standin" > "$work/standin.txt" &
+standin_pid=$!
+trap 'kill $standin_pid 2>/dev/null' EXIT
+
+# the stand-in prints the path of its pseudo-terminal first
+tries=0
+while [ ! -s "$work/standin.txt" ] && [ $tries -lt 50 ]
+do
+    sleep 0.1
+    tries=$((tries + 1))
+done
+device=$(head -n 1 "$work/standin.txt")
+if [ -z "$device" ]
+then
+    echo "firmware_standin did not start"
+    exit 1
+fi
+
+failed=0
+if ! "$station" -q -s "$script" -o "$work/telemetry.csv" "$device" > "$work/replies.txt" 2> "$work/station.txt"
+then
+    echo "ground_station script failed"
+    failed=1
+fi
+
+# every :latency line got all its replies
+latency_lines=$(grep -c '^latency ' "$work/station.txt")
+if [ "$latency_lines" -ne "$(grep -c '^:latency ' "$script")" ] || grep '^latency ' "$work/station.txt" | grep -qv 'timeouts=0$'
+then
+    echo "latency replies missing"
+    failed=1
+fi
+
+# wheel frames at the set speed while running, and speed bursts
+if ! awk -F, '
+    $1 == "wheel" { wheel++; if ($6 == "1.500" && $4 > 1.4 && $4 < 1.6) running++ }
+    $1 == "speed_burst" { burst++ }
+    /^type,seq,sample,speed_l,speed_r,set_speed_l/ { header++ }
+    END {
+        printf "csv: %d wheel frames (%d at the set speed), %d speed burst samples\n", wheel, running, burst
+        exit !(header == 1 && running >= 10 && burst >= 30)
+    }' "$work/telemetry.csv"
+then
+    echo "telemetry CSV does not match the session"
+    failed=1
+fi
+
+cat "$work/station.txt"
+if [ $failed -ne 0 ]
+then
+    cat "$work/replies.txt"
+fi
+exit $failed
@@ -0,0 +1,270 @@
+/**
+ * @file blackbox_timing.cpp
+ * @brief Simulates the black box flash writes against the scheduler tick timing
+ *
+ * Usage: blackbox_timing [-t seconds] [-r rate] [-i isr_us] [-l loop_us] [-p program_max_us] [-w] [-s seed]
+ *
+ * Runs the firmware BlackBox class on a simulated CPU in virtual time: the scheduler tick (sensor
+ * update, plus the control update on every other tick) interrupts the main loop, while a flash
+ * byte is programmed the CPU stalls and the tick waits. Each write policy is run on the same load
+ * and reports how late the ticks started and whether all the records reached the flash (checked
+ * by recovering them).
+ *
+ *   -t  simulated time (default 60 s)
+ *   -r  samples recorded per second (default BLACKBOX_RATE)
+ *   -i  max control update duration, the min is 60% of it (default 90 us)
+ *   -l  max main loop iteration time without the writes (default 200 us)
+ *   -p  max byte program time, 16 us typical (default BLACKBOX_PROGRAM_MAX_US)
+ *   -w  worst case: every byte takes the max program time
+ *
+ */
+
+#include <algorithm>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "black_box.h"
+#include "constants.h"
+
+
+#define SENSOR_TASK_US      70          // sensor update duration (SENS_SAMPLE_COUNT 1)
+#define PROGRAM_TYP_US      16          // typical byte program time
+
+
+/* WRITE POLICIES */
+enum Policies
+{
+    before_tick,            ///< firmware: BLACKBOX_WRITE_SIZE bytes if they are programmed before the next tick
+    immediate,              ///< BLACKBOX_WRITE_SIZE bytes whenever something is waiting
+    whole_record,           ///< a whole record whenever one is waiting
+};
+
+static const char* policy_names[] = {"before tick", "immediate", "whole record"};
+
+
+struct Options
+{
+    double duration_s;
+    double rate;
+    double isr_max_us;
+    double loop_max_us;
+    double program_max_us;
+    bool worst;
+    unsigned seed;
+};
+
+
+/**
+ * @brief The simulated CPU running the main loop, the scheduler tick and the black box.
+ */
+class Simulation
+{
+private:
+
+    const Options& options;
+    Policies policy;
+    std::mt19937 random;
+    std::vector<uint8_t> flash;
+    BlackBox black_box;
+
+    double now;                     // us
+    double next_tick;               // ideal time of the next tick
+    long ticks;
+    std::vector<double> latencies;  // tick start delays
+    double decimation_count;
+    int mode;
+
+    double uniform(double min, double max)
+    {
+        return std::uniform_real_distribution<double>(min, max)(random);
+    }
+
+    void control_update(void)
+    {
+        // same work as black_box_update(): a mode transition every 5 s, samples at the recording rate
+        uint32_t now_ms = (uint32_t) (now / 1000);
+        int new_mode = (int) (now / 5e6) % 2;
+        if (new_mode != mode)
+        {
+            black_box.add_mode(now_ms, new_mode, mode);
+            mode = new_mode;
+        }
+        decimation_count += options.rate / CONTROL_UPDATE_RATE;
+        if (decimation_count >= 1)
+        {
+            decimation_count -= 1;
+            float t = (float) (now / 1e6);
+            black_box.add_sample(now_ms, t, 1, 1, 0.5f, 0.5f, 11.1f);
+        }
+        now += uniform(options.isr_max_us * 0.6, options.isr_max_us);
+    }
+
+    void tick(void)
+    {
+        latencies.push_back(now - next_tick);
+        now += SENSOR_TASK_US;
+        if (ticks % SCHED_CONTROL_DIVIDER == 0)
+        {
+            control_update();
+        }
+        ticks++;
+        next_tick += SCHED_BASE_PERIOD_US;
+    }
+
+    /* Main loop work, interrupted by the ticks */
+    void work(double duration)
+    {
+        double end = now + duration;
+        while (next_tick < end)
+        {
+            now = std::max(now, next_tick);
+            double before = now;
+            tick();
+            end += now - before;
+        }
+        now = end;
+    }
+
+    /* Flash programming, nothing runs until it is over */
+    void program(uint32_t address, const uint8_t* data, int size)
+    {
+        for (int i = 0; i < size; i++)
+        {
+            double u = uniform(0, 1);
+            now += options.worst ? options.program_max_us
+                                 : PROGRAM_TYP_US + (options.program_max_us - PROGRAM_TYP_US) * u * u * u * u;
+            flash[address + i] &= data[i];
+        }
+        while (next_tick <= now)
+        {
+            tick();
+        }
+    }
+
+    void write_black_box(void)
+    {
+        uint32_t address;
+        const uint8_t* data;
+        if (policy == before_tick && next_tick - now < BLACKBOX_WRITE_SIZE * BLACKBOX_PROGRAM_MAX_US)
+        {
+            return;
+        }
+        int chunks = (policy == whole_record) ? BLACKBOX_RECORD_SIZE / BLACKBOX_WRITE_SIZE : 1;
+        for (int i = 0; i < chunks && black_box.next_chunk(&address, &data); i++)
+        {
+            program(address, data, BLACKBOX_WRITE_SIZE);
+            black_box.chunk_written(true);
+        }
+    }
+
+public:
+
+    int max_pending;
+
+    Simulation(const Options& options_, Policies policy_):
+        options(options_),
+        policy(policy_),
+        random(options_.seed),
+        flash(BLACKBOX_FLASH_SIZE, 0xFF),
+        black_box(0, BLACKBOX_FLASH_SIZE, BLACKBOX_WRITE_SIZE)
+    {
+        now = 0;
+        next_tick = SCHED_BASE_PERIOD_US;
+        ticks = 0;
+        decimation_count = 0;
+        mode = 0;
+        max_pending = 0;
+        black_box.recover(flash.data(), 0);
+    }
+
+    void run(void)
+    {
+        while (now < options.duration_s * 1e6)
+        {
+            work(uniform(10, options.loop_max_us));
+            write_black_box();
+            max_pending = std::max(max_pending, black_box.get_pending());
+        }
+        // let the queue drain
+        for (int i = 0; i < 100000 && black_box.get_pending() > 0; i++)
+        {
+            work(uniform(10, options.loop_max_us));
+            write_black_box();
+        }
+    }
+
+    void report(void)
+    {
+        BlackBox recovered(0, BLACKBOX_FLASH_SIZE, BLACKBOX_WRITE_SIZE);
+        int records = recovered.recover(flash.data(), 0);
+        std::sort(latencies.begin(), latencies.end());
+        int late = (int) (latencies.end() - std::upper_bound(latencies.begin(), latencies.end(), 10.0));
+
+        printf("%-13s %9.1f %9.1f %9d %9d %8d %8d %8d\n", policy_names[policy],
+               latencies[latencies.size() * 99 / 100], latencies.back(), late,
+               black_box.get_records(), records, black_box.get_dropped(), max_pending);
+    }
+};
+
+
+int main(int argc, char** argv)
+{
+    Options options = {60, BLACKBOX_RATE, 90, 200, BLACKBOX_PROGRAM_MAX_US, false, 1};
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool has_value = (i + 1 < argc);
+        if (strcmp(argv[i], "-t") == 0 && has_value)
+        {
+            options.duration_s = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-r") == 0 && has_value)
+        {
+            options.rate = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-i") == 0 && has_value)
+        {
+            options.isr_max_us = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-l") == 0 && has_value)
+        {
+            options.loop_max_us = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-p") == 0 && has_value)
+        {
+            options.program_max_us = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-s") == 0 && has_value)
+        {
+            options.seed = (unsigned) atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-w") == 0)
+        {
+            options.worst = true;
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-t seconds] [-r rate] [-i isr_us] [-l loop_us] [-p program_max_us] [-w] [-s seed]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    printf("%.0f s, %.0f records/s, %d us ticks (sensor %d us, control <= %.0f us), byte program %s%.0f us\n\n",
+           options.duration_s, options.rate, SCHED_BASE_PERIOD_US, SENSOR_TASK_US, options.isr_max_us,
+           options.worst ? "" : "<= ", options.program_max_us);
+    printf("%-13s %9s %9s %9s %9s %8s %8s %8s\n", "policy", "p99 (us)", "max (us)", ">10 us",
+           "written", "read", "dropped", "queue");
+    printf("%-13s %9s %9s %9s\n", "", "tick", "tick", "ticks");
+
+    for (int policy = before_tick; policy <= whole_record; policy++)
+    {
+        Simulation simulation(options, (Policies) policy);
+        simulation.run();
+        simulation.report();
+    }
+    return 0;
+}
@@ -0,0 +1,561 @@
+/**
+ * @file control_bench.cpp
+ * @brief Microbenchmarks of the control hot path on the host
+ *
+ * Usage: control_bench [-n iterations] [-r repeats] [-i trace.csv] [-o results.json] [-c baseline.json] [-x percent]
+ *
+ * Times SensorArray::update(), PID::update() and Motor::update() on their own objects, configured
+ * like the firmware globals, then update_buggy_status() and control_update_ISR() of the firmware
+ * itself once it has been line following the oval for a second and a half (BuggySim). The firmware
+ * functions are called inside a critical section so no host event runs between them. The command
+ * parser is timed over a set of commands, against the sscanf call of the parser it replaced.
+ *
+ * The inputs of each call are prepared beforehand and fed through the host HAL (sensor levels,
+ * encoder counts): from a replay trace of track_sim (-i), or drawn from distributions close to line
+ * following (line position N(0, 8 mm) with 5% of the frames anywhere within 6 cm, sensor PID
+ * measurement N(0, 1.5), wheel speeds 0.5 to 2.5 m/s). The same loop runs with only the feeding
+ * and its time and instructions are subtracted, the best of the repeats is kept.
+ *
+ * Reports ns/op and instructions/op (user space instructions from the perf counters, null when the
+ * kernel does not allow them). The ns/op of the host HAL calls say nothing of the target, the EB
+ * command times the same functions on the buggy with the DWT cycle counter.
+ *
+ *   -n  calls per benchmark and repeat (default 100000)
+ *   -r  repeats (default 5)
+ *   -o  writes the results as JSON, one benchmark per line (the layout of the EB command)
+ *   -c  compares with previous results: instructions/op when both have them, ns/op otherwise, the
+ *       exit code is 1 if a benchmark is slower by more than the threshold
+ *   -x  regression threshold in percent (default 10)
+ *
+ */
+
+#include <chrono>
+#include <linux/perf_event.h>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+#include "PID.h"
+#include "buggy_sim.h"
+#include "command_dispatcher.h"
+#include "constants.h"
+#include "control_replay.h"
+#include "host_hal.h"
+#include "motor.h"
+#include "pin_assignments.h"
+#include "sensor_array.h"
+#include "track.h"
+
+
+#define WARM_UP_TIME        1.7         // s of firmware time before the firmware benchmarks
+#define START_TIME          0.2         // s, line following started
+#define PHYSICS_STEP        0.0001      // s
+#define LINE_SIGMA          0.008       // m, line position around the array centre
+#define LINE_OUTLIERS       0.05        // part of the frames with the line anywhere within LINE_OUTLIER_RANGE
+#define LINE_OUTLIER_RANGE  0.06        // m
+#define SPOT_SIGMA          0.006       // m, sensor response across the line
+#define SENSOR_PITCH        0.016       // m
+#define MAX_BENCHES         8
+
+int firmware_main(void);
+void update_buggy_status(void);
+void control_update_ISR(float dt);
+
+extern CommandDispatcher bt_dispatcher;
+
+static const PinName sensor_pins[6] = {SENSOR0_IN_PIN, SENSOR1_IN_PIN, SENSOR2_IN_PIN,
+                                       SENSOR3_IN_PIN, SENSOR4_IN_PIN, SENSOR5_IN_PIN};
+
+static const char* const warm_up_track = "width 0.019\nline 2.0\narc 0.75 180\nline 2.0\narc 0.75 180\n";
+
+// commands of a tuning session, parsed in turn
+static const char* const command_lines[] = {"SPS 0.3 0 0.08", "SV 20 2.1", "GV 20", "GSB", "SU 3 50", "SNA 0.15 90 0.4",
+                                            "ST 0.001", "EF", "SDL 0.5", "ES"};
+static const int command_count = sizeof(command_lines) / sizeof(command_lines[0]);
+
+
+/**
+ * @brief Inputs of the calls, index i of each vector for call i.
+ */
+struct Bench_inputs
+{
+    std::vector<float> adc[6];              ///< sensor levels (0..1)
+    std::vector<float> measurement;         ///< sensor PID measurement
+    std::vector<int> encoder_step[2];       ///< left, right encoder counts since the previous control update
+};
+
+
+struct Bench_result
+{
+    std::string name;
+    double ns_per_op;
+    double instructions_per_op;             ///< negative if not counted
+};
+
+
+/**
+ * @brief Counts the user space instructions of this thread with the perf counters.
+ */
+class InstructionCounter
+{
+private:
+
+    int fd;
+
+public:
+
+    InstructionCounter(void)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    ~InstructionCounter(void)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+
+    bool available(void)
+    {
+        return fd >= 0;
+    }
+
+    void start(void)
+    {
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    uint64_t stop(void)
+    {
+        uint64_t count = 0;
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &count, sizeof(count)) != sizeof(count))
+            {
+                count = 0;
+            }
+        }
+        return count;
+    }
+};
+
+
+static InstructionCounter counter;
+
+
+/**
+ * @brief Times n calls, feed(i) then call(i), against the feeding alone, best of the repeats.
+ */
+template <typename Feed, typename Call>
+Bench_result measure(const char* name, int n, int repeats, Feed feed, Call call)
+{
+    double best_s[2] = {0, 0};
+    uint64_t best_instructions[2] = {0, 0};
+    for (int run = 0; run < repeats; run++)
+    {
+        // 0: feeding and call, 1: feeding only
+        for (int loop = 0; loop < 2; loop++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            counter.start();
+            for (int i = 0; i < n; i++)
+            {
+                feed(i);
+                if (loop == 0)
+                {
+                    call(i);
+                }
+            }
+            uint64_t instructions = counter.stop();
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (run == 0 || elapsed < best_s[loop])
+            {
+                best_s[loop] = elapsed;
+            }
+            if (run == 0 || instructions < best_instructions[loop])
+            {
+                best_instructions[loop] = instructions;
+            }
+        }
+    }
+
+    Bench_result result;
+    result.name = name;
+    result.ns_per_op = fmax(best_s[0] - best_s[1], 0) / n * 1e9;
+    result.instructions_per_op = -1;
+    if (counter.available())
+    {
+        result.instructions_per_op = ((double) best_instructions[0] - (double) best_instructions[1]) / n;
+    }
+    return result;
+}
+
+
+static void synthetic_inputs(int n, Bench_inputs* inputs)
+{
+    std::mt19937 engine(1);
+    std::normal_distribution<double> normal(0, 1);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    const Sensor_params sensors = default_sensor_params();
+    double counts_per_m = 4 * PULSE_PER_REV / (2 * M_PI * WHEEL_RADIUS);
+    double wheel_counts[2] = {0, 0};
+
+    for (int i = 0; i < n; i++)
+    {
+        double line = (uniform(engine) < LINE_OUTLIERS) ? (2 * uniform(engine) - 1) * LINE_OUTLIER_RANGE
+                                                        : normal(engine) * LINE_SIGMA;
+        for (int s = 0; s < 6; s++)
+        {
+            double distance = line - (2.5 - s) * SENSOR_PITCH;
+            double level = sensors.dark + (sensors.bright - sensors.dark) * exp(-distance * distance /
+                           (2 * SPOT_SIGMA * SPOT_SIGMA)) + sensors.noise * normal(engine);
+            inputs->adc[s].push_back((float) fmin(fmax(level, 0), 1));
+        }
+        inputs->measurement.push_back((float) (1.5 * normal(engine)));
+        for (int w = 0; w < 2; w++)
+        {
+            double speed = 0.5 + 2 * uniform(engine);
+            double previous = floor(wheel_counts[w]);
+            wheel_counts[w] += speed * counts_per_m * CONTROL_UPDATE_PERIOD;
+            inputs->encoder_step[w].push_back((int) (floor(wheel_counts[w]) - previous));
+        }
+    }
+}
+
+
+static void trace_inputs(int n, const ReplayTrace& trace, Bench_inputs* inputs)
+{
+    std::vector<const Replay_frame*> control_frames;
+    for (const Replay_frame& frame : trace.frames)
+    {
+        if (frame.in.control)
+        {
+            control_frames.push_back(&frame);
+        }
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        const Replay_frame& frame = trace.frames[i % trace.frames.size()];
+        for (int s = 0; s < 6; s++)
+        {
+            inputs->adc[s].push_back(frame.in.adc[s]);
+        }
+        // the sensor array output if recorded, its set point is 0 while line following
+        inputs->measurement.push_back(trace.recorded[0] ? frame.out.value[0] : 0);
+        for (int w = 0; w < 2; w++)
+        {
+            int step = 0;
+            size_t c = i % control_frames.size();
+            if (c > 0)
+            {
+                step = control_frames[c]->in.encoder[w] - control_frames[c - 1]->in.encoder[w];
+            }
+            inputs->encoder_step[w].push_back(step);
+        }
+    }
+}
+
+
+static void write_json(FILE* out, const char* inputs, int n, const Bench_result* results, int count)
+{
+    fprintf(out, "{\"bench\": \"control\", \"target\": \"host\", \"iterations\": %d, \"inputs\": \"%s\", \"results\": [\n",
+            n, inputs);
+    for (int i = 0; i < count; i++)
+    {
+        fprintf(out, "  {\"name\": \"%s\", \"ns_per_op\": %.1f, ", results[i].name.c_str(), results[i].ns_per_op);
+        if (results[i].instructions_per_op >= 0)
+        {
+            fprintf(out, "\"instructions_per_op\": %.1f}", results[i].instructions_per_op);
+        }
+        else
+        {
+            fprintf(out, "\"instructions_per_op\": null}");
+        }
+        fprintf(out, "%s\n", (i + 1 < count) ? "," : "");
+    }
+    fprintf(out, "]}\n");
+}
+
+
+/**
+ * @brief Reads the results of a previous run (or of the EB command), one benchmark per line.
+ *
+ * @return false if the file cannot be read
+ */
+static bool read_json(const char* path, std::vector<Bench_result>* results)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return false;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        const char* name = strstr(line, "\"name\": \"");
+        const char* ns = strstr(line, "\"ns_per_op\": ");
+        if (name == NULL || ns == NULL)
+        {
+            continue;
+        }
+        name += strlen("\"name\": \"");
+        Bench_result result;
+        result.name = std::string(name, strcspn(name, "\""));
+        result.ns_per_op = strtod(ns + strlen("\"ns_per_op\": "), NULL);
+        result.instructions_per_op = -1;
+        const char* instructions = strstr(line, "\"instructions_per_op\": ");
+        if (instructions != NULL && strncmp(instructions + strlen("\"instructions_per_op\": "), "null", 4) != 0)
+        {
+            result.instructions_per_op = strtod(instructions + strlen("\"instructions_per_op\": "), NULL);
+        }
+        results->push_back(result);
+    }
+    fclose(file);
+    return true;
+}
+
+
+/**
+ * @brief Prints the change of each benchmark against the baseline.
+ *
+ * @return false if one is slower by more than threshold percent
+ */
+static bool compare(const std::vector<Bench_result>& baseline, const Bench_result* results, int count,
+                    double threshold)
+{
+    bool passed = true;
+    printf("\n%-22s %12s %12s %8s\n", "compared with baseline", "before", "after", "change");
+    for (int i = 0; i < count; i++)
+    {
+        const Bench_result* before = NULL;
+        for (const Bench_result& result : baseline)
+        {
+            if (result.name == results[i].name)
+            {
+                before = &result;
+            }
+        }
+        if (before == NULL)
+        {
+            printf("%-22s %12s\n", results[i].name.c_str(), "new");
+            continue;
+        }
+
+        bool by_instructions = before->instructions_per_op >= 0 && results[i].instructions_per_op >= 0;
+        double old_value = by_instructions ? before->instructions_per_op : before->ns_per_op;
+        double new_value = by_instructions ? results[i].instructions_per_op : results[i].ns_per_op;
+        double change = (old_value > 0) ? (new_value - old_value) / old_value * 100 : 0;
+        bool regressed = change > threshold;
+        passed = passed && !regressed;
+        printf("%-22s %12.1f %12.1f %+7.1f%% %s%s\n", results[i].name.c_str(), old_value, new_value, change,
+               by_instructions ? "instr" : "ns", regressed ? "  REGRESSION" : "");
+    }
+    return passed;
+}
+
+
+int main(int argc, char** argv)
+{
+    int n = 100000;
+    int repeats = 5;
+    double threshold = 10;
+    const char* trace_path = NULL;
+    const char* output_path = NULL;
+    const char* baseline_path = NULL;
+    bool valid = true;
+
+    for (int i = 1; i < argc && valid; i++)
+    {
+        bool has_value = (i + 1 < argc);
+        if (strcmp(argv[i], "-n") == 0 && has_value)
+        {
+            n = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-r") == 0 && has_value)
+        {
+            repeats = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-i") == 0 && has_value)
+        {
+            trace_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-o") == 0 && has_value)
+        {
+            output_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-c") == 0 && has_value)
+        {
+            baseline_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-x") == 0 && has_value)
+        {
+            threshold = atof(argv[++i]);
+        }
+        else
+        {
+            valid = false;
+        }
+    }
+    if (!valid || n <= 0 || repeats <= 0)
+    {
+        fprintf(stderr, "usage: %s [-n iterations] [-r repeats] [-i trace.csv] [-o results.json] [-c baseline.json] "
+                        "[-x percent]\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<Bench_result> baseline;
+    if (baseline_path != NULL && !read_json(baseline_path, &baseline))
+    {
+        fprintf(stderr, "cannot open %s\n", baseline_path);
+        return 2;
+    }
+    Bench_inputs inputs;
+    if (trace_path != NULL)
+    {
+        ReplayTrace trace;
+        std::string error;
+        if (!trace.load(trace_path, &error))
+        {
+            fprintf(stderr, "%s: %s\n", trace_path, error.c_str());
+            return 2;
+        }
+        if (trace.frames.size() < 2)
+        {
+            fprintf(stderr, "%s: no frames\n", trace_path);
+            return 2;
+        }
+        trace_inputs(n, trace, &inputs);
+    }
+    else
+    {
+        synthetic_inputs(n, &inputs);
+    }
+
+    Bench_result results[MAX_BENCHES];
+    int count = 0;
+
+    // objects of their own, configured like the firmware globals
+    SensorArray sensor_array(SENSOR0_IN_PIN, SENSOR1_IN_PIN, SENSOR2_IN_PIN, SENSOR3_IN_PIN, SENSOR4_IN_PIN,
+                             SENSOR5_IN_PIN, SENSOR0_OUT_PIN, SENSOR1_OUT_PIN, SENSOR2_OUT_PIN, SENSOR3_OUT_PIN,
+                             SENSOR4_OUT_PIN, SENSOR5_OUT_PIN, SENS_SAMPLE_COUNT, SENS_DETECT_RANGE, SENS_ANGLE_COEFF);
+    sensor_array.set_all_led_on(true);
+    PID pid(PID_S_KP, PID_S_KI, PID_S_KD, PID_S_TAU, PID_S_MIN_OUT, PID_S_MAX_OUT, PID_S_MIN_INT, PID_S_MAX_INT,
+            SENSOR_UPDATE_PERIOD);
+    Motor motor(MOTORL_PWM_PIN, MOTORL_DIRECTION_PIN, MOTORL_BIPOLAR_PIN, MOTORL_CHA_PIN, MOTORL_CHB_PIN,
+                PULSE_PER_REV, MOTOR_PWM_FREQ, CONTROL_UPDATE_RATE, LP_SPEED_A0, LP_SPEED_B0, LP_SPEED_B1,
+                WHEEL_RADIUS);
+    motor.set_traction_control(TRACTION_ACCEL_WINDOW, TRACTION_ACCEL_MARGIN, TRACTION_SLEW_RATE, STALL_DUTY, STALL_TIME,
+                               STALL_DUTY_CAP);
+    motor.set_duty_cycle(0.5);
+
+    results[count++] = measure("sensor_array_update", n, repeats, [&inputs](int i)
+    {
+        for (int s = 0; s < 6; s++)
+        {
+            hal::set_analog(sensor_pins[s], inputs.adc[s][i]);
+        }
+    }, [&sensor_array](int i) { sensor_array.update(); });
+
+    results[count++] = measure("pid_update", n, repeats, [](int i) {}, [&pid, &inputs](int i)
+    {
+        pid.update(0, inputs.measurement[i], SENSOR_UPDATE_PERIOD);
+    });
+
+    int motor_counts = 0;
+    results[count++] = measure("motor_update", n, repeats, [&inputs, &motor_counts](int i)
+    {
+        motor_counts += inputs.encoder_step[0][i];
+        hal::set_encoder(MOTORL_CHA_PIN, motor_counts);
+    }, [&motor](int i) { motor.update(CONTROL_UPDATE_PERIOD); });
+
+    Cmd_args args;
+    results[count++] = measure("command_parse", n, repeats, [](int i) {}, [&args](int i)
+    {
+        bt_dispatcher.parse(command_lines[i % command_count], &args);
+    });
+
+    // the arguments of the bt_parse_rx sscanf call, the command characters were checked one by one after it
+    float values[3];
+    results[count++] = measure("command_sscanf", n, repeats, [](int i) {}, [&values](int i)
+    {
+        sscanf(command_lines[i % command_count], "%*s %f %f %f", &values[0], &values[1], &values[2]);
+    });
+
+    // the firmware line following, then frozen: no host event runs in the critical section
+    Track track;
+    std::string error;
+    track.load_text(warm_up_track, &error);
+    BuggySim sim(track, default_plant_params(), default_sensor_params(), 1);
+    sim.attach(PHYSICS_STEP);
+    hal::at(START_TIME, []() { hal::serial_send(USBTX, "EF\n"); });
+    hal::run(firmware_main, WARM_UP_TIME);
+
+    core_util_critical_section_enter();
+    results[count++] = measure("update_buggy_status", n, repeats, [](int i) {}, [](int i) { update_buggy_status(); });
+
+    int wheel_counts[2] = {hal::get_encoder(MOTORL_CHA_PIN), hal::get_encoder(MOTORR_CHA_PIN)};
+    results[count++] = measure("control_update_isr", n, repeats, [&inputs, &wheel_counts](int i)
+    {
+        wheel_counts[0] += inputs.encoder_step[0][i];
+        wheel_counts[1] += inputs.encoder_step[1][i];
+        hal::set_encoder(MOTORL_CHA_PIN, wheel_counts[0]);
+        hal::set_encoder(MOTORR_CHA_PIN, wheel_counts[1]);
+    }, [](int i) { control_update_ISR(CONTROL_UPDATE_PERIOD); });
+    core_util_critical_section_exit();
+
+    const char* input_name = (trace_path != NULL) ? "trace" : "synthetic";
+    printf("%d calls x %d repeats, %s inputs\n", n, repeats, input_name);
+    printf("%-22s %12s %12s\n", "benchmark", "ns/op", "instr/op");
+    for (int i = 0; i < count; i++)
+    {
+        printf("%-22s %12.1f", results[i].name.c_str(), results[i].ns_per_op);
+        if (results[i].instructions_per_op >= 0)
+        {
+            printf(" %12.1f\n", results[i].instructions_per_op);
+        }
+        else
+        {
+            printf(" %12s\n", "n/a");
+        }
+    }
+
+    if (output_path != NULL)
+    {
+        FILE* out = fopen(output_path, "w");
+        if (out == NULL)
+        {
+            fprintf(stderr, "cannot create %s\n", output_path);
+            return 2;
+        }
+        write_json(out, input_name, n, results, count);
+        fclose(out);
+    }
+    if (baseline_path != NULL && !compare(baseline, results, count, threshold))
+    {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,367 @@
+/**
+ * @file dispatcher_check.cpp
+ * @brief Checks every command of the firmware command table through the dispatcher
+ *
+ * Usage: dispatcher_check [-v]
+ *
+ * The expected commands below are the protocol used by the ground station and the scripts: the
+ * command text, its handler in main.cpp and the handler parameter (mode of the mode commands).
+ * Each one must be in the firmware table (bt_commands, through bt_dispatcher) and every table
+ * entry must be expected.
+ *
+ * The table is then copied with a recording handler and every command is dispatched with each
+ * allowed object (and without one when it is optional) and each allowed number of arguments: the
+ * handler must be the one of its entry and get the object and the argument values. One argument
+ * too many or too few, an object that is not allowed and a missing object must be refused
+ * without calling the handler. The exit code is 1 on the first mismatch of a command.
+ *
+ *   -v  prints every command
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "command_dispatcher.h"
+
+
+extern CommandDispatcher bt_dispatcher;
+
+Cmd_error cmd_toggle_continous(const Cmd_args& args);
+Cmd_error cmd_toggle_binary(const Cmd_args& args);
+Cmd_error cmd_get(const Cmd_args& args);
+Cmd_error cmd_set_duty(const Cmd_args& args);
+Cmd_error cmd_set_speed(const Cmd_args& args);
+Cmd_error cmd_set_gains(const Cmd_args& args);
+Cmd_error cmd_set_tau(const Cmd_args& args);
+Cmd_error cmd_set_deadband(const Cmd_args& args);
+Cmd_error cmd_set_mode(const Cmd_args& args);
+Cmd_error cmd_encoder_test(const Cmd_args& args);
+Cmd_error cmd_motor_pwm_test(const Cmd_args& args);
+Cmd_error cmd_toggle_led(const Cmd_args& args);
+Cmd_error cmd_get_param(const Cmd_args& args);
+Cmd_error cmd_set_param(const Cmd_args& args);
+Cmd_error cmd_save_params(const Cmd_args& args);
+Cmd_error cmd_default_params(const Cmd_args& args);
+Cmd_error cmd_subscribe(const Cmd_args& args);
+Cmd_error cmd_set_budget(const Cmd_args& args);
+Cmd_error cmd_get_streams(const Cmd_args& args);
+Cmd_error cmd_select_log(const Cmd_args& args);
+Cmd_error cmd_set_trigger(const Cmd_args& args);
+Cmd_error cmd_log_trigger(const Cmd_args& args);
+Cmd_error cmd_get_log(const Cmd_args& args);
+Cmd_error cmd_get_black_box(const Cmd_args& args);
+Cmd_error cmd_erase_black_box(const Cmd_args& args);
+Cmd_error cmd_get_profile(const Cmd_args& args);
+Cmd_error cmd_reset_profile(const Cmd_args& args);
+Cmd_error cmd_get_scheduler(const Cmd_args& args);
+Cmd_error cmd_get_mode(const Cmd_args& args);
+Cmd_error cmd_benchmark(const Cmd_args& args);
+Cmd_error cmd_motion_add(const Cmd_args& args);
+Cmd_error cmd_motion_get(const Cmd_args& args);
+Cmd_error cmd_motion_run(const Cmd_args& args);
+Cmd_error cmd_square_test(const Cmd_args& args);
+
+
+/* Buggy_modes of main.cpp, parameter of the cmd_set_mode entries */
+enum Mode_params
+{
+    mode_straight_test = 1,
+    mode_PID_test = 2,
+    mode_line_follow = 4,
+    mode_inactive = 7,
+    mode_active_stop = 8,
+    mode_uturn = 9,
+    mode_static_tracking = 10,
+    mode_line_follow_auto = 11,
+    mode_calibration = 13,
+    mode_duty_calibration = 14,
+};
+
+
+struct Expected_command
+{
+    const char* text;               ///< type and name characters
+    Cmd_handler handler;
+    int param;
+};
+
+
+static const Expected_command expected[] =
+{
+    {"C",   cmd_toggle_continous,   0},
+    {"B",   cmd_toggle_binary,      0},
+
+    {"GD",  cmd_get,                0},
+    {"GE",  cmd_get,                0},
+    {"GS",  cmd_get,                0},
+    {"GP",  cmd_get,                0},
+    {"GC",  cmd_get,                0},
+    {"GR",  cmd_get,                0},
+    {"GX",  cmd_get,                0},
+    {"GW",  cmd_get,                0},
+    {"GK",  cmd_get,                0},
+    {"GB",  cmd_get,                0},
+    {"GV",  cmd_get_param,          0},
+    {"GU",  cmd_get_streams,        0},
+    {"GL",  cmd_get_log,            0},
+    {"GH",  cmd_get_black_box,      0},
+    {"GY",  cmd_get_profile,        0},
+    {"GZ",  cmd_get_scheduler,      0},
+    {"GM",  cmd_get_mode,           0},
+    {"GN",  cmd_motion_get,         0},
+
+    {"SD",  cmd_set_duty,           0},
+    {"SS",  cmd_set_speed,          0},
+    {"SP",  cmd_set_gains,          0},
+    {"ST",  cmd_set_tau,            0},
+    {"SK",  cmd_set_deadband,       0},
+    {"SV",  cmd_set_param,          0},
+    {"SU",  cmd_subscribe,          0},
+    {"SB",  cmd_set_budget,         0},
+    {"SL",  cmd_select_log,         0},
+    {"SG",  cmd_set_trigger,        0},
+    {"SN",  cmd_motion_add,         0},
+
+    {"ES",  cmd_set_mode,           mode_inactive},
+    {"EX",  cmd_set_mode,           mode_active_stop},
+    {"EU",  cmd_set_mode,           mode_uturn},
+    {"EE",  cmd_encoder_test,       0},
+    {"EM",  cmd_motor_pwm_test,     0},
+    {"EZ",  cmd_set_mode,           mode_straight_test},
+    {"EQ",  cmd_square_test,        0},
+    {"EP",  cmd_set_mode,           mode_PID_test},
+    {"EL",  cmd_toggle_led,         0},
+    {"EF",  cmd_set_mode,           mode_line_follow},
+    {"ET",  cmd_set_mode,           mode_static_tracking},
+    {"EA",  cmd_set_mode,           mode_line_follow_auto},
+    {"EC",  cmd_set_mode,           mode_calibration},
+    {"ED",  cmd_set_mode,           mode_duty_calibration},
+    {"EW",  cmd_save_params,        0},
+    {"ER",  cmd_default_params,     0},
+    {"EG",  cmd_log_trigger,        0},
+    {"EH",  cmd_erase_black_box,    0},
+    {"EY",  cmd_reset_profile,      0},
+    {"EB",  cmd_benchmark,          0},
+    {"EN",  cmd_motion_run,         0},
+};
+
+static const int expected_count = sizeof(expected) / sizeof(expected[0]);
+
+// argument values sent, exact in binary so they must come back unchanged
+static const char* const arg_text[CMD_MAX_ARGS] = {"1.5", "-2", "0.25"};
+static const float arg_values[CMD_MAX_ARGS] = {1.5f, -2.0f, 0.25f};
+
+
+// last call of the recording handler
+static std::vector<Command> recording_table;
+static int calls;
+static Cmd_args recorded;
+
+
+static Cmd_error record(const Cmd_args& args)
+{
+    calls++;
+    recorded = args;
+    return cmd_ok;
+}
+
+
+static void command_text(const Command& command, char* text)
+{
+    text[0] = command.type;
+    text[1] = command.name;
+    text[2] = '\0';
+}
+
+
+/**
+ * @brief Builds "<command><object> <args>..." with count arguments.
+ */
+static void build_line(const Command& command, char object, int count, char* line, size_t size)
+{
+    char text[3];
+    command_text(command, text);
+    int length = snprintf(line, size, "%s", text);
+    if (object != '\0')
+    {
+        length += snprintf(line + length, size - length, "%c", object);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        length += snprintf(line + length, size - length, " %s", arg_text[i % CMD_MAX_ARGS]);
+    }
+}
+
+
+/**
+ * @brief Dispatches a line expected to reach the handler of entry index.
+ *
+ * @return false on a mismatch
+ */
+static bool check_accepted(CommandDispatcher& dispatcher, int index, char object, int count)
+{
+    char line[64];
+    build_line(recording_table[index], object, count, line, sizeof(line));
+    calls = 0;
+    Cmd_error error = dispatcher.dispatch(line);
+    bool passed = (error == cmd_ok && calls == 1 && recorded.command == &recording_table[index] &&
+                   recorded.object == object && recorded.count == count);
+    for (int i = 0; passed && i < count; i++)
+    {
+        passed = (recorded.values[i] == arg_values[i]);
+    }
+    if (!passed)
+    {
+        printf("\"%s\": %s, handler called %d times, expected the handler of its entry with %d arguments\n", line,
+               CommandDispatcher::error_string(error), calls, count);
+    }
+    return passed;
+}
+
+
+/**
+ * @brief Dispatches a line expected to be refused with the error.
+ *
+ * @return false on a mismatch
+ */
+static bool check_refused(CommandDispatcher& dispatcher, int index, char object, int count, Cmd_error expected_error)
+{
+    char line[64];
+    build_line(recording_table[index], object, count, line, sizeof(line));
+    calls = 0;
+    Cmd_error error = dispatcher.dispatch(line);
+    if (error != expected_error || calls != 0)
+    {
+        printf("\"%s\": %s, handler called %d times, expected %s\n", line, CommandDispatcher::error_string(error), calls,
+               CommandDispatcher::error_string(expected_error));
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * @brief Checks one entry with every object and argument count, and the refused variants.
+ *
+ * @return number of lines dispatched, negative on a mismatch
+ */
+static int check_entry(CommandDispatcher& dispatcher, int index)
+{
+    const Command& command = recording_table[index];
+    std::vector<char> objects;
+    if (command.objects == NULL || command.object_optional)
+    {
+        objects.push_back('\0');
+    }
+    for (const char* p = command.objects; p != NULL && *p != '\0'; p++)
+    {
+        objects.push_back(*p);
+    }
+
+    int lines = 0;
+    bool passed = true;
+    for (char object : objects)
+    {
+        for (int count = command.min_args; count <= command.max_args; count++, lines++)
+        {
+            passed = passed && check_accepted(dispatcher, index, object, count);
+        }
+        if (command.min_args > 0)
+        {
+            passed = passed && check_refused(dispatcher, index, object, command.min_args - 1, cmd_err_arg_count);
+            lines++;
+        }
+        passed = passed && check_refused(dispatcher, index, object, command.max_args + 1, cmd_err_arg_count);
+        lines++;
+    }
+    if (command.objects != NULL)
+    {
+        char other = 'A';
+        while (strchr(command.objects, other) != NULL)
+        {
+            other++;
+        }
+        passed = passed && check_refused(dispatcher, index, other, command.min_args, cmd_err_unknown_object);
+        lines++;
+        if (!command.object_optional)
+        {
+            passed = passed && check_refused(dispatcher, index, '\0', command.min_args, cmd_err_unknown_object);
+            lines++;
+        }
+    }
+    return passed ? lines : -1;
+}
+
+
+int main(int argc, char** argv)
+{
+    bool verbose = (argc > 1 && strcmp(argv[1], "-v") == 0);
+    int failures = 0;
+    int size = bt_dispatcher.get_size();
+
+    // every expected command in the firmware table, with its handler and parameter
+    for (const Expected_command& command : expected)
+    {
+        const Command* entry = bt_dispatcher.find(command.text[0], command.text[1]);
+        if (entry == NULL || entry->handler != command.handler || entry->param != command.param)
+        {
+            printf("%-4s %s\n", command.text, (entry == NULL) ? "missing from the table" : "wrong handler or parameter");
+            failures++;
+        }
+    }
+
+    // and nothing else (a duplicate is never reached)
+    for (int i = 0; i < size; i++)
+    {
+        const Command* entry = bt_dispatcher.get_command(i);
+        char text[3];
+        command_text(*entry, text);
+        if (bt_dispatcher.find(entry->type, entry->name) != entry)
+        {
+            printf("%-4s duplicate entry %d\n", text, i);
+            failures++;
+        }
+        bool found = false;
+        for (const Expected_command& command : expected)
+        {
+            found = found || strcmp(command.text, text) == 0;
+        }
+        if (!found)
+        {
+            printf("%-4s not expected, add it to dispatcher_check\n", text);
+            failures++;
+        }
+    }
+
+    // every command dispatched to a recording copy of the table
+    for (int i = 0; i < size; i++)
+    {
+        recording_table.push_back(*bt_dispatcher.get_command(i));
+        recording_table.back().handler = record;
+    }
+    CommandDispatcher dispatcher(recording_table.data(), size);
+    int lines = 0;
+    for (int i = 0; i < size; i++)
+    {
+        int checked = check_entry(dispatcher, i);
+        char text[3];
+        command_text(recording_table[i], text);
+        if (checked < 0)
+        {
+            printf("%-4s FAILED\n", text);
+            failures++;
+            continue;
+        }
+        lines += checked;
+        if (verbose)
+        {
+            printf("%-4s objects %-5s args %d-%d, %d lines\n", text, recording_table[i].objects ?
+                   recording_table[i].objects : "-", recording_table[i].min_args, recording_table[i].max_args, checked);
+        }
+    }
+
+    printf("%d commands (%d expected), %d lines dispatched, %d failures\n", size, expected_count, lines, failures);
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,298 @@
+/**
+ * @file firmware_host.cpp
+ * @brief Runs the firmware on the host HAL in virtual time, driven by a script
+ *
+ * Usage: firmware_host [-t seconds] [-s script] [-f flash_image] [-q]
+ *
+ * Prints what the firmware sends on the bluetooth and USB serial ports, with the virtual time,
+ * then a summary (virtual and real time, interrupts, motor outputs). A script line is a time in
+ * seconds followed by an action:
+ *
+ *   0.5  bt EF                      sends a command on bluetooth (the newline is added)
+ *   0.5  pc GY                      sends a command on the USB serial port
+ *   1.0  sensors 0 0 .8 .8 0 0      line sensor levels (0..1), in SensorArray order
+ *   1.0  analog PB_2 0.4            any analog input
+ *   1.0  input PB_4 0               digital input level
+ *   1.0  speed L 1200               encoder pulse rate of a wheel (L or R, pulses/s) until changed
+ *   2.0  print PB_6                 prints the state of a pin
+ *
+ * Blank lines and lines starting with # are ignored.
+ *
+ *   -t  virtual time to run (default 5 s)
+ *   -f  flash image file, the parameters and the black box persist between runs
+ *   -q  do not print the USB serial output
+ *
+ */
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "host_hal.h"
+#include "pin_assignments.h"
+
+
+#define ENCODER_STEP_S      0.0005      // encoder count update period of the speed action
+
+int firmware_main(void);
+
+
+static const PinName sensor_pins[6] = {SENSOR0_IN_PIN, SENSOR1_IN_PIN, SENSOR2_IN_PIN,
+                                       SENSOR3_IN_PIN, SENSOR4_IN_PIN, SENSOR5_IN_PIN};
+
+static double wheel_rate[2];            // pulses/s, left and right
+static double wheel_fraction[2];
+
+
+/**
+ * @brief Prints the bytes sent on a port one line at a time.
+ */
+class Line_printer
+{
+private:
+
+    const char* prefix;
+    std::string line;
+
+public:
+
+    bool enabled;
+
+    Line_printer(const char* prefix_): prefix(prefix_), enabled(true) {}
+
+    void add(char c)
+    {
+        if (c == '\n')
+        {
+            flush();
+        }
+        else if (c >= 32 && c < 127)
+        {
+            line.push_back(c);
+        }
+        else if (c != '\r')
+        {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\x%02x", (unsigned char) c);
+            line += escaped;
+        }
+    }
+
+    void flush(void)
+    {
+        if (enabled && !line.empty())
+        {
+            printf("%9.4f %s> %s\n", hal::now(), prefix, line.c_str());
+        }
+        line.clear();
+    }
+};
+
+
+static void print_pin(PinName pin)
+{
+    printf("%9.4f pin %s: output %d, pwm %.3f, encoder %d\n", hal::now(), hal::pin_name(pin), hal::get_output(pin),
+           hal::get_pwm(pin), hal::get_encoder(pin));
+}
+
+
+static void update_encoders(void)
+{
+    const PinName pins[2] = {MOTORL_CHA_PIN, MOTORR_CHA_PIN};
+    for (int i = 0; i < 2; i++)
+    {
+        wheel_fraction[i] += wheel_rate[i] * ENCODER_STEP_S;
+        int pulses = (int) wheel_fraction[i];
+        wheel_fraction[i] -= pulses;
+        hal::add_encoder(pins[i], pulses);
+    }
+}
+
+
+static PinName parse_pin(const char* name, int line_number)
+{
+    PinName pin = hal::pin_from_name(name);
+    if (pin == NC)
+    {
+        fprintf(stderr, "line %d: unknown pin %s\n", line_number, name);
+    }
+    return pin;
+}
+
+
+/* Schedules one script line, false if it is invalid */
+static bool schedule_line(char* line, int line_number)
+{
+    char* cursor = line;
+    while (*cursor == ' ' || *cursor == '\t')
+    {
+        cursor++;
+    }
+    if (*cursor == '\0' || *cursor == '\n' || *cursor == '#')
+    {
+        return true;
+    }
+    line[strcspn(line, "\r\n")] = '\0';
+
+    char action[16];
+    int consumed = 0;
+    double time_s;
+    if (sscanf(cursor, "%lf %15s %n", &time_s, action, &consumed) < 2)
+    {
+        fprintf(stderr, "line %d: expected a time and an action\n", line_number);
+        return false;
+    }
+    std::string args = cursor + consumed;
+
+    if (strcmp(action, "bt") == 0 || strcmp(action, "pc") == 0)
+    {
+        PinName port = (action[0] == 'b') ? BT_TX_PIN : USBTX;
+        hal::at(time_s, [port, args]() { hal::serial_send(port, args + "\n"); });
+        return true;
+    }
+    if (strcmp(action, "sensors") == 0)
+    {
+        float levels[6];
+        if (sscanf(args.c_str(), "%f %f %f %f %f %f", &levels[0], &levels[1], &levels[2], &levels[3], &levels[4],
+                   &levels[5]) != 6)
+        {
+            fprintf(stderr, "line %d: sensors needs 6 levels\n", line_number);
+            return false;
+        }
+        hal::at(time_s, [levels]()
+        {
+            for (int i = 0; i < 6; i++)
+            {
+                hal::set_analog(sensor_pins[i], levels[i]);
+            }
+        });
+        return true;
+    }
+
+    char name[16];
+    double value = 0;
+    int fields = sscanf(args.c_str(), "%15s %lf", name, &value);
+    if (strcmp(action, "speed") == 0 && fields == 2 && (name[0] == 'L' || name[0] == 'R'))
+    {
+        int wheel = (name[0] == 'L') ? 0 : 1;
+        hal::at(time_s, [wheel, value]() { wheel_rate[wheel] = value; });
+        return true;
+    }
+    if (fields < 1)
+    {
+        fprintf(stderr, "line %d: %s needs a pin\n", line_number, action);
+        return false;
+    }
+    PinName pin = parse_pin(name, line_number);
+    if (pin == NC)
+    {
+        return false;
+    }
+    if (strcmp(action, "analog") == 0 && fields == 2)
+    {
+        hal::at(time_s, [pin, value]() { hal::set_analog(pin, (float) value); });
+    }
+    else if (strcmp(action, "input") == 0 && fields == 2)
+    {
+        hal::at(time_s, [pin, value]() { hal::set_input(pin, (int) value); });
+    }
+    else if (strcmp(action, "print") == 0)
+    {
+        hal::at(time_s, [pin]() { print_pin(pin); });
+    }
+    else
+    {
+        fprintf(stderr, "line %d: unknown action %s\n", line_number, action);
+        return false;
+    }
+    return true;
+}
+
+
+static bool load_script(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+    char line[256];
+    int line_number = 0;
+    bool valid = true;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        valid = schedule_line(line, ++line_number) && valid;
+    }
+    fclose(file);
+    return valid;
+}
+
+
+int main(int argc, char** argv)
+{
+    double duration_s = 5;
+    const char* script = NULL;
+    const char* flash_file = NULL;
+    bool quiet = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool has_value = (i + 1 < argc);
+        if (strcmp(argv[i], "-t") == 0 && has_value)
+        {
+            duration_s = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-s") == 0 && has_value)
+        {
+            script = argv[++i];
+        }
+        else if (strcmp(argv[i], "-f") == 0 && has_value)
+        {
+            flash_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+        {
+            quiet = true;
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-t seconds] [-s script] [-f flash_image] [-q]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (flash_file != NULL && !hal::set_flash_file(flash_file))
+    {
+        fprintf(stderr, "cannot map the flash image %s\n", flash_file);
+        return 1;
+    }
+    if (script != NULL && !load_script(script))
+    {
+        return 1;
+    }
+
+    Line_printer bt_printer("bt");
+    Line_printer pc_printer("pc");
+    pc_printer.enabled = !quiet;
+    hal::on_serial_output(BT_TX_PIN, [&bt_printer](char c) { bt_printer.add(c); });
+    hal::on_serial_output(USBTX, [&pc_printer](char c) { pc_printer.add(c); });
+    hal::every(ENCODER_STEP_S, update_encoders);
+
+    auto start = std::chrono::steady_clock::now();
+    double reached_s = hal::run(firmware_main, duration_s);
+    double real_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    bt_printer.flush();
+    pc_printer.flush();
+
+    printf("\n%.3f s of firmware time in %.3f s (x%.0f), %llu interrupts, max interrupt latency %.1f us\n", reached_s,
+           real_s, reached_s / real_s, (unsigned long long) hal::get_interrupt_count(),
+           hal::get_max_latency_ns() / 1000.0);
+    printf("motor L: pwm %.3f, direction %d, bipolar %d | motor R: pwm %.3f, direction %d, bipolar %d | driver enable %d\n",
+           hal::get_pwm(MOTORL_PWM_PIN), hal::get_output(MOTORL_DIRECTION_PIN), hal::get_output(MOTORL_BIPOLAR_PIN),
+           hal::get_pwm(MOTORR_PWM_PIN), hal::get_output(MOTORR_DIRECTION_PIN), hal::get_output(MOTORR_BIPOLAR_PIN),
+           hal::get_output(DRIVER_ENABLE_PIN));
+    return 0;
+}
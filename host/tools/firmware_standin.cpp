@@ -0,0 +1,499 @@
+/**
+ * @file firmware_standin.cpp
+ * @brief Stand-in for the buggy firmware on a pseudo-terminal
+ *
+ * Usage: firmware_standin [-b baud]
+ *
+ * Creates a pseudo-terminal, prints its path and answers on it like the buggy does on the
+ * bluetooth link, so the ground station can be run without the hardware. The command parser,
+ * parameter registry, telemetry frames and scheduler are the firmware ones; the buggy itself is
+ * faked (the wheels follow the set speed with a small wobble). Output is paced to the baud rate
+ * (default 9600, like the HM-10), 0 disables the pacing.
+ *
+ * Supported commands: C, B, GS, GE, GX, GV [id], GU, SS <speed>, SV <id> <value>, SU <type> <rate>,
+ * SB <bytes/s> [burst], EF, ES, the 'D' key (PID log dump of the USB serial port) and the 'L' key
+ * (PID log stream of the USB serial port, run with -b 921600 to get all the samples).
+ *
+ */
+
+#include <math.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "command_dispatcher.h"
+#include "parameters.h"
+#include "serial_port.h"
+#include "telemetry.h"
+#include "telemetry_scheduler.h"
+
+
+#define LINK_QUEUE_SIZE     4096
+#define CONTROL_RATE        2500        // Hz, rate of the fake control update
+
+
+/* FAKE BUGGY STATE */
+static SerialPort port;
+static int baud = 9600;
+static bool continous = false;
+static bool binary = false;
+static bool running = false;
+static char get_sent = '\0';
+static uint8_t tx_seq = 0;
+static int64_t start_us;
+static float wheel_speed[2] = {0, 0};
+static float distance = 0;
+
+static uint8_t link_queue[LINK_QUEUE_SIZE];
+static int link_head = 0;
+static int link_length = 0;
+static int link_dropped = 0;
+
+static bool log_streaming = false;
+static int log_samples = 0;
+static int log_dropped_start = 0;
+
+enum Standin_params
+{
+    p_lf_velocity = 20,
+    p_uturn_angle = 23,
+};
+
+static const Param_def param_table[] =
+{
+    {p_lf_velocity,     "lf_vel",       param_float,    0,      4,      2.1},
+    {p_uturn_angle,     "ut_angle",     param_float,    0,      360,    190},
+};
+static ParameterRegistry params(param_table, 2, NULL);
+
+
+/* LINK OUTPUT, queued then paced to the baud rate */
+static bool queue_bytes(const uint8_t* data, int length)
+{
+    if (link_length + length > LINK_QUEUE_SIZE)
+    {
+        link_dropped++;
+        return false;
+    }
+    for (int i = 0; i < length; i++)
+    {
+        link_queue[(link_head + link_length++) % LINK_QUEUE_SIZE] = data[i];
+    }
+    return true;
+}
+
+
+static void reply(const char* format, ...)
+{
+    // same as Bluetooth::send_fstring: at most 20 characters plus a newline
+    char buffer[22];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, 21, format, args);
+    va_end(args);
+    strcat(buffer, "\n");
+    queue_bytes((const uint8_t*) buffer, strlen(buffer));
+}
+
+
+static int send_frame(uint8_t type, const uint8_t* payload, int size)
+{
+    uint8_t encoded[TELEMETRY_MAX_ENCODED];
+    int length = telemetry_encode_frame(type, tx_seq++, payload, size, encoded);
+    return (length > 0 && queue_bytes(encoded, length)) ? length : 0;
+}
+
+
+static void flush_link(int64_t now_us)
+{
+    static int64_t last_us = now_us;
+    int allowed = link_length;
+    if (link_length == 0)
+    {
+        last_us = now_us;
+        return;
+    }
+    if (baud > 0)
+    {
+        // 10 bits per byte on the wire
+        allowed = (int) ((now_us - last_us) * baud / 10 / 1000000);
+        if (allowed == 0)
+        {
+            return;
+        }
+        last_us = now_us;
+        allowed = (allowed < link_length) ? allowed : link_length;
+    }
+
+    while (allowed > 0)
+    {
+        int chunk = LINK_QUEUE_SIZE - link_head;
+        chunk = (chunk < allowed) ? chunk : allowed;
+        port.write_all(link_queue + link_head, chunk);
+        link_head = (link_head + chunk) % LINK_QUEUE_SIZE;
+        link_length -= chunk;
+        allowed -= chunk;
+    }
+}
+
+
+/* TELEMETRY */
+static int send_stream(int type)
+{
+    TelemetryWriter frame;
+    float t = (host_time_us() - start_us) / 1e6f;
+
+    switch (type)
+    {
+        case tm_wheel:
+            frame.put_fixed(wheel_speed[0], 1000);
+            frame.put_fixed(wheel_speed[1], 1000);
+            frame.put_fixed(running ? params.get(p_lf_velocity) : 0, 1000);
+            frame.put_fixed(running ? params.get(p_lf_velocity) : 0, 1000);
+            break;
+        case tm_pose:
+            frame.put_fixed(distance, 1000);
+            frame.put_fixed(0, 1000);
+            frame.put_i32(0);
+            frame.put_i32((int32_t) (distance * 1000));
+            break;
+        case tm_battery:
+            frame.put_u16(7400 - (int) (t * 0.5f));
+            frame.put_fixed(running ? 1.2f : 0.1f, 1000);
+            break;
+        case tm_timing:
+            frame.put_u16(95);
+            frame.put_u16(40);
+            break;
+        default:
+            return 0;
+    }
+    return send_frame(type, frame.data(), frame.size());
+}
+
+static TelemetryScheduler scheduler(send_stream, 900, 60);
+static TelemetryBurst speed_burst(tm_speed_burst, 2);
+
+
+/* COMMAND HANDLERS */
+static Cmd_error cmd_toggle_continous(const Cmd_args& args)
+{
+    continous = !continous;
+    return cmd_ok;
+}
+
+static Cmd_error cmd_toggle_binary(const Cmd_args& args)
+{
+    binary = !binary;
+    return cmd_ok;
+}
+
+static Cmd_error cmd_get(const Cmd_args& args)
+{
+    get_sent = args.command->name;
+    if (binary)
+    {
+        send_stream(args.command->param);
+        return cmd_ok;
+    }
+    switch (get_sent)
+    {
+        case 'S':
+            reply("S L:%.3f/ R:%.3f", wheel_speed[0], wheel_speed[1]);
+            break;
+        case 'E':
+            reply("L:%7d R:%7d", (int) (distance * 3927), (int) (distance * 3927));
+            break;
+        case 'X':
+            reply("ISR: %dus", 95);
+            break;
+        default:
+            break;
+    }
+    return cmd_ok;
+}
+
+static Cmd_error cmd_get_param(const Cmd_args& args)
+{
+    for (int i = 0; i < params.get_count(); i++)
+    {
+        const Param_def* def = params.get_def(i);
+        if (args.count == 0 || def->id == (int) args.values[0])
+        {
+            reply("V%d %s=%.4g", def->id, def->name, params.get_pending(def->id));
+        }
+    }
+    return cmd_ok;
+}
+
+static Cmd_error cmd_set_param(const Cmd_args& args)
+{
+    if (!params.set((int) args.values[0], args.values[1]))
+    {
+        return cmd_err_rejected;
+    }
+    params.apply_pending();
+    return cmd_ok;
+}
+
+static Cmd_error cmd_set_speed(const Cmd_args& args)
+{
+    Cmd_args param_args = args;
+    param_args.count = 2;
+    param_args.values[1] = args.values[0];
+    param_args.values[0] = p_lf_velocity;
+    return cmd_set_param(param_args);
+}
+
+static Cmd_error cmd_subscribe(const Cmd_args& args)
+{
+    int type = (int) args.values[0];
+    bool pushed = (type == tm_speed_burst);
+    if (!(args.values[1] >= 0 && args.values[1] <= 100) || (!pushed && type < tm_wheel) || type > tm_timing)
+    {
+        return cmd_err_rejected;
+    }
+    scheduler.subscribe(type, args.values[1], pushed);
+    return cmd_ok;
+}
+
+static Cmd_error cmd_set_budget(const Cmd_args& args)
+{
+    if (args.values[0] <= 0)
+    {
+        return cmd_err_rejected;
+    }
+    scheduler.set_budget((int) args.values[0], (args.count == 2) ? (int) args.values[1] : 60);
+    return cmd_ok;
+}
+
+static Cmd_error cmd_get_streams(const Cmd_args& args)
+{
+    reply("U budget %d", scheduler.get_budget());
+    for (int i = 0; i < TELEMETRY_MAX_STREAMS; i++)
+    {
+        if (scheduler.get_rate(i) > 0 || scheduler.get_sent(i) > 0)
+        {
+            reply("U%d %.0f s%d k%d d%d", i, scheduler.get_rate(i), scheduler.get_sent(i),
+                                         scheduler.get_decimated(i), scheduler.get_dropped(i));
+        }
+    }
+    return cmd_ok;
+}
+
+static Cmd_error cmd_run(const Cmd_args& args)
+{
+    running = (args.command->param != 0);
+    return cmd_ok;
+}
+
+
+//  type    name    objects     optional    args    handler                 param
+static const Command commands[] =
+{
+    {'C',   '\0',   NULL,       false,      0, 0,   cmd_toggle_continous,   0},
+    {'B',   '\0',   NULL,       false,      0, 0,   cmd_toggle_binary,      0},
+    {'G',   'S',    "LRBS",     true,       0, 0,   cmd_get,                tm_wheel},
+    {'G',   'E',    "LRBS",     true,       0, 0,   cmd_get,                tm_pose},
+    {'G',   'X',    "LRBS",     true,       0, 0,   cmd_get,                tm_timing},
+    {'G',   'V',    NULL,       false,      0, 1,   cmd_get_param,          0},
+    {'G',   'U',    NULL,       false,      0, 0,   cmd_get_streams,        0},
+    {'S',   'S',    NULL,       false,      1, 1,   cmd_set_speed,          0},
+    {'S',   'V',    NULL,       false,      2, 2,   cmd_set_param,          0},
+    {'S',   'U',    NULL,       false,      2, 2,   cmd_subscribe,          0},
+    {'S',   'B',    NULL,       false,      1, 2,   cmd_set_budget,         0},
+    {'E',   'F',    NULL,       false,      0, 0,   cmd_run,                1},
+    {'E',   'S',    NULL,       false,      0, 0,   cmd_run,                0},
+};
+static CommandDispatcher dispatcher(commands, sizeof(commands) / sizeof(commands[0]));
+
+
+static void dump_log(void)
+{
+    // same columns as the firmware 'D' key: time, set point, measurement, P, I, D
+    // the queued frames go out first so the log lines are not split by one
+    while (link_length > 0)
+    {
+        int chunk = LINK_QUEUE_SIZE - link_head;
+        chunk = (chunk < link_length) ? chunk : link_length;
+        port.write_all(link_queue + link_head, chunk);
+        link_head = (link_head + chunk) % LINK_QUEUE_SIZE;
+        link_length -= chunk;
+    }
+    for (int i = 0; i < 500; i++)
+    {
+        float t = i / (float) CONTROL_RATE;
+        float measurement = 2.0f * (1 - expf(-t * 20));
+        char line[96];
+        snprintf(line, sizeof(line), "%.5f,%.3f,%.3f,%.3f,%.3f,%.3f\n", t, 2.0f, measurement,
+                 0.5f * (2 - measurement), 7.5f * t, 0.0f);
+        port.write_all((const uint8_t*) line, strlen(line));
+    }
+}
+
+
+static void log_stream_status(void)
+{
+    TelemetryWriter writer;
+    writer.put_i32(log_samples);
+    writer.put_i32(link_dropped - log_dropped_start);
+    send_frame(tm_log_status, writer.data(), writer.size());
+}
+
+
+static void log_stream(int64_t now_us)
+{
+    // one record per control update, like the control ISR with the 'L' key
+    static int64_t next_sample_us = now_us;
+    if (!log_streaming)
+    {
+        next_sample_us = now_us;
+        return;
+    }
+    while (next_sample_us <= now_us)
+    {
+        next_sample_us += 1000000 / CONTROL_RATE;
+        float set_point = running ? params.get(p_lf_velocity) : 0;
+        TelemetryWriter writer;
+        writer.put_u16(log_samples & 0xFFFF);
+        writer.put_fixed(set_point, 1000);
+        writer.put_fixed(wheel_speed[0], 1000);
+        writer.put_fixed(0.5f * (set_point - wheel_speed[0]), 1000);
+        writer.put_fixed(0, 1000);
+        writer.put_fixed(0, 1000);
+        send_frame(tm_log, writer.data(), writer.size());
+
+        log_samples++;
+        if (log_samples % 250 == 0)
+        {
+            log_stream_status();
+        }
+    }
+}
+
+
+static void simulate(int64_t now_us)
+{
+    static int64_t last_us = now_us;
+    static int64_t next_sample_us = now_us;
+    float dt = (now_us - last_us) / 1e6f;
+    last_us = now_us;
+
+    float t = (now_us - start_us) / 1e6f;
+    float target = running ? params.get(p_lf_velocity) : 0;
+    for (int i = 0; i < 2; i++)
+    {
+        float wobble = running ? 0.05f * sinf(2 * 3.14159265f * (1.5f + i) * t) : 0;
+        wheel_speed[i] += (target + wobble - wheel_speed[i]) * (dt * 8 < 1 ? dt * 8 : 1);
+    }
+    distance += dt * (wheel_speed[0] + wheel_speed[1]) / 2;
+
+    if (!(binary && continous))
+    {
+        return;
+    }
+
+    // speed bursts sampled like the control ISR does, then offered to the scheduler
+    float burst_rate = scheduler.get_rate(tm_speed_burst);
+    if (burst_rate > 0 && now_us >= next_sample_us)
+    {
+        next_sample_us = now_us + (int64_t) (1e6f / (burst_rate * speed_burst.get_capacity()));
+        if (speed_burst.add((int) (wheel_speed[0] * 1000), (int) (wheel_speed[1] * 1000)))
+        {
+            if (scheduler.offer(tm_speed_burst, TELEMETRY_MAX_ENCODED, (uint32_t) now_us))
+            {
+                scheduler.sent(tm_speed_burst, send_frame(tm_speed_burst, speed_burst.data(), speed_burst.size()));
+            }
+            speed_burst.clear();
+        }
+    }
+    scheduler.update((uint32_t) now_us);
+}
+
+
+int main(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+        {
+            baud = atoi(argv[++i]);
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-b baud]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (!port.open_pty())
+    {
+        return 1;
+    }
+    printf("%s\n", port.get_slave_path());
+    fflush(stdout);
+
+    scheduler.subscribe(tm_speed_burst, 40, true);
+    start_us = host_time_us();
+
+    char line[64];
+    int line_length = 0;
+    while (true)
+    {
+        uint8_t buffer[256];
+        int count = port.read(buffer, sizeof(buffer), 1);
+        if (count < 0)
+        {
+            usleep(10000);
+            count = 0;
+        }
+
+        // commands end with '/', '\r' or '\n' like on the buggy
+        for (int i = 0; i < count; i++)
+        {
+            char c = (char) buffer[i];
+            if (line_length == 0 && c == 'D')
+            {
+                dump_log();
+            }
+            else if (line_length == 0 && c == 'L')
+            {
+                if (!log_streaming)
+                {
+                    log_samples = 0;
+                    log_dropped_start = link_dropped;
+                }
+                else
+                {
+                    log_stream_status();
+                }
+                log_streaming = !log_streaming;
+            }
+            else if (c == '/' || c == '\n' || c == '\r')
+            {
+                if (line_length > 0)
+                {
+                    line[line_length] = '\0';
+                    Cmd_error error = dispatcher.dispatch(line);
+                    if (error != cmd_ok)
+                    {
+                        reply("Err%d: %s", error, CommandDispatcher::error_string(error));
+                    }
+                    line_length = 0;
+                }
+            }
+            else if (line_length < (int) sizeof(line) - 1)
+            {
+                line[line_length++] = c;
+            }
+        }
+
+        int64_t now = host_time_us();
+        simulate(now);
+        log_stream(now);
+        flush_link(now);
+    }
+}
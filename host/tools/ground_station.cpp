@@ -0,0 +1,424 @@
+/**
+ * @file ground_station.cpp
+ * @brief Command line ground station for the buggy
+ *
+ * Usage: ground_station [-b baud] [-o csv_file] [-s script] [-q] device
+ *
+ * Talks to the buggy over a serial device: the bluetooth module (9600 baud) or the Nucleo USB
+ * serial port (115200 baud), both use the same command set. Commands typed on stdin (or read from
+ * the script) are sent one per line. Text replies are printed, binary telemetry frames are decoded
+ * to CSV (to the -o file, or stdout with the replies moved to stderr). With -q the program exits
+ * at the end of the script instead of reading stdin.
+ *
+ * Lines starting with ':' are ground station directives:
+ *
+ *   :wait <ms>                         keep receiving for a while
+ *   :expect <text> [timeout_ms]        wait for a reply containing text, exit with an error if it never comes
+ *   :latency <count> <command>         send a command count times and report the round trip time
+ *                                      to the first reply (text or frame)
+ *   :dump <file>                       send the 'D' key (USB serial) and save the PID log lines to a file
+ *   :stats                             print the link statistics
+ *
+ * Lines starting with '#' are comments.
+ *
+ */
+
+#include <algorithm>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "link_demux.h"
+#include "serial_port.h"
+#include "telemetry.h"
+#include "telemetry_csv.h"
+
+
+/**
+ * @brief Prints the replies and writes the frames as CSV, keeps track of the replies for the directives.
+ */
+class GroundStation : public LinkHandler
+{
+public:
+
+    FILE* text_out;
+    FILE* csv_out;
+    bool header_seen[256];
+    int replies;                    // text lines and frames received, used to detect a reply
+    const char* expecting;          // text searched by :expect, NULL if none
+    bool matched;                   // true once a line containing expecting was received
+    FILE* capture;                  // text lines are written here instead while dumping
+    int captured;                   // lines written to capture
+
+    GroundStation(FILE* text_out_, FILE* csv_out_)
+    {
+        text_out = text_out_;
+        csv_out = csv_out_;
+        memset(header_seen, 0, sizeof(header_seen));
+        replies = 0;
+        expecting = NULL;
+        matched = false;
+        capture = NULL;
+        captured = 0;
+    }
+
+    void on_text(const char* line)
+    {
+        replies++;
+        if (expecting != NULL && strstr(line, expecting) != NULL)
+        {
+            matched = true;
+        }
+        if (capture != NULL)
+        {
+            fprintf(capture, "%s\n", line);
+            captured++;
+            return;
+        }
+        fprintf(text_out, "< %s\n", line);
+        fflush(text_out);
+    }
+
+    void on_frame(const Telemetry_frame& frame)
+    {
+        replies++;
+        if (!header_seen[frame.type])
+        {
+            telemetry_csv_header(csv_out, frame.type);
+            header_seen[frame.type] = true;
+        }
+        telemetry_csv_frame(csv_out, frame);
+    }
+};
+
+
+static SerialPort port;
+static GroundStation* station;
+static LinkDemux* demux;
+
+
+static bool receive(int timeout_ms)
+{
+    uint8_t buffer[512];
+    int count = port.read(buffer, sizeof(buffer), timeout_ms);
+    if (count < 0)
+    {
+        fprintf(stderr, "serial port closed\n");
+        exit(1);
+    }
+    demux->feed(buffer, count);
+    return count > 0;
+}
+
+
+static void receive_for(int duration_ms)
+{
+    int64_t end = host_time_us() + (int64_t) duration_ms * 1000;
+    for (int64_t now = host_time_us(); now < end; now = host_time_us())
+    {
+        receive((int) ((end - now + 999) / 1000));
+    }
+}
+
+
+static void send_command(const char* command)
+{
+    port.write_all((const uint8_t*) command, strlen(command));
+    port.write_all((const uint8_t*) "\n", 1);
+}
+
+
+static bool expect(const char* text, int timeout_ms)
+{
+    int64_t end = host_time_us() + (int64_t) timeout_ms * 1000;
+    station->expecting = text;
+    station->matched = false;
+    while (!station->matched && host_time_us() < end)
+    {
+        receive(10);
+    }
+    station->expecting = NULL;
+    return station->matched;
+}
+
+
+static void latency(int count, const char* command)
+{
+    std::vector<double> times;
+    int timeouts = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        receive_for(20);                    // let the previous replies finish
+        int seen = station->replies;
+        int64_t start = host_time_us();
+        send_command(command);
+
+        int64_t end = start + 1000000;
+        while (station->replies == seen && host_time_us() < end)
+        {
+            receive(1);
+        }
+        if (station->replies == seen)
+        {
+            timeouts++;
+            continue;
+        }
+        times.push_back((host_time_us() - start) / 1000.0);
+    }
+
+    if (times.empty())
+    {
+        fprintf(stderr, "latency: no replies to \"%s\"\n", command);
+        return;
+    }
+    std::sort(times.begin(), times.end());
+    double sum = 0;
+    for (size_t i = 0; i < times.size(); i++)
+    {
+        sum += times[i];
+    }
+    fprintf(stderr, "latency \"%s\": n=%d min=%.2fms mean=%.2fms p95=%.2fms max=%.2fms timeouts=%d\n",
+                    command, (int) times.size(), times.front(), sum / times.size(),
+                    times[std::min(times.size() - 1, (times.size() * 95) / 100)],
+                    times.back(), timeouts);
+}
+
+
+static void dump(const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+    {
+        perror(path);
+        return;
+    }
+
+    // the log is printed as fast as the port allows, it is done once no line came for a while
+    // (telemetry frames may still be streaming)
+    int before = station->captured;
+    station->capture = file;
+    port.write_all((const uint8_t*) "D", 1);
+    int64_t last = host_time_us();
+    int seen = station->captured;
+    while (host_time_us() - last < 500000)
+    {
+        receive(50);
+        if (station->captured != seen)
+        {
+            seen = station->captured;
+            last = host_time_us();
+        }
+    }
+    station->capture = NULL;
+    fclose(file);
+    fprintf(stderr, "dump: %d lines saved to %s\n", station->captured - before, path);
+}
+
+
+static void print_stats(void)
+{
+    fprintf(stderr, "link: %d text lines, %d frames, %d crc errors, %d frames lost\n",
+                    demux->text_lines, demux->frames, demux->crc_errors, demux->lost);
+}
+
+
+/**
+ * @brief Runs one line typed or read from a script.
+ *
+ * @return false if an :expect directive failed
+ */
+static bool run_line(char* line)
+{
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == '\0' || line[0] == '#')
+    {
+        return true;
+    }
+    if (line[0] != ':')
+    {
+        send_command(line);
+        return true;
+    }
+
+    char directive[16] = "";
+    int offset = 0;
+    sscanf(line + 1, "%15s %n", directive, &offset);
+    char* argument = line + 1 + offset;
+
+    if (strcmp(directive, "wait") == 0)
+    {
+        receive_for(atoi(argument));
+    }
+    else if (strcmp(directive, "expect") == 0)
+    {
+        // optional timeout after the text
+        int timeout_ms = 2000;
+        char* last_space = strrchr(argument, ' ');
+        if (last_space != NULL && atoi(last_space + 1) > 0)
+        {
+            timeout_ms = atoi(last_space + 1);
+            *last_space = '\0';
+        }
+        if (!expect(argument, timeout_ms))
+        {
+            fprintf(stderr, "expect \"%s\" timed out\n", argument);
+            return false;
+        }
+    }
+    else if (strcmp(directive, "latency") == 0)
+    {
+        int count = 0;
+        int command_offset = 0;
+        sscanf(argument, "%d %n", &count, &command_offset);
+        latency(count, argument + command_offset);
+    }
+    else if (strcmp(directive, "dump") == 0)
+    {
+        dump(argument);
+    }
+    else if (strcmp(directive, "stats") == 0)
+    {
+        print_stats();
+    }
+    else
+    {
+        fprintf(stderr, "unknown directive :%s\n", directive);
+    }
+    return true;
+}
+
+
+int main(int argc, char** argv)
+{
+    int baud = 9600;
+    const char* csv_path = NULL;
+    const char* script_path = NULL;
+    const char* device = NULL;
+    bool quit_after_script = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+        {
+            baud = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            csv_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+        {
+            script_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-q") == 0)
+        {
+            quit_after_script = true;
+        }
+        else if (argv[i][0] == '-' || device != NULL)
+        {
+            device = NULL;
+            break;
+        }
+        else
+        {
+            device = argv[i];
+        }
+    }
+    if (device == NULL)
+    {
+        fprintf(stderr, "usage: %s [-b baud] [-o csv_file] [-s script] [-q] device\n", argv[0]);
+        return 2;
+    }
+
+    FILE* csv_out = stdout;
+    FILE* text_out = stderr;
+    if (csv_path != NULL)
+    {
+        csv_out = fopen(csv_path, "w");
+        if (csv_out == NULL)
+        {
+            perror(csv_path);
+            return 1;
+        }
+        text_out = stdout;
+    }
+
+    if (!port.open(device, baud))
+    {
+        return 1;
+    }
+    GroundStation handler(text_out, csv_out);
+    LinkDemux link(handler);
+    station = &handler;
+    demux = &link;
+
+    int status = 0;
+    if (script_path != NULL)
+    {
+        FILE* script = fopen(script_path, "r");
+        if (script == NULL)
+        {
+            perror(script_path);
+            return 1;
+        }
+        char line[256];
+        while (fgets(line, sizeof(line), script) != NULL)
+        {
+            if (!run_line(line))
+            {
+                status = 1;
+                break;
+            }
+        }
+        fclose(script);
+        receive_for(100);
+    }
+
+    if (!quit_after_script && status == 0)
+    {
+        // interactive: commands from stdin, replies and frames as they arrive
+        char line[256];
+        int line_length = 0;
+        bool stdin_open = true;
+        while (stdin_open)
+        {
+            struct pollfd fds[2] = {{port.get_fd(), POLLIN, 0}, {STDIN_FILENO, POLLIN, 0}};
+            poll(fds, 2, -1);
+            if (fds[0].revents)
+            {
+                receive(0);
+            }
+            if (fds[1].revents)
+            {
+                char c;
+                if (read(STDIN_FILENO, &c, 1) != 1)
+                {
+                    stdin_open = false;
+                }
+                else if (c == '\n' || line_length == (int) sizeof(line) - 1)
+                {
+                    line[line_length] = '\0';
+                    line_length = 0;
+                    run_line(line);
+                }
+                else
+                {
+                    line[line_length++] = c;
+                }
+            }
+        }
+        receive_for(100);
+    }
+
+    print_stats();
+    fflush(csv_out);
+    if (csv_out != stdout)
+    {
+        fclose(csv_out);
+    }
+    return status;
+}
@@ -0,0 +1,229 @@
+/**
+ * @file isr_stress.cpp
+ * @brief Checks the Seqlock and CommandBlock classes against interrupts at random points
+ *
+ * Usage: isr_stress [-t seconds] [-p max_period_us] [-s seed]
+ *
+ * A signal handler plays the ISR: a second thread sends the signal to the main thread at random
+ * intervals, so the handler interrupts the main thread at any instruction and runs to completion
+ * before it continues, like an interrupt on the single core target.
+ *
+ * - ISR to main loop: the handler publishes a block whose words all hold the same counter, the
+ *   main thread reads it in a loop and checks the words are equal
+ * - main loop to ISR: the main thread publishes such blocks, the handler reads and checks them
+ *
+ * Each direction is also run through an unprotected block written and read word by word: its
+ * torn reads show the test does interrupt the copies. The exit code is 1 if a protected read was
+ * torn.
+ *
+ *   -t  test time (default 10 s)
+ *   -p  max time between two interrupts (default 50 us)
+ *
+ */
+
+#include <atomic>
+#include <chrono>
+#include <pthread.h>
+#include <random>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#include "seqlock.h"
+
+
+#define BLOCK_WORDS     16          // large enough for the copies to be interrupted often
+
+
+struct Block
+{
+    uint32_t words[BLOCK_WORDS];
+};
+
+
+static Block make_block(uint32_t value)
+{
+    Block block;
+    for (int i = 0; i < BLOCK_WORDS; i++)
+    {
+        block.words[i] = value;
+    }
+    return block;
+}
+
+
+static bool is_torn(const Block& block)
+{
+    for (int i = 1; i < BLOCK_WORDS; i++)
+    {
+        if (block.words[i] != block.words[0])
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/* Unprotected copies, word by word */
+static void plain_write(volatile Block* target, uint32_t value)
+{
+    for (int i = 0; i < BLOCK_WORDS; i++)
+    {
+        target->words[i] = value;
+    }
+}
+
+static Block plain_read(const volatile Block* source)
+{
+    Block copy;
+    for (int i = 0; i < BLOCK_WORDS; i++)
+    {
+        copy.words[i] = source->words[i];
+    }
+    return copy;
+}
+
+
+/* Shared with the handler */
+static Seqlock<Block> published;            // written by the handler
+static CommandBlock<Block> commands;        // read by the handler
+static volatile Block plain_published;
+static volatile Block plain_commands;
+
+static volatile uint32_t isr_count = 0;
+static volatile uint32_t isr_torn = 0;      // torn command block reads
+static volatile uint32_t isr_plain_torn = 0;
+static volatile uint32_t isr_last_command = 0;
+static volatile uint32_t isr_order_errors = 0;  // older block read after a newer one
+
+
+static void isr_handler(int)
+{
+    uint32_t n = isr_count + 1;
+    isr_count = n;
+
+    published.write(make_block(n));
+    plain_write(&plain_published, n);
+
+    Block command = commands.read();
+    if (is_torn(command))
+    {
+        isr_torn = isr_torn + 1;
+    }
+    if (command.words[0] < isr_last_command)
+    {
+        isr_order_errors = isr_order_errors + 1;
+    }
+    isr_last_command = command.words[0];
+
+    if (is_torn(plain_read(&plain_commands)))
+    {
+        isr_plain_torn = isr_plain_torn + 1;
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    double duration_s = 10;
+    double max_period_us = 50;
+    unsigned seed = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool has_value = (i + 1 < argc);
+        if (strcmp(argv[i], "-t") == 0 && has_value)
+        {
+            duration_s = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-p") == 0 && has_value)
+        {
+            max_period_us = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-s") == 0 && has_value)
+        {
+            seed = (unsigned) atoi(argv[++i]);
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-t seconds] [-p max_period_us] [-s seed]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = isr_handler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, NULL);
+
+    // the interrupt source
+    pthread_t main_thread = pthread_self();
+    std::atomic<bool> running(true);
+    std::thread source([&]()
+    {
+        std::mt19937 random(seed);
+        std::uniform_int_distribution<int> period_ns(0, (int) (max_period_us * 1000));
+        while (running)
+        {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(period_ns(random)));
+            pthread_kill(main_thread, SIGUSR1);
+        }
+    });
+
+    uint64_t reads = 0;
+    uint64_t torn = 0;
+    uint64_t plain_torn = 0;
+    uint64_t order_errors = 0;
+    uint32_t last_read = 0;
+    uint32_t command = 0;
+
+    auto end = std::chrono::steady_clock::now() + std::chrono::duration<double>(duration_s);
+    while (std::chrono::steady_clock::now() < end)
+    {
+        for (int i = 0; i < 1000; i++)
+        {
+            Block block = published.read();
+            if (is_torn(block))
+            {
+                torn++;
+            }
+            if (block.words[0] < last_read)
+            {
+                order_errors++;
+            }
+            last_read = block.words[0];
+            if (is_torn(plain_read(&plain_published)))
+            {
+                plain_torn++;
+            }
+
+            command++;
+            commands.write(make_block(command));
+            plain_write(&plain_commands, command);
+            reads++;
+        }
+    }
+
+    running = false;
+    source.join();
+    signal(SIGUSR1, SIG_IGN);
+
+    printf("%.0f s, %lu interrupts, %llu main loop iterations\n\n", duration_s, (unsigned long) isr_count,
+           (unsigned long long) reads);
+    printf("%-22s %12s %12s %12s\n", "", "torn", "out of order", "plain torn");
+    printf("%-22s %12llu %12llu %12llu\n", "ISR -> main (Seqlock)", (unsigned long long) torn,
+           (unsigned long long) order_errors, (unsigned long long) plain_torn);
+    printf("%-22s %12lu %12lu %12lu\n", "main -> ISR (Command)", (unsigned long) isr_torn,
+           (unsigned long) isr_order_errors, (unsigned long) isr_plain_torn);
+
+    if (plain_torn + isr_plain_torn == 0)
+    {
+        printf("\nwarning: no unprotected read was torn, run longer or with a shorter period\n");
+    }
+    return (torn + order_errors + isr_torn + isr_order_errors > 0) ? 1 : 0;
+}
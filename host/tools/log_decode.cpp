@@ -0,0 +1,229 @@
+/**
+ * @file log_decode.cpp
+ * @brief Rebuilds the PID log CSV from the binary log stream of the USB serial port
+ *
+ * Usage: log_decode [-b baud] [-r rate] [-t seconds] [-o csv_file] source
+ *
+ * The source is either a serial device (the Nucleo USB serial port, 921600 baud by default) or a
+ * file holding the raw bytes captured from it. For a device the 'L' key is sent to start the stream,
+ * it is recorded until the -t time is over (or until Ctrl-C) then stopped with another 'L'.
+ *
+ * Writes the same columns as the 'D' key dump: time, set point, measurement, P, I, D. The time comes
+ * from the sample index in each record (-r is the control update rate) so it stays right across lost
+ * records. Text lines received in between are printed on stderr, with the link statistics at the end.
+ *
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "link_demux.h"
+#include "serial_port.h"
+#include "telemetry.h"
+
+
+/**
+ * @brief Writes the log records as CSV and counts the missing samples.
+ */
+class LogDecoder : public LinkHandler
+{
+public:
+
+    FILE* out;
+    double rate;
+    long long sample;           // unwrapped index of the last sample, -1 before the first one
+    long long samples;          // records written
+    long long missing;          // samples skipped according to the sample index
+    int buggy_samples;          // counters of the last status frame
+    int buggy_dropped;
+
+    LogDecoder(FILE* out_, double rate_)
+    {
+        out = out_;
+        rate = rate_;
+        sample = -1;
+        samples = 0;
+        missing = 0;
+        buggy_samples = 0;
+        buggy_dropped = 0;
+    }
+
+    void on_text(const char* line)
+    {
+        fprintf(stderr, "< %s\n", line);
+    }
+
+    void on_frame(const Telemetry_frame& frame)
+    {
+        TelemetryReader reader(frame);
+        if (frame.type == tm_log_status)
+        {
+            buggy_samples = reader.read_i32();
+            buggy_dropped = reader.read_i32();
+            return;
+        }
+        if (frame.type != tm_log)
+        {
+            return;
+        }
+
+        // the index is 16 bits on the link, more than 65535 samples missing in a row is not detected
+        int index = reader.read_u16();
+        if (sample < 0)
+        {
+            sample = index;
+            fprintf(out, "time,set_point,measurement,p,i,d\n");
+        }
+        else
+        {
+            long long step = (uint16_t) (index - sample);
+            if (step == 0)
+            {
+                step = 65536;
+            }
+            missing += step - 1;
+            sample += step;
+        }
+
+        double set_point = reader.read_i16() / 1000.0;
+        double measurement = reader.read_i16() / 1000.0;
+        double p = reader.read_i16() / 1000.0;
+        double i = reader.read_i16() / 1000.0;
+        double d = reader.read_i16() / 1000.0;
+        fprintf(out, "%.5f,%.3f,%.3f,%.3f,%.3f,%.3f\n", sample / rate, set_point, measurement, p, i, d);
+        samples++;
+    }
+};
+
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_interrupt(int)
+{
+    interrupted = 1;
+}
+
+
+int main(int argc, char** argv)
+{
+    int baud = 921600;
+    double rate = 2500;
+    double duration = 0;
+    const char* csv_path = NULL;
+    const char* source = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+        {
+            baud = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+        {
+            rate = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        {
+            duration = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            csv_path = argv[++i];
+        }
+        else if (argv[i][0] == '-' || source != NULL)
+        {
+            source = NULL;
+            break;
+        }
+        else
+        {
+            source = argv[i];
+        }
+    }
+    if (source == NULL || rate <= 0)
+    {
+        fprintf(stderr, "usage: %s [-b baud] [-r rate] [-t seconds] [-o csv_file] source\n", argv[0]);
+        return 2;
+    }
+
+    FILE* out = stdout;
+    if (csv_path != NULL)
+    {
+        out = fopen(csv_path, "w");
+        if (out == NULL)
+        {
+            perror(csv_path);
+            return 1;
+        }
+    }
+
+    LogDecoder decoder(out, rate);
+    LinkDemux link(decoder);
+    uint8_t buffer[4096];
+
+    struct stat info;
+    if (stat(source, &info) == 0 && S_ISCHR(info.st_mode))
+    {
+        SerialPort port;
+        if (!port.open(source, baud))
+        {
+            return 1;
+        }
+        signal(SIGINT, on_interrupt);
+        port.write_all((const uint8_t*) "L", 1);
+
+        int64_t end = host_time_us() + (int64_t) (duration * 1e6);
+        while (!interrupted && (duration <= 0 || host_time_us() < end))
+        {
+            int count = port.read(buffer, sizeof(buffer), 100);
+            if (count < 0)
+            {
+                fprintf(stderr, "serial port closed\n");
+                break;
+            }
+            link.feed(buffer, count);
+        }
+
+        // the last records and the final status frame arrive after the stop
+        port.write_all((const uint8_t*) "L", 1);
+        int64_t quiet_end = host_time_us() + 200000;
+        while (host_time_us() < quiet_end)
+        {
+            int count = port.read(buffer, sizeof(buffer), 20);
+            if (count < 0)
+            {
+                break;
+            }
+            link.feed(buffer, count);
+        }
+    }
+    else
+    {
+        FILE* in = fopen(source, "rb");
+        if (in == NULL)
+        {
+            perror(source);
+            return 1;
+        }
+        size_t count;
+        while ((count = fread(buffer, 1, sizeof(buffer), in)) > 0)
+        {
+            link.feed(buffer, (int) count);
+        }
+        fclose(in);
+    }
+
+    fprintf(stderr, "samples: %lld, missing: %lld, buggy reported %d samples and %d dropped, "
+                    "link: %d frames, %d crc errors\n",
+            decoder.samples, decoder.missing, decoder.buggy_samples, decoder.buggy_dropped,
+            link.frames, link.crc_errors);
+
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,316 @@
+/**
+ * @file monte_carlo.cpp
+ * @brief Runs a parameter set around a track over many randomised buggies and reports its robustness
+ *
+ * Usage: monte_carlo [-n runs] [-j threads] [-t seconds] [-s seed] [-x scale] [-p id=value]... [-f script]
+ *                    [-o runs.csv] track
+ *
+ * Each run is a closed loop lap (see track_sim) of the firmware with the constants.h parameters,
+ * changed by the -p parameters and the commands of a -f script (a param_sweep parameter set). The
+ * runs are drawn from the -s seed and run in parallel, one child process each, on a work stealing
+ * pool with one worker per CPU core. Each run draws:
+ *
+ *   sensor noise        ADC noise standard deviation, uniform 0.005 to 0.03
+ *   ambient offset      ADC level added to every sensor, uniform 0 to 0.1
+ *   battery             state of charge, uniform 0.2 to 1 (7.0 to 8.0 V open circuit)
+ *   wheel radius        each wheel, normal 1% around the radius the firmware uses
+ *   motor gain          each motor constant, normal 5%
+ *   ISR jitter          every Ticker interrupt is late by up to 0 to 20 us (uniform, drawn per run)
+ *   bluetooth timing    the commands and the start are sent over bluetooth, late by up to 0 to 100 ms
+ *
+ * -x scales every spread (0 runs the nominal buggy each time, only the sensor noise seed changes).
+ *
+ * Reports the failure rate (runs that did not complete the lap: off track, or out of time), the
+ * runs that lost the line (all sensors off it at least once, completed or not) and the lap time
+ * distribution of the completed runs. -o writes every run, its draws and its result as CSV, a run
+ * is reproduced with the same -s seed and -n at least its index + 1.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "buggy_sim.h"
+#include "lap_runner.h"
+#include "pin_assignments.h"
+#include "track.h"
+#include "work_pool.h"
+
+
+#define HISTOGRAM_BINS      10
+#define HISTOGRAM_WIDTH     40          // characters of the largest bin
+
+
+/**
+ * @brief The draws of one run.
+ */
+struct Run_draws
+{
+    unsigned seed;
+    double noise;
+    double ambient;
+    double battery_charge;
+    double wheel_scale[2];
+    double motor_gain[2];
+    uint32_t ticker_jitter_ns;
+    double command_jitter;              ///< s
+};
+
+
+struct Run
+{
+    Run_draws draws;
+    Lap_outcome outcome;
+};
+
+
+static Run_draws draw(std::mt19937& engine, double scale)
+{
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::normal_distribution<double> normal(0, 1);
+    const Sensor_params sensors = default_sensor_params();
+    const Plant_params plant = default_plant_params();
+
+    Run_draws d;
+    d.seed = (unsigned) engine();
+    d.noise = sensors.noise + scale * (0.005 + 0.025 * uniform(engine) - sensors.noise);
+    d.ambient = scale * 0.1 * uniform(engine);
+    d.battery_charge = plant.battery_charge + scale * (0.2 + 0.8 * uniform(engine) - plant.battery_charge);
+    for (int i = 0; i < 2; i++)
+    {
+        d.wheel_scale[i] = 1 + scale * 0.01 * normal(engine);
+        d.motor_gain[i] = 1 + scale * 0.05 * normal(engine);
+    }
+    d.ticker_jitter_ns = (uint32_t) (scale * 20000 * uniform(engine));
+    d.command_jitter = scale * 0.1 * uniform(engine);
+    return d;
+}
+
+
+static double percentile(const std::vector<double>& sorted, double fraction)
+{
+    // nearest rank
+    size_t rank = (size_t) ceil(fraction * sorted.size());
+    return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+}
+
+
+int main(int argc, char** argv)
+{
+    int runs = 200;
+    int threads = 0;
+    double max_s = 30;
+    unsigned seed = 1;
+    double scale = 1;
+    const char* csv_path = NULL;
+    const char* track_path = NULL;
+    std::vector<std::string> commands;
+    bool valid = true;
+
+    for (int i = 1; i < argc && valid; i++)
+    {
+        bool has_value = (i + 1 < argc);
+        if (strcmp(argv[i], "-n") == 0 && has_value)
+        {
+            runs = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-j") == 0 && has_value)
+        {
+            threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-t") == 0 && has_value)
+        {
+            max_s = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-s") == 0 && has_value)
+        {
+            seed = (unsigned) atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-x") == 0 && has_value)
+        {
+            scale = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-p") == 0 && has_value && strchr(argv[i + 1], '=') != NULL)
+        {
+            std::string param = argv[++i];
+            param[param.find('=')] = ' ';
+            commands.push_back("SV " + param);
+        }
+        else if (strcmp(argv[i], "-f") == 0 && has_value)
+        {
+            if (!load_commands(argv[++i], &commands))
+            {
+                fprintf(stderr, "cannot open %s\n", argv[i]);
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-o") == 0 && has_value)
+        {
+            csv_path = argv[++i];
+        }
+        else if (argv[i][0] != '-' && track_path == NULL)
+        {
+            track_path = argv[i];
+        }
+        else
+        {
+            valid = false;
+        }
+    }
+    if (!valid || track_path == NULL || runs <= 0 || scale < 0)
+    {
+        fprintf(stderr, "usage: %s [-n runs] [-j threads] [-t seconds] [-s seed] [-x scale] [-p id=value]... "
+                        "[-f script] [-o runs.csv] track\n", argv[0]);
+        return 2;
+    }
+
+    Track track;
+    std::string error;
+    if (!track.load(track_path, &error))
+    {
+        fprintf(stderr, "%s: %s\n", track_path, error.c_str());
+        return 2;
+    }
+
+    std::mt19937 engine(seed);
+    std::vector<Run> results(runs);
+    for (Run& run : results)
+    {
+        run.draws = draw(engine, scale);
+    }
+
+    WorkPool pool(threads);
+    auto start = std::chrono::steady_clock::now();
+    for (Run& run : results)
+    {
+        Run* target = &run;
+        pool.submit([target, &track, &commands, max_s]()
+        {
+            const Run_draws& d = target->draws;
+            Lap_job job = default_lap_job(track);
+            job.seed = d.seed;
+            job.max_time = max_s;
+            job.commands = commands;
+            job.sensors.noise = d.noise;
+            job.sensors.ambient = d.ambient;
+            job.plant.battery_charge = d.battery_charge;
+            for (int i = 0; i < 2; i++)
+            {
+                job.plant.wheel_scale[i] = d.wheel_scale[i];
+                job.plant.motor_gain[i] = d.motor_gain[i];
+            }
+            job.ticker_jitter_ns = d.ticker_jitter_ns;
+            job.command_port = BT_TX_PIN;
+            job.command_jitter = d.command_jitter;
+            target->outcome = run_lap(job);
+        });
+    }
+    pool.wait();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int completed = 0;
+    int off_track = 0;
+    int out_of_time = 0;
+    int crashed = 0;
+    int lost_line = 0;
+    std::vector<double> lap_times;
+    double rms_total = 0;
+    for (const Run& run : results)
+    {
+        const Sim_result& result = run.outcome.result;
+        if (!run.outcome.ran)
+        {
+            crashed++;
+            continue;
+        }
+        lost_line += (result.line_losses > 0) ? 1 : 0;
+        if (result.finished)
+        {
+            completed++;
+            lap_times.push_back(result.lap_time);
+            rms_total += result.rms_lateral;
+        }
+        else if (result.off_track)
+        {
+            off_track++;
+        }
+        else
+        {
+            out_of_time++;
+        }
+    }
+
+    printf("%s: %d runs (spread x%g, seed %u) in %.1f s, %.1f runs/s on %d workers, %llu steals\n", track_path, runs,
+           scale, seed, elapsed, runs / elapsed, pool.get_thread_count(), (unsigned long long) pool.get_steals());
+    int failed = runs - completed;
+    printf("failure rate %.1f%% (%d): %d off track, %d out of time, %d simulation errors\n", 100.0 * failed / runs,
+           failed, off_track, out_of_time, crashed);
+    printf("line lost in %.1f%% of the runs (%d)\n", 100.0 * lost_line / runs, lost_line);
+
+    if (!lap_times.empty())
+    {
+        std::sort(lap_times.begin(), lap_times.end());
+        double mean = 0;
+        for (double t : lap_times)
+        {
+            mean += t;
+        }
+        mean /= lap_times.size();
+        double variance = 0;
+        for (double t : lap_times)
+        {
+            variance += (t - mean) * (t - mean);
+        }
+        double deviation = sqrt(variance / lap_times.size());
+        printf("lap time of the %d completed runs: min %.3f, p5 %.3f, median %.3f, p95 %.3f, max %.3f s, "
+               "mean %.3f s, sd %.3f s, mean rms error %.1f mm\n", completed, lap_times.front(),
+               percentile(lap_times, 0.05), percentile(lap_times, 0.5), percentile(lap_times, 0.95), lap_times.back(),
+               mean, deviation, rms_total / completed * 1000);
+
+        double low = lap_times.front();
+        double width = (lap_times.back() - low) / HISTOGRAM_BINS;
+        int bins[HISTOGRAM_BINS] = {0};
+        for (double t : lap_times)
+        {
+            int bin = (width > 0) ? (int) ((t - low) / width) : 0;
+            bins[std::min(bin, HISTOGRAM_BINS - 1)]++;
+        }
+        int largest = *std::max_element(bins, bins + HISTOGRAM_BINS);
+        for (int i = 0; i < HISTOGRAM_BINS && width > 0; i++)
+        {
+            printf("  %7.3f - %7.3f s %5d %s\n", low + i * width, low + (i + 1) * width, bins[i],
+                   std::string(bins[i] * HISTOGRAM_WIDTH / largest, '#').c_str());
+        }
+    }
+
+    if (csv_path != NULL)
+    {
+        FILE* out = fopen(csv_path, "w");
+        if (out == NULL)
+        {
+            fprintf(stderr, "cannot create %s\n", csv_path);
+            return 2;
+        }
+        fprintf(out, "run,seed,noise,ambient,battery_charge,wheel_l,wheel_r,motor_l,motor_r,isr_jitter_us,"
+                     "bt_jitter_ms,ran,finished,off_track,lap_s,progress_m,max_lateral_mm,rms_mm,line_losses\n");
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const Run_draws& d = results[i].draws;
+            const Sim_result& r = results[i].outcome.result;
+            fprintf(out, "%zu,%u,%.4f,%.4f,%.3f,%.4f,%.4f,%.4f,%.4f,%.1f,%.1f,%d,%d,%d,%.4f,%.3f,%.2f,%.2f,%d\n", i,
+                    d.seed, d.noise, d.ambient, d.battery_charge, d.wheel_scale[0], d.wheel_scale[1], d.motor_gain[0],
+                    d.motor_gain[1], d.ticker_jitter_ns / 1000.0, d.command_jitter * 1000,
+                    results[i].outcome.ran ? 1 : 0, r.finished ? 1 : 0, r.off_track ? 1 : 0, r.lap_time, r.progress,
+                    r.max_lateral * 1000, r.rms_lateral * 1000, r.line_losses);
+        }
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,99 @@
+/**
+ * @file odometry_check.cpp
+ * @brief Checks the fixed-point Odometry class against the exact integration of arcs
+ *
+ * Usage: odometry_check [-v]
+ *
+ * Each case feeds the same tick increments to both wheels on every update (a constant curvature:
+ * straight, arcs both ways, tight turns, a turn on the spot) and compares the pose with the
+ * analytic arc of the same tick totals:
+ *
+ *   theta = (left - right) * m / separation,  s = (left + right) * m / 2
+ *   x = s sin(theta) / theta,  y = s (1 - cos(theta)) / theta     (y to the right, theta clockwise)
+ *
+ * The Q30 constants and the renormalisation use explicit 32 and 64 bit types, the host runs the
+ * same arithmetic as the Cortex-M4. The exit code is 1 if a case is off by more than 1 mm, or by
+ * more than 0.01 degrees.
+ *
+ *   -v  prints every case
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "constants.h"
+#include "odometry.h"
+
+
+#define MAX_POSITION_ERROR      0.001       // m
+#define MAX_HEADING_ERROR       0.01        // deg
+
+
+struct Arc_case
+{
+    const char* name;
+    int left;                   // ticks per update
+    int right;
+    int updates;
+};
+
+
+static const Arc_case cases[] =
+{
+    {"straight",            4,      4,      20000},
+    {"arc right",           3,      2,      20000},
+    {"arc left",            2,      3,      20000},
+    {"wide arc",            9,      8,      10000},
+    {"tight arc",           3,      -1,     10000},
+    {"single tick arc",     1,      0,      20000},
+    {"spin",                2,      -2,     5000},
+    {"reverse arc",         -3,     -2,     20000},
+};
+
+
+int main(int argc, char** argv)
+{
+    bool verbose = (argc > 1 && strcmp(argv[1], "-v") == 0);
+    const double pi = 3.14159265358979;
+    const double metres_per_tick = 2 * pi * WHEEL_RADIUS / (4 * PULSE_PER_REV);
+    int failures = 0;
+
+    for (const Arc_case& c : cases)
+    {
+        Odometry odometry(PULSE_PER_REV, WHEEL_RADIUS, WHEEL_SEPERATION);
+        for (int i = 1; i <= c.updates; i++)
+        {
+            odometry.update(c.left * i, c.right * i);
+        }
+        Pose pose = odometry.get_pose();
+
+        double left = (double) c.left * c.updates;
+        double right = (double) c.right * c.updates;
+        double theta = (left - right) * metres_per_tick / WHEEL_SEPERATION;
+        double s = (left + right) * metres_per_tick / 2;
+        double x = s;
+        double y = 0;
+        if (fabs(theta) > 1e-12)
+        {
+            x = s * sin(theta) / theta;
+            y = s * (1 - cos(theta)) / theta;
+        }
+
+        double position_error = hypot(pose.x - x, pose.y - y);
+        double heading_error = fabs(pose.heading_deg - theta * 180 / pi);
+        bool failed = position_error > MAX_POSITION_ERROR || heading_error > MAX_HEADING_ERROR;
+        failures += failed ? 1 : 0;
+        if (verbose || failed)
+        {
+            printf("%-16s x %8.4f y %8.4f heading %9.3f, exact x %8.4f y %8.4f heading %9.3f, "
+                   "error %.3f mm %.4f deg%s\n", c.name, pose.x, pose.y, pose.heading_deg, x, y, theta * 180 / pi,
+                   position_error * 1000, heading_error, failed ? "  FAILED" : "");
+        }
+    }
+
+    printf("%d/%d cases within %.1f mm and %.2f deg of the exact arc\n", (int) (sizeof(cases) / sizeof(cases[0])) - failures,
+           (int) (sizeof(cases) / sizeof(cases[0])), MAX_POSITION_ERROR * 1000, MAX_HEADING_ERROR);
+    return failures > 0 ? 1 : 0;
+}
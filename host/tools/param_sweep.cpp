@@ -0,0 +1,527 @@
+/**
+ * @file param_sweep.cpp
+ * @brief Searches the line following gains and speed over simulated laps, reports the Pareto front
+ *
+ * Usage: param_sweep [-m grid|random|cmaes] [-n laps] [-g levels] [-j threads] [-t seconds] [-s seed]
+ *                    [-p id=value]... [-W rms_weight,margin_weight] [-o front.csv] [-a all.csv] [-w params.txt]
+ *                    track
+ *
+ * Each candidate is a closed loop lap of the firmware around the track (see track_sim), its
+ * parameters set with SV commands. The laps run in parallel, one child process each, from a work
+ * stealing pool with one worker per CPU core (-j to change). The searched parameters are the
+ * sensor PID kp, kd and tau, the line following velocity and the cutoff of the sensor array
+ * output filter (sent as its a0 coefficient), over the ranges of sweep_params.
+ *
+ *   grid    every combination of -g levels per parameter (default 4, 1024 laps)
+ *   random  -n laps (default 1000) uniform over the ranges (log scale for the gains, tau and cutoff)
+ *   cmaes   CMA-ES from the firmware defaults for -n laps (default 1000), minimising
+ *           lap time + rms_weight * RMS error (mm) - margin_weight * margin (mm), default 0.2,0.05
+ *
+ * Three objectives are kept for each completed lap: the lap time, the RMS distance of the sensor
+ * array centre to the line (tracking error) and the stability margin, the distance left between
+ * the worst excursion from the line and the outer sensors (2.5 sensor pitches from the centre),
+ * negative if the line went past them. The Pareto front of the completed laps is printed, -o
+ * writes it as CSV and -w writes the knee of the front (closest to the best of each objective once
+ * normalised over the front) as a command script for ground_station -s or track_sim -f: the SV
+ * commands, then EW to save them to flash, commented out. All the sensor noise uses the -s seed,
+ * so the candidates are compared on the same noise.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "buggy_sim.h"
+#include "cma_es.h"
+#include "constants.h"
+#include "lap_runner.h"
+#include "track.h"
+#include "work_pool.h"
+
+
+#define SWEEP_DIMENSIONS    5
+#define FAILED_COST         100         // added to the distance left for a lap not completed
+#define BOUND_PENALTY       100         // per squared normalised distance out of the ranges
+#define CMAES_SIGMA         0.2         // initial step size, the ranges are normalised to 0..1
+
+
+/**
+ * @brief A searched parameter, sent as SV id value.
+ */
+struct Sweep_param
+{
+    int id;                         ///< firmware parameter id
+    const char* name;
+    double min;
+    double max;
+    double start;                   ///< firmware default
+    bool log_scale;
+    bool cutoff;                    ///< searched as a cutoff in Hz, sent as the a0 coefficient of the low-pass
+};
+
+
+static double cutoff_to_a0(double cutoff_hz)
+{
+    // first order low-pass by the bilinear transform (prewarped) at the sensor update rate
+    double k = tan(M_PI * cutoff_hz / SENSOR_UPDATE_RATE);
+    return (1 - k) / (1 + k);
+}
+
+
+static double a0_to_cutoff(double a0)
+{
+    return atan((1 - a0) / (1 + a0)) * SENSOR_UPDATE_RATE / M_PI;
+}
+
+
+// ids of the firmware parameter table (GV lists them)
+static const Sweep_param sweep_params[SWEEP_DIMENSIONS] =
+{
+    {7,     "s_kp",         0.05,       1.5,        PID_S_KP,               true,   false},
+    {9,     "s_kd",         0.005,      0.3,        PID_S_KD,               true,   false},
+    {10,    "s_tau",        0.0002,     0.02,       PID_S_TAU,              true,   false},
+    {20,    "lf_vel",       1.0,        3.0,        LINE_FOLLOW_VELOCITY,   false,  false},
+    {42,    "sn_lp_hz",     20,         1200,       a0_to_cutoff(LP_SENS_A0), true, true},
+};
+
+
+struct Evaluation
+{
+    double x[SWEEP_DIMENSIONS];     ///< normalised position, 0..1 within the ranges
+    double value[SWEEP_DIMENSIONS]; ///< parameter values (cutoff in Hz)
+    bool completed;
+    double lap_time;                ///< s
+    double rms_mm;
+    double margin_mm;
+    double progress;                ///< m
+    double cost;                    ///< CMA-ES cost
+};
+
+
+static double to_value(const Sweep_param& param, double x)
+{
+    x = fmin(fmax(x, 0), 1);
+    if (param.log_scale)
+    {
+        return param.min * pow(param.max / param.min, x);
+    }
+    return param.min + (param.max - param.min) * x;
+}
+
+
+static double to_position(const Sweep_param& param, double value)
+{
+    if (param.log_scale)
+    {
+        return log(value / param.min) / log(param.max / param.min);
+    }
+    return (value - param.min) / (param.max - param.min);
+}
+
+
+static std::string sv_command(const Sweep_param& param, double value)
+{
+    char command[64];
+    snprintf(command, sizeof(command), "SV %d %.6g", param.id, param.cutoff ? cutoff_to_a0(value) : value);
+    return command;
+}
+
+
+static bool dominates(const Evaluation& a, const Evaluation& b)
+{
+    bool no_worse = a.lap_time <= b.lap_time && a.rms_mm <= b.rms_mm && a.margin_mm >= b.margin_mm;
+    bool better = a.lap_time < b.lap_time || a.rms_mm < b.rms_mm || a.margin_mm > b.margin_mm;
+    return no_worse && better;
+}
+
+
+/**
+ * @brief Runs the laps of a batch on the pool and waits for them.
+ */
+static void evaluate(WorkPool* pool, const Lap_job& base, const std::vector<std::string>& fixed,
+                     std::vector<Evaluation*>& batch, double rms_weight, double margin_weight)
+{
+    for (Evaluation* evaluation : batch)
+    {
+        pool->submit([evaluation, &base, &fixed, rms_weight, margin_weight]()
+        {
+            Lap_job job = base;
+            job.commands = fixed;
+            for (int i = 0; i < SWEEP_DIMENSIONS; i++)
+            {
+                evaluation->value[i] = to_value(sweep_params[i], evaluation->x[i]);
+                job.commands.push_back(sv_command(sweep_params[i], evaluation->value[i]));
+            }
+            Lap_outcome outcome = run_lap(job);
+            const Sim_result& result = outcome.result;
+            evaluation->completed = outcome.ran && result.finished;
+            evaluation->lap_time = result.lap_time;
+            evaluation->rms_mm = result.rms_lateral * 1000;
+            evaluation->margin_mm = (2.5 * job.sensors.pitch - result.max_lateral) * 1000;
+            evaluation->progress = outcome.ran ? result.progress : 0;
+            if (evaluation->completed)
+            {
+                evaluation->cost = evaluation->lap_time + rms_weight * evaluation->rms_mm -
+                                   margin_weight * evaluation->margin_mm;
+            }
+            else
+            {
+                evaluation->cost = FAILED_COST + base.track->get_length() - evaluation->progress;
+            }
+        });
+    }
+    pool->wait();
+}
+
+
+static void write_csv(FILE* out, const std::vector<const Evaluation*>& evaluations, bool with_status)
+{
+    for (int i = 0; i < SWEEP_DIMENSIONS; i++)
+    {
+        fprintf(out, "%s,", sweep_params[i].name);
+    }
+    fprintf(out, "%slap_s,rms_mm,margin_mm\n", with_status ? "completed,progress_m," : "");
+    for (const Evaluation* e : evaluations)
+    {
+        for (int i = 0; i < SWEEP_DIMENSIONS; i++)
+        {
+            fprintf(out, "%.6g,", e->value[i]);
+        }
+        if (with_status)
+        {
+            fprintf(out, "%d,%.3f,", e->completed ? 1 : 0, e->progress);
+        }
+        fprintf(out, "%.4f,%.3f,%.3f\n", e->lap_time, e->rms_mm, e->margin_mm);
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    const char* method = "random";
+    int laps = 1000;
+    int levels = 4;
+    int threads = 0;
+    double max_s = 30;
+    unsigned seed = 1;
+    double rms_weight = 0.2;
+    double margin_weight = 0.05;
+    const char* front_path = NULL;
+    const char* all_path = NULL;
+    const char* params_path = NULL;
+    const char* track_path = NULL;
+    std::vector<std::string> fixed;
+    bool valid = true;
+
+    for (int i = 1; i < argc && valid; i++)
+    {
+        bool has_value = (i + 1 < argc);
+        if (strcmp(argv[i], "-m") == 0 && has_value)
+        {
+            method = argv[++i];
+        }
+        else if (strcmp(argv[i], "-n") == 0 && has_value)
+        {
+            laps = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-g") == 0 && has_value)
+        {
+            levels = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-j") == 0 && has_value)
+        {
+            threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-t") == 0 && has_value)
+        {
+            max_s = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-s") == 0 && has_value)
+        {
+            seed = (unsigned) atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-p") == 0 && has_value && strchr(argv[i + 1], '=') != NULL)
+        {
+            std::string param = argv[++i];
+            param[param.find('=')] = ' ';
+            fixed.push_back("SV " + param);
+        }
+        else if (strcmp(argv[i], "-W") == 0 && has_value)
+        {
+            valid = sscanf(argv[++i], "%lf,%lf", &rms_weight, &margin_weight) == 2;
+        }
+        else if (strcmp(argv[i], "-o") == 0 && has_value)
+        {
+            front_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-a") == 0 && has_value)
+        {
+            all_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-w") == 0 && has_value)
+        {
+            params_path = argv[++i];
+        }
+        else if (argv[i][0] != '-' && track_path == NULL)
+        {
+            track_path = argv[i];
+        }
+        else
+        {
+            valid = false;
+        }
+    }
+    bool grid = strcmp(method, "grid") == 0;
+    bool cmaes = strcmp(method, "cmaes") == 0;
+    if (!grid && !cmaes && strcmp(method, "random") != 0)
+    {
+        valid = false;
+    }
+    if (!valid || track_path == NULL || laps <= 0 || levels < 2)
+    {
+        fprintf(stderr, "usage: %s [-m grid|random|cmaes] [-n laps] [-g levels] [-j threads] [-t seconds] [-s seed]\n"
+                        "       [-p id=value]... [-W rms_weight,margin_weight] [-o front.csv] [-a all.csv] "
+                        "[-w params.txt] track\n", argv[0]);
+        return 2;
+    }
+
+    Track track;
+    std::string error;
+    if (!track.load(track_path, &error))
+    {
+        fprintf(stderr, "%s: %s\n", track_path, error.c_str());
+        return 2;
+    }
+    Lap_job base = default_lap_job(track);
+    base.seed = seed;
+    base.max_time = max_s;
+
+    WorkPool pool(threads);
+    std::vector<Evaluation> evaluations;
+    auto start = std::chrono::steady_clock::now();
+
+    if (grid)
+    {
+        int count = 1;
+        for (int i = 0; i < SWEEP_DIMENSIONS; i++)
+        {
+            count *= levels;
+        }
+        evaluations.resize(count);
+        for (int k = 0; k < count; k++)
+        {
+            for (int i = 0, rest = k; i < SWEEP_DIMENSIONS; i++, rest /= levels)
+            {
+                evaluations[k].x[i] = (double) (rest % levels) / (levels - 1);
+            }
+        }
+    }
+    else if (!cmaes)
+    {
+        std::mt19937 engine(seed);
+        std::uniform_real_distribution<double> uniform(0, 1);
+        evaluations.resize(laps);
+        for (Evaluation& e : evaluations)
+        {
+            for (int i = 0; i < SWEEP_DIMENSIONS; i++)
+            {
+                e.x[i] = uniform(engine);
+            }
+        }
+    }
+
+    if (!cmaes)
+    {
+        std::vector<Evaluation*> batch;
+        for (Evaluation& e : evaluations)
+        {
+            batch.push_back(&e);
+        }
+        evaluate(&pool, base, fixed, batch, rms_weight, margin_weight);
+    }
+    else
+    {
+        // the generations are at least as large as the pool so every core is busy
+        std::vector<double> position(SWEEP_DIMENSIONS);
+        for (int i = 0; i < SWEEP_DIMENSIONS; i++)
+        {
+            position[i] = to_position(sweep_params[i], sweep_params[i].start);
+        }
+        int lambda = std::max(CmaEs::default_lambda(SWEEP_DIMENSIONS), pool.get_thread_count());
+        CmaEs optimizer(position, CMAES_SIGMA, lambda, seed);
+        evaluations.reserve(laps + lambda);
+
+        while ((int) evaluations.size() + lambda <= laps)
+        {
+            std::vector<std::vector<double>> candidates = optimizer.ask();
+            size_t first = evaluations.size();
+            evaluations.resize(first + lambda);
+            std::vector<Evaluation*> batch;
+            for (int k = 0; k < lambda; k++)
+            {
+                for (int i = 0; i < SWEEP_DIMENSIONS; i++)
+                {
+                    evaluations[first + k].x[i] = candidates[k][i];
+                }
+                batch.push_back(&evaluations[first + k]);
+            }
+            evaluate(&pool, base, fixed, batch, rms_weight, margin_weight);
+
+            // the lap ran clamped to the ranges, the distance out of them is penalised
+            std::vector<double> costs(lambda);
+            double best = 0;
+            for (int k = 0; k < lambda; k++)
+            {
+                double out = 0;
+                for (int i = 0; i < SWEEP_DIMENSIONS; i++)
+                {
+                    double x = candidates[k][i];
+                    double excess = (x < 0) ? -x : ((x > 1) ? x - 1 : 0);
+                    out += excess * excess;
+                }
+                costs[k] = batch[k]->cost + BOUND_PENALTY * out;
+                best = (k == 0) ? costs[k] : fmin(best, costs[k]);
+            }
+            optimizer.tell(candidates, costs);
+            fprintf(stderr, "generation %d: best cost %.3f, sigma %.3f\n", optimizer.get_generation(), best,
+                    optimizer.get_sigma());
+        }
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Pareto front of the completed laps, by lap time
+    std::vector<const Evaluation*> front;
+    std::vector<const Evaluation*> all;
+    int completed = 0;
+    for (const Evaluation& candidate : evaluations)
+    {
+        all.push_back(&candidate);
+        if (!candidate.completed)
+        {
+            continue;
+        }
+        completed++;
+        bool dominated = false;
+        for (const Evaluation& other : evaluations)
+        {
+            if (other.completed && dominates(other, candidate))
+            {
+                dominated = true;
+                break;
+            }
+        }
+        if (!dominated)
+        {
+            front.push_back(&candidate);
+        }
+    }
+    std::sort(front.begin(), front.end(), [](const Evaluation* a, const Evaluation* b)
+    {
+        return a->lap_time < b->lap_time;
+    });
+
+    printf("%s: %s search, %zu laps (%d completed) in %.1f s, %.1f laps/s on %d workers, %llu steals\n", track_path,
+           method, evaluations.size(), completed, elapsed, evaluations.size() / elapsed, pool.get_thread_count(),
+           (unsigned long long) pool.get_steals());
+    if (front.empty())
+    {
+        printf("no lap completed\n");
+        return 1;
+    }
+
+    // knee: closest to the best of each objective, normalised over the front
+    double low[3] = {1e30, 1e30, 1e30};
+    double high[3] = {-1e30, -1e30, -1e30};
+    for (const Evaluation* e : front)
+    {
+        double objectives[3] = {e->lap_time, e->rms_mm, -e->margin_mm};
+        for (int i = 0; i < 3; i++)
+        {
+            low[i] = fmin(low[i], objectives[i]);
+            high[i] = fmax(high[i], objectives[i]);
+        }
+    }
+    const Evaluation* knee = front[0];
+    double knee_distance = 1e30;
+    for (const Evaluation* e : front)
+    {
+        double objectives[3] = {e->lap_time, e->rms_mm, -e->margin_mm};
+        double distance = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            double normalised = (high[i] > low[i]) ? (objectives[i] - low[i]) / (high[i] - low[i]) : 0;
+            distance += normalised * normalised;
+        }
+        if (distance < knee_distance)
+        {
+            knee_distance = distance;
+            knee = e;
+        }
+    }
+
+    printf("Pareto front, %zu laps:\n", front.size());
+    printf("%8s %8s %10s ", "lap s", "rms mm", "margin mm");
+    for (int i = 0; i < SWEEP_DIMENSIONS; i++)
+    {
+        printf(" %9s", sweep_params[i].name);
+    }
+    printf("\n");
+    for (const Evaluation* e : front)
+    {
+        printf("%8.3f %8.2f %10.2f ", e->lap_time, e->rms_mm, e->margin_mm);
+        for (int i = 0; i < SWEEP_DIMENSIONS; i++)
+        {
+            printf(" %9.4g", e->value[i]);
+        }
+        printf("%s\n", (e == knee) ? "  knee" : "");
+    }
+
+    if (front_path != NULL || all_path != NULL)
+    {
+        const char* paths[2] = {front_path, all_path};
+        for (int i = 0; i < 2; i++)
+        {
+            if (paths[i] == NULL)
+            {
+                continue;
+            }
+            FILE* out = fopen(paths[i], "w");
+            if (out == NULL)
+            {
+                fprintf(stderr, "cannot create %s\n", paths[i]);
+                return 2;
+            }
+            write_csv(out, (i == 0) ? front : all, i == 1);
+            fclose(out);
+        }
+    }
+    if (params_path != NULL)
+    {
+        FILE* out = fopen(params_path, "w");
+        if (out == NULL)
+        {
+            fprintf(stderr, "cannot create %s\n", params_path);
+            return 2;
+        }
+        fprintf(out, "# param_sweep %s search on %s: lap %.3f s, rms %.2f mm, margin %.2f mm\n", method, track_path,
+                knee->lap_time, knee->rms_mm, knee->margin_mm);
+        for (const std::string& command : fixed)
+        {
+            fprintf(out, "%s\n", command.c_str());
+        }
+        for (int i = 0; i < SWEEP_DIMENSIONS; i++)
+        {
+            fprintf(out, "%s\n", sv_command(sweep_params[i], knee->value[i]).c_str());
+        }
+        fprintf(out, "# EW\n");
+        fclose(out);
+    }
+    return 0;
+}
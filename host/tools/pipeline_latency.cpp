@@ -0,0 +1,232 @@
+/**
+ * @file pipeline_latency.cpp
+ * @brief Compares the sensor to PWM latency of separate tickers and of the scheduler tick
+ *
+ * Usage: pipeline_latency [-n boots] [-t seconds] [-i irq_us] [-s seed]
+ *
+ * Simulates the sensor and control ISRs on one CPU in virtual time and measures, for each control
+ * update, the time from the start of the sensor acquisition it uses to the motor PWM update:
+ *
+ * - tickers: the old firmware, a sensor ticker and a control ticker attached one after the other,
+ *   so their relative phase is whatever it was at boot (random here, one per boot)
+ * - scheduler: the firmware TaskScheduler, the sensor task runs first on each tick and the control
+ *   task right after it on every other tick
+ *
+ * Both get the same task durations and the same random delays from the other interrupts. The jitter
+ * is reported within a boot (max - min latency, mean and worst over the boots) and between boots
+ * (spread of the mean latency of each boot).
+ *
+ *   -n  boots, each with its own ticker phase (default 100)
+ *   -t  simulated time per boot (default 2 s)
+ *   -i  max delay of a tick by the other interrupts (default 15 us)
+ *
+ */
+
+#include <algorithm>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "constants.h"
+#include "task_scheduler.h"
+
+
+#define SENSOR_MIN_US       55          // sensor task (acquisition, filter and PID_sensor)
+#define SENSOR_MAX_US       75
+#define PWM_MIN_US          35          // control task start to the PWM update
+#define PWM_MAX_US          60
+#define CONTROL_MIN_US      60          // whole control task
+#define CONTROL_MAX_US      90
+
+
+struct Options
+{
+    int boots;
+    double duration_s;
+    double irq_max_us;
+    unsigned seed;
+};
+
+
+/**
+ * @brief Latencies of one arrangement over all the boots.
+ */
+struct Result
+{
+    std::vector<double> all;
+    std::vector<double> boot_means;
+    std::vector<double> boot_jitters;
+
+    void add_boot(const std::vector<double>& latencies)
+    {
+        double total = 0;
+        for (double l : latencies)
+        {
+            total += l;
+        }
+        boot_means.push_back(total / latencies.size());
+        auto range = std::minmax_element(latencies.begin(), latencies.end());
+        boot_jitters.push_back(*range.second - *range.first);
+        all.insert(all.end(), latencies.begin(), latencies.end());
+    }
+
+    void print(const char* name)
+    {
+        std::sort(all.begin(), all.end());
+        double total = 0;
+        for (double l : all)
+        {
+            total += l;
+        }
+        double jitter_mean = 0;
+        for (double j : boot_jitters)
+        {
+            jitter_mean += j;
+        }
+        jitter_mean /= boot_jitters.size();
+        auto means = std::minmax_element(boot_means.begin(), boot_means.end());
+
+        printf("%-10s %7.1f %7.1f %7.1f %7.1f %7.1f %9.1f %9.1f %9.1f\n", name, total / all.size(), all.front(),
+               all[all.size() / 100], all[all.size() * 99 / 100], all.back(), jitter_mean,
+               *std::max_element(boot_jitters.begin(), boot_jitters.end()), *means.second - *means.first);
+    }
+};
+
+
+/* Virtual CPU shared by the simulations (the scheduler reads the clock through a function) */
+static double now;
+static double frame_start;
+static std::vector<double> latencies;
+static std::mt19937 random_engine;
+
+static double uniform(double min, double max)
+{
+    return std::uniform_real_distribution<double>(min, max)(random_engine);
+}
+
+static void sensor_task(float dt)
+{
+    frame_start = now;
+    now += uniform(SENSOR_MIN_US, SENSOR_MAX_US);
+}
+
+static void control_task(float dt)
+{
+    double pwm = now + uniform(PWM_MIN_US, PWM_MAX_US);
+    latencies.push_back(pwm - frame_start);
+    now += uniform(CONTROL_MIN_US, CONTROL_MAX_US);
+}
+
+
+/* Old firmware: two tickers with a random relative phase, the ISRs do not preempt each other */
+static void run_tickers(const Options& options)
+{
+    double next_sensor = SENSOR_UPDATE_PERIOD_US;
+    double next_control = SENSOR_UPDATE_PERIOD_US + uniform(0, CONTROL_UPDATE_PERIOD_US);
+    double cpu_free = 0;
+
+    now = 0;
+    frame_start = 0;
+    while (now < options.duration_s * 1e6)
+    {
+        bool sensor = next_sensor <= next_control;
+        double due = sensor ? next_sensor : next_control;
+        now = std::max(due, cpu_free) + uniform(0, options.irq_max_us);
+        if (sensor)
+        {
+            sensor_task(0);
+            next_sensor += SENSOR_UPDATE_PERIOD_US;
+        }
+        else
+        {
+            control_task(0);
+            next_control += CONTROL_UPDATE_PERIOD_US;
+        }
+        cpu_free = now;
+    }
+}
+
+
+/* Current firmware: one base tick running the scheduler task table */
+static void run_scheduler(const Options& options)
+{
+    const Task_def tasks[] =
+    {
+        {"sensor",  sensor_task,    1,                      0,  0},
+        {"control", control_task,   SCHED_CONTROL_DIVIDER,  0,  0},
+    };
+    TaskScheduler scheduler(tasks, 2, SCHED_BASE_PERIOD_US, []() -> uint32_t { return (uint32_t) now; });
+
+    now = 0;
+    frame_start = 0;
+    scheduler.start();
+    double next_tick = SCHED_BASE_PERIOD_US;
+    while (now < options.duration_s * 1e6)
+    {
+        now = std::max(next_tick, now) + uniform(0, options.irq_max_us);
+        scheduler.tick();
+        next_tick += SCHED_BASE_PERIOD_US;
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    Options options = {100, 2, 15, 1};
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool has_value = (i + 1 < argc);
+        if (strcmp(argv[i], "-n") == 0 && has_value)
+        {
+            options.boots = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-t") == 0 && has_value)
+        {
+            options.duration_s = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-i") == 0 && has_value)
+        {
+            options.irq_max_us = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-s") == 0 && has_value)
+        {
+            options.seed = (unsigned) atoi(argv[++i]);
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-n boots] [-t seconds] [-i irq_us] [-s seed]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (options.boots < 1)
+    {
+        options.boots = 1;
+    }
+
+    random_engine.seed(options.seed);
+    Result tickers;
+    Result scheduler;
+    for (int boot = 0; boot < options.boots; boot++)
+    {
+        latencies.clear();
+        run_tickers(options);
+        tickers.add_boot(latencies);
+
+        latencies.clear();
+        run_scheduler(options);
+        scheduler.add_boot(latencies);
+    }
+
+    printf("%d boots of %.0f s, sensor %d Hz, control %d Hz, other interrupts <= %.0f us\n", options.boots,
+           options.duration_s, SENSOR_UPDATE_RATE, CONTROL_UPDATE_RATE, options.irq_max_us);
+    printf("sensor acquisition start to PWM update (us)\n\n");
+    printf("%-10s %7s %7s %7s %7s %7s %9s %9s %9s\n", "", "mean", "min", "p1", "p99", "max", "jitter", "jitter",
+           "boot to");
+    printf("%-10s %7s %7s %7s %7s %7s %9s %9s %9s\n", "", "", "", "", "", "", "mean", "worst", "boot");
+    tickers.print("tickers");
+    scheduler.print("scheduler");
+    return 0;
+}
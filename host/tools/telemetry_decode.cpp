@@ -0,0 +1,100 @@
+/**
+ * @file telemetry_decode.cpp
+ * @brief Decodes a captured binary telemetry stream to CSV
+ *
+ * Usage: telemetry_decode [-t type] [file]
+ *
+ * Reads the raw bytes received from the bluetooth module (stdin if no file is given) and writes
+ * one CSV line per sample to stdout. With -t only frames of that type (name or number) are written,
+ * under a single header. Link statistics are written to stderr at the end.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "telemetry.h"
+#include "telemetry_csv.h"
+
+
+static int parse_type(const char* arg)
+{
+    for (int type = 1; type < 256; type++)
+    {
+        if (strcmp(telemetry_frame_name(type), arg) == 0)
+        {
+            return type;
+        }
+    }
+    return atoi(arg);
+}
+
+
+int main(int argc, char** argv)
+{
+    int filter = -1;
+    const char* path = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        {
+            filter = parse_type(argv[++i]);
+        }
+        else if (argv[i][0] == '-' && argv[i][1] != '\0')
+        {
+            fprintf(stderr, "usage: %s [-t type] [file]\n", argv[0]);
+            return 2;
+        }
+        else
+        {
+            path = argv[i];
+        }
+    }
+
+    FILE* in = path ? fopen(path, "rb") : stdin;
+    if (in == NULL)
+    {
+        perror(path);
+        return 1;
+    }
+
+    bool header_seen[256] = {false};
+    TelemetryStreamDecoder decoder;
+    Telemetry_frame frame;
+    int samples = 0;
+    int c;
+
+    if (filter > 0)
+    {
+        telemetry_csv_header(stdout, filter);
+    }
+
+    while ((c = fgetc(in)) != EOF)
+    {
+        if (!decoder.feed((uint8_t) c, &frame))
+        {
+            continue;
+        }
+        if (filter > 0 && frame.type != filter)
+        {
+            continue;
+        }
+        if (filter <= 0 && !header_seen[frame.type])
+        {
+            header_seen[frame.type] = true;
+            telemetry_csv_header(stdout, frame.type);
+        }
+        samples += telemetry_csv_frame(stdout, frame);
+    }
+
+    fprintf(stderr, "frames: %d, samples: %d, crc errors: %d, length errors: %d, lost: %d\n",
+            decoder.frames, samples, decoder.crc_errors, decoder.length_errors, decoder.lost);
+
+    if (in != stdin)
+    {
+        fclose(in);
+    }
+    return 0;
+}
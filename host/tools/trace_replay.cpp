@@ -0,0 +1,177 @@
+/**
+ * @file trace_replay.cpp
+ * @brief Replays a recorded trace through the control path and compares it with the recorded outputs
+ *
+ * Usage: trace_replay [-e tolerance] [-n runs] [-w replayed.csv] trace
+ *
+ * The trace has one frame per scheduler tick (see ReplayTrace): the raw sensor levels, encoder
+ * counts and set points the firmware used. Each frame goes through SensorArray::update(),
+ * Motor::update(), the odometry and the four PIDs (ControlReplay) and every output column present
+ * in the trace is compared with the replayed value. track_sim -r records traces from the firmware,
+ * -w writes the trace with the replayed outputs, which becomes the golden trace the next versions
+ * of the control classes are checked against.
+ *
+ * Prints for each compared output the max error, the frames over the tolerance and the first one,
+ * then the replay speed in frames per second (best of the runs, the comparison run not included).
+ * The exit code is 1 if an output is over the tolerance.
+ *
+ *   -e  absolute tolerance (default 1e-6)
+ *   -n  timed runs (default 5)
+ *
+ */
+
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "control_replay.h"
+
+
+int main(int argc, char** argv)
+{
+    double tolerance = 1e-6;
+    int runs = 5;
+    const char* write_path = NULL;
+    const char* trace_path = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool has_value = (i + 1 < argc);
+        if (strcmp(argv[i], "-e") == 0 && has_value)
+        {
+            tolerance = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-n") == 0 && has_value)
+        {
+            runs = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-w") == 0 && has_value)
+        {
+            write_path = argv[++i];
+        }
+        else if (argv[i][0] != '-' && trace_path == NULL)
+        {
+            trace_path = argv[i];
+        }
+        else
+        {
+            trace_path = NULL;
+            break;
+        }
+    }
+    if (trace_path == NULL)
+    {
+        fprintf(stderr, "usage: %s [-e tolerance] [-n runs] [-w replayed.csv] trace\n", argv[0]);
+        return 2;
+    }
+
+    ReplayTrace trace;
+    std::string error;
+    if (!trace.load(trace_path, &error))
+    {
+        fprintf(stderr, "%s: %s\n", trace_path, error.c_str());
+        return 2;
+    }
+    FILE* out = NULL;
+    if (write_path != NULL && (out = fopen(write_path, "w")) == NULL)
+    {
+        fprintf(stderr, "cannot create %s\n", write_path);
+        return 2;
+    }
+
+    // comparison run
+    ControlReplay replay;
+    double max_error[REPLAY_OUTPUTS] = {0};
+    long over[REPLAY_OUTPUTS] = {0};
+    long first_over[REPLAY_OUTPUTS];
+    long control_frames = 0;
+    const bool all_outputs[REPLAY_OUTPUTS] = {true, true, true, true, true, true, true, true};
+    if (out != NULL)
+    {
+        ReplayTrace::write_header(out, all_outputs);
+    }
+    for (size_t f = 0; f < trace.frames.size(); f++)
+    {
+        Replay_frame frame = trace.frames[f];
+        replay.step(frame.in, &frame.out);
+        control_frames += frame.in.control ? 1 : 0;
+        for (int i = 0; i < REPLAY_OUTPUTS; i++)
+        {
+            double difference = fabs((double) frame.out.value[i] - trace.frames[f].out.value[i]);
+            if (!trace.recorded[i])
+            {
+                continue;
+            }
+            max_error[i] = fmax(max_error[i], difference);
+            if (difference > tolerance && over[i]++ == 0)
+            {
+                first_over[i] = (long) f;
+            }
+        }
+        if (out != NULL)
+        {
+            ReplayTrace::write_frame(out, frame, all_outputs);
+        }
+    }
+    if (out != NULL)
+    {
+        fclose(out);
+    }
+
+    size_t frame_count = trace.frames.size();
+    double duration = frame_count > 0 ? trace.frames.back().in.time - trace.frames.front().in.time : 0;
+    printf("%s: %zu frames (%.3f s), %ld control updates\n", trace_path, frame_count, duration, control_frames);
+    bool passed = true;
+    bool compared = false;
+    for (int i = 0; i < REPLAY_OUTPUTS; i++)
+    {
+        if (!trace.recorded[i])
+        {
+            continue;
+        }
+        compared = true;
+        printf("%-10s max error %-12.3g", replay_output_names[i], max_error[i]);
+        if (over[i] > 0)
+        {
+            printf("%ld frames over %g, first at %.6f s\n", over[i], tolerance, trace.frames[first_over[i]].in.time);
+            passed = false;
+        }
+        else
+        {
+            printf("ok\n");
+        }
+    }
+    if (!compared)
+    {
+        printf("no output recorded, nothing compared\n");
+    }
+
+    // timed runs
+    double best_s = 0;
+    volatile float sink = 0;
+    for (int run = 0; run < runs && frame_count > 0; run++)
+    {
+        replay.reset();
+        Replay_outputs outputs;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t f = 0; f < frame_count; f++)
+        {
+            replay.step(trace.frames[f].in, &outputs);
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        sink = sink + outputs.value[0];
+        if (run == 0 || elapsed < best_s)
+        {
+            best_s = elapsed;
+        }
+    }
+    if (best_s > 0)
+    {
+        printf("replay %.0f frames/s (%.0f ns per frame, %.0fx real time)\n", frame_count / best_s,
+               best_s / frame_count * 1e9, duration / best_s);
+    }
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,322 @@
+/**
+ * @file track_sim.cpp
+ * @brief Runs the firmware around a simulated track and reports the lap
+ *
+ * Usage: track_sim [-t seconds] [-p id=value]... [-f script] [-n noise] [-a ambient] [-s seed] [-o trace.csv]
+ *                  [-r replay.csv] [-v] track
+ *
+ * The unmodified firmware runs on the host HAL in virtual time, closed through the buggy physics
+ * (BuggySim: motors, gearbox, battery, encoders, chassis and the six line sensors over the
+ * track). The buggy starts with its sensor array over the start of the line, the parameters are
+ * set with SV commands and line following is started with EF, like from the ground station.
+ *
+ * Reports the lap time (from EF to the end of the lap, or of the line on an open track), the max
+ * and RMS distance of the sensor array centre to the line and the number of times all the sensors
+ * lost the line. The exit code is 1 if the lap was not completed.
+ *
+ *   -t  max virtual time (default 60 s)
+ *   -p  firmware parameter (GV lists the ids), repeatable
+ *   -f  sends the commands of a script before the start, one per line ('#' comments), like the
+ *       parameter sets written by param_sweep
+ *   -n  sensor noise, standard deviation of the ADC level (default 0.01)
+ *   -a  ambient light, ADC level added to all the sensors (default 0)
+ *   -o  writes the buggy state as CSV every 10 ms
+ *   -r  records the sensor levels, encoder counts, set points and outputs of the control path at
+ *       every scheduler tick, for trace_replay (exact with the default parameters)
+ *   -v  prints what the firmware sends
+ *
+ */
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "PID.h"
+#include "buggy_sim.h"
+#include "control_replay.h"
+#include "host_hal.h"
+#include "lap_runner.h"
+#include "motor.h"
+#include "odometry.h"
+#include "pin_assignments.h"
+#include "sensor_array.h"
+#include "task_scheduler.h"
+#include "track.h"
+
+
+#define PARAMS_TIME         0.05        // s, parameters sent after the boot messages
+#define START_TIME          0.2         // s, line following started
+#define PHYSICS_STEP        0.0001      // s
+#define TRACE_PERIOD        0.01        // s
+
+#define SENSOR_TASK         0           // scheduler task table indexes
+#define CONTROL_TASK        1
+
+int firmware_main(void);
+
+// firmware globals read by the recorder
+extern SensorArray sensor_array;
+extern Motor motor_left;
+extern Motor motor_right;
+extern Odometry odometry;
+extern PID PID_motor_left;
+extern PID PID_motor_right;
+extern PID PID_angle;
+extern PID PID_sensor;
+extern TaskScheduler scheduler;
+extern volatile uint32_t reset_requests;
+extern volatile uint32_t reset_generation;
+
+static const PinName sensor_pins[6] = {SENSOR0_IN_PIN, SENSOR1_IN_PIN, SENSOR2_IN_PIN,
+                                       SENSOR3_IN_PIN, SENSOR4_IN_PIN, SENSOR5_IN_PIN};
+
+
+/**
+ * @brief Records the replay trace of the firmware, one frame per scheduler tick.
+ *
+ * The sensor task reads the sensors first on every tick: the read of sensor 0 starts a frame (the
+ * encoder counts do not change until the tick ends) and ends the previous one, whose control path
+ * outputs are final by then. The angle PID does not run while line following, its output is not
+ * recorded.
+ */
+class TraceRecorder
+{
+private:
+
+    FILE* out;
+    Replay_frame frame;
+    bool started;
+    bool reset_pending;
+    uint32_t control_runs;
+
+    uint32_t get_control_runs(void)
+    {
+        Task_stats stats;
+        scheduler.get_task_stats(CONTROL_TASK, &stats);
+        return stats.runs;
+    }
+
+public:
+
+    TraceRecorder(FILE* out_)
+    {
+        out = out_;
+        started = false;
+        reset_pending = false;
+        control_runs = 0;
+        ReplayTrace::write_header(out, recorded_outputs());
+    }
+
+    static const bool* recorded_outputs(void)
+    {
+        static const bool recorded[REPLAY_OUTPUTS] = {true, true, true, false, true, true, true, true};
+        return recorded;
+    }
+
+    void sensor_read(int sensor, float level)
+    {
+        if (sensor == 0)
+        {
+            finish();
+            frame.in.time = hal::now();
+            frame.in.encoder[0] = hal::get_encoder(MOTORL_CHA_PIN);
+            frame.in.encoder[1] = hal::get_encoder(MOTORR_CHA_PIN);
+            // same float conversion as TaskScheduler::tick()
+            frame.in.sensor_dt = scheduler.get_last_dt_us(SENSOR_TASK) * 1e-6f;
+            reset_pending = (reset_generation != reset_requests);
+            control_runs = get_control_runs();
+            started = true;
+        }
+        frame.in.adc[sensor] = level;
+    }
+
+    void finish(void)
+    {
+        if (!started)
+        {
+            return;
+        }
+        frame.in.control = (get_control_runs() != control_runs);
+        frame.in.reset = frame.in.control && reset_pending;
+        frame.in.control_dt = scheduler.get_last_dt_us(CONTROL_TASK) * 1e-6f;
+        frame.in.sensor_sp = *PID_sensor.get_terms()[1];
+        frame.in.angle_sp = *PID_angle.get_terms()[1];
+        frame.in.wheel_sp[0] = *PID_motor_left.get_terms()[1];
+        frame.in.wheel_sp[1] = *PID_motor_right.get_terms()[1];
+
+        frame.out.value[0] = sensor_array.get_filtered_output();
+        frame.out.value[1] = PID_sensor.get_output();
+        frame.out.value[2] = odometry.get_pose().heading_deg;
+        frame.out.value[3] = PID_angle.get_output();
+        frame.out.value[4] = motor_left.get_filtered_speed();
+        frame.out.value[5] = motor_right.get_filtered_speed();
+        frame.out.value[6] = PID_motor_left.get_output();
+        frame.out.value[7] = PID_motor_right.get_output();
+        ReplayTrace::write_frame(out, frame, recorded_outputs());
+        started = false;
+    }
+};
+
+
+int main(int argc, char** argv)
+{
+    double max_s = 60;
+    unsigned seed = 1;
+    const char* trace_path = NULL;
+    const char* replay_path = NULL;
+    const char* track_path = NULL;
+    bool verbose = false;
+    std::vector<std::string> commands;
+    Plant_params plant = default_plant_params();
+    Sensor_params sensors = default_sensor_params();
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool has_value = (i + 1 < argc);
+        if (strcmp(argv[i], "-t") == 0 && has_value)
+        {
+            max_s = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-p") == 0 && has_value && strchr(argv[i + 1], '=') != NULL)
+        {
+            std::string param = argv[++i];
+            param[param.find('=')] = ' ';
+            commands.push_back("SV " + param + "\n");
+        }
+        else if (strcmp(argv[i], "-f") == 0 && has_value)
+        {
+            std::vector<std::string> script;
+            if (!load_commands(argv[++i], &script))
+            {
+                fprintf(stderr, "cannot open %s\n", argv[i]);
+                return 2;
+            }
+            for (const std::string& command : script)
+            {
+                commands.push_back(command + "\n");
+            }
+        }
+        else if (strcmp(argv[i], "-n") == 0 && has_value)
+        {
+            sensors.noise = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-a") == 0 && has_value)
+        {
+            sensors.ambient = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-s") == 0 && has_value)
+        {
+            seed = (unsigned) atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-o") == 0 && has_value)
+        {
+            trace_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-r") == 0 && has_value)
+        {
+            replay_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-v") == 0)
+        {
+            verbose = true;
+        }
+        else if (argv[i][0] != '-' && track_path == NULL)
+        {
+            track_path = argv[i];
+        }
+        else
+        {
+            track_path = NULL;
+            break;
+        }
+    }
+    if (track_path == NULL)
+    {
+        fprintf(stderr, "usage: %s [-t seconds] [-p id=value]... [-f script] [-n noise] [-a ambient] [-s seed] "
+                        "[-o trace.csv] [-r replay.csv] [-v] track\n", argv[0]);
+        return 2;
+    }
+
+    Track track;
+    std::string error;
+    if (!track.load(track_path, &error))
+    {
+        fprintf(stderr, "%s: %s\n", track_path, error.c_str());
+        return 2;
+    }
+    FILE* trace = NULL;
+    if (trace_path != NULL && (trace = fopen(trace_path, "w")) == NULL)
+    {
+        fprintf(stderr, "cannot create %s\n", trace_path);
+        return 2;
+    }
+    FILE* replay = NULL;
+    if (replay_path != NULL && (replay = fopen(replay_path, "w")) == NULL)
+    {
+        fprintf(stderr, "cannot create %s\n", replay_path);
+        return 2;
+    }
+
+    BuggySim sim(track, plant, sensors, seed);
+    sim.attach(PHYSICS_STEP);
+    sim.set_trace(trace, TRACE_PERIOD);
+
+    TraceRecorder* recorder = (replay != NULL) ? new TraceRecorder(replay) : NULL;
+    for (int i = 0; i < 6 && recorder != NULL; i++)
+    {
+        hal::set_analog_source(sensor_pins[i], [&sim, recorder, i]()
+        {
+            float level = sim.sensor_level(i);
+            recorder->sensor_read(i, level);
+            return level;
+        });
+    }
+
+    for (const std::string& command : commands)
+    {
+        hal::at(PARAMS_TIME, [command]() { hal::serial_send(USBTX, command); });
+    }
+    hal::at(START_TIME, [&sim]()
+    {
+        hal::serial_send(USBTX, "EF\n");
+        sim.start_lap(hal::now());
+    });
+
+    if (verbose)
+    {
+        hal::on_serial_output(USBTX, [](char c) { putchar(c); });
+        hal::on_serial_output(BT_TX_PIN, [](char c) { putchar(c); });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    double reached_s = hal::run(firmware_main, max_s);
+    double real_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (trace != NULL)
+    {
+        fclose(trace);
+    }
+    if (recorder != NULL)
+    {
+        recorder->finish();
+        fclose(replay);
+    }
+
+    Sim_result result = sim.get_result();
+    printf("%s: %.2f m, %s\n", track_path, track.get_length(), track.is_closed() ? "closed" : "open");
+    if (result.finished)
+    {
+        printf("lap %.3f s", result.lap_time);
+    }
+    else
+    {
+        printf("%s after %.2f m", result.off_track ? "off track" : "not finished", result.progress);
+    }
+    printf(", max lateral %.1f mm, rms %.1f mm, %d line losses, max speed %.2f m/s, min battery %.2f V\n",
+           result.max_lateral * 1000, result.rms_lateral * 1000, result.line_losses, result.max_speed,
+           result.min_battery);
+    printf("%.3f s of firmware time in %.3f s\n", reached_s, real_s);
+    return result.finished ? 0 : 1;
+}
@@ -115,6 +115,15 @@ public:
      */
     void update(float set_point, float measurement);
 
+    /**
+     * @brief Updates the output of PID controller with the measured time since the last update
+     * 
+     * @param set_point The desired set point.
+     * @param measurement The current measurement.
+     * @param dt Time since the last update (secs), instead of the update period.
+     */
+    void update(float set_point, float measurement, float dt);
+
     /**
      * @brief Takes in the 3 parameters to set the PID coefficients values.
      * 
@@ -0,0 +1,152 @@
+/**
+ * @file black_box.h
+ * @brief Run data recorder kept in internal flash across resets and power-off
+ *
+ * Only depends on the C library so it can also be built on the host, the flash itself is
+ * programmed by the caller (see next_chunk()).
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+
+#define BLACKBOX_RECORD_SIZE    16      // bytes per record, a multiple of the write size
+#define BLACKBOX_QUEUE_SIZE     32      // records waiting to be written (more than a second at 25 Hz)
+
+
+/* RECORD TYPES (an erased record reads 0xFF) */
+enum Black_box_records
+{
+    bb_session = 0x01,          ///< start of a power-up: session number u16
+    bb_sample = 0x02,           ///< sensor output, wheel speeds, applied duties (x1000) int16 x5, battery (mV) u16
+    bb_mode = 0x03,             ///< mode transition: new mode u8, previous mode u8
+};
+
+
+/**
+ * @brief A decoded record.
+ */
+struct Black_box_record
+{
+    uint8_t type;               ///< Black_box_records
+    uint16_t time;              ///< time since the session start in 10 ms units (wraps after 655 s)
+    int session;                ///< bb_session
+    int mode;                   ///< bb_mode
+    int prev_mode;              ///< bb_mode
+    float sensor;               ///< bb_sample
+    float speed_l;
+    float speed_r;
+    float duty_l;
+    float duty_r;
+    float battery;
+};
+
+
+/**
+ * @brief Appends fixed size records to a flash region without ever blocking the control ISR.
+ *
+ * Records are built by the control ISR in a RAM queue. The main loop takes them from the queue
+ * a few bytes at a time with next_chunk() and programs them right after a control update, so
+ * the CPU stall caused by programming the flash always ends before the next update starts.
+ *
+ * Each record has a CRC-8 so a record cut by a reset is skipped. At startup recover() finds the
+ * end of the data from the previous sessions, the new session is appended after it. When the
+ * region is full the recording stops, it is only erased on request (erasing stalls the CPU for
+ * about a second).
+ */
+class BlackBox
+{
+private:
+
+    uint32_t address;
+    uint32_t size;
+    int write_size;
+
+    uint8_t queue[BLACKBOX_QUEUE_SIZE][BLACKBOX_RECORD_SIZE];
+    volatile int queue_head;            // next record added by the ISR
+    volatile int queue_tail;            // record being written by the main loop
+    int chunk_offset;                   // bytes of the tail record already written
+    uint32_t write_offset;              // region offset of the tail record
+    uint32_t reserved;                  // bytes of the records queued or written
+    uint32_t session_start_ms;
+    int session;
+    int records;
+    volatile int dropped;
+    int write_errors;
+    bool recording;
+
+    bool add(uint8_t* record);
+    void start_session(uint32_t offset, int number, uint32_t now_ms);
+    static void put_i16(uint8_t* at, float value, float scale);
+    static float get_i16(const uint8_t* at, float scale);
+
+public:
+
+    /**
+     * @brief Construct a new BlackBox object, not recording until recover() is called
+     *
+     * @param address_ flash address of the region
+     * @param size_ region size in bytes (whole sectors)
+     * @param write_size_ bytes programmed at once by the main loop (divides BLACKBOX_RECORD_SIZE)
+     */
+    BlackBox(uint32_t address_, uint32_t size_, int write_size_);
+
+    /**
+     * @brief Finds the end of the recorded data and starts a new session after it.
+     *
+     * @param contents the region as read from the flash (memory mapped)
+     * @param now_ms current time, the session start
+     * @return number of valid records found
+     */
+    int recover(const uint8_t* contents, uint32_t now_ms);
+
+    /**
+     * @brief Must be called after the region was erased, starts a new session at the start.
+     */
+    void erased(uint32_t now_ms);
+
+    /**
+     * @brief Queues a sample record, for the control ISR.
+     */
+    void add_sample(uint32_t now_ms, float sensor, float speed_l, float speed_r, float duty_l, float duty_r,
+                    float battery);
+
+    /**
+     * @brief Queues a mode transition record, for the control ISR.
+     */
+    void add_mode(uint32_t now_ms, int mode, int prev_mode);
+
+    /**
+     * @brief Gets the next bytes to program.
+     *
+     * @param chunk_address set to the flash address
+     * @param data set to the bytes
+     * @return false if nothing is waiting
+     */
+    bool next_chunk(uint32_t* chunk_address, const uint8_t** data);
+
+    /**
+     * @brief Must be called after programming the chunk returned by next_chunk().
+     *
+     * @param ok false if the flash program failed, the record is then skipped
+     */
+    void chunk_written(bool ok);
+
+    /**
+     * @brief Decodes a record read from the flash.
+     *
+     * @return false if the record is erased or its CRC is wrong
+     */
+    static bool decode(const uint8_t* data, Black_box_record* record);
+
+    int get_session(void);                  ///< session number of this power-up
+    int get_records(void);                  ///< records written in the region
+    int get_dropped(void);                  ///< records lost (queue or region full)
+    int get_write_errors(void);             ///< flash programs that failed
+    int get_pending(void);                  ///< records waiting in the queue
+    uint32_t get_used(void);                ///< bytes written in the region
+    uint32_t get_size(void);                ///< region size in bytes
+    bool is_full(void);                     ///< true when no more records fit
+};
@@ -7,6 +7,7 @@
 #pragma once
 
 #include "mbed.h"
+#include "telemetry.h"
 
 /**
  * @brief BLE HM-10 Interface Class
@@ -19,23 +20,72 @@
  * 
  * Has functions that sends and recieves individual characters in a loop (keep in mind 20 bytes limit)
  * 
- * "Continous update" and "send once" property are stored in the class but handled externally 
+ * Recieving is framed in the RX interrupt: commands end with '/' or a newline and can be split over
+ * several BLE packets, up to rx_queue_size complete commands are queued until the main loop reads them.
+ * Commands longer than 20 characters (framing errors) and commands recieved while the queue is full (overflows) 
+ * are dropped and counted. An optional hook sees each command in the RX interrupt first and can take it
+ * out of the queue, for the commands that cannot wait for the main loop (stops).
+ * 
+ * Sending is non-blocking: messages are queued in a ring buffer that is drained by the UART TX interrupt,
+ * if there is no space left for a whole message it is dropped and counted.
+ * 
+ * Binary telemetry frames (see telemetry.h) can be sent with send_telemetry(), each frame fits in one packet.
+ * 
+ * "Continous update", "send once" and "binary" property are stored in the class but handled externally 
  * 
  */
 class Bluetooth
 {
+public:
+
+    /**
+     * @brief Called by the RX ISR with each complete command, returns true if it was handled (not queued).
+     */
+    typedef bool (*Rx_hook)(const char* command);
+
 protected:
 
     const static int buffer_size = 20;  ///< Number of bits per packet (20)
+    const static int tx_ring_size = 1024;///< Size of the transmit ring buffer (about 1s at 9600 baud, a whole GV listing)
+    const static int rx_queue_size = 8; ///< Number of complete commands that can be queued
+
+    /* One recieved command */
+    struct Frame
+    {
+        char data[buffer_size + 1];
+    };
 
     RawSerial bt_serial;                ///< creates the RawSerial object to connect with the bluetooth module 
     bool continous_update;              ///< if this is true, sends data on each loop without bt commands.
     bool send_once;                     ///< true when get cmd is used
+    bool binary;                        ///< if this is true, data is sent as binary telemetry frames instead of text
+    uint8_t tx_seq;                     ///< sequence number of the next telemetry frame
     volatile int rx_index;              ///< keeps track of the next memory location to store the next char recieved
-    volatile bool data_complete;        ///< true if the incoming data if fully recieved
+    volatile bool data_complete;        ///< true if a command was taken from the queue and is in rx_buffer
     char tx_buffer[buffer_size + 1];    ///< buffer to store transmit data
-    char rx_buffer[buffer_size + 1];    ///< buffer to store recieved data
+    char rx_buffer[buffer_size + 1];    ///< command being processed by the main loop
+
+    Frame rx_frame;                     ///< command being assembled by the RX ISR
+    CircularBuffer<Frame, rx_queue_size> rx_queue; ///< complete commands waiting for the main loop
+    bool rx_discarding;                 ///< true while skipping the rest of a command that was too long
+    volatile int rx_overflows;          ///< number of commands dropped because the queue was full
+    volatile int rx_framing_errors;     ///< number of commands dropped because they were too long
+    Rx_hook rx_hook;                    ///< sees the commands before they are queued, NULL if none
+
+    CircularBuffer<char, tx_ring_size> tx_ring; ///< characters waiting to be transmitted
+    volatile bool tx_active;            ///< true while the TX interrupt is attached
+    volatile int tx_dropped;            ///< number of messages dropped because the ring buffer was full
     
+    /**
+     * @brief ISR that runs when the UART can accept more characters.
+     * 
+     * Moves characters from the ring buffer to the UART, detaches itself when the ring buffer is empty.
+     */
+    void data_transmit_ISR(void);
+
+    /* Attaches the TX ISR if it is not already running */
+    void start_transmit(void);
+
     /* This function used to initialise the Bluetooth object */
     void init(void);
     
@@ -52,8 +102,9 @@ public:
     Bluetooth(PinName TX_pin, PinName RX_pin, int baud_rate); 
 
     /**
-     * @brief Returns true if incoming data is fully recieved
+     * @brief Returns true if a complete command is ready in the rx buffer
      * 
+     * Takes the next command from the queue if the previous one was reset.
      */
     bool data_recieved_complete(void);
 
@@ -62,7 +113,8 @@ public:
      * 
      * This ISR will run for every character recieved by the bluetooth module.
      * 
-     * Each time this ISR is ran one character is stored into rx_buffer.
+     * Each time this ISR is ran one character is added to the command being assembled,
+     * the command is queued when the terminator ('/' or newline) is recieved.
      *  
      * rx_index stores the location of next memory location to store the next character
      * 
@@ -70,26 +122,77 @@ public:
     void data_recieved_ISR(void);
 
     /**
-     * @brief Resets the recieved data buffer for new incoming data.
+     * @brief Sets the hook called by the RX ISR with each complete command (NULL to remove it)
      * 
-     * Ideally used after processing recieved data. 
+     * @param hook must be ISR safe, returns true if the command was handled and must not be queued
+     */
+    void set_rx_hook(Rx_hook hook);
+
+    /**
+     * @brief Resets the recieved data buffer for new incoming data.
      * 
-     * Note: newly recieved data will be lost if rx_buffer was not reset
+     * Ideally used after processing recieved data, the next queued command is then available.
      */
     void reset_rx_buffer(void);
 
     /**
      * @brief Sends character array to the bluetooth
      * 
+     * Queues the characters followed by a newline and returns straight away.
+     * 
      * @param char_arr pointer to the character array
+     * @return true if queued, false if dropped because the transmit buffer is full
      */
-    void send_buffer(char* char_arr);
+    bool send_buffer(char* char_arr);
+
+    /**
+     * @brief Queues raw bytes to be sent to the bluetooth (no newline added)
+     * 
+     * @param data pointer to the bytes
+     * @param length number of bytes
+     * @return true if queued, false if dropped because the transmit buffer is full
+     */
+    bool send_bytes(const char* data, int length);
+
+    /**
+     * @brief Sends a binary telemetry frame
+     * 
+     * @param type frame type (Telemetry_types)
+     * @param payload pointer to the payload bytes
+     * @param length payload length (max TELEMETRY_MAX_PAYLOAD)
+     * @return number of bytes queued (encoded frame length), 0 if dropped
+     */
+    int send_telemetry(uint8_t type, const uint8_t* payload, int length);
+
+    /**
+     * @brief returns the number of messages dropped because the transmit buffer was full
+     * 
+     */
+    int get_tx_dropped(void);
+
+    /**
+     * @brief returns the number of commands dropped because the command queue was full
+     * 
+     */
+    int get_rx_overflows(void);
+
+    /**
+     * @brief returns the number of commands dropped because they were longer than 20 characters
+     * 
+     */
+    int get_rx_framing_errors(void);
+
+    /**
+     * @brief returns the number of bytes waiting in the transmit buffer
+     * 
+     */
+    int get_tx_pending(void);
 
     
     /**
      * @brief Sends formatted string to the bluetooth 
      * 
-     * Used the same way as printf()
+     * Used the same way as printf(), non-blocking like send_buffer()
      */
     void send_fstring(const char* format, ...);
 
@@ -105,6 +208,19 @@ public:
      */
     bool is_continous(void);
 
+    /**
+     * @brief returns true if binary telemetry is enabled
+     * 
+     */
+    bool is_binary(void);
+
+    /**
+     * @brief Set the binary property to the bool value passed
+     * 
+     * @param status bool value to be applied
+     */
+    void set_binary(bool status);
+
     /**
      * @brief returns true if send once is enabled
      * 
@@ -114,7 +230,7 @@ public:
     /**
      * @brief returns the raw data recieved as a character array
      * 
-     * @return pointer to the rx buffer (character array)
+     * @return pointer to the rx buffer (character array without the terminator)
      */
     char* get_rx_buffer(void);
     
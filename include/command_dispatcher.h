@@ -0,0 +1,146 @@
+/**
+ * @file command_dispatcher.h
+ * @brief Table-driven command parser and dispatcher
+ *
+ * Only depends on the C library so it can also be built on the host.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+
+#define CMD_MAX_ARGS        3       // max number of numeric arguments per command
+#define CMD_MAX_TYPES       8       // max number of different command types (first character)
+
+
+/* COMMAND ERRORS */
+enum Cmd_error
+{
+    cmd_ok = 0,
+    cmd_err_empty,                  ///< nothing to parse
+    cmd_err_unknown_type,           ///< first character is not a known command type
+    cmd_err_unknown_command,        ///< second character is not a known command of that type
+    cmd_err_unknown_object,         ///< object character missing or not allowed for the command
+    cmd_err_arg_count,              ///< wrong number of arguments
+    cmd_err_bad_number,             ///< an argument is not a number
+    cmd_err_rejected,               ///< the handler rejected the command (e.g. value out of range)
+};
+
+
+struct Command;
+
+/**
+ * @brief Parsed command passed to the handlers.
+ */
+struct Cmd_args
+{
+    const Command* command;         ///< table entry that matched
+    char object;                    ///< object character, '\0' if none
+    int count;                      ///< number of arguments parsed
+    float values[CMD_MAX_ARGS];     ///< arguments
+};
+
+typedef Cmd_error (*Cmd_handler)(const Cmd_args& args);
+
+
+/**
+ * @brief One entry of the command table.
+ *
+ * A command is written as "<type><name><object> <arg> <arg> ...", e.g. "SPL 0.5 7.5 0".
+ * Single character commands (e.g. "C") use name '\0'.
+ */
+struct Command
+{
+    char type;                      ///< first character
+    char name;                      ///< second character, '\0' for single character commands
+    const char* objects;            ///< allowed object characters, NULL if the command takes no object
+    bool object_optional;           ///< true if the object character may be left out
+    uint8_t min_args;               ///< minimum number of arguments
+    uint8_t max_args;               ///< maximum number of arguments (up to CMD_MAX_ARGS)
+    Cmd_handler handler;            ///< function called with the parsed arguments
+    int param;                      ///< passed to the handler through args.command->param
+};
+
+
+/**
+ * @brief Parses commands and dispatches them to the handler in a constant command table.
+ *
+ * Lookups are O(1): the constructor builds an index from (type, name) characters to the table entry.
+ * Numbers are parsed with a small tokenizer instead of sscanf. Nothing is allocated.
+ */
+class CommandDispatcher
+{
+private:
+
+    static const int name_slots = 37;   // '\0', 'A'-'Z', '0'-'9'
+
+    const Command* table;
+    int table_size;
+    char types[CMD_MAX_TYPES];                  // command type character of each type slot
+    int type_count;
+    uint8_t index[CMD_MAX_TYPES][name_slots];   // table index + 1, 0 if no command
+
+    int type_slot(char type);
+    static int name_slot(char name);
+
+public:
+
+    /**
+     * @brief Construct a new CommandDispatcher object
+     *
+     * @param table_ the command table, must stay valid
+     * @param table_size_ number of entries
+     */
+    CommandDispatcher(const Command* table_, int table_size_);
+
+    /**
+     * @brief Finds the table entry of a command.
+     *
+     * @return the entry, NULL if unknown
+     */
+    const Command* find(char type, char name);
+
+    /**
+     * @brief Number of entries of the command table.
+     */
+    int get_size(void);
+
+    /**
+     * @brief Returns an entry of the command table, NULL if out of range.
+     */
+    const Command* get_command(int command);
+
+    /**
+     * @brief Parses a command without calling the handler.
+     *
+     * @param line null terminated command
+     * @param args set to the parsed command and arguments
+     * @return cmd_ok or the parsing error
+     */
+    Cmd_error parse(const char* line, Cmd_args* args);
+
+    /**
+     * @brief Parses a command and calls its handler.
+     *
+     * @param line null terminated command
+     * @return cmd_ok, the parsing error or the handler error
+     */
+    Cmd_error dispatch(const char* line);
+
+    /**
+     * @brief Short description of an error (fits in a bluetooth packet).
+     */
+    static const char* error_string(Cmd_error error);
+};
+
+
+/**
+ * @brief Parses a decimal number ("-12", "0.5", "+3.25e-2").
+ *
+ * @param text start of the number, set to the first character after it
+ * @param value set to the parsed value
+ * @return true if a number was parsed
+ */
+bool cmd_parse_float(const char** text, float* value);
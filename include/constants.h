@@ -54,7 +54,7 @@
 /* OTHER CONSTANTS */
 
 // Sensor Array Constants
-#define SENS_SAMPLE_COUNT       1   // 5 - 311us, 3 - 195us   
+#define SENS_SAMPLE_COUNT       1   // ADC samples averaged per sensor, EB times the update with it
 #define SENS_ANGLE_COEFF        1
 #define SENS_DETECT_RANGE       0.4
 
@@ -83,21 +83,41 @@
 #define SQUARE_TURNING_RIGHT_ANGLE          92
 #define SQUARE_TURNING_LEFT_ANGLE           101.5
 #define SQUARE_DISTANCE                     1.01
+#define SQUARE_TURN_RADIUS                  0.15    // m, corners driven as arcs, 0 turns on the spot
+
+// Motion Script Constants
+#define MOTION_VELOCITY             0.4     // m/s, segments uploaded without a velocity
+#define MOTION_ACCEL                2       // m/s^2, velocity ramp between segments
+#define MOTION_END_VELOCITY         0.05    // m/s, a segment followed by a stop brakes to this at its end
+#define MOTION_LOST_DISTANCE        0.05    // m driven without line for a follow segment to end
 
 // Control Timing Constants
 #define CONTROL_UPDATE_RATE         2500                                    // Hz
 #define CONTROL_UPDATE_PERIOD       (1.0f / CONTROL_UPDATE_RATE)            // Seconds
 #define CONTROL_UPDATE_PERIOD_US    (int)(1'000'000 / CONTROL_UPDATE_RATE)  // Micro Seconds
 
-// Control Timing Constants
-#define SENSOR_UPDATE_RATE         5000                                    // Hz
-#define SENSOR_UPDATE_PERIOD       (1.0f / CONTROL_UPDATE_RATE)            // Seconds
-#define SENSOR_UPDATE_PERIOD_US    (int)(1'000'000 / CONTROL_UPDATE_RATE)  // Micro Seconds
+// Sensor Timing Constants
+#define SENSOR_UPDATE_RATE          5000                                    // Hz
+#define SENSOR_UPDATE_PERIOD        (1.0f / SENSOR_UPDATE_RATE)             // Seconds
+#define SENSOR_UPDATE_PERIOD_US     (int)(1'000'000 / SENSOR_UPDATE_RATE)   // Micro Seconds
 
 // Serial Update Timing Constants
 #define SERIAL_UPDATE_PERIOD        0.02     /// Seconds
 
-#define LOG_SIZE                    8'500
+// Scheduler Constants (every rate is an integer divisor of the base rate)
+#define SCHED_BASE_RATE             SENSOR_UPDATE_RATE                      // Hz, one tick per sensor update
+#define SCHED_BASE_PERIOD_US        (int)(1'000'000 / SCHED_BASE_RATE)      // Micro Seconds
+#define SCHED_CONTROL_DIVIDER       (SCHED_BASE_RATE / CONTROL_UPDATE_RATE)
+#define SCHED_SERIAL_DIVIDER        (int)(SERIAL_UPDATE_PERIOD * SCHED_BASE_RATE)
+
+// Profiler Constants
+#define PROFILE_CYCLES_PER_US       84      // DWT cycle counter frequency (core clock in MHz)
+
+// Benchmark (EB command): calls of each hot path function, timed one by one with the DWT cycle counter
+#define BENCH_DEFAULT_ITERATIONS    1000
+#define BENCH_MAX_ITERATIONS        20000
+
+#define LOG_RING_SIZE               32'768  // bytes of the ring logger (delta compressed samples)
 
 // Encoder Constants
 #define WHEEL_SEPERATION    0.188       
@@ -106,6 +126,7 @@
 #define LP_SPEED_B0         0.13575525       
 #define LP_SPEED_B1         0.13575525       
 #define LP_SPEED_A0         0.7284895      
+#define LP_SENS_A0          0.63946321          // sensor array output filter (also hardcoded in SensorArray)
 
 // 2 Hz Pole Freq:
 // Filter coefficients b_i: [0.0591174 0.0591174]
@@ -120,8 +141,55 @@
 // Motor Constants
 #define MOTOR_PWM_FREQ      20000
 
+// Traction Control (Slip/Stall) Constants
+#define TRACTION_ACCEL_WINDOW   50          // control updates per wheel acceleration measurement (20 ms)
+#define TRACTION_ACCEL_MARGIN   12.0        // m/s^2 over the set point acceleration, above the ~1 g the tyres can transmit
+#define TRACTION_SLEW_RATE      2.5         // duty cycle increase per second allowed after a slip
+#define STALL_DUTY              0.5         // duty cycle above which no ticks counts as stalled
+#define STALL_TIME              0.15        // s
+#define STALL_DUTY_CAP          0.3         // max duty cycle while stalled
+
+// Motor Deadband Compensation Constants (0 disables the compensation until calibrated)
+#define MOTOR_L_DEADBAND        0
+#define MOTOR_R_DEADBAND        0
+
+// Motor Duty Calibration Constants
+#define DUTY_CAL_RAMP_RATE      0.05        // duty cycle per second
+#define DUTY_CAL_MAX_DUTY       0.6         // also the lookup table range
+#define DUTY_CAL_MOVE_TIME      0.05        // s
+#define DUTY_CAL_MOVE_TICKS     8           // ticks per DUTY_CAL_MOVE_TIME to count as moving
+#define DUTY_CAL_SETTLE_TIME    0.2         // s
+#define DUTY_CAL_MEASURE_TIME   0.1         // s
+
 // Bluetooth HM10 module default config constants
 #define BT_BAUD_RATE        9600
 
+// PC serial commands
+#define PC_RX_BUFFER_SIZE   32
+
+// PC (USB) serial, fast enough for the log stream: 17 bytes per sample at the control rate is 42.5 KB/s
+#define PC_BAUD_RATE        921600
+#define LOG_STATUS_PERIOD   250         // control updates between log status frames (10 Hz)
+
+// Runtime parameters are saved to the last flash sector (sector 7, 128 KB), reserved in mbed_app.json
+#define PARAM_FLASH_ADDRESS     0x08060000
+#define PARAM_FLASH_SIZE        0x20000
+
+// Black box recorder in flash sector 6 (128 KB, 8192 records), the firmware is limited to sectors 0-5 in mbed_app.json
+#define BLACKBOX_FLASH_ADDRESS      0x08040000
+#define BLACKBOX_FLASH_SIZE         0x20000
+#define BLACKBOX_RATE               25          // Hz, samples recorded while running (about 5 minutes of runs)
+#define BLACKBOX_WRITE_SIZE         1           // bytes programmed at once between two scheduler ticks
+#define BLACKBOX_PROGRAM_MAX_US     100         // max byte program time (16 us typical), a write needs this much time before the next tick
+#define BLACKBOX_BATTERY_PERIOD_MS  1000        // battery measurement refresh (one-wire, main loop)
+
+// Binary telemetry: default wheel speed bursts per second (6 samples per frame, sampled at 240 Hz)
+#define TELEMETRY_BURST_RATE    40
+
+// Binary telemetry bandwidth budget, the HM-10 link carries at most 960 bytes/s at 9600 baud
+#define TELEMETRY_BUDGET        900         // bytes per second
+#define TELEMETRY_BURST         60          // bytes sent at once after an idle period
+#define TELEMETRY_MAX_RATE      100         // Hz, max subscription rate of a stream
+
 // Maths constant
 #define PI                  3.14159265
\ No newline at end of file
@@ -0,0 +1,164 @@
+/**
+ * @file duty_calibrator.h
+ * @brief Automatic on-track motor deadband and duty cycle lookup table calibration
+ *
+ */
+
+#pragma once
+
+#include "mbed.h"
+#include "motor.h"
+#include "parameters.h"
+
+
+/**
+ * @brief Parameter ids of the actuator compensation, apply() stages the results to them.
+ */
+struct Duty_cal_params
+{
+    uint8_t deadband[2];                ///< deadband of the left and right motors
+    uint8_t lut_enabled[2];             ///< param_bool, true to use the lookup table of the motor
+    uint8_t lut[2];                     ///< first of the lut_size - 2 inner points of each table (consecutive ids)
+};
+
+
+/**
+ * @brief Measures the actuator compensation of both motors while the buggy drives on the track.
+ *
+ * Requires the buggy to be on the track with some free space in front of it (about 1.5m).
+ * update() has to be called at the motor update rate, preferably in the control ISR after the motors are updated.
+ * The ramp counts the ticks from the first update() after start(), so the encoders can still be reset in between.
+ *
+ * Stages:
+ * 1. Ramp: the raw duty cycle of both motors is slowly increased until each wheel starts turning,
+ *    that duty cycle is the static friction deadband of the motor.
+ * 2. Levels (optional): the duty cycle is stepped through evenly spaced levels up to the max duty,
+ *    the steady state speed is measured at each level and a lookup table is built so the speed is
+ *    linear with the command.
+ *
+ * The compensation is disabled on both motors while calibrating, the results are applied with apply().
+ * Traction control is disabled too (the stall cap and the slew limit would change the duty cycles
+ * measured). Both are restored when the calibration ends, fails or is aborted.
+ */
+class DutyCalibrator
+{
+public:
+
+    static const int lut_size = 6;      ///< Number of lookup table points built
+
+private:
+
+    enum Stage
+    {
+        idle,
+        starting,
+        ramp,
+        settle,
+        measure,
+        done,
+        failed,
+    };
+
+    Motor* motors[2];                   // left and right motors
+    const int update_rate;              // rate at which update() is called (Hz)
+    const float ramp_step;              // duty cycle increase per update during the ramp
+    const float max_duty;               // highest duty cycle used, also the lookup table range
+    const int move_window;              // updates per movement check during the ramp
+    const int move_ticks;               // ticks in one window for the wheel to count as turning
+    const int settle_updates;           // updates to wait after each level change
+    const int measure_updates;          // updates to average the speed over
+
+    volatile Stage stage;
+    bool build_lut;                     // true to step through the levels after the ramp
+    int stage_updates;                  // updates spent in the current stage/window
+    int level;                          // current level index (1 to lut_size - 1)
+
+    float duty[2];                      // raw duty cycle currently applied
+    bool found[2];                      // true when the deadband of the motor is found
+    bool traction[2];                   // traction control state before the calibration, restored at the end
+    bool compensation[2];               // compensation state before the calibration, restored at the end
+    int window_ticks[2];                // tick count at the start of the movement window
+    float deadband[2];                  // measured deadband
+    float level_speed[2][lut_size];     // measured speed at each level, index 0 is the deadband (0 speed)
+    float speed_sum[2];                 // speed accumulated during a measurement
+    float lut[2][lut_size];             // resulting lookup tables
+
+    float level_duty(int motor, int level_index);
+    void make_lut(int motor);
+    void finish(Stage end_stage);
+
+public:
+
+    /**
+     * @brief Construct a new DutyCalibrator object
+     *
+     * @param left left motor
+     * @param right right motor
+     * @param updateRate rate at which update() is called (Hz)
+     * @param rampRate duty cycle increase per second during the ramp
+     * @param maxDuty highest duty cycle used, the calibration fails if a wheel does not turn below it
+     * @param moveTime time window of the movement check during the ramp (s)
+     * @param moveTicks ticks in one window for the wheel to count as turning
+     * @param settleTime time to wait after each level change (s)
+     * @param measureTime time to average the speed over at each level (s)
+     */
+    DutyCalibrator(Motor& left, Motor& right, int updateRate, float rampRate, float maxDuty,
+                   float moveTime, int moveTicks, float settleTime, float measureTime);
+
+    /**
+     * @brief Start the calibration.
+     *
+     * @param with_lut true to also build the lookup table, false to only measure the deadband
+     */
+    void start(bool with_lut);
+
+    /**
+     * @brief Stops the calibration and the motors.
+     */
+    void abort(void);
+
+    /**
+     * @brief Run one calibration step, preferably in the control ISR.
+     */
+    void update(void);
+
+    /**
+     * @brief Returns true while the calibration is running.
+     */
+    bool is_running(void);
+
+    /**
+     * @brief Returns true if the calibration finished successfully.
+     */
+    bool is_done(void);
+
+    /**
+     * @brief Returns true if the calibration failed (a wheel did not turn below the max duty).
+     */
+    bool is_failed(void);
+
+    /**
+     * @brief Applies the measured compensation to both motors and enables it.
+     *
+     * The results are also staged to the parameters so they survive the next parameter update and can be saved.
+     *
+     * @param registry parameters holding the compensation
+     * @param ids parameter ids of the deadbands and lookup tables
+     */
+    void apply(ParameterRegistry& registry, const Duty_cal_params& ids);
+
+    /**
+     * @brief Get the measured deadband of a motor.
+     *
+     * @param motor 0 for left, 1 for right
+     */
+    float get_deadband(int motor);
+
+    /**
+     * @brief Get the lookup table of a motor.
+     *
+     * @param motor 0 for left, 1 for right
+     * @return pointer to lut_size duty cycles, NULL if no lookup table was built
+     */
+    const float* get_lut(int motor);
+};
@@ -0,0 +1,122 @@
+/**
+ * @file log_serial.h
+ * @brief USB serial port carrying text replies and the binary log stream
+ *
+ */
+
+#pragma once
+
+#include "mbed.h"
+#include "telemetry.h"
+
+/**
+ * @brief USB Serial Port with a Double Buffered Transmitter
+ *
+ * Replaces the blocking Serial object used for the pc so logging can run continuously at the control rate.
+ *
+ * Bytes are written in the "filling" buffer while the UART TX interrupt drains the other one,
+ * the buffers are swapped each time the one being sent is empty. Writing never waits for the UART,
+ * a message that does not fit in the filling buffer is dropped and counted (the log records sent by the ISR).
+ *
+ * Text written with printf() waits for space instead since it is only used by the main loop,
+ * so replies are never lost even while the log stream fills the buffers.
+ *
+ * Binary frames use the same format as the bluetooth telemetry (see telemetry.h), they can be mixed with text lines.
+ *
+ */
+class LogSerial
+{
+protected:
+
+    const static int buffer_size = 1024;    ///< Size of each buffer (about 11ms at 921600 baud)
+    const static int text_size = 128;       ///< Max length of a printf() message
+
+    RawSerial serial;                       ///< RawSerial object of the USB serial port (can be used in ISRs)
+    uint8_t buffers[2][buffer_size];        ///< the filling buffer and the buffer being sent
+    volatile int fill_length[2];            ///< number of bytes written in each buffer
+    volatile int filling;                   ///< index of the buffer being filled
+    volatile int send_index;                ///< next byte to send from the other buffer
+    volatile bool tx_active;                ///< true while the TX interrupt is attached
+    uint8_t tx_seq;                         ///< sequence number of the next frame
+    volatile int dropped;                   ///< number of messages dropped because the buffer was full
+    volatile int bytes_sent;                ///< number of bytes handed to the UART
+
+    /**
+     * @brief ISR that runs when the UART can accept more characters.
+     *
+     * Sends the buffer that is not being filled, swaps the buffers when it is empty
+     * and detaches itself when both are empty.
+     */
+    void data_transmit_ISR(void);
+
+    /* Copies the bytes to the filling buffer and starts transmitting, must be called in a critical section */
+    bool queue(const uint8_t* data, int length);
+
+public:
+
+    /**
+     * @brief Construct a new LogSerial object
+     *
+     * @param TX_pin TX pin on the MCU
+     * @param RX_pin RX pin on the MCU
+     * @param baud_rate The serial baudrate
+     */
+    LogSerial(PinName TX_pin, PinName RX_pin, int baud_rate);
+
+    /**
+     * @brief Queues raw bytes, can be used in an ISR
+     *
+     * @param data pointer to the bytes
+     * @param length number of bytes
+     * @return true if queued, false if dropped because the filling buffer is full
+     */
+    bool write(const uint8_t* data, int length);
+
+    /**
+     * @brief Sends a binary frame, can be used in an ISR
+     *
+     * @param type frame type (Telemetry_types)
+     * @param payload pointer to the payload bytes
+     * @param length payload length (max TELEMETRY_MAX_PAYLOAD)
+     * @return number of bytes queued (encoded frame length), 0 if dropped
+     */
+    int send_telemetry(uint8_t type, const uint8_t* payload, int length);
+
+    /**
+     * @brief Sends formatted text, used the same way as printf()
+     *
+     * Waits for the transmitter if the buffer is full, must not be used in an ISR.
+     * Messages longer than 128 characters are truncated.
+     */
+    void printf(const char* format, ...);
+
+    /**
+     * @brief returns true if a character was recieved
+     *
+     */
+    bool readable(void);
+
+    /**
+     * @brief returns the next character recieved
+     *
+     */
+    int getc(void);
+
+    /**
+     * @brief returns the number of messages dropped because the buffer was full
+     *
+     */
+    int get_dropped(void);
+
+    /**
+     * @brief returns the number of bytes sent since the start
+     *
+     */
+    int get_bytes_sent(void);
+
+    /**
+     * @brief returns the number of bytes waiting to be sent
+     *
+     */
+    int get_pending(void);
+};
@@ -0,0 +1,170 @@
+/**
+ * @file mode_machine.h
+ * @brief Table-driven mode state machine fed by an event queue
+ *
+ * Only depends on the C library so it can also be built on the host.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+
+#define MODE_QUEUE_SIZE     8       // mode requests waiting for the main loop
+#define MODE_ANY            -1      // matches every mode in the transition table
+#define MODE_NONE           -1      // no mode
+
+
+typedef void (*Mode_action)(void);
+typedef bool (*Mode_guard)(int from, int to);
+typedef void (*Mode_change_hook)(int from, int to);
+
+
+/**
+ * @brief One mode, the state table is indexed by the mode number.
+ */
+struct Mode_state
+{
+    const char* name;
+    Mode_action entry;              ///< prepares the mode before it is entered, NULL if none
+    Mode_action exit;               ///< run by the control tick leaving the mode, NULL if none (must be ISR safe)
+    bool urgent;                    ///< entered from the control tick (entry must be ISR safe)
+};
+
+
+/**
+ * @brief One allowed transition, the first row matching a request is used.
+ *
+ * A request with no matching row, or whose guard returns false, is rejected.
+ */
+struct Mode_transition
+{
+    int from;                       ///< mode or MODE_ANY
+    int to;                         ///< mode or MODE_ANY
+    Mode_guard guard;               ///< NULL if always allowed
+};
+
+
+/**
+ * @brief Time from a request to the mode change.
+ */
+struct Mode_latency
+{
+    uint32_t count;
+    uint32_t last_us;
+    uint32_t max_us;
+    uint64_t total_us;              ///< for the mean
+};
+
+
+/**
+ * @brief Applies mode change requests in order, with guards and entry/exit actions.
+ *
+ * Requests are posted from anywhere (commands, ISRs, the mode logic) and queued. The mode itself
+ * is only changed by the control tick (process_urgent()), so the control algorithm never sees a
+ * half applied transition:
+ *
+ * - requests for an urgent mode (stops) skip the queue and cancel the pending requests, the
+ *   control tick applies them with their exit and entry actions, at most one tick later
+ * - other requests are checked against the transition table by the main loop (process()), which
+ *   runs the entry action (it may block: calibration, messages), then the control tick runs the
+ *   exit action of the old mode and switches the mode, so the old mode runs until its exit action
+ *   and the new mode starts from the state set by its entry action
+ *
+ * post() is not reentrant: when requests are posted from the main loop and an ISR, the main loop
+ * must post with the interrupts disabled.
+ */
+class ModeMachine
+{
+private:
+
+    struct Mode_event
+    {
+        int mode;
+        uint32_t time_us;
+        uint32_t stop_count;            // urgent changes before the request, older requests are cancelled
+    };
+
+    const Mode_state* states;
+    int state_count;
+    const Mode_transition* transitions;
+    int transition_count;
+    Mode_change_hook on_change;
+
+    volatile int current;
+    Mode_event queue[MODE_QUEUE_SIZE];
+    volatile int queue_head;
+    volatile int queue_tail;
+
+    volatile int urgent_mode;           // posted urgent request
+    volatile uint32_t urgent_time_us;
+    volatile uint32_t stop_count;       // urgent changes applied
+    volatile int requested_mode;        // request checked by the main loop, applied by the tick
+    volatile uint32_t requested_time_us;
+    volatile uint32_t requested_stop_count;
+
+    Mode_latency latency[2];            // normal, urgent
+    uint32_t transition_total;
+    uint32_t rejected;
+    uint32_t dropped;
+    int last_rejected;
+
+    bool allowed(int from, int to);
+    void record_latency(bool urgent, uint32_t us);
+
+public:
+
+    /**
+     * @brief Construct a new ModeMachine object
+     *
+     * @param states_ state table indexed by mode, must stay valid
+     * @param state_count_ number of modes
+     * @param transitions_ transition table, must stay valid
+     * @param transition_count_ number of rows
+     * @param on_change_ called by the control tick when the mode changes (must be ISR safe), NULL if none
+     */
+    ModeMachine(const Mode_state* states_, int state_count_, const Mode_transition* transitions_,
+                int transition_count_, Mode_change_hook on_change_);
+
+    /**
+     * @brief Sets the first mode and runs its entry action, before the control tick starts.
+     */
+    void start(int mode);
+
+    /**
+     * @brief Requests a mode change.
+     *
+     * @return false if the mode is invalid or the queue is full
+     */
+    bool post(int mode, uint32_t now_us);
+
+    /**
+     * @brief Applies an urgent request or the checked request, call at the start of the control tick.
+     */
+    void process_urgent(uint32_t now_us);
+
+    /**
+     * @brief Checks the next request and runs its entry action, call in the main loop.
+     */
+    void process(void);
+
+    /**
+     * @brief Copies the latency statistics of the normal or urgent transitions.
+     */
+    void get_latency(bool urgent, Mode_latency* copy);
+
+    /**
+     * @brief Clears the latency statistics and counters.
+     */
+    void reset_stats(void);
+
+    bool is_changing(void);                 ///< true while a request waits to be applied
+    int get_mode(void);                     ///< current mode
+    const char* get_name(int mode);
+    int get_pending(void);                  ///< requests waiting in the queue
+    uint32_t get_transitions(void);         ///< mode changes applied
+    uint32_t get_rejected(void);            ///< requests rejected by the table or a guard
+    uint32_t get_dropped(void);             ///< requests lost because the queue was full
+    int get_last_rejected(void);            ///< mode of the last rejected request, MODE_NONE if none
+};
@@ -0,0 +1,167 @@
+/**
+ * @file motion_script.h
+ * @brief Motion script interpreter for the scripted tasks (square task, venue specific manoeuvres)
+ *
+ * Only depends on the C library so it can also be built on the host.
+ *
+ */
+
+#pragma once
+
+
+/* SEGMENT TYPES (object character of the SN command) */
+enum Motion_types
+{
+    motion_straight = 'S',          ///< straight line: length (m)
+    motion_turn = 'T',              ///< turn on the spot or while rolling: angle (deg)
+    motion_arc = 'A',               ///< circular arc: length is the radius (m), angle (deg)
+    motion_follow = 'F',            ///< follow the line until it is lost, or for length (m) if not 0
+    motion_wait = 'W',              ///< stand still: length is the time (s)
+};
+
+
+/**
+ * @brief One segment of a motion script.
+ *
+ * Angles are relative to the heading at the end of the previous segment, positive turns right
+ * (same sign as the odometry heading).
+ */
+struct Motion_segment
+{
+    char type;                      ///< Motion_types
+    float length;                   ///< m, arc radius (m) or wait time (s)
+    float angle;                    ///< deg, turns and arcs only
+    float velocity;                 ///< cruise velocity (m/s), 0 for a turn on the spot
+};
+
+
+/**
+ * @brief Set points computed by MotionScript::update().
+ */
+struct Motion_output
+{
+    float velocity;                 ///< forward velocity (m/s)
+    float heading_deg;              ///< heading set point of the angle PID (odometry frame)
+    float turn_offset;              ///< feed forward wheel speed difference of arcs, added to the left and taken from the right (m/s)
+    bool follow;                    ///< true while following the line, the heading set point is not used
+    bool finished;                  ///< true on the update the last segment ends
+};
+
+
+/**
+ * @brief Runs a list of motion segments without blocking, one step per control update.
+ *
+ * The velocity is blended between segments: it is ramped at the acceleration limit and looks
+ * ahead to the entry velocity of the next segment, so a segment only slows down as much as the
+ * next one needs (a straight into an arc keeps its speed, a straight into a turn on the spot
+ * brakes to stand still exactly at its end). Turns and follow segments keep their velocity until
+ * they end, the next segment brakes. Distances and angles ending a segment are carried
+ * to the next one, the errors do not add up over the script.
+ *
+ * The script is edited from main() while stopped, update() runs in the control ISR.
+ */
+class MotionScript
+{
+public:
+
+    static const int max_segments = 32;     ///< Max number of segments in a script
+
+private:
+
+    enum State
+    {
+        idle,
+        starting,
+        running,
+        done,
+    };
+
+    Motion_segment segments[max_segments];
+    int count;
+
+    const float wheel_separation;   // m, for the arc feed forward
+    const float end_velocity;       // velocity reached at the end of a segment followed by a stop (m/s)
+    const float lost_distance;      // distance without line for a follow segment to end (m)
+    float accel;                    // velocity ramp (m/s^2)
+
+    volatile State state;
+    volatile int index;             // segment running
+    float origin_distance;          // odometry distance at the start of the segment
+    float origin_heading;           // heading set point at the start of the segment
+    float velocity;                 // ramped velocity set point
+    float elapsed;                  // time in the segment (s)
+    float line_seen_distance;       // odometry distance where the line was last detected
+
+    void enter(int segment, float distance, float heading);
+    float entry_velocity(int segment);
+
+public:
+
+    /**
+     * @brief Construct a new MotionScript object
+     *
+     * @param wheelSeparation distance between the two wheels (m)
+     * @param accel_ velocity ramp (m/s^2)
+     * @param endVelocity velocity reached at the end of a segment followed by a stop (m/s)
+     * @param lostDistance distance driven without line for a follow segment to end (m)
+     */
+    MotionScript(float wheelSeparation, float accel_, float endVelocity, float lostDistance);
+
+    /**
+     * @brief Removes all the segments.
+     */
+    void clear(void);
+
+    /**
+     * @brief Appends a segment.
+     *
+     * @return false if the script is full or the segment is not valid (negative length, zero arc radius...)
+     */
+    bool add(char type, float length, float angle, float velocity);
+
+    /**
+     * @brief Number of segments in the script.
+     */
+    int get_count(void);
+
+    /**
+     * @brief Returns a segment, NULL if out of range.
+     */
+    const Motion_segment* get_segment(int segment);
+
+    /**
+     * @brief Sets the velocity ramp (m/s^2).
+     */
+    void set_accel(float accel_);
+
+    /**
+     * @brief Runs the script from the first segment, the next update() takes the pose as its origin.
+     */
+    void start(void);
+
+    /**
+     * @brief Stops the script, update() returns zero set points.
+     */
+    void stop(void);
+
+    /**
+     * @brief Run one step of the script, in the control ISR.
+     *
+     * @param distance odometry distance (m)
+     * @param heading_deg odometry heading (deg)
+     * @param line_detected true if the sensor array sees the line
+     * @param dt time since the last update (s)
+     * @return the set points
+     */
+    Motion_output update(float distance, float heading_deg, bool line_detected, float dt);
+
+    /**
+     * @brief Returns true from start() until the last segment ends.
+     */
+    bool is_running(void);
+
+    /**
+     * @brief Index of the segment running (count once finished).
+     */
+    int get_index(void);
+};
@@ -38,15 +38,54 @@ private:
     volatile float prev_filtered_speed; // previous tangential speed of the wheel before filtering out the noise
     volatile float rpm;                 // latest rounds per minute of the wheel
 
+    // Traction control (slip and stall detection)
+    bool traction_enabled;              // true if set_traction_control() was called with valid limits and not disabled
+    bool traction_configured;           // true if set_traction_control() was called with valid limits
+    bool traction_requested;            // false if disabled with set_traction_enabled(), kept when the limits change
+    int accel_window;                   // number of updates per acceleration measurement
+    int window_updates;                 // updates counted in the current window
+    float window_time;                  // measured time of the current window (s)
+    int window_start_ticks;             // cumulative tick count at the start of the current window
+    float window_speed;                 // average speed over the last complete window
+    float accel_margin;                 // acceleration over the set point acceleration above which the wheel is spinning
+    volatile float speed_setpoint;      // wheel speed set point, its change gives the expected acceleration
+    float window_setpoint;              // speed set point at the end of the last complete window
+    float slew_per_update;              // max increase of the duty cycle magnitude per update while limited
+    float stall_duty;                   // duty cycle magnitude above which zero ticks counts towards a stall
+    int stall_updates;                  // number of zero tick updates before a stall is flagged
+    float stall_duty_cap;               // duty cycle magnitude limit while stalled
+    int zero_tick_updates;              // consecutive updates with no ticks while driving above stall_duty
+    float applied_duty;                 // duty cycle magnitude actually written after limiting
+    bool applied_direction;             // direction of the applied duty cycle
+    volatile float measured_accel;      // latest windowed acceleration of the wheel
+    volatile bool slipping;             // true while the measured acceleration exceeds the expected one by accel_margin
+    volatile bool slew_limited;         // true from a slip until the applied duty catches up with the requested duty
+    volatile bool stalled;              // true while stalled
+    volatile int slip_count;            // number of slip events since reset_traction_counts()
+    volatile int stall_count;           // number of stall events since reset_traction_counts()
+
+    void update_traction(int tick_diff, float dt);
+
+    // Actuator compensation (static friction deadband and optional lookup table)
+    static const int comp_lut_max = 8;  // max number of lookup table points
+    bool compensation_enabled;          // true to apply the compensation in set_duty_cycle()
+    float deadband;                     // duty cycle needed to overcome static friction
+    float comp_lut[comp_lut_max];       // duty cycle for evenly spaced commands from 0 to comp_lut_range
+    int comp_lut_size;                  // number of points in comp_lut, 0 if only the deadband is used
+    float comp_lut_range;               // command at the last lookup table point
+    const float comp_zero_band = 0.005; // commands below this are treated as 0 (no deadband jump)
+
+    float compensate(float command);
+
     const int pwm_freq;         // frequency at which the PWM is operating at
     const int update_rate;      // rate of which the values are updated
     const int pulse_per_rev;    // the tick counts counted by the encoder per revolution
     const float wheel_radius;   // radius of the buggy wheel
 
     // Low pass filter constants
-    const float LP_a0; 
-    const float LP_b0;
-    const float LP_b1;
+    float LP_a0; 
+    float LP_b0;
+    float LP_b1;
 
     // value of pi used
     const float pi = 3.14159265;
@@ -89,6 +128,8 @@ public:
     /**
      * @brief Set the duty cycle of the motor.
      * 
+     * Traction limiting and the actuator compensation are applied before writing to the PWM pin.
+     * 
      * @param DutyCycle The duty cycle value (0 to 1).
      */
     void set_duty_cycle(float DutyCycle);
@@ -114,6 +155,135 @@ public:
      */
     float get_duty_cycle();
 
+    /**
+     * @brief Get the duty cycle actually applied after traction limiting.
+     * 
+     * @return The applied duty cycle value (-1 to 1).
+     */
+    float get_applied_duty_cycle();
+
+    /**
+     * @brief Enable slip and stall detection with duty limiting.
+     * 
+     * Slip: the wheel acceleration measured over a window of updates exceeds the acceleration of the
+     * speed set point (set_speed_setpoint()) over the same window by more than accel_margin, while the
+     * duty cycle drives the wheel in that direction (the wheel can not accelerate that fast with grip).
+     * The duty cycle magnitude is then slew rate limited until it catches up with the requested duty.
+     * 
+     * Stall: the duty cycle magnitude is above stall_duty and no tick is seen for stall_time.
+     * The duty cycle magnitude is capped to stall_duty_cap until the wheel moves again.
+     * 
+     * Decreasing the duty cycle magnitude is never limited, so stopping is always immediate.
+     * 
+     * Can be called again to change the limits, the detection stays disabled if set_traction_enabled(false) was called.
+     * A zero accel window or stall time disables it.
+     * 
+     * @param accel_window_ Number of updates per acceleration measurement.
+     * @param accel_margin_ Acceleration (m/s^2) over the set point acceleration above which the wheel is spinning.
+     * @param slew_rate Max increase of the duty cycle magnitude per second while limited.
+     * @param stall_duty_ Duty cycle magnitude above which zero ticks counts towards a stall.
+     * @param stall_time Time (s) with no ticks before a stall is flagged.
+     * @param stall_duty_cap_ Duty cycle magnitude limit while stalled.
+     */
+    void set_traction_control(int accel_window_, float accel_margin_, float slew_rate, float stall_duty_, float stall_time, float stall_duty_cap_);
+
+    /**
+     * @brief Enable or disable the slip and stall detection configured with set_traction_control().
+     * 
+     * Enabling starts a new acceleration measurement and clears the slip and stall states.
+     * 
+     * @param status true to limit the duty cycle
+     */
+    void set_traction_enabled(bool status);
+
+    /**
+     * @brief Returns false if the detection was disabled with set_traction_enabled(), even if it is not configured.
+     */
+    bool is_traction_enabled(void);
+
+    /**
+     * @brief Set the wheel speed set point used by the slip detection, once per update.
+     * 
+     * Modes driving the duty cycle directly do not change it: the wheel is then expected to hold its speed.
+     * 
+     * @param speed Speed set point (m/s).
+     */
+    void set_speed_setpoint(float speed);
+
+    /**
+     * @brief Set the actuator compensation applied in set_duty_cycle().
+     * 
+     * A geared DC motor does not move below its static friction duty cycle, the compensation maps 
+     * the linear command from the PID to the duty cycle so the wheel responds linearly:
+     * 
+     * - without a lookup table: duty = deadband + (1 - deadband) * command
+     * - with a lookup table: linear interpolation over evenly spaced commands from 0 to lut_range,
+     *   the command is passed through unchanged above lut_range
+     * 
+     * Commands within a small band around 0 still give 0 duty cycle.
+     * 
+     * @param deadband_ Duty cycle needed to overcome static friction (0 to 1).
+     * @param lut Duty cycle for each lookup table point, NULL to only use the deadband.
+     * @param lut_size Number of points in lut (2 to 8).
+     * @param lut_range Command at the last lookup table point.
+     */
+    void set_compensation(float deadband_, const float* lut, int lut_size, float lut_range);
+
+    /**
+     * @brief Enable or disable the actuator compensation.
+     * 
+     * @param status true to apply the compensation
+     */
+    void set_compensation_enabled(bool status);
+
+    /**
+     * @brief Returns true if the actuator compensation is applied.
+     */
+    bool is_compensation_enabled(void);
+
+    /**
+     * @brief Get the static friction deadband duty cycle.
+     */
+    float get_deadband(void);
+
+    /**
+     * @brief Get the compensation lookup table.
+     * 
+     * @param lut_size Set to the number of points in the table (0 if only the deadband is used).
+     * @return Pointer to the lookup table.
+     */
+    const float* get_compensation_lut(int* lut_size);
+
+    /**
+     * @brief Returns true while the wheel is detected as spinning.
+     */
+    bool is_slipping(void);
+
+    /**
+     * @brief Returns true while the wheel is detected as stalled.
+     */
+    bool is_stalled(void);
+
+    /**
+     * @brief Get the number of slip events since reset_traction_counts().
+     */
+    int get_slip_count(void);
+
+    /**
+     * @brief Get the number of stall events since reset_traction_counts().
+     */
+    int get_stall_count(void);
+
+    /**
+     * @brief Clear the slip and stall event counts, reset() keeps them so they can be read after a run.
+     */
+    void reset_traction_counts(void);
+
+    /**
+     * @brief Get the latest windowed acceleration of the wheel (m/s^2).
+     */
+    float get_measured_accel(void);
+
     // Encoder Stuffs:
 
     /**
@@ -123,6 +293,13 @@ public:
      */
     void update(void);
 
+    /**
+     * @brief Calculate and update all the speed variables with the measured time since the last update.
+     * 
+     * @param dt Time since the last update (secs), instead of 1 / update rate.
+     */
+    void update(float dt);
+
     /**
      * @brief Reset the encoder tick count.
      */
@@ -163,4 +340,13 @@ public:
      */
     float get_filtered_speed(void);
 
+    /**
+     * @brief Set the coefficients of the speed low-pass filter.
+     *
+     * @param LowPass_a0 Coefficient a0 for the low-pass filter.
+     * @param LowPass_b0 Coefficient b0 for the low-pass filter.
+     * @param LowPass_b1 Coefficient b1 for the low-pass filter.
+     */
+    void set_low_pass(float LowPass_a0, float LowPass_b0, float LowPass_b1);
+
 };
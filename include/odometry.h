@@ -0,0 +1,104 @@
+/**
+ * @file odometry.h
+ * @brief Fixed-point differential drive pose estimator
+ *
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "seqlock.h"
+
+
+/**
+ * @brief Snapshot of the buggy pose published by the Odometry class.
+ *
+ * The frame is fixed at the position and heading of the buggy on the last reset:
+ * x points forward, y points to the right and the heading is positive clockwise
+ * (same sign convention as the old cumulative angle, left wheel ticks minus right wheel ticks).
+ */
+struct Pose
+{
+    float x;            /**< @brief Position along the starting heading (m). */
+    float y;            /**< @brief Position to the right of the starting heading (m). */
+    float heading_deg;  /**< @brief Cumulative heading, not wrapped (degrees, clockwise positive). */
+    float distance;     /**< @brief Distance travelled by the centre of the wheel axle (m). */
+};
+
+
+/**
+ * @brief Incremental (x, y, theta) odometry integrated from encoder tick deltas.
+ *
+ * update() is meant to be called once per control tick from the control ISR with the
+ * cumulative tick counts of both wheels. Only integer and fixed-point maths is used in the update:
+ *
+ * - heading and distance are kept as exact integer tick sums, so they never drift
+ * - cos/sin of the heading are kept in Q30 and rotated each tick using the small angle
+ *   approximation (cos d = 1 - d^2/2, sin d = d) and renormalised
+ * - x/y are integrated at the mid-point heading of each tick (second order accurate for arcs)
+ *
+ * The result is published through a Seqlock so get_pose() always returns a consistent snapshot,
+ * even when the ISR interrupts the read.
+ */
+class Odometry
+{
+private:
+
+    int prev_tick_left;             // cumulative left tick count on the previous update
+    int prev_tick_right;            // cumulative right tick count on the previous update
+
+    int32_t tick_diff_sum;          // sum of (left - right) ticks, proportional to the heading
+    int32_t tick_total_sum;         // sum of (left + right) ticks, proportional to the distance
+    int64_t x_acc;                  // x in (left + right) ticks, Q30
+    int64_t y_acc;                  // y in (left + right) ticks, Q30
+    int32_t cos_q30;                // cos(heading), Q30
+    int32_t sin_q30;                // sin(heading), Q30
+
+    int32_t rad_per_diff_q30;       // heading change (rad) per tick of (left - right), Q30
+    float metres_per_total;         // distance travelled per tick of (left + right)
+    float deg_per_diff;             // heading change (degrees) per tick of (left - right)
+
+    Seqlock<Pose> published;        // written by update() and reset(), read by get_pose()
+
+    void publish(void);
+
+public:
+
+    /**
+     * @brief Construct a new Odometry object
+     *
+     * @param pulse_per_rev encoder pulses per revolution (x4 encoding is assumed)
+     * @param wheel_radius radius of the wheels (m)
+     * @param wheel_separation distance between the two wheels (m)
+     */
+    Odometry(int pulse_per_rev, float wheel_radius, float wheel_separation);
+
+    /**
+     * @brief Integrate the pose using the new cumulative tick counts.
+     *
+     * Preferably run in the control Interrupt Service Routine (ISR) after the motors are updated.
+     *
+     * @param tick_count_left cumulative tick count of the left wheel
+     * @param tick_count_right cumulative tick count of the right wheel
+     */
+    void update(int tick_count_left, int tick_count_right);
+
+    /**
+     * @brief Reset the pose to the origin.
+     *
+     * Should be called together with Motor::reset() since the tick counts restart from 0, from the
+     * same ISR as update().
+     */
+    void reset(void);
+
+    /**
+     * @brief Get a consistent snapshot of the latest pose.
+     *
+     * Safe to call from the main loop while update() runs in an ISR.
+     *
+     * @return the latest pose
+     */
+    Pose get_pose(void);
+};
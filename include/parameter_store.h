@@ -0,0 +1,109 @@
+/**
+ * @file parameter_store.h
+ * @brief Wear-levelled flash storage for the parameter registry
+ *
+ */
+
+#pragma once
+
+#include "mbed.h"
+#include "parameters.h"
+
+
+/**
+ * @brief Saves the parameter values to a dedicated flash sector.
+ *
+ * Each save appends a record to the sector instead of erasing it, so the sector is only erased
+ * when it is full (about 500 saves for 32 parameters in a 128 KB sector). Loading uses the last
+ * record with a valid CRC, so a save interrupted by a reset falls back to the previous record.
+ *
+ * Records store (id, value) pairs, parameters added later keep their default and
+ * values that are no longer valid (unknown id or out of range) are skipped.
+ *
+ * When the sector is full the next save erases it before writing its record: a reset or a power
+ * loss in between (the erase takes one to two seconds) loses every saved value and the next start
+ * uses the defaults. Writing the new record to a second region before erasing the old one would
+ * close that window, but there is no free sector for it (the program uses sectors 0-5 and the
+ * black box sector 6). get_free_count() tells how many saves are left before that erase, and
+ * get_erased() whether the last save did it, so the caller can report it.
+ *
+ * Flash operations stall the CPU (including the ISRs) while the sector is erased or programmed,
+ * they should only be used while the motors are disabled.
+ */
+class ParameterStore
+{
+private:
+
+    static const uint32_t record_magic = 0x50524D31;    // "PRM1"
+
+    /* Record header, followed by count entries */
+    struct Record_header
+    {
+        uint32_t magic;
+        uint16_t count;             // number of entries
+        uint16_t crc;               // CRC-16 of the entries
+    };
+
+    /* One saved parameter */
+    struct Record_entry
+    {
+        uint32_t id;
+        float value;
+    };
+
+    FlashIAP flash;
+    const uint32_t address;         // start of the sector
+    const uint32_t size;            // sector size
+    uint32_t next_offset;           // offset of the next free record
+    int save_count;                 // records written since the sector was last erased
+    uint32_t record_size;           // flash used by a record (padded), 0 until one is written or loaded
+    bool erased;                    // true if the last save erased the sector
+
+    uint32_t scan(Record_header* last_header, uint32_t* last_offset);
+    static uint16_t crc16(const uint8_t* data, int length, uint16_t crc);
+
+public:
+
+    /**
+     * @brief Construct a new ParameterStore object
+     *
+     * @param address_ start address of the flash sector, must not be used by the program
+     * @param size_ size of the flash sector
+     */
+    ParameterStore(uint32_t address_, uint32_t size_);
+
+    /**
+     * @brief Loads the last saved values into the registry (staged, see ParameterRegistry::set()).
+     *
+     * @return number of values loaded, -1 if nothing was saved
+     */
+    int load(ParameterRegistry& registry);
+
+    /**
+     * @brief Saves the staged values of the registry.
+     *
+     * @return true if the record was written and verified
+     */
+    bool save(const ParameterRegistry& registry);
+
+    /**
+     * @brief Erases all the saved records.
+     */
+    bool erase(void);
+
+    /**
+     * @brief Get the number of records written since the sector was last erased.
+     */
+    int get_save_count(void);
+
+    /**
+     * @brief Get the number of saves left before the sector has to be erased (-1 if not known yet).
+     */
+    int get_free_count(void);
+
+    /**
+     * @brief Returns true if the last save had to erase the sector (the saved values were lost
+     * until the new record was written).
+     */
+    bool get_erased(void);
+};
@@ -0,0 +1,142 @@
+/**
+ * @file parameters.h
+ * @brief Runtime parameter registry for the tunable constants
+ *
+ * Only depends on the C library so it can also be built on the host.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+
+#define PARAM_MAX_COUNT     64      // max number of parameters in a registry
+
+
+/* PARAMETER TYPES */
+enum Param_type
+{
+    param_float,
+    param_int,                      ///< value is rounded to the nearest integer
+    param_bool,                     ///< value is 0 or 1
+};
+
+
+/**
+ * @brief Definition of one parameter, the table of definitions is constant.
+ *
+ * The id is what is sent over the serial links and saved to flash, so it must never be reused
+ * for a different parameter. Definitions do not need to be sorted.
+ */
+struct Param_def
+{
+    uint8_t id;                     ///< unique id
+    const char* name;               ///< short name (fits in a bluetooth packet with its value)
+    Param_type type;                ///< value type
+    float min;                      ///< minimum value (inclusive)
+    float max;                      ///< maximum value (inclusive)
+    float default_value;            ///< value on reset, normally the constants.h define
+};
+
+
+/**
+ * @brief Typed, range checked parameters that can be changed while running.
+ *
+ * Values are double buffered: set() stages the new value and apply_pending(), called at the
+ * start of the control ISR, copies all staged values at once and calls the apply callback
+ * to push them into the controllers. The controllers therefore never run with half of an update.
+ * Several set() calls can be grouped with begin_update()/end_update() so they are applied together.
+ */
+class ParameterRegistry
+{
+public:
+
+    typedef void (*Apply_callback)(const ParameterRegistry& registry);
+
+private:
+
+    const Param_def* defs;
+    int count;
+    float active[PARAM_MAX_COUNT];      // values used by the controllers
+    float pending[PARAM_MAX_COUNT];     // staged values
+    volatile bool dirty;                // true if pending differs from active
+    volatile bool holding;              // true between begin_update() and end_update()
+    Apply_callback apply_callback;
+
+public:
+
+    /**
+     * @brief Construct a new ParameterRegistry object, all values start at their default.
+     *
+     * @param defs_ the parameter definitions, must stay valid
+     * @param count_ number of definitions (up to PARAM_MAX_COUNT)
+     * @param callback called by apply_pending() after the values change, NULL if not needed
+     */
+    ParameterRegistry(const Param_def* defs_, int count_, Apply_callback callback);
+
+    /**
+     * @brief Get the number of parameters.
+     */
+    int get_count(void) const;
+
+    /**
+     * @brief Get a parameter definition by position in the table (0 to get_count() - 1).
+     */
+    const Param_def* get_def(int index) const;
+
+    /**
+     * @brief Get the table position of a parameter id, -1 if unknown.
+     */
+    int index_of(int id) const;
+
+    /**
+     * @brief Get the table position of a parameter name, -1 if unknown.
+     */
+    int index_of(const char* name) const;
+
+    /**
+     * @brief Get the value used by the controllers.
+     *
+     * @param id parameter id (0 is returned for an unknown id)
+     */
+    float get(int id) const;
+
+    /**
+     * @brief Get the staged value (the value after the next apply).
+     *
+     * @param id parameter id (0 is returned for an unknown id)
+     */
+    float get_pending(int id) const;
+
+    /**
+     * @brief Stages a new value.
+     *
+     * @param id parameter id
+     * @param value new value, converted to the parameter type
+     * @return false if the id is unknown or the value is out of range
+     */
+    bool set(int id, float value);
+
+    /**
+     * @brief Stages the default value of every parameter.
+     */
+    void reset_defaults(void);
+
+    /**
+     * @brief Holds staged values back from apply_pending() until end_update().
+     */
+    void begin_update(void);
+
+    /**
+     * @brief Releases the values staged since begin_update().
+     */
+    void end_update(void);
+
+    /**
+     * @brief Applies the staged values if any, preferably at the start of the control ISR.
+     *
+     * @return true if new values were applied
+     */
+    bool apply_pending(void);
+};
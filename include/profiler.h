@@ -0,0 +1,121 @@
+/**
+ * @file profiler.h
+ * @brief Cycle counting execution time profiler with log2 histograms
+ *
+ * Only depends on the C library so it can also be built on the host, the cycle counter is read
+ * through a function given to the constructor (the DWT cycle counter on the buggy).
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+
+#define PROFILE_MAX_SCOPES      24      // scopes measured at the same time
+#define PROFILE_BINS            24      // histogram bin i counts durations of 2^i to 2^(i+1) - 1 cycles
+
+
+/**
+ * @brief Reads a free running 32 bit cycle counter.
+ */
+typedef uint32_t (*Cycle_source)(void);
+
+
+/**
+ * @brief Execution time statistics of one scope, in cycles.
+ */
+struct Profile_stats
+{
+    uint32_t count;                     ///< measurements since the last reset
+    uint32_t min;
+    uint32_t max;
+    uint32_t last;
+    uint64_t total;                     ///< sum of all the measurements, for the mean
+    uint32_t over_budget;               ///< measurements longer than the budget
+    uint32_t bins[PROFILE_BINS];        ///< log2 histogram
+};
+
+
+/**
+ * @brief Measures how long named code sections (scopes) take and keeps their distribution.
+ *
+ * A scope is measured with start() and stop(), scopes can be nested. Each measurement costs two
+ * counter reads and a few instructions, so it can be used in the control ISR. The histogram has
+ * one bin per power of two, enough to see the tail of the distribution (the p99) without storing
+ * the measurements.
+ *
+ * A scope must only be measured from one context (ISR or main loop). Reading and reset() from
+ * the main loop should be done with the interrupts disabled to get consistent values.
+ */
+class Profiler
+{
+private:
+
+    const char* const* names;
+    int scope_count;
+    Cycle_source read_cycles;
+    uint32_t cycles_per_us;
+
+    Profile_stats stats[PROFILE_MAX_SCOPES];
+    uint32_t budget[PROFILE_MAX_SCOPES];        // cycles, 0 if none
+
+public:
+
+    /**
+     * @brief Construct a new Profiler object
+     *
+     * @param names_ name of each scope, must stay valid
+     * @param scope_count_ number of scopes (up to PROFILE_MAX_SCOPES)
+     * @param read_cycles_ reads the cycle counter
+     * @param cycles_per_us_ cycle counter frequency in MHz
+     */
+    Profiler(const char* const* names_, int scope_count_, Cycle_source read_cycles_, uint32_t cycles_per_us_);
+
+    /**
+     * @brief Starts a measurement.
+     *
+     * @return cycle counter, to pass to stop()
+     */
+    uint32_t start(void);
+
+    /**
+     * @brief Ends a measurement started with start().
+     */
+    void stop(int scope, uint32_t start_cycles);
+
+    /**
+     * @brief Adds a measurement taken some other way.
+     */
+    void record(int scope, uint32_t cycles);
+
+    /**
+     * @brief Sets the time above which a measurement counts as an overrun (0 for none).
+     */
+    void set_budget(int scope, float budget_us);
+
+    /**
+     * @brief Clears the statistics of all the scopes.
+     */
+    void reset(void);
+
+    /**
+     * @brief Copies the statistics of a scope.
+     *
+     * @return false if the scope is invalid
+     */
+    bool get_stats(int scope, Profile_stats* copy);
+
+    /**
+     * @brief Estimates a percentile from the histogram.
+     *
+     * @param fraction e.g. 0.99 for the p99
+     * @return upper bound in cycles of the bin reaching the fraction (never more than the max)
+     */
+    uint32_t get_percentile(int scope, float fraction);
+
+    uint32_t get_last(int scope);           ///< last measurement in cycles
+    float to_us(uint32_t cycles);           ///< converts cycles to microseconds
+    int get_scope_count(void);
+    const char* get_name(int scope);
+};
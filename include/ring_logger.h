@@ -0,0 +1,181 @@
+/**
+ * @file ring_logger.h
+ * @brief Delta compressed circular data logger with a pre/post trigger
+ *
+ * Only depends on the C library so it can also be built on the host.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+
+#define LOG_MAX_CHANNELS        8       // channels recorded at the same time
+#define LOG_BLOCK_SAMPLES       32      // samples per block, each block starts with absolute values
+
+
+/**
+ * @brief Reads the current value of a channel, called from the control ISR.
+ */
+typedef float (*Log_source)(void);
+
+/**
+ * @brief One channel that can be selected for logging.
+ */
+struct Log_channel
+{
+    const char* name;       ///< column name
+    Log_source read;        ///< reads the value
+    float scale;            ///< values are stored as round(value * scale)
+};
+
+
+/* LOGGER STATES */
+enum Log_states
+{
+    log_stopped,            ///< not recording, the ring can be read
+    log_recording,          ///< recording, the oldest samples are overwritten
+    log_post_trigger,       ///< triggered, recording the samples after the trigger
+    log_done,               ///< all the post trigger samples were recorded, the ring can be read
+};
+
+
+/**
+ * @brief Records selected channels in a circular byte buffer, several times denser than raw samples.
+ *
+ * Each sample stores, for every selected channel, the difference from the previous sample as a zigzag
+ * varint (1 byte for a change of less than +-64 steps). Samples are grouped in blocks starting with
+ * the absolute values, so when the buffer is full the oldest block is dropped as a whole and the
+ * rest can still be decoded.
+ *
+ * A trigger (line lost, saturation, mode change...) freezes the buffer once the post trigger samples
+ * are recorded, reading then starts at the pre trigger samples. Without a trigger the last samples
+ * that fit are kept.
+ *
+ * sample() and trigger() are meant for the control ISR, the configuration and reading functions
+ * for the main loop while the logger is stopped or done.
+ */
+class RingLogger
+{
+private:
+
+    const Log_channel* channels;
+    int channel_count;
+    uint8_t* ring;
+    int size;
+
+    uint8_t selected[LOG_MAX_CHANNELS];     // channel index of each column
+    int selected_count;
+    int decimation;                         // control updates per sample
+    int decimation_count;
+    int pre_samples;
+    int post_samples;
+
+    volatile int state;                     // Log_states
+    int head;                               // next byte written
+    int tail;                               // first byte of the oldest block
+    int used;                               // bytes between tail and head
+    int block_start;                        // first byte of the block being written
+    int block_count;                        // samples in the block being written, 0 to start a new block
+    int32_t last[LOG_MAX_CHANNELS];         // last stored values
+    uint32_t sample_index;                  // index of the next sample since arm()
+    uint32_t oldest_index;                  // index of the first sample of the oldest block
+    uint32_t trigger_index;
+    int post_count;                         // post trigger samples left
+    int trigger_cause;
+    int blocks_dropped;
+
+    // reader position
+    int read_pos;
+    int read_block_end;
+    int read_block_count;
+    uint32_t read_index;
+    int32_t read_last[LOG_MAX_CHANNELS];
+
+    void put(uint8_t byte);
+    uint8_t get(int position);
+    void drop_oldest_block(void);
+    bool read_varint(int* position, uint32_t* value);
+
+public:
+
+    /**
+     * @brief Construct a new RingLogger object, stopped with no channel selected
+     *
+     * @param channels_ table of the channels that can be selected, must stay valid
+     * @param channel_count_ number of entries
+     * @param buffer memory used for the ring, must stay valid
+     * @param size_ buffer size in bytes (at least a few KB)
+     */
+    RingLogger(const Log_channel* channels_, int channel_count_, uint8_t* buffer, int size_);
+
+    /**
+     * @brief Selects the recorded channels, clears the ring and stops.
+     *
+     * @param ids channel table indexes, in column order
+     * @param count number of channels (up to LOG_MAX_CHANNELS)
+     * @return false if an index is invalid or too many channels
+     */
+    bool select(const uint8_t* ids, int count);
+
+    /**
+     * @brief Records one sample every n calls to sample(), clears the ring and stops.
+     */
+    void set_decimation(int n);
+
+    /**
+     * @brief Sets the samples kept around a trigger, clears the ring and stops.
+     *
+     * @param pre samples kept before the trigger (as many as fit if 0)
+     * @param post samples recorded after the trigger
+     */
+    void set_trigger(int pre, int post);
+
+    /**
+     * @brief Clears the ring and starts recording.
+     */
+    void arm(void);
+
+    /**
+     * @brief Stops recording (e.g. before reading without a trigger).
+     */
+    void stop(void);
+
+    /**
+     * @brief Triggers the logger, ignored unless recording.
+     *
+     * @param cause stored with the trigger, returned by get_trigger_cause() (not 0)
+     */
+    void trigger(int cause);
+
+    /**
+     * @brief Records the selected channels, call at every control update.
+     */
+    void sample(void);
+
+    int get_state(void);                    ///< Log_states
+    int get_trigger_cause(void);            ///< cause passed to trigger(), 0 if not triggered
+    int get_selected_count(void);           ///< number of selected channels
+    const Log_channel* get_selected(int column);    ///< channel of a column
+    int get_decimation(void);               ///< control updates per sample
+    int get_pre_samples(void);
+    int get_post_samples(void);
+    int get_used_bytes(void);               ///< bytes in the ring
+    int get_sample_count(void);             ///< samples in the ring
+    int get_blocks_dropped(void);           ///< blocks overwritten since arm()
+
+    /**
+     * @brief Starts reading the ring from the first sample kept (pre trigger samples if triggered).
+     */
+    void start_read(void);
+
+    /**
+     * @brief Reads the next sample, only while stopped or done.
+     *
+     * @param offset set to the sample position relative to the trigger (or to the first sample kept)
+     * @param values set to the values of the selected channels, in column order
+     * @return false when there are no more samples
+     */
+    bool read_next(int32_t* offset, float* values);
+};
@@ -29,8 +29,8 @@ private:
     bool prev_left_true;
     
     const int sample_count_;    // The number of samples to take for averaging sensor readings.
-    const float detect_range_; // The detection threshold for line detection. 
-    const float angle_coeff;    // The gain at which the sensor output is multiplied to represent the angle.
+    float detect_range_;        // The detection threshold for line detection. 
+    float angle_coeff;          // The gain at which the sensor output is multiplied to represent the angle.
     bool line_detected;         // Flag indicating whether a line is detected. 
 
     float cali_min[6] = {0.15, 0.15, 0.15, 0.15, 0.15, 0.15};
@@ -47,9 +47,9 @@ private:
     // Filter coefficients b_i: [0.1802684 0.1802684]
     // Filter coefficients a_i: [0.63946321]
 
-    const float LP_a0 = 0.63946321;
-    const float LP_b0 = 0.1802684;
-    const float LP_b1 = 0.1802684;
+    float LP_a0 = 0.63946321;
+    float LP_b0 = 0.1802684;
+    float LP_b1 = 0.1802684;
 
     //{15, 5, 1, -1, -5, -15};
     /**
@@ -126,6 +126,23 @@ public:
 
     float get_filtered_output(void);
 
+    /**
+     * @brief Sets the detection threshold for line detection.
+     * 
+     * @param detect_range Minimum difference between the highest and lowest sensor reading.
+     */
+    void set_detect_range(float detect_range);
+
+    /**
+     * @brief Sets the gain at which the sensor output is multiplied to represent the angle.
+     */
+    void set_angle_coeff(float angle_coefficient);
+
+    /**
+     * @brief Sets the coefficients of the output low-pass filter.
+     */
+    void set_low_pass(float LowPass_a0, float LowPass_b0, float LowPass_b1);
+
     void calibrate_sensors(void);
 
     float* get_calibration_constants(void);
@@ -0,0 +1,131 @@
+/**
+ * @file seqlock.h
+ * @brief Tear-free data exchange between the interrupts and the main loop
+ *
+ * Header only and without Mbed dependency so it can also be built on the host. Both classes are
+ * meant for a single core: an interrupt runs to completion before the code it interrupted
+ * continues, so the only ordering needed is the compiler's (std::atomic_signal_fence).
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+
+/**
+ * @brief Snapshot published by an ISR and read by the main loop (sequence lock).
+ *
+ * The writer increments the sequence number before and after copying the value, a reader copies
+ * the value and retries if the sequence number was odd or changed meanwhile. write() never waits,
+ * read() only retries when it was interrupted by a write.
+ *
+ * The writer must not be interrupted by a reader: write from the ISR, read from the main loop (or
+ * from the same ISR, the read then never retries). T must be trivially copyable.
+ */
+template <typename T>
+class Seqlock
+{
+private:
+
+    volatile uint32_t seq;          // odd while the value is being written
+    T value;
+
+public:
+
+    Seqlock(): seq(0), value() {}
+
+    /**
+     * @brief Publishes a new value, wait-free (single writer).
+     */
+    void write(const T& new_value)
+    {
+        seq = seq + 1;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        value = new_value;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        seq = seq + 1;
+    }
+
+    /**
+     * @brief Returns a consistent copy of the last value published.
+     */
+    T read(void) const
+    {
+        T copy;
+        uint32_t start;
+        do
+        {
+            start = seq;
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            copy = value;
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+        } while ((start & 1) || start != seq);
+        return copy;
+    }
+
+    /**
+     * @brief Number of writes since the construction.
+     */
+    uint32_t get_version(void) const
+    {
+        return seq / 2;
+    }
+};
+
+
+/**
+ * @brief Command block written by the main loop and read by the ISRs (double buffer).
+ *
+ * The writer fills the buffer the readers are not using and then switches the index in a single
+ * store, so a read always sees a whole block, the previous one or the new one. Both read() and
+ * write() are wait-free.
+ *
+ * The reader must not be interrupted by the writer: read from the ISRs, write from the main loop
+ * only (a single writer). T must be trivially copyable.
+ */
+template <typename T>
+class CommandBlock
+{
+private:
+
+    T blocks[2];
+    volatile uint8_t front;         // block the readers use
+    volatile uint32_t version;
+
+public:
+
+    CommandBlock(): blocks(), front(0), version(0) {}
+
+    /**
+     * @brief Publishes a new block, the readers use it from their next read().
+     */
+    void write(const T& block)
+    {
+        uint8_t back = 1 - front;
+        blocks[back] = block;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        front = back;
+        version = version + 1;
+    }
+
+    /**
+     * @brief Returns a copy of the last block published.
+     */
+    T read(void) const
+    {
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        T copy = blocks[front];
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        return copy;
+    }
+
+    /**
+     * @brief Number of writes since the construction.
+     */
+    uint32_t get_version(void) const
+    {
+        return version;
+    }
+};
@@ -0,0 +1,153 @@
+/**
+ * @file task_scheduler.h
+ * @brief Multi-rate periodic task scheduler driven by a single base tick
+ *
+ * Only depends on the C library so it can also be built on the host, the time is read through a
+ * function given to the constructor.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+
+#define SCHED_MAX_TASKS     8       // tasks in the table
+
+
+/**
+ * @brief Periodic task, dt is the measured time since its previous start (seconds).
+ */
+typedef void (*Task_function)(float dt);
+
+/**
+ * @brief One shot callback (see TaskScheduler::set_timeout()).
+ */
+typedef void (*Timeout_callback)(void);
+
+/**
+ * @brief Reads a free running microsecond clock.
+ */
+typedef uint32_t (*Clock_source)(void);
+
+
+/**
+ * @brief One entry of the task table.
+ *
+ * A task runs on the ticks where (tick % divider) == phase. Tasks due on the same tick run in
+ * table order, so a task that needs the output of another one is placed after it.
+ */
+struct Task_def
+{
+    const char* name;
+    Task_function run;
+    uint16_t divider;               ///< base ticks per run, the task rate is the base rate / divider
+    uint16_t phase;                 ///< tick offset (less than divider)
+    uint32_t deadline_us;           ///< max time from the tick to the end of the task, 0 for the base period
+};
+
+
+/**
+ * @brief Timing statistics of a task.
+ */
+struct Task_stats
+{
+    uint32_t runs;
+    uint32_t deadline_misses;       ///< runs that ended after the deadline
+    uint32_t min_dt_us;             ///< shortest time between two starts
+    uint32_t max_dt_us;             ///< longest time between two starts
+    uint32_t max_end_us;            ///< longest time from the tick to the end of the task
+};
+
+
+/**
+ * @brief Runs a table of periodic tasks at integer divisors of one base tick rate.
+ *
+ * tick() is called by a single periodic timer interrupt, so the tasks keep fixed phases relative
+ * to each other instead of drifting like separate timers. Each tick is compared to its ideal time
+ * (start time + n periods): the latency of the ticks, the ticks whose tasks did not finish before
+ * the next tick (overruns) and the tasks ending after their deadline are counted.
+ *
+ * A one shot timeout can also be run on a later tick.
+ */
+class TaskScheduler
+{
+private:
+
+    const Task_def* tasks;
+    int task_count;
+    uint32_t base_period_us;
+    Clock_source read_us;
+
+    volatile uint32_t ticks;
+    uint32_t start_us;
+    uint32_t last_start[SCHED_MAX_TASKS];
+    uint32_t last_dt[SCHED_MAX_TASKS];
+    Task_stats stats[SCHED_MAX_TASKS];
+    uint32_t overruns;
+    uint32_t late_ticks;
+    uint32_t max_latency_us;
+
+    volatile Timeout_callback timeout_callback;
+    volatile uint32_t timeout_tick;
+
+public:
+
+    /**
+     * @brief Construct a new TaskScheduler object
+     *
+     * @param tasks_ task table, must stay valid
+     * @param task_count_ number of tasks (up to SCHED_MAX_TASKS)
+     * @param base_period_us_ period of the tick() calls
+     * @param read_us_ reads the clock used to measure the ticks
+     */
+    TaskScheduler(const Task_def* tasks_, int task_count_, uint32_t base_period_us_, Clock_source read_us_);
+
+    /**
+     * @brief Resets the tick count and statistics, call just before starting the base timer.
+     *
+     * The first tick is expected one base period later.
+     */
+    void start(void);
+
+    /**
+     * @brief Runs the tasks due on this tick, called by the base timer interrupt.
+     */
+    void tick(void);
+
+    /**
+     * @brief Runs a callback once on the first tick at least delay seconds later, replaces the previous one.
+     */
+    void set_timeout(Timeout_callback callback, float delay);
+
+    /**
+     * @brief Cancels the timeout if it has not run yet.
+     */
+    void cancel_timeout(void);
+
+    /**
+     * @brief Clears the statistics (not the tick count).
+     */
+    void reset_stats(void);
+
+    /**
+     * @brief Copies the statistics of a task.
+     *
+     * @return false if the task is invalid
+     */
+    bool get_task_stats(int task, Task_stats* copy);
+
+    /**
+     * @brief Ideal time of the next tick, on the clock given to the constructor.
+     */
+    uint32_t get_next_tick_us(void);
+
+    uint32_t get_ticks(void);               ///< ticks since start()
+    uint32_t get_last_dt_us(int task);      ///< dt given to the last run of a task
+    uint32_t get_overruns(void);            ///< ticks that ended after the next tick was due
+    uint32_t get_late_ticks(void);          ///< ticks that started after the next tick was due
+    uint32_t get_max_latency_us(void);      ///< longest delay between the ideal and actual tick start
+    uint32_t get_base_period_us(void);
+    int get_task_count(void);
+    const char* get_name(int task);
+};
@@ -0,0 +1,265 @@
+/**
+ * @file telemetry.h
+ * @brief Compact binary telemetry frames for the 20 byte BLE packets
+ *
+ * Shared by the firmware (encoding) and the host tools (decoding), so it only depends on the C library.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+
+/*  FRAME FORMAT
+
+    Raw frame:      [type u8][seq u8][payload 0-15 bytes][crc8 u8]
+    On the link:    COBS(raw frame) followed by a 0x00 delimiter
+
+    The largest frame is 20 bytes on the link so one frame always fits one BLE packet.
+    All multi-byte fields are little endian fixed-point integers, see telemetry_frame_fields().
+    The CRC is CRC-8 (poly 0x07, init 0x00) over type, seq and payload.
+*/
+
+#define TELEMETRY_MAX_PAYLOAD       15
+#define TELEMETRY_MAX_RAW           (TELEMETRY_MAX_PAYLOAD + 3)
+#define TELEMETRY_MAX_ENCODED       (TELEMETRY_MAX_RAW + 2)     // COBS overhead + delimiter
+#define TELEMETRY_DELIMITER         0x00
+
+
+/* TELEMETRY FRAME TYPES */
+enum Telemetry_types
+{
+    tm_speed_burst = 0x01,      ///< 6 samples of left/right wheel speed (mm/s), int16 first sample then int8 deltas
+    tm_sensor_burst = 0x02,     ///< 14 samples of the filtered sensor array output (x100), int16 first sample then int8 deltas
+    tm_wheel = 0x03,            ///< left/right speed and set speed (mm/s), int16 x4
+    tm_duty = 0x04,             ///< left/right requested and applied duty cycle (x1000), int16 x4
+    tm_sensor = 0x05,           ///< array output, filtered output (x1000) int16 x2, line detected u8, 6 sensor values (x255) u8 x6
+    tm_pid = 0x06,              ///< PID id u8 (0 motor L, 1 motor R, 2 angle, 3 sensor), set point, measurement, P, I, D, output (x1000) int16 x6
+    tm_pose = 0x07,             ///< x, y (mm) int16 x2, heading (0.01 deg) int32, distance (mm) int32
+    tm_battery = 0x08,          ///< voltage (mV) u16, current (mA) int16
+    tm_timing = 0x09,           ///< control ISR time, main loop time (us) u16 x2
+    tm_log = 0x0A,              ///< PID log sample (USB serial): sample index u16, set point, measurement, P, I, D (x1000) int16 x5
+    tm_log_status = 0x0B,       ///< log stream counters: samples logged, records dropped int32 x2
+};
+
+
+/**
+ * @brief A decoded telemetry frame.
+ */
+struct Telemetry_frame
+{
+    uint8_t type;                               ///< frame type, see Telemetry_types
+    uint8_t seq;                                ///< sequence number, increments by one per frame sent
+    uint8_t length;                             ///< payload length
+    uint8_t payload[TELEMETRY_MAX_PAYLOAD];     ///< payload bytes
+};
+
+
+/**
+ * @brief Builds a frame payload from fixed-point fields.
+ *
+ * Values are clamped to the range of the field type, writes past the payload size are ignored.
+ */
+class TelemetryWriter
+{
+private:
+
+    uint8_t buffer[TELEMETRY_MAX_PAYLOAD];
+    int length;
+
+public:
+
+    TelemetryWriter(void);
+
+    void put_u8(int value);                 ///< unsigned 8 bit field
+    void put_i8(int value);                 ///< signed 8 bit field
+    void put_u16(int value);                ///< unsigned 16 bit field
+    void put_i16(int value);                ///< signed 16 bit field
+    void put_i32(int32_t value);            ///< signed 32 bit field
+
+    /**
+     * @brief Adds a float as a signed 16 bit fixed-point field.
+     *
+     * @param value value to send
+     * @param scale the field holds value * scale, rounded
+     */
+    void put_fixed(float value, float scale);
+
+    const uint8_t* data(void);              ///< payload bytes
+    int size(void);                         ///< payload length
+};
+
+
+/**
+ * @brief Reads fixed-point fields from a frame payload in order.
+ *
+ * Reads past the end of the payload return 0.
+ */
+class TelemetryReader
+{
+private:
+
+    const uint8_t* buffer;
+    int length;
+    int position;
+
+public:
+
+    TelemetryReader(const Telemetry_frame& frame);
+
+    int read_u8(void);
+    int read_i8(void);
+    int read_u16(void);
+    int read_i16(void);
+    int32_t read_i32(void);
+    int remaining(void);                    ///< bytes left to read
+};
+
+
+/**
+ * @brief Packs consecutive samples of up to 2 channels into one burst frame.
+ *
+ * The first sample of each channel is stored as int16 and the following ones as int8 deltas
+ * from the previous reconstructed value, so the decoder never drifts (changes larger than
+ * the int8 range are spread over the following samples).
+ */
+class TelemetryBurst
+{
+private:
+
+    uint8_t type;
+    int channels;
+    int capacity;
+    int count;
+    int last[2];
+    TelemetryWriter writer;
+
+public:
+
+    /**
+     * @brief Construct a new TelemetryBurst object
+     *
+     * @param type_ frame type sent with the burst
+     * @param channels_ number of channels per sample (1 or 2)
+     */
+    TelemetryBurst(uint8_t type_, int channels_);
+
+    /**
+     * @brief Adds one sample, values are already scaled to integers.
+     *
+     * @return true if the burst is full and should be sent
+     */
+    bool add(int value0, int value1 = 0);
+
+    bool is_full(void);                     ///< true if no more samples fit
+    int get_count(void);                    ///< samples in the burst
+    int get_capacity(void);                 ///< samples per burst
+    uint8_t get_type(void);                 ///< frame type of the burst
+    const uint8_t* data(void);              ///< payload bytes
+    int size(void);                         ///< payload length
+    void clear(void);                       ///< start a new burst
+
+    /**
+     * @brief Decodes a burst payload.
+     *
+     * @param frame burst frame
+     * @param channels number of channels per sample (1 or 2)
+     * @param samples output, samples[i * channels + c]
+     * @param max_samples max number of samples stored
+     * @return number of samples decoded
+     */
+    static int decode(const Telemetry_frame& frame, int channels, int* samples, int max_samples);
+};
+
+
+/**
+ * @brief Reassembles frames from a byte stream, for the receiving side.
+ */
+class TelemetryStreamDecoder
+{
+private:
+
+    uint8_t buffer[TELEMETRY_MAX_ENCODED];
+    int length;
+    bool overflow;
+    int last_seq;
+
+public:
+
+    int frames;             ///< frames decoded
+    int crc_errors;         ///< frames dropped because of a bad CRC or COBS encoding
+    int length_errors;      ///< frames dropped because they were too long or too short
+    int lost;               ///< frames missing according to the sequence numbers
+
+    TelemetryStreamDecoder(void);
+
+    /**
+     * @brief Feeds one received byte.
+     *
+     * @param byte received byte
+     * @param frame set to the decoded frame when the byte completes a valid frame
+     * @return true if a frame was decoded
+     */
+    bool feed(uint8_t byte, Telemetry_frame* frame);
+};
+
+
+/**
+ * @brief Description of one payload field, used to print frames generically.
+ */
+struct Telemetry_field
+{
+    const char* name;       ///< column name
+    char kind;              ///< 'b' u8, 'c' i8, 'w' u16, 'h' i16, 'i' i32
+    float scale;            ///< physical value = field / scale
+};
+
+
+/**
+ * @brief CRC-8 (poly 0x07) of a buffer.
+ */
+uint8_t telemetry_crc8(const uint8_t* data, int length);
+
+/**
+ * @brief COBS encodes a buffer (no delimiter added).
+ *
+ * @return number of bytes written to out, at most length + 1 for length < 254
+ */
+int telemetry_cobs_encode(const uint8_t* in, int length, uint8_t* out);
+
+/**
+ * @brief COBS decodes a buffer (without the delimiter).
+ *
+ * @return number of bytes written to out, -1 if the encoding is invalid
+ */
+int telemetry_cobs_decode(const uint8_t* in, int length, uint8_t* out);
+
+/**
+ * @brief Encodes a complete frame ready to be sent, including the delimiter.
+ *
+ * @param out buffer of at least TELEMETRY_MAX_ENCODED bytes
+ * @return number of bytes written to out, 0 if the payload is too long
+ */
+int telemetry_encode_frame(uint8_t type, uint8_t seq, const uint8_t* payload, int length, uint8_t* out);
+
+/**
+ * @brief Decodes one frame received between two delimiters.
+ *
+ * @return true if the frame is valid
+ */
+bool telemetry_decode_frame(const uint8_t* in, int length, Telemetry_frame* frame);
+
+/**
+ * @brief Get the field layout of a fixed frame type.
+ *
+ * @param type frame type
+ * @param count set to the number of fields
+ * @return the fields in order, NULL for burst frames and unknown types
+ */
+const Telemetry_field* telemetry_frame_fields(uint8_t type, int* count);
+
+/**
+ * @brief Get the name of a frame type.
+ */
+const char* telemetry_frame_name(uint8_t type);
@@ -0,0 +1,132 @@
+/**
+ * @file telemetry_scheduler.h
+ * @brief Telemetry stream subscriptions sent within a bandwidth budget
+ *
+ * Only depends on the C library so it can also be built on the host.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+
+#define TELEMETRY_MAX_STREAMS   16      // stream ids are the telemetry frame types (0 to 15)
+
+
+/**
+ * @brief Sends the subscribed telemetry streams, each at its own rate, within a bytes per second budget.
+ *
+ * The budget is a token bucket: it fills at the budget rate up to the burst size and each frame
+ * sent takes its size from it. When several streams are due, the most overdue one is sent first and
+ * the others wait for the bucket to refill. A sample still waiting when the next one is due is skipped
+ * (decimated), a frame that the sender could not queue is dropped. Both are counted per stream.
+ *
+ * Polled streams are built by the sender callback when they are due. Pushed streams (e.g. bursts
+ * filled by an ISR) are only checked against the budget with offer() when they are ready.
+ */
+class TelemetryScheduler
+{
+public:
+
+    /**
+     * @brief Builds and queues one frame of a stream.
+     *
+     * @return number of bytes queued, 0 if the frame was dropped
+     */
+    typedef int (*Stream_sender)(int stream);
+
+private:
+
+    struct Stream
+    {
+        float rate;                 // Hz, 0 if not subscribed
+        bool pushed;                // true if sent with offer() instead of the sender
+        uint32_t period_us;
+        uint32_t next_due_us;
+        int cost;                   // bytes of the last frame, used to check the budget
+        int sent;
+        int decimated;
+        int dropped;
+    };
+
+    Stream streams[TELEMETRY_MAX_STREAMS];
+    Stream_sender sender;
+    int budget;                     // bytes per second
+    int burst;                      // bucket size in bytes
+    int64_t tokens_us;              // bucket level in bytes * 1e6, so fractions of a byte are kept
+    uint32_t last_update_us;
+    bool started;
+
+    void refill(uint32_t now_us);
+    bool take(Stream& stream, int bytes);
+
+public:
+
+    /**
+     * @brief Construct a new TelemetryScheduler object with no subscriptions
+     *
+     * @param sender_ builds and queues the frames of the polled streams
+     * @param budget_ bytes per second
+     * @param burst_ max bytes sent at once after an idle period (at least one frame)
+     */
+    TelemetryScheduler(Stream_sender sender_, int budget_, int burst_);
+
+    /**
+     * @brief Subscribes to a stream, replaces the previous rate.
+     *
+     * @param stream stream id (0 to TELEMETRY_MAX_STREAMS - 1)
+     * @param rate samples per second, 0 to unsubscribe
+     * @param pushed true if the frames are sent with offer()
+     * @return false if the stream id or the rate is not valid
+     */
+    bool subscribe(int stream, float rate, bool pushed = false);
+
+    /**
+     * @brief Removes all subscriptions, the counters are kept.
+     */
+    void unsubscribe_all(void);
+
+    /**
+     * @brief Sets the bandwidth budget.
+     *
+     * @param budget_ bytes per second
+     * @param burst_ max bytes sent at once after an idle period
+     */
+    void set_budget(int budget_, int burst_);
+
+    /**
+     * @brief Sends the polled streams that are due, call it from the main loop.
+     *
+     * @param now_us current time (wraps around)
+     */
+    void update(uint32_t now_us);
+
+    /**
+     * @brief Checks a frame of a pushed stream against the budget.
+     *
+     * @param stream stream id
+     * @param bytes frame size
+     * @param now_us current time
+     * @return true if the frame should be sent, false if it is decimated
+     */
+    bool offer(int stream, int bytes, uint32_t now_us);
+
+    /**
+     * @brief Reports the result of sending a frame accepted by offer().
+     *
+     * @param bytes number of bytes queued, 0 if the frame was dropped
+     */
+    void sent(int stream, int bytes);
+
+    /**
+     * @brief Resets the sent, decimated and dropped counters.
+     */
+    void reset_counters(void);
+
+    float get_rate(int stream);             ///< subscribed rate, 0 if not subscribed
+    int get_sent(int stream);               ///< frames sent
+    int get_decimated(int stream);          ///< samples skipped because of the budget
+    int get_dropped(int stream);            ///< frames the sender could not queue
+    int get_budget(void);                   ///< bytes per second
+};
@@ -16,6 +16,21 @@
 #include "PID.h"
 #include "motor_driver_board.h"
 #include "sensor_array.h"
+#include "odometry.h"
+#include "duty_calibrator.h"
+#include "telemetry.h"
+#include "command_dispatcher.h"
+#include "parameters.h"
+#include "parameter_store.h"
+#include "telemetry_scheduler.h"
+#include "log_serial.h"
+#include "ring_logger.h"
+#include "black_box.h"
+#include "profiler.h"
+#include "task_scheduler.h"
+#include "mode_machine.h"
+#include "seqlock.h"
+#include "motion_script.h"
 
 
 /* BT COMMAND CHARS */
@@ -26,6 +41,7 @@ enum Bt_cmd_chars
     ch_get = 'G',                    // G
     ch_set = 'S',                    // S
     ch_continous = 'C',              // C
+    ch_binary = 'B',                 // B
 
     // 2 - exec types
     ch_stop = 'S',                   // S
@@ -41,6 +57,14 @@ enum Bt_cmd_chars
     ch_static_tracking = 'T',        // T
     ch_line_follow_auto = 'A',       // A
     ch_calibrate = 'C',
+    ch_duty_calibrate = 'D',         // D
+    ch_param_save = 'W',             // W
+    ch_param_defaults = 'R',         // R
+    ch_log_trigger = 'G',            // G
+    ch_black_box_erase = 'H',        // H
+    ch_profile_reset = 'Y',          // Y
+    ch_benchmark = 'B',              // B
+    ch_motion_run = 'N',             // N
 
     // 2 - data types
     ch_pwm_duty = 'D',               // D
@@ -51,7 +75,19 @@ enum Bt_cmd_chars
     ch_current_usage = 'C',          // C
     ch_runtime = 'R',                // R
     ch_loop_time = 'X',              // X
-    ch_loop_count = 'Y',             // Y
+    ch_profile = 'Y',                // Y
+    ch_traction = 'W',               // W
+    ch_deadband = 'K',               // K
+    ch_bt_stats = 'B',               // B
+    ch_param = 'V',                  // V
+    ch_stream = 'U',                 // U
+    ch_budget = 'B',                 // B
+    ch_log = 'L',                    // L
+    ch_trigger = 'G',                // G
+    ch_black_box = 'H',              // H
+    ch_scheduler = 'Z',              // Z
+    ch_mode = 'M',                   // M
+    ch_motion = 'N',                 // N
 
     // 3 - obj types
     ch_motor_left = 'L',         // L // PID, Encoder Ticks, Velocity
@@ -62,10 +98,127 @@ enum Bt_cmd_chars
 };
 
 
-/* BUGGY MODES */
+/* PARAMETER IDS (saved to flash, never reuse an id for a different parameter) */
+enum Param_ids
+{
+    // PID gains
+    p_pid_m_l_kp = 0,
+    p_pid_m_l_ki = 1,
+    p_pid_m_l_kd = 2,
+    p_pid_m_r_kp = 3,
+    p_pid_m_r_ki = 4,
+    p_pid_m_r_kd = 5,
+    p_pid_m_tau = 6,
+    p_pid_s_kp = 7,
+    p_pid_s_ki = 8,
+    p_pid_s_kd = 9,
+    p_pid_s_tau = 10,
+    p_pid_a_kp = 11,
+    p_pid_a_ki = 12,
+    p_pid_a_kd = 13,
+    p_pid_a_tau = 14,
+
+    // line follow
+    p_lf_velocity = 20,
+    p_lf_velocity_uturn = 21,
+    p_lf_stop_distance = 22,
+    p_uturn_angle = 23,
+    p_slow_accel_time = 24,
+    p_slow_accel_divider = 25,
+    p_stop_detect_time = 26,
+
+    // square task
+    p_sq_velocity = 30,
+    p_sq_right_angle = 31,
+    p_sq_left_angle = 32,
+    p_sq_distance = 33,
+    p_sq_radius = 34,
+
+    // motion script
+    p_ms_velocity = 35,
+    p_ms_accel = 36,
+
+    // sensors and filters
+    p_sens_detect_range = 40,
+    p_sens_angle_coeff = 41,
+    p_sens_lp_a0 = 42,
+    p_speed_lp_a0 = 43,
+
+    // motor compensation (SK, ED), the lookup tables span DUTY_CAL_MAX_DUTY
+    p_m_l_deadband = 50,
+    p_m_r_deadband = 51,
+    p_m_l_lut = 52,
+    p_m_r_lut = 53,
+    p_m_l_lut1 = 54,                // inner points 1 to 4, the first is the deadband and the last DUTY_CAL_MAX_DUTY
+    p_m_l_lut2 = 55,
+    p_m_l_lut3 = 56,
+    p_m_l_lut4 = 57,
+    p_m_r_lut1 = 58,
+    p_m_r_lut2 = 59,
+    p_m_r_lut3 = 60,
+    p_m_r_lut4 = 61,
+
+    // traction control
+    p_tc_window = 70,
+    p_tc_margin = 71,
+    p_tc_slew = 72,
+    p_stall_duty = 73,
+    p_stall_time = 74,
+    p_stall_cap = 75,
+};
+
+
+/* RING LOGGER TRIGGERS (bit mask) */
+enum Log_triggers
+{
+    trig_manual = 1,                ///< EG command
+    trig_line_lost = 2,             ///< line lost while line following
+    trig_saturation = 4,            ///< a motor PID output at its limit
+    trig_mode_change = 8,           ///< buggy mode changed
+};
+
+
+/* PROFILER SCOPES (GY command index, names in profile_names) */
+enum Profile_scopes
+{
+    prof_control_isr,               ///< whole control update
+    prof_motor_update,              ///< encoders, speed filters and odometry
+    prof_mixer,                     ///< motor set speeds from the outer loop (includes prof_pid_angle)
+    prof_pid_angle,
+    prof_pid_motor_l,
+    prof_pid_motor_r,
+    prof_log_stream,                ///< one PID log sample sent to the pc
+    prof_logging,                   ///< ring logger, black box and telemetry sampling
+    prof_sensor_isr,                ///< whole sensor update
+    prof_sensor_read,
+    prof_pid_sensor,
+    prof_bt_parse,                  ///< one bluetooth command
+    prof_bt_send,                   ///< one bluetooth data update or telemetry frame
+    prof_pc,                        ///< one pc command line or pc data update
+    prof_black_box_write,           ///< one flash program
+    prof_main_loop,                 ///< whole main loop iteration
+    prof_sensor_age,                ///< sensor acquisition start to control update start (age of the frame used)
+    prof_sensor_to_pwm,             ///< sensor acquisition start to the motor PWM update
+    prof_count,
+};
+
+
+/* BENCHMARKS (EB command, same names as the host control_bench results) */
+enum Bench_ids
+{
+    bench_sensor_array,             ///< SensorArray::update(), with the ADC conversions
+    bench_pid,                      ///< PID::update() with the sensor PID gains
+    bench_motor,                    ///< Motor::update(), encoder read and speed filter
+    bench_buggy_status,             ///< update_buggy_status()
+    bench_control_isr,              ///< control_update_ISR() in the current mode
+    bench_count,
+};
+
+
+/* BUGGY MODES (index of the mode state table) */
 enum Buggy_modes
 {
-    square_mode,
+    motion_script,
     straight_test,
     PID_test,
     line_test,
@@ -79,6 +232,7 @@ enum Buggy_modes
     line_follow_auto,
     stop_detect_line,
     calibration,
+    duty_calibration,
 };
 
 
@@ -87,17 +241,19 @@ enum Buggy_modes
  * 
  * This struct holds various parameters related to the state of the buggy, including velocities,
  * angles, distances, and task-specific variables.
+ * 
+ * Only used by main(): the ISRs get the set points through the setpoints command block.
  */
 struct Buggy_status
 {
     float set_velocity;         /**< @brief The set velocity for the buggy. */
     float set_angle;            /**< @brief The set angle for the buggy. */
 
-    float left_set_speed;       /**< @brief The set speed of the left wheel. */
-    float right_set_speed;      /**< @brief The set speed of the right wheel. */
-
     float cumulative_angle_deg; /**< @brief The cumulative angle (in degrees) traveled by the buggy. */
     float distance_travelled;   /**< @brief The distance travelled by the buggy. */
+    float x_position;           /**< @brief Odometry x position (forward from the last reset). */
+    float y_position;           /**< @brief Odometry y position (right of the last reset). */
+    uint32_t reset_generation;  /**< @brief Controller reset the pose was taken after (see reset_requests). */
 
     float lf_line_last_seen;    /**< @brief The position of the last seen line by the left front sensor. */
 
@@ -105,11 +261,26 @@ struct Buggy_status
     float accel_start_distance;
     float accel_start_angle;
     bool is_accelerating;
+};
+
+
+/**
+ * @brief Set points published by main() for the sensor and control ISRs.
+ */
+struct Buggy_setpoints
+{
+    float velocity;
+    float angle;
+};
+
 
-    // square task variables
-    float sq_set_angle;         /**< @brief The set angle for the square task. */
-    float sq_set_distance;      /**< @brief The set distance for the square task. */
-    int sq_stage;               /**< @brief The current stage of the square task. */
+/**
+ * @brief Wheel set speeds computed by the control ISR.
+ */
+struct Wheel_set_speeds
+{
+    float left;
+    float right;
 };
 
 
@@ -118,30 +289,55 @@ volatile bool pc_serial_update = false;
 volatile bool bt_serial_update = false;
 int ISR_exec_time = 0;
 int loop_exec_time = 0;
-
-float bt_float_data[3] = {0};
-short int data_log[LOG_SIZE][5] = {0};
-int log_index = 0;
+bool cmd_from_pc = false;           // true while dispatching a command recieved from the pc
+
+char pc_rx_buffer[PC_RX_BUFFER_SIZE];
+int pc_rx_index = 0;
+
+uint8_t log_ring[LOG_RING_SIZE];            // memory of the ring logger
+volatile int log_trigger_mask = 0;          // Log_triggers checked by the control ISR
+Buggy_modes log_last_mode = inactive;       // mode at the previous log update, for the mode change trigger
+volatile bool log_streaming = false;        // true while the PID log is streamed over the pc serial
+int black_box_decimation_count = 0;
+Buggy_modes black_box_last_mode = inactive; // mode at the previous black box update, for the transitions
+int black_box_battery_ms = 0;               // time of the last battery measurement
+int log_samples = 0;                        // samples streamed since the stream started
+int log_dropped_start = 0;                  // pc serial drop count when the stream started
 char bt_data_sent;
 char bt_obj_sent;
 float* pid_constants;               // used only for sending datat to bluetooth
 float* cal_constants;
 
-Buggy_modes  buggy_mode;          // stores buggy states when performing actions
-Buggy_modes  prev_buggy_mode;
+// Binary telemetry speed bursts, filled by the control ISR and sent by main()
+TelemetryBurst speed_burst[2] = {TelemetryBurst(tm_speed_burst, 2), TelemetryBurst(tm_speed_burst, 2)};
+volatile int speed_burst_filling = 0;       // burst being filled by the ISR
+volatile bool speed_burst_ready = false;    // true when the other burst is full and waiting to be sent
+volatile int speed_burst_dropped = 0;       // bursts dropped because the previous one was not sent yet
+int telemetry_decimation_count = 0;
+volatile int telemetry_decimation = 0;      // control updates per speed burst sample, 0 if not subscribed
+
+Buggy_modes  buggy_mode;          // current mode, only changed by the mode machine in the control ISR
+volatile bool stop_time_ready = false;      // active stop time waiting to be sent by main()
+float stop_time = 0;
+
+// Shared between main() and the ISRs (see seqlock.h), the ISRs never wait
+CommandBlock<Buggy_setpoints> setpoints;        // buggy_status set points, written by main()
+Seqlock<Wheel_set_speeds> wheel_set_speeds;     // mixer output, written by the control ISR
+volatile uint32_t reset_requests = 0;           // reset_everything() calls in main(), done by the control ISR
+volatile uint32_t reset_generation = 0;         // reset requests done by the control ISR
+volatile bool slow_accel_due = false;           // slow acceleration timeout, applied by main()
+volatile uint32_t sensor_frame_cycles = 0;      // cycle counter at the start of the last sensor acquisition
 Buggy_status buggy_status = {0};
 
-volatile float lf_velocity = LINE_FOLLOW_VELOCITY;
+volatile float lf_velocity = LINE_FOLLOW_VELOCITY;      // lf_vel, only written by apply_parameters()
+bool lf_uturn_override = false;                         // lf_vel_ut is used from the end of a u-turn, cleared by SS and the next run
 
 
 /* OBJECTS DECLARATIONS */
 DigitalOut LED(LED_PIN);                    // Debug LED set
-Serial pc(USBTX, USBRX, 115200);            // set up serial comm with pc
+LogSerial pc(USBTX, USBRX, PC_BAUD_RATE);   // set up serial comm with pc
 Timer global_timer;                         // set up global program timer
-Ticker control_ticker;
-Ticker serial_ticker;
-Ticker sensor_ticker;
-Timeout logic_timout;
+Ticker base_ticker;                         // the only timer interrupt, drives the scheduler
 
 Bluetooth bt(BT_TX_PIN, BT_RX_PIN, BT_BAUD_RATE);     
 MotorDriverBoard driver_board(DRIVER_ENABLE_PIN, DRIVER_MONITOR_PIN);
@@ -153,392 +349,684 @@ PID PID_motor_left (PID_M_L_KP, PID_M_L_KI, PID_M_L_KD, PID_M_TAU, PID_M_MIN_OUT
 PID PID_motor_right(PID_M_R_KP, PID_M_R_KI, PID_M_R_KD, PID_M_TAU, PID_M_MIN_OUT, PID_M_MAX_OUT, PID_M_MIN_INT, PID_M_MAX_INT, CONTROL_UPDATE_PERIOD);
 PID PID_angle (PID_A_KP, PID_A_KI, PID_A_KD, PID_A_TAU, PID_A_MIN_OUT, PID_A_MAX_OUT, PID_A_MIN_INT, PID_A_MAX_INT, CONTROL_UPDATE_PERIOD);
 PID PID_sensor(PID_S_KP, PID_S_KI, PID_S_KD, PID_S_TAU, PID_S_MIN_OUT, PID_S_MAX_OUT, PID_S_MIN_INT, PID_S_MAX_INT, SENSOR_UPDATE_PERIOD);
+Odometry odometry(PULSE_PER_REV, WHEEL_RADIUS, WHEEL_SEPERATION);
+DutyCalibrator duty_calibrator(motor_left, motor_right, CONTROL_UPDATE_RATE, DUTY_CAL_RAMP_RATE, DUTY_CAL_MAX_DUTY, 
+                               DUTY_CAL_MOVE_TIME, DUTY_CAL_MOVE_TICKS, DUTY_CAL_SETTLE_TIME, DUTY_CAL_MEASURE_TIME);
+MotionScript motion(WHEEL_SEPERATION, MOTION_ACCEL, MOTION_END_VELOCITY, MOTION_LOST_DISTANCE);       // run by the control ISR in motion_script mode
 
 
 // Helper Function Prototypes:
 void stop_motors(void);                                                 ///< Set pwm dc to 0 for both motors
-void update_buggy_status(int tick_count_left, int tick_count_right);    ///< Update buggy status variables
-void reset_everything(void);                                            ///< Reset all buggy values and all objects variables
-bool bt_parse_rx(char* rx_buffer);                                      ///< Parse recieved bluetooth data
-void control_update_ISR(void);                                          ///< ISR updating the control algorithm
-void serial_update_ISR(void);                                           ///< ISR to update flag to send data to pc/bt in main()
+void update_buggy_status(void);                                         ///< Update buggy status variables from the odometry
+void reset_everything(void);                                            ///< Reset all buggy values, the objects are reset by the next control update
+void reset_controllers(void);                                           ///< Reset the motors, odometry and PIDs, runs in the control ISR
+void publish_setpoints(void);                                           ///< Publish the buggy_status set points to the ISRs
+void control_update_ISR(float dt);                                      ///< ISR updating the control algorithm
+void serial_update_ISR(float dt);                                       ///< ISR to update flag to send data to pc/bt in main()
 void stop_detect_ISR(void);                                     
 void bt_send_data(void);                                                ///< Send data to the bt module
 void pc_send_data(void);                                                ///< Send data to the pc
-void sensor_update_ISR();
+void sensor_update_ISR(float dt);
 void slow_accel_ISR(void);
+float line_follow_velocity(void);                                       ///< Line follow speed, lf_vel_ut after a u-turn
+void bt_send_compensation(void);                                        ///< Send the motor compensation to the bt module
+void bt_send_frame(char data_type);                                     ///< Send data to the bt module as a telemetry frame
+int bt_send_stream(int type);                                           ///< Send one telemetry frame of a type, returns the bytes queued
+void set_speed_burst_rate(float rate);                                  ///< Subscribe to the speed bursts (frames per second)
+void telemetry_sample(void);                                            ///< Sample binary telemetry bursts, runs in the control ISR
+void apply_parameters(const ParameterRegistry& registry);               ///< Push the parameter values into the controllers, runs in the control ISR
+void log_stream_sample(void);                                           ///< Send one PID log sample to the pc, runs in the control ISR
+void log_stream_status(void);                                           ///< Send the log stream counters to the pc
+void log_update(void);                                                  ///< Check the log triggers and record a sample, runs in the control ISR
+void log_dump(void);                                                    ///< Print the ring logger content to the pc as CSV
+void black_box_update(void);                                            ///< Queue the black box records, runs in the control ISR
+void black_box_write(void);                                             ///< Program the next black box bytes if it ends before the next scheduler tick
+void black_box_dump(void);                                              ///< Print the black box content to the pc as CSV
+void profile_dump(void);                                                ///< Print the profiler, scheduler and mode machine statistics to the pc
+void benchmark_run(int iterations);                                     ///< Time the control hot path functions and print the results to the pc as JSON
+void mode_request(Buggy_modes mode);                                    ///< Post a mode change to the mode machine (main loop or ISR)
+void mode_changed(int from, int to);                                    ///< Mode machine hook, runs in the control ISR
+bool bt_rx_hook(const char* command);                                   ///< Post the stop commands from the bluetooth RX ISR
+void mode_enter_active_stop(void);
+void mode_enter_PID_test(void);
+void mode_enter_uturn(void);
+void mode_enter_static_tracking(void);
+void mode_enter_line_follow(void);
+void mode_enter_stop_detect_line(void);
+void mode_enter_calibration(void);
+void mode_enter_duty_calibration(void);
+void mode_enter_motion_script(void);
+void motion_load_square(void);                                          ///< Replace the motion script with the square task built from the sq_ parameters
+void cmd_reply(const char* format, ...);                                ///< Reply to a command on the port it came from
+void pc_key_command(char key);                                          ///< Handle the single key pc commands
+
+// BT Command Handler Prototypes (see bt_commands table):
+Cmd_error cmd_toggle_continous(const Cmd_args& args);
+Cmd_error cmd_toggle_binary(const Cmd_args& args);
+Cmd_error cmd_get(const Cmd_args& args);
+Cmd_error cmd_set_duty(const Cmd_args& args);
+Cmd_error cmd_set_speed(const Cmd_args& args);
+Cmd_error cmd_set_gains(const Cmd_args& args);
+Cmd_error cmd_set_tau(const Cmd_args& args);
+Cmd_error cmd_set_deadband(const Cmd_args& args);
+Cmd_error cmd_set_mode(const Cmd_args& args);
+Cmd_error cmd_encoder_test(const Cmd_args& args);
+Cmd_error cmd_motor_pwm_test(const Cmd_args& args);
+Cmd_error cmd_toggle_led(const Cmd_args& args);
+Cmd_error cmd_get_param(const Cmd_args& args);
+Cmd_error cmd_set_param(const Cmd_args& args);
+Cmd_error cmd_save_params(const Cmd_args& args);
+Cmd_error cmd_default_params(const Cmd_args& args);
+Cmd_error cmd_subscribe(const Cmd_args& args);
+Cmd_error cmd_set_budget(const Cmd_args& args);
+Cmd_error cmd_get_streams(const Cmd_args& args);
+Cmd_error cmd_select_log(const Cmd_args& args);
+Cmd_error cmd_set_trigger(const Cmd_args& args);
+Cmd_error cmd_log_trigger(const Cmd_args& args);
+Cmd_error cmd_get_log(const Cmd_args& args);
+Cmd_error cmd_get_black_box(const Cmd_args& args);
+Cmd_error cmd_erase_black_box(const Cmd_args& args);
+Cmd_error cmd_get_profile(const Cmd_args& args);
+Cmd_error cmd_reset_profile(const Cmd_args& args);
+Cmd_error cmd_get_scheduler(const Cmd_args& args);
+Cmd_error cmd_get_mode(const Cmd_args& args);
+Cmd_error cmd_benchmark(const Cmd_args& args);
+Cmd_error cmd_motion_add(const Cmd_args& args);
+Cmd_error cmd_motion_get(const Cmd_args& args);
+Cmd_error cmd_motion_run(const Cmd_args& args);
+Cmd_error cmd_square_test(const Cmd_args& args);
+
+
+/* PARAMETER TABLE */
+//  id                      name            type            min     max     default
+const Param_def param_table[] =
+{
+    {p_pid_m_l_kp,          "m_l_kp",       param_float,    0,      100,    PID_M_L_KP},
+    {p_pid_m_l_ki,          "m_l_ki",       param_float,    0,      100,    PID_M_L_KI},
+    {p_pid_m_l_kd,          "m_l_kd",       param_float,    0,      100,    PID_M_L_KD},
+    {p_pid_m_r_kp,          "m_r_kp",       param_float,    0,      100,    PID_M_R_KP},
+    {p_pid_m_r_ki,          "m_r_ki",       param_float,    0,      100,    PID_M_R_KI},
+    {p_pid_m_r_kd,          "m_r_kd",       param_float,    0,      100,    PID_M_R_KD},
+    {p_pid_m_tau,           "m_tau",        param_float,    0,      10,     PID_M_TAU},
+    {p_pid_s_kp,            "s_kp",         param_float,    0,      100,    PID_S_KP},
+    {p_pid_s_ki,            "s_ki",         param_float,    0,      100,    PID_S_KI},
+    {p_pid_s_kd,            "s_kd",         param_float,    0,      100,    PID_S_KD},
+    {p_pid_s_tau,           "s_tau",        param_float,    0,      10,     PID_S_TAU},
+    {p_pid_a_kp,            "a_kp",         param_float,    0,      100,    PID_A_KP},
+    {p_pid_a_ki,            "a_ki",         param_float,    0,      100,    PID_A_KI},
+    {p_pid_a_kd,            "a_kd",         param_float,    0,      100,    PID_A_KD},
+    {p_pid_a_tau,           "a_tau",        param_float,    0,      10,     PID_A_TAU},
+
+    {p_lf_velocity,         "lf_vel",       param_float,    0,      4,      LINE_FOLLOW_VELOCITY},
+    {p_lf_velocity_uturn,   "lf_vel_ut",    param_float,    0,      4,      LINE_FOLLOW_VELOCITY_UTURN},
+    {p_lf_stop_distance,    "lf_stop",      param_float,    0,      5,      LINE_FOLLOW_STOP_DISTANCE},
+    {p_uturn_angle,         "ut_angle",     param_float,    0,      360,    UTURN_ANGLE},
+    {p_slow_accel_time,     "acc_time",     param_float,    0,      10,     SLOW_ACCEL_TIME},
+    {p_slow_accel_divider,  "acc_div",      param_float,    1,      10,     SLOW_ACCEL_DIVIDER},
+    {p_stop_detect_time,    "stop_time",    param_float,    0,      10,     STOP_DETECT_TIME},
+
+    {p_sq_velocity,         "sq_vel",       param_float,    0,      2,      SQUARE_VELOCITY_SET},
+    {p_sq_right_angle,      "sq_right",     param_float,    0,      180,    SQUARE_TURNING_RIGHT_ANGLE},
+    {p_sq_left_angle,       "sq_left",      param_float,    0,      180,    SQUARE_TURNING_LEFT_ANGLE},
+    {p_sq_distance,         "sq_dist",      param_float,    0,      5,      SQUARE_DISTANCE},
+    {p_sq_radius,           "sq_radius",    param_float,    0,      0.5,    SQUARE_TURN_RADIUS},
+
+    {p_ms_velocity,         "ms_vel",       param_float,    0,      2,      MOTION_VELOCITY},
+    {p_ms_accel,            "ms_accel",     param_float,    0.1,    10,     MOTION_ACCEL},
+
+    {p_sens_detect_range,   "sn_range",     param_float,    0,      1,      SENS_DETECT_RANGE},
+    {p_sens_angle_coeff,    "sn_coeff",     param_float,    -10,    10,     SENS_ANGLE_COEFF},
+    {p_sens_lp_a0,          "sn_lp_a0",     param_float,    0,      0.99,   LP_SENS_A0},
+    {p_speed_lp_a0,         "sp_lp_a0",     param_float,    0,      0.99,   LP_SPEED_A0},
+
+    {p_m_l_deadband,        "m_l_db",       param_float,    0,      1,      MOTOR_L_DEADBAND},
+    {p_m_r_deadband,        "m_r_db",       param_float,    0,      1,      MOTOR_R_DEADBAND},
+    {p_m_l_lut,             "m_l_lut",      param_bool,     0,      1,      0},
+    {p_m_r_lut,             "m_r_lut",      param_bool,     0,      1,      0},
+    {p_m_l_lut1,            "m_l_lut1",     param_float,    0,      1,      0},
+    {p_m_l_lut2,            "m_l_lut2",     param_float,    0,      1,      0},
+    {p_m_l_lut3,            "m_l_lut3",     param_float,    0,      1,      0},
+    {p_m_l_lut4,            "m_l_lut4",     param_float,    0,      1,      0},
+    {p_m_r_lut1,            "m_r_lut1",     param_float,    0,      1,      0},
+    {p_m_r_lut2,            "m_r_lut2",     param_float,    0,      1,      0},
+    {p_m_r_lut3,            "m_r_lut3",     param_float,    0,      1,      0},
+    {p_m_r_lut4,            "m_r_lut4",     param_float,    0,      1,      0},
+
+    {p_tc_window,           "tc_window",    param_int,      0,      500,    TRACTION_ACCEL_WINDOW},
+    {p_tc_margin,           "tc_margin",    param_float,    0,      100,    TRACTION_ACCEL_MARGIN},
+    {p_tc_slew,             "tc_slew",      param_float,    0,      100,    TRACTION_SLEW_RATE},
+    {p_stall_duty,          "st_duty",      param_float,    0,      1,      STALL_DUTY},
+    {p_stall_time,          "st_time",      param_float,    0,      10,     STALL_TIME},
+    {p_stall_cap,           "st_cap",       param_float,    0,      1,      STALL_DUTY_CAP},
+};
+
+ParameterRegistry params(param_table, sizeof(param_table) / sizeof(param_table[0]), apply_parameters);
+
+// ED results, staged to the parameters so EW saves them
+const Duty_cal_params duty_cal_params = {{p_m_l_deadband, p_m_r_deadband}, {p_m_l_lut, p_m_r_lut}, {p_m_l_lut1, p_m_r_lut1}};
+static_assert(p_m_l_lut4 - p_m_l_lut1 + 3 == DutyCalibrator::lut_size, "one parameter per inner lookup table point");
+ParameterStore param_store(PARAM_FLASH_ADDRESS, PARAM_FLASH_SIZE);
+
+// Binary telemetry streams (stream id = frame type), sent while in binary continous mode
+TelemetryScheduler telemetry_scheduler(bt_send_stream, TELEMETRY_BUDGET, TELEMETRY_BURST);
+
+
+/* LOG CHANNEL TABLE (SL command mask bits are the table indexes) */
+const Log_channel log_channels[] =
+{
+    {"m_l_sp",      []() { return *PID_motor_left.get_terms()[1]; },        1000},
+    {"m_l_meas",    []() { return *PID_motor_left.get_terms()[2]; },        1000},
+    {"m_l_p",       []() { return *PID_motor_left.get_terms()[4]; },        1000},
+    {"m_l_i",       []() { return *PID_motor_left.get_terms()[5]; },        1000},
+    {"m_l_d",       []() { return *PID_motor_left.get_terms()[6]; },        1000},
+    {"m_l_out",     []() { return *PID_motor_left.get_terms()[7]; },        1000},
+    {"m_r_sp",      []() { return *PID_motor_right.get_terms()[1]; },       1000},
+    {"m_r_meas",    []() { return *PID_motor_right.get_terms()[2]; },       1000},
+    {"m_r_out",     []() { return *PID_motor_right.get_terms()[7]; },       1000},
+    {"s_meas",      []() { return *PID_sensor.get_terms()[2]; },            1000},
+    {"s_out",       []() { return *PID_sensor.get_terms()[7]; },            1000},
+    {"a_meas",      []() { return *PID_angle.get_terms()[2]; },             100},
+    {"a_out",       []() { return *PID_angle.get_terms()[7]; },             1000},
+    {"sens_out",    []() { return sensor_array.get_array_output(); },       1000},
+    {"duty_l",      []() { return motor_left.get_applied_duty_cycle(); },   1000},
+    {"duty_r",      []() { return motor_right.get_applied_duty_cycle(); },  1000},
+    {"distance",    []() { return odometry.get_pose().distance; },          1000},
+    {"mode",        []() { return (float) buggy_mode; },                    1},
+};
+
+RingLogger ring_logger(log_channels, sizeof(log_channels) / sizeof(log_channels[0]), log_ring, LOG_RING_SIZE);
+
+FlashIAP black_box_flash;
+BlackBox black_box(BLACKBOX_FLASH_ADDRESS, BLACKBOX_FLASH_SIZE, BLACKBOX_WRITE_SIZE);
+
+const char* const profile_names[prof_count] =
+{
+    "control_isr", "motor_update", "mixer", "pid_angle", "pid_motor_l", "pid_motor_r", "log_stream", "logging",
+    "sensor_isr", "sensor_read", "pid_sensor", "bt_parse", "bt_send", "pc", "black_box_write", "main_loop",
+    "sensor_age", "sensor_to_pwm",
+};
+
+// DWT cycle counter, enabled at the start of main()
+Profiler profiler(profile_names, prof_count, []() -> uint32_t { return DWT->CYCCNT; }, PROFILE_CYCLES_PER_US);
+
+const char* const bench_names[bench_count] =
+{
+    "sensor_array_update", "pid_update", "motor_update", "update_buggy_status", "control_update_isr",
+};
+
+Profiler bench_profiler(bench_names, bench_count, []() -> uint32_t { return DWT->CYCCNT; }, PROFILE_CYCLES_PER_US);
+
+
+/* SCHEDULER TASK TABLE (GZ command index) */
+//  name        task                    divider                 phase   deadline (us, 0 = base period)
+const Task_def sched_tasks[] =
+{
+    {"sensor",  sensor_update_ISR,      1,                      0,      0},     // 5 kHz
+    {"control", control_update_ISR,     SCHED_CONTROL_DIVIDER,  0,      0},     // 2.5 kHz, after the sensor update of the same tick
+    {"serial",  serial_update_ISR,      SCHED_SERIAL_DIVIDER,   1,      0},     // 50 Hz, on a tick without control update
+};
+
+TaskScheduler scheduler(sched_tasks, sizeof(sched_tasks) / sizeof(sched_tasks[0]), SCHED_BASE_PERIOD_US,
+                        []() -> uint32_t { return (uint32_t) global_timer.read_us(); });
+
+
+/* MODE STATE TABLE (same order as Buggy_modes) */
+//  name                    entry                           exit                                    urgent
+const Mode_state mode_states[] =
+{
+    {"motion_script",       mode_enter_motion_script,       []() { motion.stop(); },                false},
+    {"straight_test",       reset_everything,               NULL,                                   false},
+    {"PID_test",            mode_enter_PID_test,            NULL,                                   false},
+    {"line_test",           NULL,                           NULL,                                   false},
+    {"line_follow",         mode_enter_line_follow,         NULL,                                   false},
+    {"task_test",           []() { bt.set_continous(true); },   NULL,                               false},
+    {"task_test_inactive",  []() { bt.set_continous(true); },   NULL,                               false},
+    {"inactive",            stop_motors,                    NULL,                                   true},
+    {"active_stop",         mode_enter_active_stop,         NULL,                                   true},
+    {"uturn",               mode_enter_uturn,               NULL,                                   false},
+    {"static_tracking",     mode_enter_static_tracking,     NULL,                                   false},
+    {"line_follow_auto",    mode_enter_line_follow,         NULL,                                   false},
+    {"stop_detect_line",    mode_enter_stop_detect_line,    NULL,                                   false},
+    {"calibration",         mode_enter_calibration,         NULL,                                   false},
+    {"duty_calibration",    mode_enter_duty_calibration,    []() { duty_calibrator.abort(); },      false},
+};
+
+/* MODE TRANSITION TABLE (first matching row) */
+//  from        to                  guard
+const Mode_transition mode_transitions[] =
+{
+    {MODE_ANY,  calibration,        [](int from, int to) { return from == inactive; }},     // motors stopped
+    {MODE_ANY,  duty_calibration,   [](int from, int to) { return from == inactive; }},
+    {MODE_ANY,  MODE_ANY,           NULL},
+};
+
+ModeMachine mode_machine(mode_states, sizeof(mode_states) / sizeof(mode_states[0]), mode_transitions,
+                         sizeof(mode_transitions) / sizeof(mode_transitions[0]), mode_changed);
+
+
+/* BT COMMAND TABLE */
+//  type            name                    objects     optional    args    handler                 param
+const Command bt_commands[] =
+{
+    {ch_continous,  '\0',                   NULL,       false,      0, 0,   cmd_toggle_continous,   0},
+    {ch_binary,     '\0',                   NULL,       false,      0, 0,   cmd_toggle_binary,      0},
+
+    {ch_get,        ch_pwm_duty,            "LRBS",     true,       0, 0,   cmd_get,                0},
+    {ch_get,        ch_ticks_cumulative,    "LRBS",     true,       0, 0,   cmd_get,                0},
+    {ch_get,        ch_speed,               "LRBS",     true,       0, 0,   cmd_get,                0},
+    {ch_get,        ch_gains_PID,           "LRBS",     true,       0, 0,   cmd_get,                0},
+    {ch_get,        ch_current_usage,       "LRBS",     true,       0, 0,   cmd_get,                0},
+    {ch_get,        ch_runtime,             "LRBS",     true,       0, 0,   cmd_get,                0},
+    {ch_get,        ch_loop_time,           "LRBS",     true,       0, 0,   cmd_get,                0},
+    {ch_get,        ch_traction,            "LRBS",     true,       0, 0,   cmd_get,                0},
+    {ch_get,        ch_deadband,            "LRBS",     true,       0, 0,   cmd_get,                0},
+    {ch_get,        ch_bt_stats,            "LRBS",     true,       0, 0,   cmd_get,                0},
+    {ch_get,        ch_param,               NULL,       false,      0, 1,   cmd_get_param,          0},
+    {ch_get,        ch_stream,              NULL,       false,      0, 0,   cmd_get_streams,        0},
+    {ch_get,        ch_log,                 NULL,       false,      0, 0,   cmd_get_log,            0},
+    {ch_get,        ch_black_box,           NULL,       false,      0, 0,   cmd_get_black_box,      0},
+    {ch_get,        ch_profile,             NULL,       false,      0, 1,   cmd_get_profile,        0},
+    {ch_get,        ch_scheduler,           NULL,       false,      0, 1,   cmd_get_scheduler,      0},
+    {ch_get,        ch_mode,                NULL,       false,      0, 0,   cmd_get_mode,           0},
+    {ch_get,        ch_motion,              NULL,       false,      0, 0,   cmd_motion_get,         0},
+
+    {ch_set,        ch_pwm_duty,            "LR",       false,      1, 1,   cmd_set_duty,           0},
+    {ch_set,        ch_speed,               NULL,       false,      1, 1,   cmd_set_speed,          0},
+    {ch_set,        ch_gains_PID,           "LRBS",     false,      3, 3,   cmd_set_gains,          0},
+    {ch_set,        ch_tau_PID,             "LRBS",     false,      1, 1,   cmd_set_tau,            0},
+    {ch_set,        ch_deadband,            "LRB",      false,      1, 1,   cmd_set_deadband,       0},
+    {ch_set,        ch_param,               NULL,       false,      2, 2,   cmd_set_param,          0},
+    {ch_set,        ch_stream,              NULL,       false,      2, 2,   cmd_subscribe,          0},
+    {ch_set,        ch_budget,              NULL,       false,      1, 2,   cmd_set_budget,         0},
+    {ch_set,        ch_log,                 NULL,       false,      1, 2,   cmd_select_log,         0},
+    {ch_set,        ch_trigger,             NULL,       false,      1, 3,   cmd_set_trigger,        0},
+    {ch_set,        ch_motion,              "STAFW",    true,       0, 3,   cmd_motion_add,         0},
+
+    {ch_execute,    ch_stop,                NULL,       false,      0, 0,   cmd_set_mode,           inactive},
+    {ch_execute,    ch_active_stop,         NULL,       false,      0, 0,   cmd_set_mode,           active_stop},
+    {ch_execute,    ch_uturn,               NULL,       false,      0, 0,   cmd_set_mode,           uturn},
+    {ch_execute,    ch_encoder_test,        NULL,       false,      0, 0,   cmd_encoder_test,       0},
+    {ch_execute,    ch_motor_pwm_test,      NULL,       false,      0, 0,   cmd_motor_pwm_test,     0},
+    {ch_execute,    ch_straight_test,       NULL,       false,      0, 0,   cmd_set_mode,           straight_test},
+    {ch_execute,    ch_square_test,         NULL,       false,      0, 0,   cmd_square_test,        0},
+    {ch_execute,    ch_PID_test,            NULL,       false,      0, 0,   cmd_set_mode,           PID_test},
+    {ch_execute,    ch_toggle_led_test,     NULL,       false,      0, 0,   cmd_toggle_led,         0},
+    {ch_execute,    ch_line_follow,         NULL,       false,      0, 0,   cmd_set_mode,           line_follow},
+    {ch_execute,    ch_static_tracking,     NULL,       false,      0, 0,   cmd_set_mode,           static_tracking},
+    {ch_execute,    ch_line_follow_auto,    NULL,       false,      0, 0,   cmd_set_mode,           line_follow_auto},
+    {ch_execute,    ch_calibrate,           NULL,       false,      0, 0,   cmd_set_mode,           calibration},
+    {ch_execute,    ch_duty_calibrate,      NULL,       false,      0, 0,   cmd_set_mode,           duty_calibration},
+    {ch_execute,    ch_param_save,          NULL,       false,      0, 0,   cmd_save_params,        0},
+    {ch_execute,    ch_param_defaults,      NULL,       false,      0, 0,   cmd_default_params,     0},
+    {ch_execute,    ch_log_trigger,         NULL,       false,      0, 0,   cmd_log_trigger,        0},
+    {ch_execute,    ch_black_box_erase,     NULL,       false,      0, 0,   cmd_erase_black_box,    0},
+    {ch_execute,    ch_profile_reset,       NULL,       false,      0, 0,   cmd_reset_profile,      0},
+    {ch_execute,    ch_benchmark,           NULL,       false,      0, 1,   cmd_benchmark,          0},
+    {ch_execute,    ch_motion_run,          NULL,       false,      0, 0,   cmd_motion_run,         0},
+};
+
+CommandDispatcher bt_dispatcher(bt_commands, sizeof(bt_commands) / sizeof(bt_commands[0]));
 
 
 /* MAIN FUNCTION */
 int main()
 {
-    buggy_mode = inactive;
-    buggy_mode = inactive;
+    mode_machine.start(inactive);
 
     while (!bt.is_ready()) {};          // while bluetooth not ready, loop and do nothing
 
     sensor_array.set_all_led_on(true);
 
+    motor_left.set_traction_control(TRACTION_ACCEL_WINDOW, TRACTION_ACCEL_MARGIN, TRACTION_SLEW_RATE, STALL_DUTY, STALL_TIME, STALL_DUTY_CAP);
+    motor_right.set_traction_control(TRACTION_ACCEL_WINDOW, TRACTION_ACCEL_MARGIN, TRACTION_SLEW_RATE, STALL_DUTY, STALL_TIME, STALL_DUTY_CAP);
+    motor_left.set_compensation(MOTOR_L_DEADBAND, NULL, 0, 0);
+    motor_right.set_compensation(MOTOR_R_DEADBAND, NULL, 0, 0);
+    motor_left.set_compensation_enabled(MOTOR_L_DEADBAND > 0);
+    motor_right.set_compensation_enabled(MOTOR_R_DEADBAND > 0);
+
+    set_speed_burst_rate(TELEMETRY_BURST_RATE);
+
+    // Same channels as the old PID log until changed with SL
+    const uint8_t default_log_channels[] = {0, 1, 2, 3, 4};
+    ring_logger.select(default_log_channels, sizeof(default_log_channels));
+    ring_logger.arm();
+
+    // Saved parameters are applied by the first control update
+    int params_loaded = param_store.load(params);
+    pc.printf("Parameters: %d loaded from flash\n", params_loaded);
+
     global_timer.start();                                                           // Starts the global program timer
-    sensor_ticker.attach_us(&sensor_update_ISR, SENSOR_UPDATE_PERIOD_US);           // Starts the control ISR update ticker
-    control_ticker.attach_us(&control_update_ISR, CONTROL_UPDATE_PERIOD_US);        // Starts the control ISR update ticker
-    serial_ticker.attach(&serial_update_ISR, SERIAL_UPDATE_PERIOD);                 // Starts the control ISR update ticker
+
+    // The profiler uses the DWT cycle counter (one count per CPU clock)
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    profiler.set_budget(prof_control_isr, SCHED_BASE_PERIOD_US);
+
+    // The black box continues after the previous sessions (the flash is memory mapped)
+    black_box_flash.init();
+    int black_box_records = black_box.recover((const uint8_t*) BLACKBOX_FLASH_ADDRESS, global_timer.read_ms());
+    pc.printf("Black box: session %d, %d records, %d%% used\n", black_box.get_session(), black_box_records,
+              (int) (100 * black_box.get_used() / black_box.get_size()));
+
+    bt.set_rx_hook(bt_rx_hook);
+    scheduler.start();
+    base_ticker.attach_us(callback(&scheduler, &TaskScheduler::tick), SCHED_BASE_PERIOD_US);  // Starts the sensor, control and serial tasks
     
     while (1)
     {
-        int curr_time = global_timer.read_us();
+        uint32_t loop_start = profiler.start();
 
         /* --- START OF COMMAND PROCESSING --- */
-        if (bt.data_recieved_complete()) 
+        while (bt.data_recieved_complete()) 
         {
-            char* rx_buf = bt.get_rx_buffer(); 
-            if (!bt_parse_rx(rx_buf))
+            uint32_t parse_start = profiler.start();
+            Cmd_error error = bt_dispatcher.dispatch(bt.get_rx_buffer());
+            if (error != cmd_ok)
             {
-                bt.send_fstring("Err: %s", rx_buf);
+                cmd_reply("Err%d: %s", error, CommandDispatcher::error_string(error));
             }
             bt.reset_rx_buffer();
+            profiler.stop(prof_bt_parse, parse_start);
         }
 
-        if (pc.readable())
+        // PC commands use the same table as bluetooth, one command per line
+        while (pc.readable())
         {
-            switch (pc.getc()) 
+            char c = pc.getc();
+            if (pc_rx_index == 0 && (c == 'r' || c == 's' || c == 'D' || c == 'L' || c == 'H' || c == 'P'))
             {
-            case 'r':
-                reset_everything();
-                buggy_mode = static_tracking;
-                break;
-            case 's':
-                buggy_mode = inactive;
-                stop_motors();
-                break;
-            case 'D':
-                buggy_mode = inactive;
-                for(int i = 0; i < log_index; i++)
+                pc_key_command(c);
+            }
+            else if (c == '\n' || c == '\r' || c == '/')
+            {
+                if (pc_rx_index > 0)
                 {
-                    pc.printf("%.5f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
-                                    (i * CONTROL_UPDATE_PERIOD),
-                                    (float) (data_log[i][0] / 1000.0), //= set_point
-                                    (float) (data_log[i][1] / 1000.0), //= measurement
-                                    (float) (data_log[i][2] / 1000.0), //= propotional
-                                    (float) (data_log[i][3] / 1000.0), //= integrator
-                                    (float) (data_log[i][4] / 1000.0)); //= differentiator
+                    uint32_t pc_start = profiler.start();
+                    pc_rx_buffer[pc_rx_index] = '\0';
+                    cmd_from_pc = true;
+                    Cmd_error error = bt_dispatcher.dispatch(pc_rx_buffer);
+                    if (error != cmd_ok)
+                    {
+                        cmd_reply("Err%d: %s", error, CommandDispatcher::error_string(error));
+                    }
+                    cmd_from_pc = false;
+                    pc_rx_index = 0;
+                    profiler.stop(prof_pc, pc_start);
                 }
-                log_index = 0;
-                break;
-            default:
-                break;
             }
-
+            else if (pc_rx_index < PC_RX_BUFFER_SIZE - 1)
+            {
+                pc_rx_buffer[pc_rx_index++] = c;
+            }
         }
         /* ---  END OF COMMAND PROCESSING  --- */
 
 
         /* --- START OF BUGGY ACTIONS/STATE LOGIC CODE --- */ 
-        update_buggy_status(motor_left.get_tick_count(), motor_right.get_tick_count());
+        update_buggy_status();
 
-        // Buggy mode transition code
-        if (buggy_mode != prev_buggy_mode)
+        // Checks the next mode request and prepares the mode, the control ISR switches to it
+        mode_machine.process();
+
+        if (stop_time_ready)
         {
-            driver_board.set_enable(buggy_mode != inactive && 
-                                    buggy_mode != task_test_inactive);
+            // the control ISR has reset the controllers and ignores the set points, clear them
+            memset(&buggy_status, 0, sizeof(buggy_status));
+            bt.send_fstring("T:%.3f\n", stop_time);
+            stop_time_ready = false;
+        }
 
-            switch (buggy_mode)
+        if (slow_accel_due)
+        {
+            if (buggy_mode == line_follow_auto ||
+                buggy_mode == line_follow)
             {
-                case PID_test:
-                    reset_everything();
-                    pid_constants = PID_motor_left.get_constants();
-                    bt.send_fstring("P:%.2f,I:%.2f", pid_constants[0], pid_constants[1]);
-                    bt.send_fstring("D:%.2f,T:%.2f\n", pid_constants[2], pid_constants[3]);
-                    buggy_status.set_angle = 0;
-                    buggy_status.set_velocity = 0.0;
-                    break;
-                case square_mode:
-                case straight_test:
-                    reset_everything();
-                    break;
-                case task_test:
-                case task_test_inactive:
-                    bt.set_continous(true);
-                    break;
-                case uturn:
-                    reset_everything();
-                    buggy_status.set_angle = UTURN_ANGLE;
-                    buggy_status.set_velocity = 0.0;
-                    break;
-                case static_tracking:
-                    reset_everything();
-                    pid_constants = PID_sensor.get_constants();
-                    bt.send_fstring("\nP:%.3f\nI:%.3f\n", pid_constants[0], pid_constants[1]);
-                    bt.send_fstring("D:%.3f\nT:%.3f\n", pid_constants[2], pid_constants[3]);
-                    buggy_status.set_angle = 0;
-                    buggy_status.set_velocity = 0.0;
-                    break;
-                case line_follow_auto:
-                case line_follow:
-                    reset_everything();
+                buggy_status.set_velocity = line_follow_velocity();
+            }
+            slow_accel_due = false;
+        }
 
-                    // if (!sensor_array.is_line_detected())
+        // Buggy mode continous logic, on a pose taken after the last controller reset: the control ISR
+        // can switch the mode and reset the odometry after update_buggy_status() in the same loop
+        if (buggy_status.reset_generation == reset_requests)
+        {
+            switch (buggy_mode) 
+            {   
+                case inactive:
+                    driver_board.disable();
+                    stop_motors();
+                    break;
+                case PID_test:
+                    if (buggy_status.distance_travelled <= 0.1)
+                    {
+                        buggy_status.set_velocity = 2;
+                    }
+                    // if (buggy_status.distance_travelled >= 0.1)
                     // {
-                    //     buggy_mode = inactive;
-                    //     bt.send_fstring("Line undetected\n", global_timer.read());
-                    //     break;
+                    //     buggy_status.set_velocity = 0.5;
                     // }
-                    
-                    pid_constants = PID_sensor.get_constants();
-                    bt.send_fstring("T:%.3f\n", global_timer.read());
-                    bt.send_fstring("\nP:%.3f\nI:%.3f\n", pid_constants[0], pid_constants[1]);
-                    bt.send_fstring("D:%.3f\nT:%.3f\n", pid_constants[2], pid_constants[3]);
-
-                    buggy_status.set_angle = 0;
-                    buggy_status.set_velocity = lf_velocity / SLOW_ACCEL_DIVIDER;
-
-                    buggy_status.accel_start_angle = buggy_status.cumulative_angle_deg;
-                    buggy_status.accel_start_distance = buggy_status.distance_travelled;
-                    buggy_status.is_accelerating = false;
-                    logic_timout.attach(&slow_accel_ISR, SLOW_ACCEL_TIME);
-                    break;
-                case active_stop:
-                    reset_everything();
-                    buggy_status.set_angle = 0;
-                    buggy_status.set_velocity = 0.0;
-                    bt.send_fstring("T:%.3f\n", global_timer.read());
-                    break;
-                case stop_detect_line:
-                    reset_everything();
-                    logic_timout.attach(&stop_detect_ISR, STOP_DETECT_TIME);
-                    buggy_status.set_angle = 0;
-                    buggy_status.set_velocity = 0.0;
-                    break;
-                case calibration:
-                    reset_everything();
-                    sensor_array.calibrate_sensors();
-                    cal_constants = sensor_array.get_calibration_constants();
-                    for (int i = 0; i < 6; i++)
+                    // if (buggy_status.distance_travelled >= 0.4)
+                    // {
+                    //     buggy_status.set_velocity = 1;
+                    // }
+                    // if (buggy_status.distance_travelled >= 1)
+                    // {
+                    //     buggy_status.set_velocity = 0.5;
+                    // }
+                    if (buggy_status.distance_travelled >= 0.7)
                     {
-                        bt.send_fstring("%d:%.4f\n", i, cal_constants[i]);
+                        mode_request(active_stop);
                     }
-                    buggy_mode = inactive;
-                    break;
-                default:
                     break;
-            }            
-            prev_buggy_mode = buggy_mode;
-        }
 
-        // Buggy mode continous logic
-        switch (buggy_mode) 
-        {   
-            case inactive:
-                driver_board.disable();
-                stop_motors();
-                break;
-            case square_mode:
-                switch (buggy_status.sq_stage)
-                {
-                    case 0:
-                        buggy_status.sq_set_distance += SQUARE_DISTANCE;
-                        buggy_status.set_angle = buggy_status.sq_set_angle;
-                        buggy_status.set_velocity = SQUARE_VELOCITY_SET;
-                        buggy_status.sq_stage++;
-                        break;
-                    case 7:
-                    case 1:
-                    case 3:
-                    case 5:
-                        if (buggy_status.distance_travelled >= buggy_status.sq_set_distance) // wait to move 1m then, start turning right
-                        {
-                            if (buggy_status.sq_stage == 7)
-                            {
-                                buggy_status.sq_set_angle += SQUARE_TURNING_RIGHT_ANGLE;
-                            }
-                            buggy_status.sq_set_angle += SQUARE_TURNING_RIGHT_ANGLE;
-                            buggy_status.set_angle = buggy_status.sq_set_angle;
-                            buggy_status.set_velocity = 0;
-                            buggy_status.sq_stage++;
-                        }
-                        break;
-                    case 2:
-                    case 4:
-                    case 6:
-                    case 8:
-                        if (buggy_status.cumulative_angle_deg >= buggy_status.sq_set_angle) // wait to turn 90 and start moving straight
-                        {
-                            buggy_status.sq_set_distance += SQUARE_DISTANCE;
-                            buggy_status.set_angle = buggy_status.sq_set_angle;
-                            buggy_status.set_velocity = SQUARE_VELOCITY_SET;
-                            buggy_status.sq_stage++;
-                        }
-                        break;
-                    case 9:
-                    case 11:
-                    case 13:
-                        if (buggy_status.distance_travelled >= buggy_status.sq_set_distance) // wait to move 1m then, start turning left
-                        {
-                            buggy_status.sq_set_angle -= SQUARE_TURNING_LEFT_ANGLE;
-                            buggy_status.set_angle = buggy_status.sq_set_angle;
-                            buggy_status.set_velocity = 0;
-                            buggy_status.sq_stage++;
-                        }
-                        break;
-                    case 10:
-                    case 12:
-                    case 14:
-                        if (buggy_status.cumulative_angle_deg <= buggy_status.sq_set_angle) // wait to turn -90 and start moving straight
+                case uturn:
+                    if (buggy_status.cumulative_angle_deg >= buggy_status.set_angle)
+                    {
+                        if (sensor_array.is_line_detected())
                         {
-                            buggy_status.sq_set_distance += SQUARE_DISTANCE;
-                            buggy_status.set_angle = buggy_status.sq_set_angle;
-                            buggy_status.set_velocity = SQUARE_VELOCITY_SET;
-                            buggy_status.sq_stage++;
+                            mode_request(line_follow_auto);
+                            lf_uturn_override = true;
                         }
-                        break;
-                    case 15:
-                        if (buggy_status.distance_travelled >= buggy_status.sq_set_distance)  // Stop
+                        else 
                         {
-                            buggy_mode = inactive;
-                            stop_motors();
-                            buggy_status.sq_stage = 0;
+                            buggy_status.set_angle += 10;
                         }
-                        break;
-                    default:
-                        break;
-                }
-                break;
-            case PID_test:
-                if (buggy_status.distance_travelled <= 0.1)
-                {
-                    buggy_status.set_velocity = 2;
-                }
-                // if (buggy_status.distance_travelled >= 0.1)
-                // {
-                //     buggy_status.set_velocity = 0.5;
-                // }
-                // if (buggy_status.distance_travelled >= 0.4)
-                // {
-                //     buggy_status.set_velocity = 1;
-                // }
-                // if (buggy_status.distance_travelled >= 1)
-                // {
-                //     buggy_status.set_velocity = 0.5;
-                // }
-                if (buggy_status.distance_travelled >= 0.7)
-                {
-                    buggy_mode = active_stop;
-                    reset_everything();
-                }
-                break;
-
-            case uturn:
-                if (buggy_status.cumulative_angle_deg >= buggy_status.set_angle)
-                {
+                    }
+                    break;
+                case line_follow_auto:
                     if (sensor_array.is_line_detected())
                     {
-                        buggy_mode = line_follow_auto;
-                        lf_velocity = LINE_FOLLOW_VELOCITY_UTURN;
+                        buggy_status.lf_line_last_seen = buggy_status.distance_travelled;
                     }
-                    else 
+                    else if (buggy_status.distance_travelled - buggy_status.lf_line_last_seen >= params.get(p_lf_stop_distance))
                     {
-                        buggy_status.set_angle += 10;
+                        // buggy_mode = stop_detect_line;
+                        // stop_motors();
+                        // float prev_speed = buggy_status.set_velocity;
+                        // while (!sensor_array.is_line_detected())
+                        // {
+                        //     buggy_status.set_velocity = -1;
+                        // }
+                        // buggy_status.set_velocity = prev_speed;
                     }
-                }
-                break;
-            case line_follow_auto:
-                if (sensor_array.is_line_detected())
-                {
-                    buggy_status.lf_line_last_seen = buggy_status.distance_travelled;
-                }
-                else if (buggy_status.distance_travelled - buggy_status.lf_line_last_seen >= LINE_FOLLOW_STOP_DISTANCE)
-                {
-                    // buggy_mode = stop_detect_line;
-                    // stop_motors();
-                    // float prev_speed = buggy_status.set_velocity;
-                    // while (!sensor_array.is_line_detected())
+                    break;
+                case line_follow: 
+                    //// comment this disable accel
+                    // if (buggy_status.is_accelerating)
                     // {
-                    //     buggy_status.set_velocity = -1;
+                    //     float accel_distance = buggy_status.distance_travelled - buggy_status.accel_start_distance;
+                    //     if (accel_distance > MANUAL_ACCEL_DISTANCE)
+                    //     {
+                    //         // pc.printf("SLOWING DOWN\n");
+                    //         buggy_status.set_velocity = lf_velocity;
+                    //         buggy_status.accel_start_angle = buggy_status.cumulative_angle_deg;
+                    //         buggy_status.is_accelerating = false;
+                    //     }
+                    //     else
+                    //     {
+                    //         // pc.printf("fast\n");
+                    //         buggy_status.set_velocity = MANUAL_ACCEL_SPEED;
+                    //     }
                     // }
-                    // buggy_status.set_velocity = prev_speed;
-                }
-                break;
-            case line_follow: 
-                //// comment this disable accel
-                // if (buggy_status.is_accelerating)
-                // {
-                //     float accel_distance = buggy_status.distance_travelled - buggy_status.accel_start_distance;
-                //     if (accel_distance > MANUAL_ACCEL_DISTANCE)
-                //     {
-                //         // pc.printf("SLOWING DOWN\n");
-                //         buggy_status.set_velocity = lf_velocity;
-                //         buggy_status.accel_start_angle = buggy_status.cumulative_angle_deg;
-                //         buggy_status.is_accelerating = false;
-                //     }
-                //     else
-                //     {
-                //         // pc.printf("fast\n");
-                //         buggy_status.set_velocity = MANUAL_ACCEL_SPEED;
-                //     }
-                // }
-                // else 
-                // {
-                //     float accel_angle = fabsf(buggy_status.cumulative_angle_deg - buggy_status.accel_start_angle);
-                //     // pc.printf("%f\n", accel_angle);
-                //     if (accel_angle > MANUAL_ACCEL_ANGLE)
-                //     {
-                //         // pc.printf("Accelerating!!! %f\n", accel_angle);
-                //         buggy_status.set_velocity = MANUAL_ACCEL_SPEED;
-                //         buggy_status.accel_start_distance = buggy_status.distance_travelled;
-                //         buggy_status.is_accelerating = true;
-                //     }
-                //     else
-                //     {
-                //         // pc.printf("slowstuff\n");
-                //         buggy_status.set_velocity = lf_velocity;
-                //     }
-                // }
-                break;
-            case stop_detect_line:
-                if (sensor_array.is_line_detected())
-                {
-                    buggy_mode = line_follow_auto;
-                };
-            default:
-                break;
-        }    
+                    // else 
+                    // {
+                    //     float accel_angle = fabsf(buggy_status.cumulative_angle_deg - buggy_status.accel_start_angle);
+                    //     // pc.printf("%f\n", accel_angle);
+                    //     if (accel_angle > MANUAL_ACCEL_ANGLE)
+                    //     {
+                    //         // pc.printf("Accelerating!!! %f\n", accel_angle);
+                    //         buggy_status.set_velocity = MANUAL_ACCEL_SPEED;
+                    //         buggy_status.accel_start_distance = buggy_status.distance_travelled;
+                    //         buggy_status.is_accelerating = true;
+                    //     }
+                    //     else
+                    //     {
+                    //         // pc.printf("slowstuff\n");
+                    //         buggy_status.set_velocity = lf_velocity;
+                    //     }
+                    // }
+                    break;
+                case stop_detect_line:
+                    if (sensor_array.is_line_detected())
+                    {
+                        mode_request(line_follow_auto);
+                    };
+                    break;
+                case duty_calibration:
+                    if (mode_machine.is_changing())
+                    {
+                        break;      // result already handled
+                    }
+                    if (duty_calibrator.is_done())
+                    {
+                        duty_calibrator.apply(params, duty_cal_params);
+                        bt_send_compensation();
+                        mode_request(inactive);
+                    }
+                    else if (duty_calibrator.is_failed())
+                    {
+                        bt.send_fstring("Err: Cal failed\n");
+                        mode_request(inactive);
+                    }
+                    break;
+                case calibration:
+                    mode_request(inactive);     // done by the entry action
+                    break;
+                default:
+                    break;
+            }    
+        }
+        publish_setpoints();
         /* ---  END OF BUGGY ACTIONS/STATE LOGIC CODE  --- */ 
 
         
         /* --- START OF SERIAL UPDATE CODE --- */
+        if (speed_burst_ready)
+        {
+            TelemetryBurst& burst = speed_burst[1 - speed_burst_filling];
+            if (telemetry_scheduler.offer(tm_speed_burst, TELEMETRY_MAX_ENCODED, global_timer.read_us()))
+            {
+                uint32_t send_start = profiler.start();
+                telemetry_scheduler.sent(tm_speed_burst, bt.send_telemetry(burst.get_type(), burst.data(), burst.size()));
+                profiler.stop(prof_bt_send, send_start);
+            }
+            speed_burst_ready = false;
+        }
+
+        if (bt.is_binary() && bt.is_continous())
+        {
+            telemetry_scheduler.update(global_timer.read_us());
+        }
+
         if (bt_serial_update)
         {
+            uint32_t send_start = profiler.start();
             bt_send_data();
             bt_serial_update = false;
+            profiler.stop(prof_bt_send, send_start);
         }
 
         if (pc_serial_update)
         {
+            uint32_t pc_start = profiler.start();
             pc_send_data();
             pc_serial_update = false;
+            profiler.stop(prof_pc, pc_start);
         }
         /* ---  END OF SERIAL UPDATE CODE  --- */
 
 
+        /* --- BLACK BOX --- */
+        black_box_write();
+        if (global_timer.read_ms() - black_box_battery_ms >= BLACKBOX_BATTERY_PERIOD_MS)
+        {
+            driver_board.update_measurements();
+            black_box_battery_ms = global_timer.read_ms();
+        }
+
+
         /*       END OF LOOP      */
-        loop_exec_time = global_timer.read_us() - curr_time;
+        profiler.stop(prof_main_loop, loop_start);
+        loop_exec_time = (int) profiler.to_us(profiler.get_last(prof_main_loop));
     }
 }
 
 
 /* HELPER FUNCTIONS */
-void control_update_ISR(void)
+void control_update_ISR(float dt)
 {   
-    // Get the current time to measure the execution time
-    int curr_time = global_timer.read_us();
+    uint32_t isr_start = profiler.start();
+
+    // The sensor task runs first on the same tick, the frame is as old as its acquisition
+    uint32_t frame_cycles = sensor_frame_cycles;
+    profiler.record(prof_sensor_age, isr_start - frame_cycles);
+
+    // Stops and the mode requests checked by main() take effect here, before the control algorithm
+    mode_machine.process_urgent(global_timer.read_us());
+    uint32_t requests = reset_requests;
+    if (reset_generation != requests)
+    {
+        reset_controllers();
+        reset_generation = requests;
+    }
+
+    // A stop does not wait for main() to clear the set points
+    Buggy_setpoints sp = setpoints.read();
+    if (buggy_mode == active_stop)
+    {
+        sp.velocity = 0;
+        sp.angle = 0;
+    }
+    static Wheel_set_speeds wheels = {0, 0};
+
+    // Parameter changes are applied between two control updates
+    params.apply_pending();
 
     /* Run all the update functions: */
-    motor_left.update();
-    motor_right.update();
+    uint32_t scope_start = profiler.start();
+    motor_left.update(dt);
+    motor_right.update(dt);
+    odometry.update(motor_left.get_tick_count(), motor_right.get_tick_count());
+    profiler.stop(prof_motor_update, scope_start);
+
+    // The motion script computes its own set points from the new pose
+    Motion_output script = {0, 0, 0, false, false};
+    if (buggy_mode == motion_script)
+    {
+        Pose pose = odometry.get_pose();
+        script = motion.update(pose.distance, pose.heading_deg, sensor_array.is_line_detected(), dt);
+        sp.velocity = script.velocity;
+        sp.angle = script.heading_deg;
+        if (script.finished)
+        {
+            mode_request(inactive);
+        }
+    }
 
     /* Calculate and apply PID output on certain modes only*/
     if (buggy_mode == PID_test ||
-        buggy_mode == square_mode || 
+        buggy_mode == motion_script || 
         buggy_mode == line_follow ||
         buggy_mode == line_follow_auto ||
         buggy_mode == uturn ||
@@ -546,24 +1034,28 @@ void control_update_ISR(void)
         buggy_mode == active_stop)
     {
         // Update set PID_angle and calculate motor set speed depending on buggy mode
-        if (buggy_mode == square_mode || 
+        uint32_t mixer_start = profiler.start();
+        if ((buggy_mode == motion_script && !script.follow) || 
             buggy_mode == PID_test ||
             buggy_mode == uturn ||
             buggy_mode == active_stop)
         {
-            PID_angle.update(buggy_status.set_angle, buggy_status.cumulative_angle_deg);
+            scope_start = profiler.start();
+            PID_angle.update(sp.angle, odometry.get_pose().heading_deg, dt);
+            profiler.stop(prof_pid_angle, scope_start);
             
-            buggy_status.left_set_speed  = buggy_status.set_velocity + PID_angle.get_output();
-            buggy_status.right_set_speed = buggy_status.set_velocity - PID_angle.get_output();
+            // turn_offset is the arc feed forward of the motion script, 0 otherwise
+            wheels.left  = sp.velocity + script.turn_offset + PID_angle.get_output();
+            wheels.right = sp.velocity - script.turn_offset - PID_angle.get_output();
         }
         else if (buggy_mode == static_tracking)
         {
-            buggy_status.left_set_speed  = buggy_status.set_velocity + PID_sensor.get_output();
-            buggy_status.right_set_speed = buggy_status.set_velocity - PID_sensor.get_output();
+            wheels.left  = sp.velocity + PID_sensor.get_output();
+            wheels.right = sp.velocity - PID_sensor.get_output();
         }
         else
         {   
-            float base_speed = buggy_status.set_velocity;
+            float base_speed = sp.velocity;
 
             // float sens_out_abs = fabsf(sensor_array.get_filtered_output());
             // if (sens_out_abs > SLOW_TURNING_THRESH)
@@ -582,37 +1074,38 @@ void control_update_ISR(void)
             float speed_offset = PID_sensor.get_output();
             if (speed_offset > 0)
             {
-                buggy_status.left_set_speed  = base_speed;
-                buggy_status.right_set_speed = base_speed - 2 * speed_offset;
+                wheels.left  = base_speed;
+                wheels.right = base_speed - 2 * speed_offset;
             }
             else 
             {
-                buggy_status.left_set_speed  = base_speed - 2 * -speed_offset;
-                buggy_status.right_set_speed = base_speed;
+                wheels.left  = base_speed - 2 * -speed_offset;
+                wheels.right = base_speed;
             }
         }
 
+        wheel_set_speeds.write(wheels);
+        profiler.stop(prof_mixer, mixer_start);
+
         // Calculate Motor PID and apply the output: 
-        PID_motor_left.update(buggy_status.left_set_speed, motor_left.get_filtered_speed());
-        PID_motor_right.update(buggy_status.right_set_speed, motor_right.get_filtered_speed());
+        motor_left.set_speed_setpoint(wheels.left);
+        motor_right.set_speed_setpoint(wheels.right);
+        scope_start = profiler.start();
+        PID_motor_left.update(wheels.left, motor_left.get_filtered_speed(), dt);
+        profiler.stop(prof_pid_motor_l, scope_start);
+        scope_start = profiler.start();
+        PID_motor_right.update(wheels.right, motor_right.get_filtered_speed(), dt);
+        profiler.stop(prof_pid_motor_r, scope_start);
         motor_left.set_duty_cycle(PID_motor_left.get_output());
         motor_right.set_duty_cycle(PID_motor_right.get_output());
+        profiler.record(prof_sensor_to_pwm, profiler.start() - frame_cycles);
 
         // PID Data Logging
-        if(log_index < LOG_SIZE)
-        {
-            float** out_arr = PID_motor_left.get_terms();
-            // float** out_arr = PID_motor_right.get_terms();
-            // float** out_arr = PID_sensor.get_terms();
-            // data_log[log_index][0] = *out_arr[0]; //= time_index
-            data_log[log_index][0] = (short int) (*out_arr[1] * 1000); //= set_point
-            data_log[log_index][1] = (short int) (*out_arr[2] * 1000); //= measurement
-            // data_log[log_index][3] = *out_arr[3]; //= error
-            data_log[log_index][2] = (short int) (*out_arr[4] * 1000); //= propotional
-            data_log[log_index][3] = (short int) (*out_arr[5] * 1000); //= integrator
-            data_log[log_index][4] = (short int) (*out_arr[6] * 1000); //= differentiator
-            // data_log[log_index][7] = *out_arr[7]; //= output
-            log_index++;
+        if (log_streaming)
+        {
+            scope_start = profiler.start();
+            log_stream_sample();
+            profiler.stop(prof_log_stream, scope_start);
         }
 
         // Sends PID Data to the PC (WARNING: CAN CAUSE BT MALFUNCTION)
@@ -640,36 +1133,62 @@ void control_update_ISR(void)
     // pc.printf("%.4f,%.4f\n", motor_left.get_speed(), motor_left.get_filtered_speed());
     // pc.printf("%.4f\n", buggy_status.cumulative_angle_deg);
 
+    if (buggy_mode == duty_calibration)
+    {
+        duty_calibrator.update();
+    }
+
+    scope_start = profiler.start();
+    log_update();
+    black_box_update();
+
+    if (bt.is_binary() && bt.is_continous())
+    {
+        telemetry_sample();
+    }
+    profiler.stop(prof_logging, scope_start);
+
     // Measure control ISR execution time
-    ISR_exec_time = global_timer.read_us() - curr_time;
+    profiler.stop(prof_control_isr, isr_start);
+    ISR_exec_time = (int) profiler.to_us(profiler.get_last(prof_control_isr));
 }
 
 
-void sensor_update_ISR(void)
+void sensor_update_ISR(float dt)
 {
+    uint32_t isr_start = profiler.start();
+    sensor_frame_cycles = isr_start;
     sensor_array.update();
-    PID_sensor.update(buggy_status.set_angle, sensor_array.get_filtered_output());
+    profiler.stop(prof_sensor_read, isr_start);
+
+    uint32_t pid_start = profiler.start();
+    PID_sensor.update(setpoints.read().angle, sensor_array.get_filtered_output(), dt);
+    profiler.stop(prof_pid_sensor, pid_start);
+    profiler.stop(prof_sensor_isr, isr_start);
 }
 
 
 void slow_accel_ISR(void)
 {
-    if (buggy_mode == line_follow_auto ||
-        buggy_mode == line_follow)
-    {
-        buggy_status.set_velocity = lf_velocity;
-    }
+    // buggy_status belongs to main()
+    slow_accel_due = true;
 }
 
 void stop_detect_ISR(void)
 {
     if (buggy_mode == stop_detect_line)
     {
-        buggy_mode = inactive;
+        mode_request(inactive);
     }
 }
 
 
+float line_follow_velocity(void)
+{
+    return lf_uturn_override ? params.get(p_lf_velocity_uturn) : lf_velocity;
+}
+
+
 void stop_motors(void)
 {
     motor_left.set_duty_cycle(0.0);
@@ -677,191 +1196,1335 @@ void stop_motors(void)
 }
 
 
-void update_buggy_status(int tick_count_left, int tick_count_right)
+void update_buggy_status(void)
 {
-    // Angle calculations
-    buggy_status.cumulative_angle_deg = (float) (360 * WHEEL_RADIUS) * (tick_count_left - tick_count_right) / (WHEEL_SEPERATION * 4 * PULSE_PER_REV);
-
-    // distance travelled calculation
-    buggy_status.distance_travelled = ((float) (tick_count_left + tick_count_right) / (2 * PULSE_PER_REV * 4)) * 2 * PI * WHEEL_RADIUS;
+    // Pose is integrated in the control ISR, take a consistent snapshot of it. The generation is read
+    // first, a reset in between only holds the mode logic back for one more loop
+    buggy_status.reset_generation = reset_generation;
+    Pose pose = odometry.get_pose();
+
+    buggy_status.cumulative_angle_deg = pose.heading_deg;
+    buggy_status.distance_travelled = pose.distance;
+    buggy_status.x_position = pose.x;
+    buggy_status.y_position = pose.y;
 }
 
 
 void reset_everything(void)
+{
+    memset(&buggy_status, 0, sizeof(buggy_status));
+    publish_setpoints();
+    reset_requests = reset_requests + 1;
+}
+
+
+void reset_controllers(void)
 {
     motor_left.reset();
     motor_right.reset();
+    odometry.reset();
     PID_motor_left.reset();
     PID_motor_right.reset();
     PID_angle.reset();
     PID_sensor.reset();
+}
 
-    memset(&buggy_status, 0, sizeof(buggy_status));
+
+void publish_setpoints(void)
+{
+    Buggy_setpoints block = {buggy_status.set_velocity, buggy_status.set_angle};
+    setpoints.write(block);
 }
 
 
-bool bt_parse_rx(char* rx_buffer)
-{   
-    /*  This function reads the incoming data and checks for 
-        specific command format and returns the command type 
-        returns false if parsing failed     */
+void mode_request(Buggy_modes mode)
+{
+    // posted from the main loop and from ISRs
+    core_util_critical_section_enter();
+    mode_machine.post(mode, global_timer.read_us());
+    core_util_critical_section_exit();
+}
 
-    // command parsing -> to-do 
 
-    char cmd_type = rx_buffer[0];
-    char exec_type = rx_buffer[1];
-    char data_type = rx_buffer[1];
-    char obj_type = rx_buffer[2];
+void mode_changed(int from, int to)
+{
+    buggy_mode = (Buggy_modes) to;
+    driver_board.set_enable(to != inactive && 
+                            to != task_test_inactive);
+}
 
-    int data_amount;
 
-    switch(rx_buffer[0])
+bool bt_rx_hook(const char* command)
+{
+    // ES and EX skip the command queue, the next control update stops
+    if (command[0] == ch_execute && (command[1] == ch_stop || command[1] == ch_active_stop) && command[2] == '\0')
     {
-        case ch_continous:
-            bt.set_continous(!bt.is_continous());
-            break;
-        case ch_get:
-            bt.set_send_once(true);
-            bt_data_sent = data_type;
-            bt_obj_sent = obj_type;
-            break;
-        case ch_set:  
-            data_amount = (data_type == ch_gains_PID) ? 3 : 1;
-            if (sscanf(rx_buffer, "%*s %f %f %f", &bt_float_data[0], &bt_float_data[1], &bt_float_data[2]) != data_amount)
-            {
-                return false;
-            }
+        mode_request(command[1] == ch_stop ? inactive : active_stop);
+        return true;
+    }
+    return false;
+}
 
-            switch (data_type)
-            {
-                case ch_pwm_duty:               // P
-                    switch (obj_type)
-                    {
-                        case ch_motor_left:
-                            motor_left.set_duty_cycle(bt_float_data[0]);
-                            break;
-                        case ch_motor_right:
-                            motor_right.set_duty_cycle(bt_float_data[0]);
-                            break;
-                        default:
-                            break;
-                    }
-                    break;
-                case ch_speed:                  // S
-                    lf_velocity = bt_float_data[0];
-                    break;
-                case ch_gains_PID:
-                    switch (obj_type)
-                    {
-                        case ch_motor_left:
-                            PID_motor_left.set_constants(bt_float_data[0], bt_float_data[1], bt_float_data[2]);
-                            break;
-                        case ch_motor_right:
-                            PID_motor_right.set_constants(bt_float_data[0], bt_float_data[1], bt_float_data[2]);
-                            break;
-                        case ch_motor_both:
-                            PID_motor_left.set_constants(bt_float_data[0], bt_float_data[1], bt_float_data[2]);
-                            PID_motor_right.set_constants(bt_float_data[0], bt_float_data[1], bt_float_data[2]);
-                            break;
-                        case ch_sensor:
-                            PID_sensor.set_constants(bt_float_data[0], bt_float_data[1], bt_float_data[2]);
-                            break;
-                        default:
-                            break;
-                    }
-                    break;
-                case ch_tau_PID:
-                    switch (obj_type)
-                    {
-                        case ch_motor_left:
-                            PID_motor_left.set_tau(bt_float_data[0]);
-                            break;
-                        case ch_motor_right:
-                            PID_motor_right.set_tau(bt_float_data[0]);
-                            break;
-                        case ch_motor_both:
-                            PID_motor_left.set_tau(bt_float_data[0]);
-                            PID_motor_right.set_tau(bt_float_data[0]);
-                            break;
-                        case ch_sensor:
-                            PID_sensor.set_tau(bt_float_data[0]);
-                            break;
-                        default:
-                            break;
-                    }
-                    break;
-                default:
-                    break;
-            }
-            break;
-        case ch_execute:
-            switch (exec_type)
-            {
-                case ch_stop:
-                    buggy_mode = inactive;
-                    break;
-                case ch_active_stop:
-                    buggy_mode = active_stop;
-                    break;
-                case ch_uturn:
-                    buggy_mode = uturn;
-                    break;
-                case ch_encoder_test:
-                    bt_data_sent = ch_ticks_cumulative;
-                    bt_obj_sent = ch_motor_both;
-                    buggy_mode = task_test;
-                    break;
-                case ch_motor_pwm_test:
-                    bt_data_sent = ch_pwm_duty;
-                    bt_obj_sent = ch_motor_both;
-                    buggy_mode = task_test_inactive;
-                    break;
-                case ch_straight_test:
-                    buggy_mode = straight_test;
-                    break;
-                case ch_square_test:
-                    buggy_mode = square_mode;
-                    break;
-                case ch_PID_test:
-                    buggy_mode = PID_test;
-                    break;
-                case ch_toggle_led_test:
-                    LED = !LED;
-                    break;
-                case ch_line_follow:
-                    buggy_mode = line_follow;
-                    break;
-                case ch_static_tracking:
-                    buggy_mode = static_tracking;
-                    break;
-                case ch_line_follow_auto:
-                    buggy_mode = line_follow_auto;
-                    break;
-                case ch_calibrate:
-                    buggy_mode = calibration;
-                    break;
-                default:
-                    break;
+
+/* MODE ENTRY ACTIONS (see mode_states) */
+void mode_enter_active_stop(void)
+{
+    // runs in the control ISR, the time is sent by main()
+    reset_controllers();
+    stop_time = global_timer.read();
+    stop_time_ready = true;
+}
+
+
+void mode_enter_PID_test(void)
+{
+    reset_everything();
+    pid_constants = PID_motor_left.get_constants();
+    bt.send_fstring("P:%.2f,I:%.2f", pid_constants[0], pid_constants[1]);
+    bt.send_fstring("D:%.2f,T:%.2f\n", pid_constants[2], pid_constants[3]);
+}
+
+
+void mode_enter_uturn(void)
+{
+    reset_everything();
+    buggy_status.set_angle = params.get(p_uturn_angle);
+    buggy_status.set_velocity = 0.0;
+    publish_setpoints();
+}
+
+
+void mode_enter_static_tracking(void)
+{
+    reset_everything();
+    pid_constants = PID_sensor.get_constants();
+    bt.send_fstring("\nP:%.3f\nI:%.3f\n", pid_constants[0], pid_constants[1]);
+    bt.send_fstring("D:%.3f\nT:%.3f\n", pid_constants[2], pid_constants[3]);
+}
+
+
+void mode_enter_line_follow(void)
+{
+    // the u-turn speed only carries over to the line follow started by the u-turn
+    if (buggy_mode != uturn)
+    {
+        lf_uturn_override = false;
+    }
+    reset_everything();
+
+    pid_constants = PID_sensor.get_constants();
+    bt.send_fstring("T:%.3f\n", global_timer.read());
+    bt.send_fstring("\nP:%.3f\nI:%.3f\n", pid_constants[0], pid_constants[1]);
+    bt.send_fstring("D:%.3f\nT:%.3f\n", pid_constants[2], pid_constants[3]);
+
+    buggy_status.set_angle = 0;
+    buggy_status.set_velocity = line_follow_velocity() / params.get(p_slow_accel_divider);
+
+    buggy_status.accel_start_angle = buggy_status.cumulative_angle_deg;
+    buggy_status.accel_start_distance = buggy_status.distance_travelled;
+    buggy_status.is_accelerating = false;
+    publish_setpoints();
+    slow_accel_due = false;
+    scheduler.set_timeout(&slow_accel_ISR, params.get(p_slow_accel_time));
+}
+
+
+void mode_enter_stop_detect_line(void)
+{
+    reset_everything();
+    scheduler.set_timeout(&stop_detect_ISR, params.get(p_stop_detect_time));
+}
+
+
+void mode_enter_calibration(void)
+{
+    reset_everything();
+    sensor_array.calibrate_sensors();
+    cal_constants = sensor_array.get_calibration_constants();
+    for (int i = 0; i < 6; i++)
+    {
+        bt.send_fstring("%d:%.4f\n", i, cal_constants[i]);
+    }
+}
+
+
+void mode_enter_duty_calibration(void)
+{
+    reset_everything();
+    duty_calibrator.start(true);
+}
+
+
+void mode_enter_motion_script(void)
+{
+    // the script starts from the pose after the controllers are reset
+    reset_everything();
+    motion.start();
+}
+
+
+void motion_load_square(void)
+{
+    float side = params.get(p_sq_distance);
+    float radius = params.get(p_sq_radius);
+    float velocity = params.get(p_sq_velocity);
+
+    // Square clockwise, back on the spot at the start corner, then the same square anticlockwise.
+    // The corners are arcs (no stop) when the radius is not 0, the sides are shortened to keep the size.
+    motion.clear();
+    for (int lap = 0; lap < 2; lap++)
+    {
+        float angle = (lap == 0) ? params.get(p_sq_right_angle) : -params.get(p_sq_left_angle);
+        motion.add(motion_straight, fmaxf(side - radius, 0), 0, velocity);
+        for (int corner = 0; corner < 3; corner++)
+        {
+            if (radius > 0)
+            {
+                motion.add(motion_arc, radius, angle, velocity);
             }
-            break;
+            else
+            {
+                motion.add(motion_turn, 0, angle, 0);
+            }
+            motion.add(motion_straight, fmaxf(side - ((corner < 2) ? 2 : 1) * radius, 0), 0, velocity);
+        }
+        if (lap == 0)
+        {
+            motion.add(motion_turn, 0, 2 * params.get(p_sq_right_angle), 0);
+        }
+    }
+}
+
+
+/* BT COMMAND HANDLERS */
+int pids_from_object(char object, PID** pids)
+{
+    // 'B' selects both motor PIDs
+    int count = 0;
+    if (object == ch_motor_left || object == ch_motor_both)
+    {
+        pids[count++] = &PID_motor_left;
+    }
+    if (object == ch_motor_right || object == ch_motor_both)
+    {
+        pids[count++] = &PID_motor_right;
+    }
+    if (object == ch_sensor)
+    {
+        pids[count++] = &PID_sensor;
+    }
+    return count;
+}
+
+
+Cmd_error cmd_toggle_continous(const Cmd_args& args)
+{
+    bt.set_continous(!bt.is_continous());
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_toggle_binary(const Cmd_args& args)
+{
+    bt.set_binary(!bt.is_binary());
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_get(const Cmd_args& args)
+{
+    bt.set_send_once(true);
+    bt_data_sent = args.command->name;
+    bt_obj_sent = args.object ? args.object : ch_no_obj;
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_set_duty(const Cmd_args& args)
+{
+    Motor& motor = (args.object == ch_motor_left) ? motor_left : motor_right;
+    motor.set_duty_cycle(args.values[0]);
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_set_speed(const Cmd_args& args)
+{
+    if (!params.set(p_lf_velocity, args.values[0]))
+    {
+        return cmd_err_rejected;
+    }
+    lf_uturn_override = false;
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_set_gains(const Cmd_args& args)
+{
+    // first parameter id of the kp, ki, kd group of each PID
+    int ids[2];
+    int count = 0;
+    if (args.object == ch_motor_left || args.object == ch_motor_both)
+    {
+        ids[count++] = p_pid_m_l_kp;
+    }
+    if (args.object == ch_motor_right || args.object == ch_motor_both)
+    {
+        ids[count++] = p_pid_m_r_kp;
+    }
+    if (args.object == ch_sensor)
+    {
+        ids[count++] = p_pid_s_kp;
+    }
+
+    bool success = true;
+    params.begin_update();
+    for (int i = 0; i < count; i++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            success &= params.set(ids[i] + k, args.values[k]);
+        }
+    }
+    params.end_update();
+    return success ? cmd_ok : cmd_err_rejected;
+}
+
+
+Cmd_error cmd_set_tau(const Cmd_args& args)
+{
+    // both motor PIDs share the same tau
+    int id = (args.object == ch_sensor) ? p_pid_s_tau : p_pid_m_tau;
+    return params.set(id, args.values[0]) ? cmd_ok : cmd_err_rejected;
+}
+
+
+Cmd_error cmd_set_deadband(const Cmd_args& args)
+{
+    // a deadband set by hand replaces the calibrated lookup table, applied by the next control update
+    bool ok = true;
+    params.begin_update();
+    if (args.object == ch_motor_left || args.object == ch_motor_both)
+    {
+        ok = params.set(p_m_l_deadband, args.values[0]) && params.set(p_m_l_lut, 0) && ok;
+    }
+    if (args.object == ch_motor_right || args.object == ch_motor_both)
+    {
+        ok = params.set(p_m_r_deadband, args.values[0]) && params.set(p_m_r_lut, 0) && ok;
+    }
+    params.end_update();
+    return ok ? cmd_ok : cmd_err_rejected;
+}
+
+
+Cmd_error cmd_set_mode(const Cmd_args& args)
+{
+    mode_request((Buggy_modes) args.command->param);
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_encoder_test(const Cmd_args& args)
+{
+    bt_data_sent = ch_ticks_cumulative;
+    bt_obj_sent = ch_motor_both;
+    mode_request(task_test);
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_motor_pwm_test(const Cmd_args& args)
+{
+    bt_data_sent = ch_pwm_duty;
+    bt_obj_sent = ch_motor_both;
+    mode_request(task_test_inactive);
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_toggle_led(const Cmd_args& args)
+{
+    LED = !LED;
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_get_param(const Cmd_args& args)
+{
+    if (args.count == 1)
+    {
+        int index = params.index_of((int) args.values[0]);
+        if (index < 0)
+        {
+            return cmd_err_rejected;
+        }
+        const Param_def* def = params.get_def(index);
+        cmd_reply("V%d %s=%.4g", def->id, def->name, params.get(def->id));
+        return cmd_ok;
+    }
+
+    // no id: list all of them
+    for (int i = 0; i < params.get_count(); i++)
+    {
+        const Param_def* def = params.get_def(i);
+        if (cmd_from_pc)
+        {
+            pc.printf("V%d %-10s %10.4g  [%g, %g] default %g\n", def->id, def->name, params.get(def->id), 
+                                                                  def->min, def->max, def->default_value);
+        }
+        else
+        {
+            bt.send_fstring("V%d %s=%.4g", def->id, def->name, params.get(def->id));
+        }
+    }
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_set_param(const Cmd_args& args)
+{
+    return params.set((int) args.values[0], args.values[1]) ? cmd_ok : cmd_err_rejected;
+}
+
+
+Cmd_error cmd_save_params(const Cmd_args& args)
+{
+    // the CPU stalls while the flash is written, only allowed with the motors off and no mode requested
+    if (buggy_mode != inactive || mode_machine.get_pending() > 0 || !param_store.save(params))
+    {
+        return cmd_err_rejected;
+    }
+    if (param_store.get_erased())
+    {
+        // the sector was full, nothing was saved between the erase and the new record
+        cmd_reply("Saved 1, erased");
+    }
+    else
+    {
+        // 0 left: the next save erases the sector first
+        cmd_reply("Saved %d, %d left", param_store.get_save_count(), param_store.get_free_count());
+    }
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_default_params(const Cmd_args& args)
+{
+    params.reset_defaults();
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_subscribe(const Cmd_args& args)
+{
+    int type = (int) args.values[0];
+    float rate = args.values[1];
+    if (!(rate >= 0 && rate <= TELEMETRY_MAX_RATE))
+    {
+        return cmd_err_rejected;
+    }
+
+    if (type == tm_speed_burst)
+    {
+        set_speed_burst_rate(rate);
+        return cmd_ok;
+    }
+    if (type < tm_wheel || type > tm_timing)
+    {
+        return cmd_err_rejected;
+    }
+    telemetry_scheduler.subscribe(type, rate);
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_set_budget(const Cmd_args& args)
+{
+    int budget = (int) args.values[0];
+    int burst = (args.count == 2) ? (int) args.values[1] : TELEMETRY_BURST;
+    if (budget <= 0 || burst <= 0)
+    {
+        return cmd_err_rejected;
+    }
+    telemetry_scheduler.set_budget(budget, burst);
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_get_streams(const Cmd_args& args)
+{
+    // s: frames sent, k: samples decimated by the budget, d: frames dropped (tx buffer full)
+    cmd_reply("U budget %d", telemetry_scheduler.get_budget());
+    for (int i = 0; i < TELEMETRY_MAX_STREAMS; i++)
+    {
+        if (telemetry_scheduler.get_rate(i) > 0 || telemetry_scheduler.get_sent(i) > 0)
+        {
+            cmd_reply("U%d %.0f s%d k%d d%d", i, telemetry_scheduler.get_rate(i), telemetry_scheduler.get_sent(i),
+                                             telemetry_scheduler.get_decimated(i), telemetry_scheduler.get_dropped(i));
+        }
+    }
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_select_log(const Cmd_args& args)
+{
+    // bit i of the mask selects log_channels[i], columns are in table order
+    uint32_t mask = (uint32_t) args.values[0];
+    int decimation = (args.count == 2) ? (int) args.values[1] : ring_logger.get_decimation();
+    uint8_t ids[LOG_MAX_CHANNELS];
+    int count = 0;
+    for (int i = 0; i < (int) (sizeof(log_channels) / sizeof(log_channels[0])); i++)
+    {
+        if (mask & (1u << i))
+        {
+            if (count == LOG_MAX_CHANNELS)
+            {
+                return cmd_err_rejected;
+            }
+            ids[count++] = i;
+        }
+    }
+    if (count == 0 || decimation < 1 || !ring_logger.select(ids, count))
+    {
+        return cmd_err_rejected;
+    }
+    ring_logger.set_decimation(decimation);
+    ring_logger.arm();
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_set_trigger(const Cmd_args& args)
+{
+    int mask = (int) args.values[0];
+    int pre = (args.count >= 2) ? (int) args.values[1] : 0;
+    int post = (args.count == 3) ? (int) args.values[2] : 0;
+    if (mask < 0 || pre < 0 || post < 0)
+    {
+        return cmd_err_rejected;
+    }
+    log_trigger_mask = mask;
+    ring_logger.set_trigger(pre, post);
+    ring_logger.arm();
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_log_trigger(const Cmd_args& args)
+{
+    ring_logger.trigger(trig_manual);
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_get_log(const Cmd_args& args)
+{
+    // state (Log_states), samples kept, bytes used, trigger cause
+    cmd_reply("L%d n%d b%d t%d", ring_logger.get_state(), ring_logger.get_sample_count(),
+                                ring_logger.get_used_bytes(), ring_logger.get_trigger_cause());
+    if (cmd_from_pc)
+    {
+        for (int i = 0; i < (int) (sizeof(log_channels) / sizeof(log_channels[0])); i++)
+        {
+            pc.printf("%2d %s\n", i, log_channels[i].name);
+        }
+    }
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_get_black_box(const Cmd_args& args)
+{
+    // session, records, percentage of the flash region used, records dropped
+    cmd_reply("H s%d r%d u%d%% d%d", black_box.get_session(), black_box.get_records(),
+                                    (int) (100 * black_box.get_used() / black_box.get_size()), black_box.get_dropped());
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_erase_black_box(const Cmd_args& args)
+{
+    // erasing the sector stalls the CPU for about a second, only allowed with the motors off
+    if (buggy_mode != inactive ||
+        black_box_flash.erase(BLACKBOX_FLASH_ADDRESS, BLACKBOX_FLASH_SIZE) != 0)
+    {
+        return cmd_err_rejected;
+    }
+    black_box.erased(global_timer.read_ms());
+    cmd_reply("Erased");
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_get_profile(const Cmd_args& args)
+{
+    // scope (control ISR by default): count, min/mean/p99/max in us, overruns
+    int scope = (args.count > 0) ? (int) args.values[0] : prof_control_isr;
+    Profile_stats stats;
+    core_util_critical_section_enter();
+    bool valid = profiler.get_stats(scope, &stats);
+    uint32_t p99 = profiler.get_percentile(scope, 0.99f);
+    core_util_critical_section_exit();
+    if (!valid)
+    {
+        return cmd_err_rejected;
+    }
+    float mean = (stats.count > 0) ? (float) (stats.total / stats.count) : 0;
+    cmd_reply("Y%d %s n%lu %.1f/%.1f/%.1f/%.1f o%lu", scope, profiler.get_name(scope), (unsigned long) stats.count,
+              profiler.to_us(stats.min), profiler.to_us(mean), profiler.to_us(p99), profiler.to_us(stats.max),
+              (unsigned long) stats.over_budget);
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_reset_profile(const Cmd_args& args)
+{
+    core_util_critical_section_enter();
+    profiler.reset();
+    scheduler.reset_stats();
+    mode_machine.reset_stats();
+    motor_left.reset_traction_counts();
+    motor_right.reset_traction_counts();
+    core_util_critical_section_exit();
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_get_scheduler(const Cmd_args& args)
+{
+    if (args.count == 0)
+    {
+        // ticks, overruns, late ticks, max tick latency (us)
+        cmd_reply("Z t%lu o%lu l%lu m%lu", (unsigned long) scheduler.get_ticks(), (unsigned long) scheduler.get_overruns(),
+                  (unsigned long) scheduler.get_late_ticks(), (unsigned long) scheduler.get_max_latency_us());
+        return cmd_ok;
+    }
+
+    // task: runs, deadline misses, min-max dt (us), max end from the tick (us)
+    int task = (int) args.values[0];
+    Task_stats stats;
+    core_util_critical_section_enter();
+    bool valid = scheduler.get_task_stats(task, &stats);
+    core_util_critical_section_exit();
+    if (!valid)
+    {
+        return cmd_err_rejected;
+    }
+    cmd_reply("Z%d %s n%lu m%lu dt%lu-%lu e%lu", task, scheduler.get_name(task), (unsigned long) stats.runs,
+              (unsigned long) stats.deadline_misses, (unsigned long) stats.min_dt_us, (unsigned long) stats.max_dt_us,
+              (unsigned long) stats.max_end_us);
+    return cmd_ok;
+}
 
-        default:
-            return false;
+
+Cmd_error cmd_get_mode(const Cmd_args& args)
+{
+    Mode_latency normal;
+    Mode_latency urgent;
+    core_util_critical_section_enter();
+    mode_machine.get_latency(false, &normal);
+    mode_machine.get_latency(true, &urgent);
+    uint32_t transitions = mode_machine.get_transitions();
+    uint32_t rejected = mode_machine.get_rejected();
+    uint32_t dropped = mode_machine.get_dropped();
+    core_util_critical_section_exit();
+
+    // mode, transitions, rejected, dropped, urgent and normal latency max/mean (us)
+    cmd_reply("M %s t%lu r%lu d%lu u%lu/%lu n%lu/%lu", mode_machine.get_name(buggy_mode), (unsigned long) transitions,
+              (unsigned long) rejected, (unsigned long) dropped, (unsigned long) urgent.max_us,
+              (unsigned long) (urgent.count ? urgent.total_us / urgent.count : 0), (unsigned long) normal.max_us,
+              (unsigned long) (normal.count ? normal.total_us / normal.count : 0));
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_benchmark(const Cmd_args& args)
+{
+    // the control ISR is also called from the main loop, only with the motors off
+    int iterations = (args.count > 0) ? (int) args.values[0] : BENCH_DEFAULT_ITERATIONS;
+    if (buggy_mode != inactive || iterations < 1 || iterations > BENCH_MAX_ITERATIONS)
+    {
+        return cmd_err_rejected;
+    }
+    benchmark_run(iterations);
+    cmd_reply("Bench %d", iterations);
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_motion_add(const Cmd_args& args)
+{
+    // the control ISR reads the script while it runs
+    if (buggy_mode == motion_script || mode_machine.is_changing())
+    {
+        return cmd_err_rejected;
+    }
+
+    // no segment type: clear the script
+    if (args.object == '\0')
+    {
+        if (args.count != 0)
+        {
+            return cmd_err_arg_count;
+        }
+        motion.clear();
+        cmd_reply("N0");
+        return cmd_ok;
+    }
+
+    // arguments of each type, the velocity is optional (ms_vel, 0 for a turn on the spot)
+    float length = 0;
+    float angle = 0;
+    float velocity = params.get(p_ms_velocity);
+    int required = 1;
+    int velocity_arg = 1;
+    switch (args.object)
+    {
+        case motion_straight:
+            length = args.values[0];
+            break;
+        case motion_turn:
+            angle = args.values[0];
+            velocity = 0;
             break;
+        case motion_arc:
+            length = args.values[0];
+            angle = args.values[1];
+            required = 2;
+            velocity_arg = 2;
+            break;
+        case motion_follow:
+            length = (args.count > 0) ? args.values[0] : 0;
+            required = 0;
+            break;
+        case motion_wait:
+            length = args.values[0];
+            velocity_arg = CMD_MAX_ARGS;
+            break;
+    }
+    if (args.count < required || args.count > velocity_arg + 1)
+    {
+        return cmd_err_arg_count;
+    }
+    if (args.count > velocity_arg)
+    {
+        velocity = args.values[velocity_arg];
+    }
+    if (!motion.add(args.object, length, angle, velocity))
+    {
+        return cmd_err_rejected;
+    }
+    cmd_reply("N%d", motion.get_count());
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_motion_get(const Cmd_args& args)
+{
+    // one line per segment: index, type, length, angle, velocity, then the segment running
+    for (int i = 0; i < motion.get_count(); i++)
+    {
+        const Motion_segment* segment = motion.get_segment(i);
+        cmd_reply("N%d %c %.3f %.1f %.2f", i, segment->type, segment->length, segment->angle, segment->velocity);
+    }
+    cmd_reply("N %d/%d%s", motion.get_index(), motion.get_count(), motion.is_running() ? " running" : "");
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_motion_run(const Cmd_args& args)
+{
+    if (motion.get_count() == 0 || buggy_mode == motion_script)
+    {
+        return cmd_err_rejected;
+    }
+    mode_request(motion_script);
+    return cmd_ok;
+}
+
+
+Cmd_error cmd_square_test(const Cmd_args& args)
+{
+    if (buggy_mode == motion_script || mode_machine.is_changing())
+    {
+        return cmd_err_rejected;
+    }
+    motion_load_square();
+    mode_request(motion_script);
+    return cmd_ok;
+}
+
+
+void cmd_reply(const char* format, ...)
+{
+    char buffer[64];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+
+    if (cmd_from_pc)
+    {
+        pc.printf("%s\n", buffer);
+    }
+    else
+    {
+        bt.send_fstring("%s", buffer);
+    }
+}
+
+
+void pc_key_command(char key)
+{
+    switch (key) 
+    {
+    case 'r':
+        reset_everything();
+        mode_request(static_tracking);
+        break;
+    case 's':
+        mode_request(inactive);
+        stop_motors();
+        break;
+    case 'D':
+        mode_request(inactive);
+        ring_logger.stop();
+        log_dump();
+        ring_logger.arm();
+        break;
+    case 'H':
+        black_box_dump();
+        break;
+    case 'P':
+        profile_dump();
+        break;
+    case 'L':
+        // the ISR reads the counters only while streaming, reset them before it starts
+        if (!log_streaming)
+        {
+            log_samples = 0;
+            log_dropped_start = pc.get_dropped();
+            log_streaming = true;
+        }
+        else
+        {
+            log_streaming = false;
+            log_stream_status();
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+
+void log_stream_sample(void)
+{
+    float** out_arr = PID_motor_left.get_terms();
+    TelemetryWriter writer;
+    writer.put_u16(log_samples & 0xFFFF);
+    writer.put_fixed(*out_arr[1], 1000);    //= set_point
+    writer.put_fixed(*out_arr[2], 1000);    //= measurement
+    writer.put_fixed(*out_arr[4], 1000);    //= propotional
+    writer.put_fixed(*out_arr[5], 1000);    //= integrator
+    writer.put_fixed(*out_arr[6], 1000);    //= differentiator
+    pc.send_telemetry(tm_log, writer.data(), writer.size());
+
+    log_samples++;
+    if (log_samples % LOG_STATUS_PERIOD == 0)
+    {
+        log_stream_status();
+    }
+}
+
+
+void log_stream_status(void)
+{
+    TelemetryWriter writer;
+    writer.put_i32(log_samples);
+    writer.put_i32(pc.get_dropped() - log_dropped_start);
+    pc.send_telemetry(tm_log_status, writer.data(), writer.size());
+}
+
+
+void log_update(void)
+{
+    int mask = log_trigger_mask;
+    int cause = 0;
+    if ((mask & trig_mode_change) && buggy_mode != log_last_mode)
+    {
+        cause |= trig_mode_change;
+    }
+    if ((mask & trig_line_lost) && (buggy_mode == line_follow || buggy_mode == line_follow_auto) &&
+        !sensor_array.is_line_detected())
+    {
+        cause |= trig_line_lost;
+    }
+    if ((mask & trig_saturation) && buggy_mode != inactive &&
+        (fabsf(PID_motor_left.get_output()) >= PID_M_MAX_OUT || fabsf(PID_motor_right.get_output()) >= PID_M_MAX_OUT))
+    {
+        cause |= trig_saturation;
+    }
+    log_last_mode = buggy_mode;
+
+    if (cause != 0)
+    {
+        ring_logger.trigger(cause);
+    }
+    ring_logger.sample();
+}
+
+
+void log_dump(void)
+{
+    // time in seconds from the trigger (or from the first sample kept)
+    float period = ring_logger.get_decimation() * CONTROL_UPDATE_PERIOD;
+    int columns = ring_logger.get_selected_count();
+    int decimals[LOG_MAX_CHANNELS];
+    char line[128];
+    int length = snprintf(line, sizeof(line), "time");
+    for (int i = 0; i < columns; i++)
+    {
+        const Log_channel* channel = ring_logger.get_selected(i);
+        decimals[i] = (int) ceilf(log10f(channel->scale));
+        length += snprintf(line + length, sizeof(line) - length, ",%s", channel->name);
+    }
+    pc.printf("# trigger %d, %d samples, %d bytes\n", ring_logger.get_trigger_cause(), ring_logger.get_sample_count(),
+              ring_logger.get_used_bytes());
+    pc.printf("%s\n", line);
+
+    int32_t offset;
+    float values[LOG_MAX_CHANNELS];
+    ring_logger.start_read();
+    while (ring_logger.read_next(&offset, values))
+    {
+        length = snprintf(line, sizeof(line), "%.5f", offset * period);
+        for (int i = 0; i < columns && length < (int) sizeof(line); i++)
+        {
+            length += snprintf(line + length, sizeof(line) - length, ",%.*f", decimals[i], values[i]);
+        }
+        pc.printf("%s\n", line);
+    }
+}
+
+
+void black_box_update(void)
+{
+    // mode transitions are always recorded, samples only while running
+    int now_ms = global_timer.read_ms();
+    if (buggy_mode != black_box_last_mode)
+    {
+        black_box.add_mode(now_ms, buggy_mode, black_box_last_mode);
+        black_box_last_mode = buggy_mode;
+    }
+    if (buggy_mode == inactive || ++black_box_decimation_count < CONTROL_UPDATE_RATE / BLACKBOX_RATE)
+    {
+        return;
+    }
+    black_box_decimation_count = 0;
+    black_box.add_sample(now_ms, sensor_array.get_filtered_output(), motor_left.get_filtered_speed(),
+                         motor_right.get_filtered_speed(), motor_left.get_applied_duty_cycle(),
+                         motor_right.get_applied_duty_cycle(), driver_board.get_voltage());
+}
+
+
+void black_box_write(void)
+{
+    // the CPU stalls while the flash is programmed (up to 100 us per byte), so a write only starts
+    // if it is over before the next scheduler tick
+    int32_t slack = (int32_t) (scheduler.get_next_tick_us() - (uint32_t) global_timer.read_us());
+    uint32_t address;
+    const uint8_t* data;
+    if (slack < BLACKBOX_WRITE_SIZE * BLACKBOX_PROGRAM_MAX_US || !black_box.next_chunk(&address, &data))
+    {
+        return;
+    }
+    uint32_t write_start = profiler.start();
+    black_box.chunk_written(black_box_flash.program(data, address, BLACKBOX_WRITE_SIZE) == 0);
+    profiler.stop(prof_black_box_write, write_start);
+}
+
+
+void black_box_dump(void)
+{
+    // one CSV line per sample, sessions and mode transitions as comments
+    const uint8_t* contents = (const uint8_t*) BLACKBOX_FLASH_ADDRESS;
+    uint32_t used = black_box.get_used();
+    Black_box_record record;
+    int mode = inactive;
+    uint16_t last_time = 0;
+    uint32_t time_wraps = 0;
+
+    pc.printf("time,mode,sensor,speed_l,speed_r,duty_l,duty_r,battery\n");
+    for (uint32_t offset = 0; offset < used; offset += BLACKBOX_RECORD_SIZE)
+    {
+        if (!BlackBox::decode(contents + offset, &record))
+        {
+            continue;
+        }
+        if (record.type == bb_session)
+        {
+            mode = inactive;
+            last_time = 0;
+            time_wraps = 0;
+            pc.printf("# session %d\n", record.session);
+            continue;
+        }
+        if (record.time < last_time)
+        {
+            time_wraps++;
+        }
+        last_time = record.time;
+        float time = (time_wraps * 65536 + record.time) / 100.0f;
+
+        if (record.type == bb_mode)
+        {
+            mode = record.mode;
+            pc.printf("# %.2f mode %d -> %d\n", time, record.prev_mode, record.mode);
+        }
+        else
+        {
+            pc.printf("%.2f,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", time, mode, record.sensor, record.speed_l,
+                      record.speed_r, record.duty_l, record.duty_r, record.battery);
+        }
+    }
+    pc.printf("# %d records, %d dropped, %d write errors\n", black_box.get_records(), black_box.get_dropped(),
+              black_box.get_write_errors());
+}
+
+
+void profile_dump(void)
+{
+    pc.printf("# profiler: times in us, histogram bins are [2^i, 2^(i+1)) cycles at %d cycles/us\n", PROFILE_CYCLES_PER_US);
+    pc.printf("%2s %-16s %9s %8s %8s %8s %8s %6s\n", "id", "scope", "count", "min", "mean", "p99", "max", "over");
+    for (int scope = 0; scope < profiler.get_scope_count(); scope++)
+    {
+        Profile_stats stats;
+        core_util_critical_section_enter();
+        profiler.get_stats(scope, &stats);
+        uint32_t p99 = profiler.get_percentile(scope, 0.99f);
+        core_util_critical_section_exit();
+
+        float mean = (stats.count > 0) ? (float) (stats.total / stats.count) : 0;
+        pc.printf("%2d %-16s %9lu %8.2f %8.2f %8.2f %8.2f %6lu\n", scope, profiler.get_name(scope),
+                  (unsigned long) stats.count, profiler.to_us(stats.min), profiler.to_us(mean), profiler.to_us(p99),
+                  profiler.to_us(stats.max), (unsigned long) stats.over_budget);
+
+        // only the bins used, as "i:count"
+        char line[128];
+        int length = snprintf(line, sizeof(line), "   bins");
+        for (int bin = 0; bin < PROFILE_BINS && length < (int) sizeof(line); bin++)
+        {
+            if (stats.bins[bin] > 0)
+            {
+                length += snprintf(line + length, sizeof(line) - length, " %d:%lu", bin, (unsigned long) stats.bins[bin]);
+            }
+        }
+        if (stats.count > 0)
+        {
+            pc.printf("%s\n", line);
+        }
+    }
+
+    pc.printf("# scheduler: %d us ticks, %lu ticks, %lu overruns, %lu late, max latency %lu us\n", SCHED_BASE_PERIOD_US,
+              (unsigned long) scheduler.get_ticks(), (unsigned long) scheduler.get_overruns(),
+              (unsigned long) scheduler.get_late_ticks(), (unsigned long) scheduler.get_max_latency_us());
+    pc.printf("%2s %-16s %9s %8s %8s %8s %8s\n", "id", "task", "runs", "misses", "min dt", "max dt", "max end");
+    for (int task = 0; task < scheduler.get_task_count(); task++)
+    {
+        Task_stats stats;
+        core_util_critical_section_enter();
+        scheduler.get_task_stats(task, &stats);
+        core_util_critical_section_exit();
+        pc.printf("%2d %-16s %9lu %8lu %8lu %8lu %8lu\n", task, scheduler.get_name(task), (unsigned long) stats.runs,
+                  (unsigned long) stats.deadline_misses, (unsigned long) stats.min_dt_us, (unsigned long) stats.max_dt_us,
+                  (unsigned long) stats.max_end_us);
+    }
+
+    Mode_latency latency[2];
+    core_util_critical_section_enter();
+    mode_machine.get_latency(false, &latency[0]);
+    mode_machine.get_latency(true, &latency[1]);
+    core_util_critical_section_exit();
+    pc.printf("# mode machine: %lu transitions, %lu rejected (last %s), %lu dropped, latency from the request in us\n",
+              (unsigned long) mode_machine.get_transitions(), (unsigned long) mode_machine.get_rejected(),
+              mode_machine.get_name(mode_machine.get_last_rejected()), (unsigned long) mode_machine.get_dropped());
+    pc.printf("%2s %-16s %9s %8s %8s %8s\n", "", "transitions", "count", "last", "max", "mean");
+    for (int i = 0; i < 2; i++)
+    {
+        pc.printf("%2s %-16s %9lu %8lu %8lu %8lu\n", "", i ? "urgent" : "normal", (unsigned long) latency[i].count,
+                  (unsigned long) latency[i].last_us, (unsigned long) latency[i].max_us,
+                  (unsigned long) (latency[i].count ? latency[i].total_us / latency[i].count : 0));
+    }
+}
+
+
+void benchmark_run(int iterations)
+{
+    // Each call is timed with the interrupts off, the ISRs only run late by one call. The sensor array,
+    // motor and control ISR use the real objects (ADC, encoders), the PID a copy of the sensor PID.
+    PID pid(PID_S_KP, PID_S_KI, PID_S_KD, PID_S_TAU, PID_S_MIN_OUT, PID_S_MAX_OUT, PID_S_MIN_INT, PID_S_MAX_INT,
+            SENSOR_UPDATE_PERIOD);
+    uint32_t seed = 1;
+    bench_profiler.reset();
+    for (int i = 0; i < iterations; i++)
+    {
+        // sensor array output while the line is seen, uniform over -5..5
+        seed = seed * 1664525 + 1013904223;
+        float measurement = (float) ((seed >> 16) % 2001) / 200.0f - 5.0f;
+
+        for (int bench = 0; bench < bench_count; bench++)
+        {
+            core_util_critical_section_enter();
+            uint32_t start = bench_profiler.start();
+            switch (bench)
+            {
+            case bench_sensor_array:
+                sensor_array.update();
+                break;
+            case bench_pid:
+                pid.update(0, measurement, SENSOR_UPDATE_PERIOD);
+                break;
+            case bench_motor:
+                motor_left.update(CONTROL_UPDATE_PERIOD);
+                break;
+            case bench_buggy_status:
+                update_buggy_status();
+                break;
+            case bench_control_isr:
+                control_update_ISR(CONTROL_UPDATE_PERIOD);
+                break;
+            }
+            bench_profiler.stop(bench, start);
+            core_util_critical_section_exit();
+        }
+    }
+
+    // same layout as the host control_bench results, one benchmark per line (printf() takes 128 characters)
+    pc.printf("{\"bench\": \"control\", \"target\": \"stm32f401re\", \"clock_hz\": %lu, ",
+              (unsigned long) SystemCoreClock);
+    pc.printf("\"iterations\": %d, \"mode\": \"%s\", \"results\": [\n", iterations, mode_machine.get_name(buggy_mode));
+    for (int bench = 0; bench < bench_count; bench++)
+    {
+        Profile_stats stats;
+        bench_profiler.get_stats(bench, &stats);
+        float mean = (stats.count > 0) ? (float) (stats.total / stats.count) : 0;
+        pc.printf("  {\"name\": \"%s\", \"ns_per_op\": %.1f, \"cycles_per_op\": %.1f, ", bench_names[bench],
+                  mean * 1000.0f / PROFILE_CYCLES_PER_US, mean);
+        pc.printf("\"min_cycles\": %lu, \"p99_cycles\": %lu, \"max_cycles\": %lu}%s\n", (unsigned long) stats.min,
+                  (unsigned long) bench_profiler.get_percentile(bench, 0.99f), (unsigned long) stats.max,
+                  (bench + 1 < bench_count) ? "," : "");
+    }
+    pc.printf("]}\n");
+}
+
+
+void apply_parameters(const ParameterRegistry& registry)
+{
+    PID_motor_left.set_constants(registry.get(p_pid_m_l_kp), registry.get(p_pid_m_l_ki), registry.get(p_pid_m_l_kd));
+    PID_motor_right.set_constants(registry.get(p_pid_m_r_kp), registry.get(p_pid_m_r_ki), registry.get(p_pid_m_r_kd));
+    PID_motor_left.set_tau(registry.get(p_pid_m_tau));
+    PID_motor_right.set_tau(registry.get(p_pid_m_tau));
+    PID_sensor.set_constants(registry.get(p_pid_s_kp), registry.get(p_pid_s_ki), registry.get(p_pid_s_kd));
+    PID_sensor.set_tau(registry.get(p_pid_s_tau));
+    PID_angle.set_constants(registry.get(p_pid_a_kp), registry.get(p_pid_a_ki), registry.get(p_pid_a_kd));
+    PID_angle.set_tau(registry.get(p_pid_a_tau));
+
+    // filters are first order low-pass with unity gain, b0 = b1 = (1 - a0) / 2
+    float sens_a0 = registry.get(p_sens_lp_a0);
+    float speed_a0 = registry.get(p_speed_lp_a0);
+    sensor_array.set_detect_range(registry.get(p_sens_detect_range));
+    sensor_array.set_angle_coeff(registry.get(p_sens_angle_coeff));
+    sensor_array.set_low_pass(sens_a0, (1 - sens_a0) / 2, (1 - sens_a0) / 2);
+    motor_left.set_low_pass(speed_a0, (1 - speed_a0) / 2, (1 - speed_a0) / 2);
+    motor_right.set_low_pass(speed_a0, (1 - speed_a0) / 2, (1 - speed_a0) / 2);
+
+    lf_velocity = registry.get(p_lf_velocity);
+    motion.set_accel(registry.get(p_ms_accel));
+
+    Motor* motors[2] = {&motor_left, &motor_right};
+    const int deadband_ids[2] = {p_m_l_deadband, p_m_r_deadband};
+    const int lut_enabled_ids[2] = {p_m_l_lut, p_m_r_lut};
+    const int lut_ids[2] = {p_m_l_lut1, p_m_r_lut1};
+    for (int m = 0; m < 2; m++)
+    {
+        float lut[DutyCalibrator::lut_size];
+        lut[0] = registry.get(deadband_ids[m]);
+        for (int i = 1; i < DutyCalibrator::lut_size - 1; i++)
+        {
+            lut[i] = registry.get(lut_ids[m] + i - 1);
+        }
+        lut[DutyCalibrator::lut_size - 1] = DUTY_CAL_MAX_DUTY;
+        motors[m]->set_compensation(lut[0], registry.get(lut_enabled_ids[m]) ? lut : NULL, DutyCalibrator::lut_size, DUTY_CAL_MAX_DUTY);
+
+        // the duty calibration drives the raw duty cycle, it restores the compensation state when it ends
+        if (!duty_calibrator.is_running())
+        {
+            motors[m]->set_compensation_enabled(lut[0] > 0);
+        }
+
+        // a duty calibration in progress keeps the detection disabled
+        motors[m]->set_traction_control((int) registry.get(p_tc_window), registry.get(p_tc_margin), registry.get(p_tc_slew),
+                                        registry.get(p_stall_duty), registry.get(p_stall_time), registry.get(p_stall_cap));
     }
-    return true;
 }
 
 
-void serial_update_ISR(void)
+void serial_update_ISR(float dt)
 {
     pc_serial_update = true;
     bt_serial_update = true;
 }
 
 
+void telemetry_sample(void)
+{
+    // Wheel speed burst sampled every telemetry_decimation control updates
+    if (telemetry_decimation == 0 || ++telemetry_decimation_count < telemetry_decimation)
+    {
+        return;
+    }
+    telemetry_decimation_count = 0;
+
+    TelemetryBurst& burst = speed_burst[speed_burst_filling];
+    if (burst.add((int) (motor_left.get_filtered_speed() * 1000), (int) (motor_right.get_filtered_speed() * 1000)))
+    {
+        if (speed_burst_ready)
+        {
+            // previous burst still not sent, overwrite this one
+            speed_burst_dropped++;
+        }
+        else
+        {
+            speed_burst_filling = 1 - speed_burst_filling;
+            speed_burst_ready = true;
+        }
+        speed_burst[speed_burst_filling].clear();
+    }
+}
+
+
+void bt_send_frame(char data_type)
+{
+    switch (data_type)
+    {
+        case ch_pwm_duty:               // D
+            bt_send_stream(tm_duty);
+            break;
+        case ch_speed:                  // S
+            bt_send_stream(tm_wheel);
+            break;
+        case ch_ticks_cumulative:       // E
+            bt_send_stream(tm_pose);
+            break;
+        case ch_gains_PID:              // P
+            bt_send_stream(tm_pid);
+            break;
+        case ch_current_usage:          // C
+            bt_send_stream(tm_battery);
+            break;
+        case ch_loop_time:              // X
+            bt_send_stream(tm_timing);
+            break;
+        default:
+            break;
+    }
+}
+
+
+int bt_send_stream(int type)
+{
+    TelemetryWriter frame;
+    float** out_arr;
+    float* sens;
+    Pose pose;
+    Wheel_set_speeds wheels;
+
+    switch (type)
+    {
+        case tm_duty:
+            frame.put_fixed(motor_left.get_duty_cycle() * (motor_left.get_direction() ? 1 : -1), 1000);
+            frame.put_fixed(motor_right.get_duty_cycle() * (motor_right.get_direction() ? 1 : -1), 1000);
+            frame.put_fixed(motor_left.get_applied_duty_cycle(), 1000);
+            frame.put_fixed(motor_right.get_applied_duty_cycle(), 1000);
+            break;
+        case tm_wheel:
+            frame.put_fixed(motor_left.get_filtered_speed(), 1000);
+            frame.put_fixed(motor_right.get_filtered_speed(), 1000);
+            wheels = wheel_set_speeds.read();
+            frame.put_fixed(wheels.left, 1000);
+            frame.put_fixed(wheels.right, 1000);
+            break;
+        case tm_sensor:
+            frame.put_fixed(sensor_array.get_array_output(), 1000);
+            frame.put_fixed(sensor_array.get_filtered_output(), 1000);
+            frame.put_u8(sensor_array.is_line_detected());
+            sens = sensor_array.get_sens_output_array();
+            for (int i = 0; i < 6; i++)
+            {
+                frame.put_u8((int) (sens[i] * 255));
+            }
+            break;
+        case tm_pose:
+            pose = odometry.get_pose();
+            frame.put_fixed(pose.x, 1000);
+            frame.put_fixed(pose.y, 1000);
+            frame.put_i32((int32_t) (pose.heading_deg * 100));
+            frame.put_i32((int32_t) (pose.distance * 1000));
+            break;
+        case tm_pid:
+            out_arr = PID_sensor.get_terms();
+            frame.put_u8(3);
+            for (int i = 1; i < 8; i++)
+            {
+                if (i != 3)     // error is set point - measurement, not sent
+                {
+                    frame.put_fixed(*out_arr[i], 1000);
+                }
+            }
+            break;
+        case tm_battery:
+            driver_board.update_measurements();
+            frame.put_u16((int) (driver_board.get_voltage() * 1000));
+            frame.put_fixed(driver_board.get_current(), 1000);
+            break;
+        case tm_timing:
+            frame.put_u16(ISR_exec_time);
+            frame.put_u16(loop_exec_time);
+            break;
+        default:
+            return 0;
+    }
+    return bt.send_telemetry(type, frame.data(), frame.size());
+}
+
+
+void set_speed_burst_rate(float rate)
+{
+    // the burst is filled in the control ISR, the rate sets how often it samples
+    telemetry_scheduler.subscribe(tm_speed_burst, rate, true);
+    telemetry_decimation = (rate > 0) ? (int) (CONTROL_UPDATE_RATE / (rate * speed_burst[0].get_capacity()) + 0.5f) : 0;
+    if (rate > 0 && telemetry_decimation < 1)
+    {
+        telemetry_decimation = 1;
+    }
+}
+
+
 void bt_send_data(void)
 {
+    // Binary mode: continous data is streamed as bursts by the control ISR, get requests are answered with a frame
+    if (bt.is_binary())
+    {
+        if (bt.is_send_once())
+        {
+            bt_send_frame(bt_data_sent);
+            bt.set_send_once(false);
+        }
+        return;
+    }
+
     // Handling sending data through BT 
     if (bt.is_continous() || bt.is_send_once())
     {   
@@ -943,8 +2606,16 @@ void bt_send_data(void)
             case ch_loop_time:              // X
                 bt.send_fstring("ISR: %dus", ISR_exec_time);
                 break;
-            case ch_loop_count:             // Y
-                bt.send_fstring("removed feature");
+            case ch_bt_stats:               // B
+                bt.send_fstring("BT d:%d q:%d", bt.get_tx_dropped(), bt.get_tx_pending());
+                bt.send_fstring("BT o:%d f:%d", bt.get_rx_overflows(), bt.get_rx_framing_errors());
+                break;
+            case ch_deadband:               // K
+                bt_send_compensation();
+                break;
+            case ch_traction:               // W
+                bt.send_fstring("W L:%d/%d R:%d/%d", motor_left.get_slip_count(), motor_left.get_stall_count(),
+                                                     motor_right.get_slip_count(), motor_right.get_stall_count());
                 break;
             default:
                 bt.send_fstring("Err: No Data\n");
@@ -955,6 +2626,24 @@ void bt_send_data(void)
 }
 
 
+void bt_send_compensation(void)
+{
+    Motor* motors[2] = {&motor_left, &motor_right};
+    const char names[2] = {'L', 'R'};
+
+    for (int m = 0; m < 2; m++)
+    {
+        int lut_size;
+        const float* lut = motors[m]->get_compensation_lut(&lut_size);
+        bt.send_fstring("K%c DB:%.3f", names[m], motors[m]->get_deadband());
+        for (int i = 0; i + 2 < lut_size; i += 3)
+        {
+            bt.send_fstring("K%c%d:%.2f %.2f %.2f", names[m], i, lut[i], lut[i + 1], lut[i + 2]);
+        }
+    }
+}
+
+
 void pc_send_data(void)
 {
     // pc.printf("\n");
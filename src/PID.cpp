@@ -55,6 +55,12 @@ PID::PID(
 
 
 void PID::update(float set_point_, float measurement_) 
+{
+    update(set_point_, measurement_, sample_time);
+}
+
+
+void PID::update(float set_point_, float measurement_, float dt) 
 {
     /* Error */
     error = set_point_ - measurement_;
@@ -67,7 +73,7 @@ void PID::update(float set_point_, float measurement_)
 
     
     /* --- INTEGRAL TERM ---  */
-    integrator = integrator + 0.5f * ki * sample_time * (error + prev_error);  
+    integrator = integrator + 0.5f * ki * dt * (error + prev_error);  
 
     //  Anti-wind-up via integrator clamping 
     if (integrator > lim_max_int) 
@@ -81,13 +87,13 @@ void PID::update(float set_point_, float measurement_)
 
     /* --- DERIVATIVE TERM --- */
     differentiator = -(2.0f * kd * (measurement - prev_measurement)	/* Note: derivative on measurement, therefore minus sign in front of equation! */
-                    + (2.0f * tau - sample_time) * differentiator)
-                    / (2.0f * tau + sample_time);
+                    + (2.0f * tau - dt) * differentiator)
+                    / (2.0f * tau + dt);
 
 
     //  Compute Output
     output = proportional + integrator + differentiator;
-    time_index += sample_time;
+    time_index += dt;
 
     // Apply limits
     if (output > lim_max_output) 
@@ -0,0 +1,286 @@
+#include <math.h>
+#include <string.h>
+
+#include "black_box.h"
+#include "telemetry.h"
+
+
+/*  RECORD FORMAT (16 bytes, little endian)
+
+    [type u8][crc8 u8][time u16 (10 ms)][payload 12 bytes, zero padded]
+
+    The CRC-8 (same as the telemetry frames) covers the type, time and payload.
+    The records are programmed in order, a reset while programming leaves a record with a wrong CRC.
+*/
+
+
+BlackBox::BlackBox(uint32_t address_, uint32_t size_, int write_size_)
+{
+    address = address_;
+    size = size_;
+    write_size = write_size_;
+    queue_head = 0;
+    queue_tail = 0;
+    chunk_offset = 0;
+    write_offset = 0;
+    reserved = size;
+    session_start_ms = 0;
+    session = 0;
+    records = 0;
+    dropped = 0;
+    write_errors = 0;
+    recording = false;
+}
+
+
+static bool is_erased(const uint8_t* data)
+{
+    for (int i = 0; i < BLACKBOX_RECORD_SIZE; i++)
+    {
+        if (data[i] != 0xFF)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static uint8_t record_crc(const uint8_t* record)
+{
+    // everything but the CRC byte itself
+    uint8_t covered[BLACKBOX_RECORD_SIZE - 1];
+    covered[0] = record[0];
+    memcpy(covered + 1, record + 2, BLACKBOX_RECORD_SIZE - 2);
+    return telemetry_crc8(covered, sizeof(covered));
+}
+
+
+int BlackBox::recover(const uint8_t* contents, uint32_t now_ms)
+{
+    recording = false;
+    records = 0;
+    int last_session = 0;
+    uint32_t offset = 0;
+    Black_box_record record;
+    for (; offset < size && !is_erased(contents + offset); offset += BLACKBOX_RECORD_SIZE)
+    {
+        if (decode(contents + offset, &record))
+        {
+            records++;
+            if (record.type == bb_session && record.session > last_session)
+            {
+                last_session = record.session;
+            }
+        }
+    }
+
+    start_session(offset, last_session + 1, now_ms);
+    return records;
+}
+
+
+void BlackBox::erased(uint32_t now_ms)
+{
+    recording = false;
+    records = 0;
+    start_session(0, 1, now_ms);
+}
+
+
+void BlackBox::start_session(uint32_t offset, int number, uint32_t now_ms)
+{
+    // nothing is added by the ISR while the write position changes
+    recording = false;
+    write_offset = offset;
+    reserved = offset;
+    chunk_offset = 0;
+    queue_tail = queue_head;
+    session = number;
+    session_start_ms = now_ms;
+    recording = true;
+
+    uint8_t start[BLACKBOX_RECORD_SIZE] = {bb_session};
+    start[4] = (uint8_t) session;
+    start[5] = (uint8_t) (session >> 8);
+    add(start);
+}
+
+
+bool BlackBox::add(uint8_t* record)
+{
+    int next = (queue_head + 1) % BLACKBOX_QUEUE_SIZE;
+    if (!recording || next == queue_tail || reserved + BLACKBOX_RECORD_SIZE > size)
+    {
+        dropped++;
+        return false;
+    }
+    record[1] = record_crc(record);
+    memcpy(queue[queue_head], record, BLACKBOX_RECORD_SIZE);
+    reserved += BLACKBOX_RECORD_SIZE;
+    queue_head = next;
+    return true;
+}
+
+
+void BlackBox::put_i16(uint8_t* at, float value, float scale)
+{
+    float scaled = value * scale;
+    int16_t field = (int16_t) ((scaled > 32767) ? 32767 : ((scaled < -32768) ? -32768 : lroundf(scaled)));
+    at[0] = (uint8_t) field;
+    at[1] = (uint8_t) ((uint16_t) field >> 8);
+}
+
+
+float BlackBox::get_i16(const uint8_t* at, float scale)
+{
+    return (int16_t) (at[0] | (at[1] << 8)) / scale;
+}
+
+
+void BlackBox::add_sample(uint32_t now_ms, float sensor, float speed_l, float speed_r, float duty_l, float duty_r,
+                          float battery)
+{
+    uint8_t record[BLACKBOX_RECORD_SIZE] = {bb_sample};
+    uint16_t time = (uint16_t) ((now_ms - session_start_ms) / 10);
+    record[2] = (uint8_t) time;
+    record[3] = (uint8_t) (time >> 8);
+    put_i16(record + 4, sensor, 1000);
+    put_i16(record + 6, speed_l, 1000);
+    put_i16(record + 8, speed_r, 1000);
+    put_i16(record + 10, duty_l, 1000);
+    put_i16(record + 12, duty_r, 1000);
+    int millivolts = (int) (battery * 1000);
+    millivolts = (millivolts < 0) ? 0 : ((millivolts > 0xFFFF) ? 0xFFFF : millivolts);
+    record[14] = (uint8_t) millivolts;
+    record[15] = (uint8_t) (millivolts >> 8);
+    add(record);
+}
+
+
+void BlackBox::add_mode(uint32_t now_ms, int mode, int prev_mode)
+{
+    uint8_t record[BLACKBOX_RECORD_SIZE] = {bb_mode};
+    uint16_t time = (uint16_t) ((now_ms - session_start_ms) / 10);
+    record[2] = (uint8_t) time;
+    record[3] = (uint8_t) (time >> 8);
+    record[4] = (uint8_t) mode;
+    record[5] = (uint8_t) prev_mode;
+    add(record);
+}
+
+
+bool BlackBox::next_chunk(uint32_t* chunk_address, const uint8_t** data)
+{
+    if (queue_tail == queue_head)
+    {
+        return false;
+    }
+    *chunk_address = address + write_offset + chunk_offset;
+    *data = queue[queue_tail] + chunk_offset;
+    return true;
+}
+
+
+void BlackBox::chunk_written(bool ok)
+{
+    chunk_offset += write_size;
+    if (!ok)
+    {
+        // the rest of the record is left as it is, its CRC is wrong so it is skipped when read
+        write_errors++;
+        chunk_offset = BLACKBOX_RECORD_SIZE;
+    }
+    if (chunk_offset < BLACKBOX_RECORD_SIZE)
+    {
+        return;
+    }
+    if (ok)
+    {
+        records++;
+    }
+    chunk_offset = 0;
+    write_offset += BLACKBOX_RECORD_SIZE;
+    queue_tail = (queue_tail + 1) % BLACKBOX_QUEUE_SIZE;
+}
+
+
+bool BlackBox::decode(const uint8_t* data, Black_box_record* record)
+{
+    if (is_erased(data) || record_crc(data) != data[1])
+    {
+        return false;
+    }
+    memset(record, 0, sizeof(*record));
+    record->type = data[0];
+    record->time = (uint16_t) (data[2] | (data[3] << 8));
+    switch (data[0])
+    {
+        case bb_session:
+            record->session = data[4] | (data[5] << 8);
+            break;
+        case bb_sample:
+            record->sensor = get_i16(data + 4, 1000);
+            record->speed_l = get_i16(data + 6, 1000);
+            record->speed_r = get_i16(data + 8, 1000);
+            record->duty_l = get_i16(data + 10, 1000);
+            record->duty_r = get_i16(data + 12, 1000);
+            record->battery = (data[14] | (data[15] << 8)) / 1000.0f;
+            break;
+        case bb_mode:
+            record->mode = data[4];
+            record->prev_mode = data[5];
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+
+int BlackBox::get_session(void)
+{
+    return session;
+}
+
+
+int BlackBox::get_records(void)
+{
+    return records;
+}
+
+
+int BlackBox::get_dropped(void)
+{
+    return dropped;
+}
+
+
+int BlackBox::get_write_errors(void)
+{
+    return write_errors;
+}
+
+
+int BlackBox::get_pending(void)
+{
+    return (queue_head - queue_tail + BLACKBOX_QUEUE_SIZE) % BLACKBOX_QUEUE_SIZE;
+}
+
+
+uint32_t BlackBox::get_used(void)
+{
+    return write_offset;
+}
+
+
+uint32_t BlackBox::get_size(void)
+{
+    return size;
+}
+
+
+bool BlackBox::is_full(void)
+{
+    return reserved + BLACKBOX_RECORD_SIZE > size;
+}
@@ -12,21 +12,56 @@ void Bluetooth::init(void)
     bt_serial.attach(callback(this, &Bluetooth::data_recieved_ISR), Serial::RxIrq);
     rx_index = 0;
     data_complete = false;
+    rx_discarding = false;
+    rx_overflows = 0;
+    rx_framing_errors = 0;
+    rx_hook = NULL;
+    tx_active = false;
+    tx_dropped = 0;
+    tx_seq = 0;
+    binary = false;
 }
 
 
 void Bluetooth::data_recieved_ISR(void)
 {
     /*  This ISR will run for every character recieved by the bluetooth module.
-        Each time this ISR is ran one character is stored into rx_buffer. 
+        Each time this ISR is ran one character is added to rx_frame, a command can arrive over several packets.
         rx_index stores the location of next memory location to store the next character */
     char c = bt_serial.getc();
-    if (!data_complete)
+    if (c == '/' || c == '\n' || c == '\r')
     {
-        rx_buffer[rx_index++] = c;
-        if (c == '/' || rx_index == buffer_size)
+        if (!rx_discarding && rx_index > 0)
         {
-            data_complete = true;
+            rx_frame.data[rx_index] = '\0';
+            if (rx_hook != NULL && rx_hook(rx_frame.data))
+            {
+                // handled by the hook, not queued
+            }
+            else if (rx_queue.full())
+            {
+                rx_overflows++;
+            }
+            else
+            {
+                rx_queue.push(rx_frame);
+            }
+        }
+        rx_discarding = false;
+        rx_index = 0;
+    }
+    else if (!rx_discarding)
+    {
+        if (rx_index == buffer_size)
+        {
+            // too long, skip everything up to the next terminator
+            rx_framing_errors++;
+            rx_discarding = true;
+            rx_index = 0;
+        }
+        else
+        {
+            rx_frame.data[rx_index++] = c;
         }
     }
 }
@@ -34,33 +69,108 @@ void Bluetooth::data_recieved_ISR(void)
 
 bool Bluetooth::data_recieved_complete(void)
 {   
-    /* Returns true if incoming data is fully recieved*/
+    /* Returns true if a command is ready, takes the next one from the queue if needed */
+    if (!data_complete)
+    {
+        Frame frame;
+        if (rx_queue.pop(frame))
+        {
+            memcpy(rx_buffer, frame.data, buffer_size + 1);
+            data_complete = true;
+        }
+    }
     return data_complete;
 }
 
 
+void Bluetooth::set_rx_hook(Rx_hook hook)
+{
+    rx_hook = hook;
+}
+
+
 void Bluetooth::reset_rx_buffer(void)
 {   
     /* Resets the rx_buffer. Ideally used after processing recieved data*/ 
     memset(rx_buffer, '\0', buffer_size);
     data_complete = false;
-    rx_index = 0;
 }
 
 
-void Bluetooth::send_buffer(char* char_arr)
-{   
-    /*  sends the char array one by one */
-    for(int i = 0; i < buffer_size - 1; i++)
+void Bluetooth::data_transmit_ISR(void)
+{
+    /*  This ISR runs when the UART is ready for more characters.
+        Moves as many characters as possible from the ring buffer to the UART 
+        and stops itself when there is nothing left to send */
+    char ch;
+    while (bt_serial.writeable())
     {
-        char ch = char_arr[i];
-        bt_serial.putc(ch);
-        if (ch == '\0')
+        if (!tx_ring.pop(ch))
         {
-            break;
+            bt_serial.attach(NULL, Serial::TxIrq);
+            tx_active = false;
+            return;
         }
+        bt_serial.putc(ch);
+    }
+}
+
+
+void Bluetooth::start_transmit(void)
+{
+    /*  The ISR can detach itself at any time, so check and attach atomically */
+    core_util_critical_section_enter();
+    if (!tx_active)
+    {
+        tx_active = true;
+        bt_serial.attach(callback(this, &Bluetooth::data_transmit_ISR), Serial::TxIrq);
+    }
+    core_util_critical_section_exit();
+}
+
+
+bool Bluetooth::send_bytes(const char* data, int length)
+{
+    /*  queues the bytes, the whole message is dropped if it does not fit */
+    if (tx_ring_size - (int) tx_ring.size() < length)
+    {
+        tx_dropped++;
+        return false;
+    }
+    for (int i = 0; i < length; i++)
+    {
+        tx_ring.push(data[i]);
     }
-    bt_serial.putc('\n');
+    start_transmit();
+    return true;
+}
+
+
+int Bluetooth::send_telemetry(uint8_t type, const uint8_t* payload, int length)
+{
+    /*  encodes the frame, the sequence number is used even if the frame is dropped so the loss shows up */
+    uint8_t frame[TELEMETRY_MAX_ENCODED];
+    int frame_length = telemetry_encode_frame(type, tx_seq++, payload, length, frame);
+    if (frame_length == 0 || !send_bytes((const char*) frame, frame_length))
+    {
+        return 0;
+    }
+    return frame_length;
+}
+
+
+bool Bluetooth::send_buffer(char* char_arr)
+{   
+    /*  queues the char array followed by a newline */
+    char message[buffer_size + 1];
+    int length = 0;
+    while (length < buffer_size - 1 && char_arr[length] != '\0')
+    {
+        message[length] = char_arr[length];
+        length++;
+    }
+    message[length++] = '\n';
+    return send_bytes(message, length);
 }
 
 
@@ -77,6 +187,30 @@ void Bluetooth::send_fstring(const char* format, ...)
 }
 
 
+int Bluetooth::get_tx_dropped(void)
+{
+    return tx_dropped;
+}
+
+
+int Bluetooth::get_rx_overflows(void)
+{
+    return rx_overflows;
+}
+
+
+int Bluetooth::get_rx_framing_errors(void)
+{
+    return rx_framing_errors;
+}
+
+
+int Bluetooth::get_tx_pending(void)
+{
+    return tx_ring.size();
+}
+
+
 bool Bluetooth::is_ready(void)
 {   
     /* returns true if bluetooth module is ready */
@@ -97,6 +231,18 @@ char* Bluetooth::get_rx_buffer(void)
 }
 
 
+bool Bluetooth::is_binary(void)
+{
+    return binary;
+}
+
+
+void Bluetooth::set_binary(bool status)
+{
+    binary = status;
+}
+
+
 bool Bluetooth::is_send_once(void)   
 {
     return send_once;
@@ -0,0 +1,297 @@
+#include <string.h>
+
+#include "command_dispatcher.h"
+
+
+static const float pow10_table[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f};
+
+
+static bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static bool is_separator(char c)
+{
+    return c == ' ' || c == ',' || c == '\t';
+}
+
+
+bool cmd_parse_float(const char** text, float* value)
+{
+    const char* p = *text;
+    bool negative = false;
+    uint32_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+
+    if (*p == '-' || *p == '+')
+    {
+        negative = (*p == '-');
+        p++;
+    }
+
+    // integer and fraction digits accumulated as an integer, only the first 9 are significant
+    for (; is_digit(*p); p++, digits++)
+    {
+        if (mantissa < 100000000)
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+        }
+        else
+        {
+            exponent++;
+        }
+    }
+    if (*p == '.')
+    {
+        for (p++; is_digit(*p); p++, digits++)
+        {
+            if (mantissa < 100000000)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                exponent--;
+            }
+        }
+    }
+    if (digits == 0)
+    {
+        return false;
+    }
+
+    if (*p == 'e' || *p == 'E')
+    {
+        const char* e = p + 1;
+        bool exp_negative = false;
+        int exp_value = 0;
+        if (*e == '-' || *e == '+')
+        {
+            exp_negative = (*e == '-');
+            e++;
+        }
+        if (is_digit(*e))
+        {
+            for (; is_digit(*e); e++)
+            {
+                if (exp_value < 100)
+                {
+                    exp_value = exp_value * 10 + (*e - '0');
+                }
+            }
+            exponent += exp_negative ? -exp_value : exp_value;
+            p = e;
+        }
+    }
+
+    float result = (float) mantissa;
+    while (exponent > 0)
+    {
+        int step = (exponent > 9) ? 9 : exponent;
+        result *= pow10_table[step];
+        exponent -= step;
+    }
+    while (exponent < 0)
+    {
+        int step = (-exponent > 9) ? 9 : -exponent;
+        result /= pow10_table[step];
+        exponent += step;
+    }
+
+    *value = negative ? -result : result;
+    *text = p;
+    return true;
+}
+
+
+CommandDispatcher::CommandDispatcher(const Command* table_, int table_size_)
+{
+    table = table_;
+    table_size = table_size_;
+    type_count = 0;
+    memset(index, 0, sizeof(index));
+
+    for (int i = 0; i < table_size && i < 255; i++)
+    {
+        int slot = type_slot(table[i].type);
+        if (slot < 0 && type_count < CMD_MAX_TYPES)
+        {
+            slot = type_count;
+            types[type_count++] = table[i].type;
+        }
+
+        int name = name_slot(table[i].name);
+        if (slot >= 0 && name >= 0 && index[slot][name] == 0)
+        {
+            index[slot][name] = i + 1;
+        }
+    }
+}
+
+
+int CommandDispatcher::type_slot(char type)
+{
+    for (int i = 0; i < type_count; i++)
+    {
+        if (types[i] == type)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+int CommandDispatcher::name_slot(char name)
+{
+    if (name == '\0')
+    {
+        return 0;
+    }
+    if (name >= 'A' && name <= 'Z')
+    {
+        return 1 + name - 'A';
+    }
+    if (name >= '0' && name <= '9')
+    {
+        return 27 + name - '0';
+    }
+    return -1;
+}
+
+
+const Command* CommandDispatcher::find(char type, char name)
+{
+    int slot = type_slot(type);
+    int name_index = name_slot(name);
+    if (slot < 0 || name_index < 0 || index[slot][name_index] == 0)
+    {
+        return NULL;
+    }
+    return &table[index[slot][name_index] - 1];
+}
+
+
+int CommandDispatcher::get_size(void)
+{
+    return table_size;
+}
+
+
+const Command* CommandDispatcher::get_command(int command)
+{
+    if (command < 0 || command >= table_size)
+    {
+        return NULL;
+    }
+    return &table[command];
+}
+
+
+Cmd_error CommandDispatcher::parse(const char* line, Cmd_args* args)
+{
+    while (is_separator(*line))
+    {
+        line++;
+    }
+    if (*line == '\0')
+    {
+        return cmd_err_empty;
+    }
+
+    char type = line[0];
+    if (type_slot(type) < 0)
+    {
+        return cmd_err_unknown_type;
+    }
+
+    // single character command if nothing (or a separator) follows the type
+    char name = is_separator(line[1]) ? '\0' : line[1];
+    const Command* command = find(type, name);
+    if (command == NULL)
+    {
+        return cmd_err_unknown_command;
+    }
+
+    const char* p = line + ((name == '\0') ? 1 : 2);
+    args->command = command;
+    args->object = '\0';
+    args->count = 0;
+
+    if (command->objects != NULL)
+    {
+        if (*p != '\0' && !is_separator(*p))
+        {
+            if (strchr(command->objects, *p) == NULL)
+            {
+                return cmd_err_unknown_object;
+            }
+            args->object = *p++;
+        }
+        else if (!command->object_optional)
+        {
+            return cmd_err_unknown_object;
+        }
+    }
+
+    // anything else glued to the command is ignored, like the old "%*s" format
+    while (*p != '\0' && !is_separator(*p))
+    {
+        p++;
+    }
+
+    while (true)
+    {
+        while (is_separator(*p))
+        {
+            p++;
+        }
+        if (*p == '\0')
+        {
+            break;
+        }
+        if (args->count == CMD_MAX_ARGS || args->count == command->max_args)
+        {
+            return cmd_err_arg_count;
+        }
+        if (!cmd_parse_float(&p, &args->values[args->count]) || (*p != '\0' && !is_separator(*p)))
+        {
+            return cmd_err_bad_number;
+        }
+        args->count++;
+    }
+
+    if (args->count < command->min_args)
+    {
+        return cmd_err_arg_count;
+    }
+    return cmd_ok;
+}
+
+
+Cmd_error CommandDispatcher::dispatch(const char* line)
+{
+    Cmd_args args;
+    Cmd_error error = parse(line, &args);
+    if (error != cmd_ok)
+    {
+        return error;
+    }
+    return args.command->handler(args);
+}
+
+
+const char* CommandDispatcher::error_string(Cmd_error error)
+{
+    switch (error)
+    {
+        case cmd_ok:                    return "ok";
+        case cmd_err_empty:             return "empty";
+        case cmd_err_unknown_type:      return "unknown type";
+        case cmd_err_unknown_command:   return "unknown cmd";
+        case cmd_err_unknown_object:    return "bad object";
+        case cmd_err_arg_count:         return "arg count";
+        case cmd_err_bad_number:        return "bad number";
+        case cmd_err_rejected:          return "rejected";
+        default:                        return "error";
+    }
+}
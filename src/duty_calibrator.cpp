@@ -0,0 +1,267 @@
+#include "mbed.h"
+
+#include "duty_calibrator.h"
+
+
+DutyCalibrator::DutyCalibrator(Motor& left, Motor& right, int updateRate, float rampRate, float maxDuty,
+                               float moveTime, int moveTicks, float settleTime, float measureTime):
+                update_rate(updateRate),
+                ramp_step(rampRate / updateRate),
+                max_duty(maxDuty),
+                move_window((int) (moveTime * updateRate)),
+                move_ticks(moveTicks),
+                settle_updates((int) (settleTime * updateRate)),
+                measure_updates((int) (measureTime * updateRate))
+{
+    motors[0] = &left;
+    motors[1] = &right;
+    stage = idle;
+    build_lut = false;
+    for (int m = 0; m < 2; m++)
+    {
+        deadband[m] = 0;
+        traction[m] = false;
+        compensation[m] = false;
+    }
+}
+
+
+void DutyCalibrator::start(bool with_lut)
+{
+    build_lut = with_lut;
+    stage_updates = 0;
+    level = 0;
+
+    // running before the motors are changed, the parameter updates then leave the compensation disabled
+    bool restart = is_running();
+    stage = starting;
+
+    for (int m = 0; m < 2; m++)
+    {
+        if (!restart)
+        {
+            traction[m] = motors[m]->is_traction_enabled();
+            compensation[m] = motors[m]->is_compensation_enabled();
+        }
+        motors[m]->set_traction_enabled(false);
+        motors[m]->set_compensation_enabled(false);
+        motors[m]->set_duty_cycle(0);
+        duty[m] = 0;
+        found[m] = false;
+        level_speed[m][0] = 0;
+    }
+}
+
+
+void DutyCalibrator::abort(void)
+{
+    if (is_running())
+    {
+        finish(failed);
+    }
+}
+
+
+void DutyCalibrator::update(void)
+{
+    switch (stage)
+    {
+        case starting:
+            // the encoders are reset by the control ISR after start(), count from the first update
+            for (int m = 0; m < 2; m++)
+            {
+                window_ticks[m] = motors[m]->get_tick_count();
+            }
+            stage = ramp;
+            break;
+
+        case ramp:
+            for (int m = 0; m < 2; m++)
+            {
+                if (!found[m])
+                {
+                    duty[m] += ramp_step;
+                }
+            }
+
+            if (++stage_updates >= move_window)
+            {
+                stage_updates = 0;
+                for (int m = 0; m < 2; m++)
+                {
+                    int ticks = motors[m]->get_tick_count();
+                    if (!found[m] && abs(ticks - window_ticks[m]) >= move_ticks)
+                    {
+                        // the wheel broke away at some point in this window, take the middle of it
+                        found[m] = true;
+                        deadband[m] = duty[m] - ramp_step * move_window / 2;
+                        duty[m] = deadband[m];
+                    }
+                    window_ticks[m] = ticks;
+                }
+
+                if (found[0] && found[1])
+                {
+                    if (!build_lut)
+                    {
+                        finish(done);
+                        return;
+                    }
+                    level = 1;
+                    duty[0] = level_duty(0, level);
+                    duty[1] = level_duty(1, level);
+                    stage = settle;
+                }
+                else if (duty[0] > max_duty || duty[1] > max_duty)
+                {
+                    finish(failed);
+                    return;
+                }
+            }
+            break;
+
+        case settle:
+            if (++stage_updates >= settle_updates)
+            {
+                stage_updates = 0;
+                speed_sum[0] = 0;
+                speed_sum[1] = 0;
+                stage = measure;
+            }
+            break;
+
+        case measure:
+            speed_sum[0] += motors[0]->get_filtered_speed();
+            speed_sum[1] += motors[1]->get_filtered_speed();
+
+            if (++stage_updates >= measure_updates)
+            {
+                stage_updates = 0;
+                for (int m = 0; m < 2; m++)
+                {
+                    level_speed[m][level] = speed_sum[m] / measure_updates;
+                }
+
+                if (++level >= lut_size)
+                {
+                    make_lut(0);
+                    make_lut(1);
+                    finish(done);
+                    return;
+                }
+                duty[0] = level_duty(0, level);
+                duty[1] = level_duty(1, level);
+                stage = settle;
+            }
+            break;
+
+        default:
+            return;
+    }
+
+    motors[0]->set_duty_cycle(duty[0]);
+    motors[1]->set_duty_cycle(duty[1]);
+}
+
+
+float DutyCalibrator::level_duty(int motor, int level_index)
+{
+    return deadband[motor] + (max_duty - deadband[motor]) * level_index / (lut_size - 1);
+}
+
+
+void DutyCalibrator::make_lut(int motor)
+{
+    // Speed should be linear with the command: the command max_duty gives the speed measured at max_duty.
+    // For each evenly spaced command find the duty cycle giving the matching speed on the measured curve.
+    float top_speed = level_speed[motor][lut_size - 1];
+
+    // force the measured curve to be increasing so it can be inverted
+    for (int i = 1; i < lut_size; i++)
+    {
+        if (level_speed[motor][i] < level_speed[motor][i - 1])
+        {
+            level_speed[motor][i] = level_speed[motor][i - 1];
+        }
+    }
+
+    lut[motor][0] = deadband[motor];
+    lut[motor][lut_size - 1] = max_duty;
+
+    int segment = 0;
+    for (int i = 1; i < lut_size - 1; i++)
+    {
+        float target_speed = top_speed * i / (lut_size - 1);
+        while (segment < lut_size - 2 && level_speed[motor][segment + 1] < target_speed)
+        {
+            segment++;
+        }
+
+        float speed_low = level_speed[motor][segment];
+        float speed_high = level_speed[motor][segment + 1];
+        float fraction = (speed_high > speed_low) ? (target_speed - speed_low) / (speed_high - speed_low) : 0;
+        lut[motor][i] = level_duty(motor, segment) + (level_duty(motor, segment + 1) - level_duty(motor, segment)) * fraction;
+    }
+}
+
+
+void DutyCalibrator::finish(Stage end_stage)
+{
+    motors[0]->set_duty_cycle(0);
+    motors[1]->set_duty_cycle(0);
+    motors[0]->set_traction_enabled(traction[0]);
+    motors[1]->set_traction_enabled(traction[1]);
+    motors[0]->set_compensation_enabled(compensation[0]);
+    motors[1]->set_compensation_enabled(compensation[1]);
+    stage = end_stage;
+}
+
+
+bool DutyCalibrator::is_running(void)
+{
+    return stage == starting || stage == ramp || stage == settle || stage == measure;
+}
+
+
+bool DutyCalibrator::is_done(void)
+{
+    return stage == done;
+}
+
+
+bool DutyCalibrator::is_failed(void)
+{
+    return stage == failed;
+}
+
+
+void DutyCalibrator::apply(ParameterRegistry& registry, const Duty_cal_params& ids)
+{
+    registry.begin_update();
+    for (int m = 0; m < 2; m++)
+    {
+        motors[m]->set_compensation(deadband[m], get_lut(m), lut_size, max_duty);
+        motors[m]->set_compensation_enabled(true);
+
+        // the first and last points are the deadband and max_duty
+        registry.set(ids.deadband[m], deadband[m]);
+        registry.set(ids.lut_enabled[m], build_lut);
+        for (int i = 1; build_lut && i < lut_size - 1; i++)
+        {
+            registry.set(ids.lut[m] + i - 1, lut[m][i]);
+        }
+    }
+    registry.end_update();
+}
+
+
+float DutyCalibrator::get_deadband(int motor)
+{
+    return deadband[motor];
+}
+
+
+const float* DutyCalibrator::get_lut(int motor)
+{
+    return build_lut ? lut[motor] : NULL;
+}
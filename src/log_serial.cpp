@@ -0,0 +1,152 @@
+#include "mbed.h"
+
+#include "log_serial.h"
+
+
+LogSerial::LogSerial(PinName TX_pin, PinName RX_pin, int baud_rate): serial(TX_pin, RX_pin, baud_rate)
+{
+    fill_length[0] = 0;
+    fill_length[1] = 0;
+    filling = 0;
+    send_index = 0;
+    tx_active = false;
+    tx_seq = 0;
+    dropped = 0;
+    bytes_sent = 0;
+}
+
+
+void LogSerial::data_transmit_ISR(void)
+{
+    /*  Sends from the buffer that is not being filled, when it is empty the buffers are swapped
+        so the bytes written meanwhile are sent next, stops when there is nothing left */
+    while (serial.writeable())
+    {
+        int sending = filling ^ 1;
+        if (send_index == fill_length[sending])
+        {
+            if (fill_length[filling] == 0)
+            {
+                serial.attach(NULL, SerialBase::TxIrq);
+                tx_active = false;
+                return;
+            }
+            fill_length[sending] = 0;
+            filling = sending;
+            send_index = 0;
+            sending = filling ^ 1;
+        }
+        serial.putc(buffers[sending][send_index++]);
+        bytes_sent++;
+    }
+}
+
+
+bool LogSerial::queue(const uint8_t* data, int length)
+{
+    int length_before = fill_length[filling];
+    if (length_before + length > buffer_size)
+    {
+        return false;
+    }
+    memcpy(buffers[filling] + length_before, data, length);
+    fill_length[filling] = length_before + length;
+
+    if (!tx_active)
+    {
+        // nothing being sent, this buffer goes out straight away
+        int sending = filling ^ 1;
+        fill_length[sending] = 0;
+        filling = sending;
+        send_index = 0;
+        tx_active = true;
+        serial.attach(callback(this, &LogSerial::data_transmit_ISR), SerialBase::TxIrq);
+    }
+    return true;
+}
+
+
+bool LogSerial::write(const uint8_t* data, int length)
+{
+    core_util_critical_section_enter();
+    bool queued = queue(data, length);
+    if (!queued)
+    {
+        dropped++;
+    }
+    core_util_critical_section_exit();
+    return queued;
+}
+
+
+int LogSerial::send_telemetry(uint8_t type, const uint8_t* payload, int length)
+{
+    /*  the sequence number is used even if the frame is dropped so the loss shows up */
+    uint8_t frame[TELEMETRY_MAX_ENCODED];
+    core_util_critical_section_enter();
+    uint8_t seq = tx_seq++;
+    core_util_critical_section_exit();
+
+    int frame_length = telemetry_encode_frame(type, seq, payload, length, frame);
+    if (frame_length == 0 || !write(frame, frame_length))
+    {
+        return 0;
+    }
+    return frame_length;
+}
+
+
+void LogSerial::printf(const char* format, ...)
+{
+    char buffer[text_size + 1];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length > text_size)
+    {
+        length = text_size;
+    }
+
+    // the TX interrupt frees a whole buffer at a time, wait for it
+    bool queued = false;
+    while (!queued && length > 0)
+    {
+        core_util_critical_section_enter();
+        queued = queue((const uint8_t*) buffer, length);
+        core_util_critical_section_exit();
+    }
+}
+
+
+bool LogSerial::readable(void)
+{
+    return serial.readable();
+}
+
+
+int LogSerial::getc(void)
+{
+    return serial.getc();
+}
+
+
+int LogSerial::get_dropped(void)
+{
+    return dropped;
+}
+
+
+int LogSerial::get_bytes_sent(void)
+{
+    return bytes_sent;
+}
+
+
+int LogSerial::get_pending(void)
+{
+    core_util_critical_section_enter();
+    int pending = fill_length[filling] + fill_length[filling ^ 1] - send_index;
+    core_util_critical_section_exit();
+    return pending;
+}
@@ -0,0 +1,264 @@
+#include <string.h>
+
+#include "mode_machine.h"
+
+
+ModeMachine::ModeMachine(const Mode_state* states_, int state_count_, const Mode_transition* transitions_,
+                         int transition_count_, Mode_change_hook on_change_)
+{
+    states = states_;
+    state_count = state_count_;
+    transitions = transitions_;
+    transition_count = transition_count_;
+    on_change = on_change_;
+    current = MODE_NONE;
+    queue_head = 0;
+    queue_tail = 0;
+    urgent_mode = MODE_NONE;
+    urgent_time_us = 0;
+    stop_count = 0;
+    requested_mode = MODE_NONE;
+    requested_time_us = 0;
+    requested_stop_count = 0;
+    reset_stats();
+}
+
+
+void ModeMachine::start(int mode)
+{
+    if (mode < 0 || mode >= state_count)
+    {
+        return;
+    }
+    current = mode;
+    if (on_change != nullptr)
+    {
+        on_change(MODE_NONE, mode);
+    }
+    if (states[mode].entry != nullptr)
+    {
+        states[mode].entry();
+    }
+}
+
+
+bool ModeMachine::post(int mode, uint32_t now_us)
+{
+    if (mode < 0 || mode >= state_count)
+    {
+        return false;
+    }
+
+    if (states[mode].urgent)
+    {
+        // a stop overrides everything that was requested before it
+        urgent_time_us = now_us;
+        urgent_mode = mode;
+        return true;
+    }
+
+    // the mode logic polls, a request repeated before it is applied is merged with it
+    int last = (queue_head + MODE_QUEUE_SIZE - 1) % MODE_QUEUE_SIZE;
+    bool repeated = (queue_head != queue_tail) ? (queue[last].mode == mode && queue[last].stop_count == stop_count)
+                                               : (requested_mode == mode);
+    if (repeated)
+    {
+        return true;
+    }
+
+    int next = (queue_head + 1) % MODE_QUEUE_SIZE;
+    if (next == queue_tail)
+    {
+        dropped++;
+        return false;
+    }
+    queue[queue_head].mode = mode;
+    queue[queue_head].time_us = now_us;
+    queue[queue_head].stop_count = stop_count;
+    queue_head = next;
+    return true;
+}
+
+
+bool ModeMachine::allowed(int from, int to)
+{
+    for (int i = 0; i < transition_count; i++)
+    {
+        const Mode_transition& row = transitions[i];
+        if ((row.from == MODE_ANY || row.from == from) && (row.to == MODE_ANY || row.to == to))
+        {
+            return row.guard == nullptr || row.guard(from, to);
+        }
+    }
+    return false;
+}
+
+
+void ModeMachine::record_latency(bool urgent, uint32_t us)
+{
+    Mode_latency& l = latency[urgent ? 1 : 0];
+    l.count++;
+    l.last_us = us;
+    l.total_us += us;
+    if (us > l.max_us)
+    {
+        l.max_us = us;
+    }
+    transition_total++;
+}
+
+
+void ModeMachine::process_urgent(uint32_t now_us)
+{
+    int to = urgent_mode;
+    if (to != MODE_NONE)
+    {
+        // the requests posted before are cancelled (the main loop skips them)
+        urgent_mode = MODE_NONE;
+        requested_mode = MODE_NONE;
+        stop_count = stop_count + 1;
+
+        int from = current;
+        if (to == from)
+        {
+            return;
+        }
+        if (!allowed(from, to))
+        {
+            rejected++;
+            last_rejected = to;
+            return;
+        }
+        if (states[from].exit != nullptr)
+        {
+            states[from].exit();
+        }
+        if (states[to].entry != nullptr)
+        {
+            states[to].entry();
+        }
+        current = to;
+        if (on_change != nullptr)
+        {
+            on_change(from, to);
+        }
+        record_latency(true, now_us - urgent_time_us);
+        return;
+    }
+
+    to = requested_mode;
+    if (to != MODE_NONE)
+    {
+        requested_mode = MODE_NONE;
+        if (requested_stop_count != stop_count)
+        {
+            return;
+        }
+        // the old mode runs until this tick, its exit action can not run in the main loop
+        int from = current;
+        if (states[from].exit != nullptr)
+        {
+            states[from].exit();
+        }
+        current = to;
+        if (on_change != nullptr)
+        {
+            on_change(from, to);
+        }
+        record_latency(false, now_us - requested_time_us);
+    }
+}
+
+
+void ModeMachine::process(void)
+{
+    // one request at a time, the next one is checked once the tick has applied this one
+    while (requested_mode == MODE_NONE && urgent_mode == MODE_NONE && queue_tail != queue_head)
+    {
+        Mode_event event = queue[queue_tail];
+        queue_tail = (queue_tail + 1) % MODE_QUEUE_SIZE;
+        int from = current;
+        if (event.mode == from || event.stop_count != stop_count)
+        {
+            continue;
+        }
+        if (!allowed(from, event.mode))
+        {
+            rejected++;
+            last_rejected = event.mode;
+            continue;
+        }
+        if (states[event.mode].entry != nullptr)
+        {
+            states[event.mode].entry();
+        }
+        // a stop applied during the actions cancels the request (checked again by the tick)
+        requested_time_us = event.time_us;
+        requested_stop_count = event.stop_count;
+        requested_mode = event.mode;
+    }
+}
+
+
+void ModeMachine::get_latency(bool urgent, Mode_latency* copy)
+{
+    *copy = latency[urgent ? 1 : 0];
+}
+
+
+void ModeMachine::reset_stats(void)
+{
+    memset(latency, 0, sizeof(latency));
+    transition_total = 0;
+    rejected = 0;
+    dropped = 0;
+    last_rejected = MODE_NONE;
+}
+
+
+bool ModeMachine::is_changing(void)
+{
+    return urgent_mode != MODE_NONE || requested_mode != MODE_NONE || queue_head != queue_tail;
+}
+
+
+int ModeMachine::get_mode(void)
+{
+    return current;
+}
+
+
+const char* ModeMachine::get_name(int mode)
+{
+    return (mode >= 0 && mode < state_count) ? states[mode].name : "";
+}
+
+
+int ModeMachine::get_pending(void)
+{
+    return (queue_head - queue_tail + MODE_QUEUE_SIZE) % MODE_QUEUE_SIZE;
+}
+
+
+uint32_t ModeMachine::get_transitions(void)
+{
+    return transition_total;
+}
+
+
+uint32_t ModeMachine::get_rejected(void)
+{
+    return rejected;
+}
+
+
+uint32_t ModeMachine::get_dropped(void)
+{
+    return dropped;
+}
+
+
+int ModeMachine::get_last_rejected(void)
+{
+    return last_rejected;
+}
@@ -0,0 +1,262 @@
+#include <math.h>
+#include <stddef.h>
+
+#include "motion_script.h"
+
+
+#define DEG_TO_RAD      0.0174532925f
+
+
+MotionScript::MotionScript(float wheelSeparation, float accel_, float endVelocity, float lostDistance):
+                wheel_separation(wheelSeparation),
+                end_velocity(endVelocity),
+                lost_distance(lostDistance)
+{
+    accel = accel_;
+    count = 0;
+    state = idle;
+    index = 0;
+    origin_distance = 0;
+    origin_heading = 0;
+    velocity = 0;
+    elapsed = 0;
+    line_seen_distance = 0;
+}
+
+
+void MotionScript::clear(void)
+{
+    count = 0;
+}
+
+
+bool MotionScript::add(char type, float length, float angle, float velocity_)
+{
+    if (count >= max_segments || length < 0 || velocity_ < 0)
+    {
+        return false;
+    }
+    switch (type)
+    {
+        case motion_arc:
+            if (length <= 0 || angle == 0)
+            {
+                return false;
+            }
+            break;
+        case motion_straight:
+        case motion_turn:
+        case motion_follow:
+        case motion_wait:
+            break;
+        default:
+            return false;
+    }
+
+    Motion_segment& segment = segments[count++];
+    segment.type = type;
+    segment.length = length;
+    segment.angle = angle;
+    segment.velocity = (type == motion_wait) ? 0 : velocity_;
+    return true;
+}
+
+
+int MotionScript::get_count(void)
+{
+    return count;
+}
+
+
+const Motion_segment* MotionScript::get_segment(int segment)
+{
+    if (segment < 0 || segment >= count)
+    {
+        return NULL;
+    }
+    return &segments[segment];
+}
+
+
+void MotionScript::set_accel(float accel_)
+{
+    accel = accel_;
+}
+
+
+void MotionScript::start(void)
+{
+    state = (count > 0) ? starting : done;
+}
+
+
+void MotionScript::stop(void)
+{
+    state = idle;
+}
+
+
+void MotionScript::enter(int segment, float distance, float heading)
+{
+    index = segment;
+    origin_distance = distance;
+    origin_heading = heading;
+    elapsed = 0;
+    line_seen_distance = distance;
+}
+
+
+float MotionScript::entry_velocity(int segment)
+{
+    // the script ends standing still
+    return (segment < count) ? segments[segment].velocity : 0;
+}
+
+
+Motion_output MotionScript::update(float distance, float heading_deg, bool line_detected, float dt)
+{
+    Motion_output out = {0, origin_heading, 0, false, false};
+
+    if (state == starting)
+    {
+        velocity = 0;
+        enter(0, distance, heading_deg);
+        state = running;
+    }
+    if (state != running)
+    {
+        velocity = 0;
+        return out;
+    }
+    elapsed += dt;
+
+    // Move on to the next segment, the end point of a segment is the origin of the next one
+    for (int steps = 0; steps < count; steps++)
+    {
+        const Motion_segment& segment = segments[index];
+        float travelled = distance - origin_distance;
+        float end_distance = distance;
+        float end_heading = origin_heading;
+        bool ended = false;
+
+        switch (segment.type)
+        {
+            case motion_straight:
+                end_distance = origin_distance + segment.length;
+                ended = (travelled >= segment.length);
+                break;
+            case motion_turn:
+                end_heading = origin_heading + segment.angle;
+                ended = (segment.angle >= 0) ? (heading_deg >= end_heading) : (heading_deg <= end_heading);
+                break;
+            case motion_arc:
+                end_distance = origin_distance + segment.length * fabsf(segment.angle) * DEG_TO_RAD;
+                end_heading = origin_heading + segment.angle;
+                ended = (distance >= end_distance);
+                break;
+            case motion_follow:
+                if (line_detected)
+                {
+                    line_seen_distance = distance;
+                }
+                end_heading = heading_deg;
+                ended = (segment.length > 0 && travelled >= segment.length) ||
+                        (distance - line_seen_distance >= lost_distance);
+                break;
+            case motion_wait:
+                ended = (elapsed >= segment.length);
+                break;
+        }
+
+        if (!ended)
+        {
+            break;
+        }
+        if (index + 1 >= count)
+        {
+            origin_heading = end_heading;
+            index = count;
+            state = done;
+            velocity = 0;
+            out.heading_deg = end_heading;
+            out.finished = true;
+            return out;
+        }
+        enter(index + 1, end_distance, end_heading);
+    }
+
+    // Velocity: cruise, limited by the braking distance to the entry velocity of the next segment
+    const Motion_segment& segment = segments[index];
+    float travelled = distance - origin_distance;
+    float target = segment.velocity;
+    float remaining = -1;           // unknown
+    switch (segment.type)
+    {
+        case motion_straight:
+            remaining = segment.length - travelled;
+            break;
+        case motion_arc:
+            remaining = segment.length * fabsf(segment.angle) * DEG_TO_RAD - travelled;
+            break;
+        default:
+            // turns end on the heading, follow segments on an event: the next segment brakes,
+            // the line follow mixer is not stable at low speed anyway
+            break;
+    }
+    if (remaining >= 0)
+    {
+        // a segment braking to stand still arrives slowly instead, the end would never be reached
+        float exit = fminf(fmaxf(entry_velocity(index + 1), end_velocity), segment.velocity);
+        target = fminf(target, sqrtf(exit * exit + 2 * accel * remaining));
+    }
+    if (target > velocity)
+    {
+        velocity = fminf(target, velocity + accel * dt);
+    }
+    else
+    {
+        // some margin over the braking curve so the end is not overshot
+        velocity = fmaxf(target, velocity - 2 * accel * dt);
+    }
+    out.velocity = velocity;
+
+    // Heading set point
+    switch (segment.type)
+    {
+        case motion_turn:
+            out.heading_deg = origin_heading + segment.angle;
+            break;
+        case motion_arc:
+        {
+            float arc_length = segment.length * fabsf(segment.angle) * DEG_TO_RAD;
+            float progress = fminf(fmaxf(travelled / arc_length, 0), 1);
+            out.heading_deg = origin_heading + segment.angle * progress;
+            out.turn_offset = velocity * wheel_separation / (2 * segment.length);
+            if (segment.angle < 0)
+            {
+                out.turn_offset = -out.turn_offset;
+            }
+            break;
+        }
+        case motion_follow:
+            out.heading_deg = heading_deg;
+            out.follow = true;
+            break;
+        default:
+            out.heading_deg = origin_heading;
+            break;
+    }
+    return out;
+}
+
+
+bool MotionScript::is_running(void)
+{
+    return state == starting || state == running;
+}
+
+
+int MotionScript::get_index(void)
+{
+    return index;
+}
@@ -18,6 +18,18 @@ Motor::Motor(PinName pwm, PinName dir, PinName bip, PinName CH_A, PinName CH_B,
                 LP_b1(LowPass_b1),
                 wheel_radius(wheelRadius)
 {
+    traction_enabled = false;
+    traction_configured = false;
+    traction_requested = true;
+    applied_duty = 0;
+    applied_direction = true;
+    compensation_enabled = false;
+    deadband = 0;
+    comp_lut_size = 0;
+    comp_lut_range = 1;
+    reset();
+    reset_traction_counts();
+
     PWM_pin.period(1.0 / pwm_freq);
     set_direction(1);
     set_bipolar_mode(false);
@@ -31,6 +43,11 @@ Motor::Motor(PinName pwm, PinName dir, PinName bip, PinName CH_A, PinName CH_B,
 };
 
 void Motor::update(void)
+{
+    update(1.0f / update_rate);
+}
+
+void Motor::update(float dt)
 {
     // update pulse diff
     curr_tick_count = qei.getPulses();
@@ -38,7 +55,7 @@ void Motor::update(void)
     prev_tick_count = curr_tick_count;
 
     // update rotational freq
-    rotational_freq = ((float) tick_diff / (4 * pulse_per_rev)) * update_rate;
+    rotational_freq = ((float) tick_diff / (4 * pulse_per_rev)) / dt;
 
     // update rpm
     rpm = rotational_freq * 60;
@@ -51,6 +68,59 @@ void Motor::update(void)
 
     prev_filtered_speed = filtered_speed;
     prev_speed = speed;
+
+    if (traction_enabled)
+    {
+        update_traction(tick_diff, dt);
+    }
+}
+
+void Motor::update_traction(int tick_diff, float dt)
+{
+    // Stall: driving hard but the wheel is not turning
+    if (applied_duty >= stall_duty && tick_diff == 0)
+    {
+        if (++zero_tick_updates == stall_updates)
+        {
+            stalled = true;
+            stall_count++;
+        }
+    }
+    else if (tick_diff != 0)
+    {
+        zero_tick_updates = 0;
+        stalled = false;
+    }
+
+    // Slip: windowed acceleration, single update tick differences are too coarse to differentiate
+    window_time += dt;
+    if (++window_updates < accel_window)
+    {
+        return;
+    }
+
+    float new_window_speed = 2 * pi * wheel_radius * ((float) (curr_tick_count - window_start_ticks) / (4 * pulse_per_rev)) / window_time;
+    measured_accel = (new_window_speed - window_speed) / window_time;
+    window_speed = new_window_speed;
+    window_start_ticks = curr_tick_count;
+    window_updates = 0;
+    window_time = 0;
+
+    // acceleration asked by the set point over the same window (a step counts for one window), a
+    // wheel lagging behind a set point slowing down is not spinning
+    float expected_accel = (speed_setpoint - window_setpoint) / window_time;
+    window_setpoint = speed_setpoint;
+
+    // only counts as slip if the motor is driving the wheel in the direction of the acceleration
+    float driven_accel = direction ? measured_accel : -measured_accel;
+    float driven_expected = direction ? expected_accel : -expected_accel;
+    bool new_slipping = driven_accel > fmaxf(driven_expected, 0) + accel_margin && applied_duty > 0;
+    if (new_slipping && !slipping)
+    {
+        slip_count++;
+        slew_limited = true;
+    }
+    slipping = new_slipping;
 }
 
 void Motor::reset(void)
@@ -65,6 +135,66 @@ void Motor::reset(void)
     prev_speed = 0;
     prev_filtered_speed = 0;
     rpm = 0;
+
+    window_updates = 0;
+    window_time = 0;
+    window_start_ticks = 0;
+    window_speed = 0;
+    speed_setpoint = 0;
+    window_setpoint = 0;
+    measured_accel = 0;
+    zero_tick_updates = 0;
+    slipping = false;
+    slew_limited = false;
+    stalled = false;
+}
+
+void Motor::reset_traction_counts(void)
+{
+    slip_count = 0;
+    stall_count = 0;
+}
+
+void Motor::set_traction_control(int accel_window_, float accel_margin_, float slew_rate, float stall_duty_, float stall_time, float stall_duty_cap_)
+{
+    accel_window = accel_window_;
+    accel_margin = accel_margin_;
+    slew_per_update = slew_rate / update_rate;
+    stall_duty = stall_duty_;
+    stall_updates = (int) (stall_time * update_rate);
+    stall_duty_cap = stall_duty_cap_;
+    traction_configured = accel_window > 0 && stall_updates > 0;
+    set_traction_enabled(traction_requested);
+}
+
+void Motor::set_traction_enabled(bool status)
+{
+    bool enable = status && traction_configured;
+    if (enable && !traction_enabled)
+    {
+        // the speed of the last window is stale, it would read as a jump in acceleration
+        window_updates = 0;
+        window_time = 0;
+        window_start_ticks = curr_tick_count;
+        window_speed = filtered_speed;
+        window_setpoint = speed_setpoint;
+        zero_tick_updates = 0;
+        slipping = false;
+        slew_limited = false;
+        stalled = false;
+    }
+    traction_requested = status;
+    traction_enabled = enable;
+}
+
+bool Motor::is_traction_enabled(void)
+{
+    return traction_requested;
+}
+
+void Motor::set_speed_setpoint(float speed)
+{
+    speed_setpoint = speed;
 }
 
 void Motor::set_duty_cycle(float DutyCycle)
@@ -79,9 +209,92 @@ void Motor::set_duty_cycle(float DutyCycle)
     {
         set_direction(1);
     }
-    PWM_pin.write(1 - duty_cycle);
+
+    float magnitude = duty_cycle;
+    if (traction_enabled)
+    {
+        // only increases are limited, a direction change starts again from 0
+        float prev_magnitude = (direction == applied_direction) ? applied_duty : 0;
+        if (slew_limited && magnitude > prev_magnitude + slew_per_update)
+        {
+            magnitude = prev_magnitude + slew_per_update;
+        }
+        else if (!slipping)
+        {
+            slew_limited = false;
+        }
+        if (stalled && magnitude > stall_duty_cap)
+        {
+            magnitude = stall_duty_cap;
+        }
+    }
+    applied_duty = magnitude;
+    applied_direction = direction;
+    PWM_pin.write(1 - compensate(magnitude));
 };
 
+float Motor::compensate(float command)
+{
+    if (!compensation_enabled)
+    {
+        return command;
+    }
+    if (command < comp_zero_band)
+    {
+        return 0;
+    }
+    if (comp_lut_size < 2)
+    {
+        return deadband + (1 - deadband) * command;
+    }
+    if (command >= comp_lut_range)
+    {
+        return command;
+    }
+
+    // linear interpolation between the two nearest points
+    float position = command / comp_lut_range * (comp_lut_size - 1);
+    int index = (int) position;
+    float fraction = position - index;
+    return comp_lut[index] + (comp_lut[index + 1] - comp_lut[index]) * fraction;
+}
+
+void Motor::set_compensation(float deadband_, const float* lut, int lut_size, float lut_range)
+{
+    deadband = deadband_;
+    comp_lut_size = 0;
+    if (lut != NULL && lut_size >= 2 && lut_size <= comp_lut_max && lut_range > 0)
+    {
+        for (int i = 0; i < lut_size; i++)
+        {
+            comp_lut[i] = lut[i];
+        }
+        comp_lut_range = lut_range;
+        comp_lut_size = lut_size;
+    }
+}
+
+void Motor::set_compensation_enabled(bool status)
+{
+    compensation_enabled = status;
+}
+
+bool Motor::is_compensation_enabled(void)
+{
+    return compensation_enabled;
+}
+
+float Motor::get_deadband(void)
+{
+    return deadband;
+}
+
+const float* Motor::get_compensation_lut(int* lut_size)
+{
+    *lut_size = comp_lut_size;
+    return comp_lut;
+}
+
 void Motor::set_direction(bool DirState)
 {
     Direction.write(DirState);
@@ -109,6 +322,36 @@ float Motor::get_duty_cycle(void)
     return duty_cycle;
 };
 
+float Motor::get_applied_duty_cycle(void)
+{
+    return applied_direction ? applied_duty : -applied_duty;
+}
+
+bool Motor::is_slipping(void)
+{
+    return slipping;
+}
+
+bool Motor::is_stalled(void)
+{
+    return stalled;
+}
+
+int Motor::get_slip_count(void)
+{
+    return slip_count;
+}
+
+int Motor::get_stall_count(void)
+{
+    return stall_count;
+}
+
+float Motor::get_measured_accel(void)
+{
+    return measured_accel;
+}
+
 int Motor::get_tick_count(void)
 {
     return curr_tick_count;
@@ -132,4 +375,11 @@ float Motor::get_speed(void)
 float Motor::get_filtered_speed(void)
 {
     return filtered_speed;
-}
\ No newline at end of file
+}
+
+void Motor::set_low_pass(float LowPass_a0, float LowPass_b0, float LowPass_b1)
+{
+    LP_a0 = LowPass_a0;
+    LP_b0 = LowPass_b0;
+    LP_b1 = LowPass_b1;
+}
@@ -0,0 +1,106 @@
+#include "odometry.h"
+
+
+#define Q30_ONE     ((int32_t) 1 << 30)
+
+// same width on the host as on the target (long is 32 bit on the Cortex-M4, 64 bit on the host)
+static_assert(sizeof(Q30_ONE) == 4, "Q30 constants must be 32 bit");
+
+static inline int32_t mul_q30(int32_t a, int32_t b)
+{
+    return (int32_t) (((int64_t) a * b) >> 30);
+}
+
+
+Odometry::Odometry(int pulse_per_rev, float wheel_radius, float wheel_separation)
+{
+    const float pi = 3.14159265f;
+    float metres_per_tick = 2 * pi * wheel_radius / (4 * pulse_per_rev);
+
+    // (left + right) counts each tick twice, (left - right) / separation is the heading in radians
+    metres_per_total = metres_per_tick / 2;
+    deg_per_diff = metres_per_tick / wheel_separation * (180 / pi);
+    rad_per_diff_q30 = (int32_t) (metres_per_tick / wheel_separation * Q30_ONE + 0.5f);
+
+    reset();
+}
+
+
+void Odometry::update(int tick_count_left, int tick_count_right)
+{
+    int diff_left = tick_count_left - prev_tick_left;
+    int diff_right = tick_count_right - prev_tick_right;
+    prev_tick_left = tick_count_left;
+    prev_tick_right = tick_count_right;
+
+    int32_t tick_diff = diff_left - diff_right;
+    int32_t tick_total = diff_left + diff_right;
+
+    tick_diff_sum += tick_diff;
+    tick_total_sum += tick_total;
+
+    if (tick_diff != 0)
+    {
+        int32_t d_theta = tick_diff * rad_per_diff_q30;
+        int32_t half_d_theta = d_theta / 2;
+
+        // integrate the position at the mid-point heading: cos/sin(theta + d/2)
+        if (tick_total != 0)
+        {
+            int32_t cos_mid = cos_q30 - mul_q30(sin_q30, half_d_theta);
+            int32_t sin_mid = sin_q30 + mul_q30(cos_q30, half_d_theta);
+            x_acc += (int64_t) tick_total * cos_mid;
+            y_acc += (int64_t) tick_total * sin_mid;
+        }
+
+        // rotate the heading vector by d using cos d = 1 - d^2/2, sin d = d
+        int32_t half_d_theta_sq = mul_q30(d_theta, half_d_theta);
+        int32_t new_cos = cos_q30 - mul_q30(sin_q30, d_theta) - mul_q30(cos_q30, half_d_theta_sq);
+        int32_t new_sin = sin_q30 + mul_q30(cos_q30, d_theta) - mul_q30(sin_q30, half_d_theta_sq);
+
+        // renormalise so the length stays at 1, first order: k = (3 - |v|^2) / 2
+        int32_t mag_sq = mul_q30(new_cos, new_cos) + mul_q30(new_sin, new_sin);
+        int32_t k = (int32_t) ((3 * (int64_t) Q30_ONE - mag_sq) / 2);
+        cos_q30 = mul_q30(new_cos, k);
+        sin_q30 = mul_q30(new_sin, k);
+    }
+    else if (tick_total != 0)
+    {
+        x_acc += (int64_t) tick_total * cos_q30;
+        y_acc += (int64_t) tick_total * sin_q30;
+    }
+
+    publish();
+}
+
+
+void Odometry::reset(void)
+{
+    prev_tick_left = 0;
+    prev_tick_right = 0;
+    tick_diff_sum = 0;
+    tick_total_sum = 0;
+    x_acc = 0;
+    y_acc = 0;
+    cos_q30 = Q30_ONE;
+    sin_q30 = 0;
+
+    publish();
+}
+
+
+void Odometry::publish(void)
+{
+    Pose pose;
+    pose.x = (float) x_acc * (metres_per_total / Q30_ONE);
+    pose.y = (float) y_acc * (metres_per_total / Q30_ONE);
+    pose.heading_deg = tick_diff_sum * deg_per_diff;
+    pose.distance = tick_total_sum * metres_per_total;
+    published.write(pose);
+}
+
+
+Pose Odometry::get_pose(void)
+{
+    return published.read();
+}
@@ -0,0 +1,201 @@
+#include "mbed.h"
+
+#include "parameter_store.h"
+
+
+ParameterStore::ParameterStore(uint32_t address_, uint32_t size_):
+    address(address_),
+    size(size_)
+{
+    next_offset = 0;
+    save_count = 0;
+    record_size = 0;
+    erased = false;
+}
+
+
+uint16_t ParameterStore::crc16(const uint8_t* data, int length, uint16_t crc)
+{
+    // CRC-16/CCITT, bitwise since it only runs when loading or saving
+    for (int i = 0; i < length; i++)
+    {
+        crc ^= (uint16_t) data[i] << 8;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+
+uint32_t ParameterStore::scan(Record_header* last_header, uint32_t* last_offset)
+{
+    // flash must be initialised, returns the offset after the last record (erased or not valid)
+    uint32_t page_size = flash.get_page_size();
+    uint32_t offset = 0;
+    *last_offset = size;
+    save_count = 0;
+
+    while (offset + sizeof(Record_header) <= size)
+    {
+        Record_header header;
+        flash.read(&header, address + offset, sizeof(header));
+        if (header.magic != record_magic)
+        {
+            break;
+        }
+        if (header.count > PARAM_MAX_COUNT)
+        {
+            // corrupted header, the record length is unknown so nothing can be appended after it
+            return size;
+        }
+
+        uint32_t length = sizeof(Record_header) + header.count * sizeof(Record_entry);
+        uint32_t padded = (length + page_size - 1) / page_size * page_size;
+        Record_entry entries[PARAM_MAX_COUNT];
+        flash.read(entries, address + offset + sizeof(Record_header), header.count * sizeof(Record_entry));
+        if (crc16((const uint8_t*) entries, header.count * sizeof(Record_entry), 0xFFFF) == header.crc)
+        {
+            *last_header = header;
+            *last_offset = offset;
+            record_size = padded;
+        }
+
+        save_count++;
+        offset += padded;
+    }
+    return offset;
+}
+
+
+int ParameterStore::load(ParameterRegistry& registry)
+{
+    Record_header header;
+    uint32_t offset;
+    Record_entry entries[PARAM_MAX_COUNT];
+
+    flash.init();
+    next_offset = scan(&header, &offset);
+    if (offset < size)
+    {
+        flash.read(entries, address + offset + sizeof(Record_header), header.count * sizeof(Record_entry));
+    }
+    flash.deinit();
+
+    if (offset >= size)
+    {
+        return -1;
+    }
+
+    int loaded = 0;
+    registry.begin_update();
+    for (int i = 0; i < header.count; i++)
+    {
+        if (registry.set(entries[i].id, entries[i].value))
+        {
+            loaded++;
+        }
+    }
+    registry.end_update();
+    return loaded;
+}
+
+
+bool ParameterStore::save(const ParameterRegistry& registry)
+{
+    uint8_t record[sizeof(Record_header) + PARAM_MAX_COUNT * sizeof(Record_entry) + 16];
+    Record_header header;
+    Record_entry entries[PARAM_MAX_COUNT];
+    uint32_t offset;
+
+    int count = registry.get_count();
+    for (int i = 0; i < count; i++)
+    {
+        const Param_def* def = registry.get_def(i);
+        entries[i].id = def->id;
+        entries[i].value = registry.get_pending(def->id);
+    }
+
+    header.magic = record_magic;
+    header.count = count;
+    header.crc = crc16((const uint8_t*) entries, count * sizeof(Record_entry), 0xFFFF);
+
+    flash.init();
+    uint32_t page_size = flash.get_page_size();
+    uint32_t length = sizeof(Record_header) + count * sizeof(Record_entry);
+    uint32_t padded = (length + page_size - 1) / page_size * page_size;
+    if (padded > sizeof(record))
+    {
+        flash.deinit();
+        return false;
+    }
+
+    memset(record, 0xFF, padded);
+    memcpy(record, &header, sizeof(header));
+    memcpy(record + sizeof(header), entries, count * sizeof(Record_entry));
+
+    // the record is ready before anything is erased, the window without a saved record is only
+    // the erase and the program
+    next_offset = scan(&header, &offset);
+    record_size = padded;
+    erased = (next_offset + padded > size);
+    if (erased)
+    {
+        // sector full, start again from the beginning
+        if (flash.erase(address, size) != 0)
+        {
+            flash.deinit();
+            return false;
+        }
+        next_offset = 0;
+        save_count = 0;
+    }
+
+    bool success = (flash.program(record, address + next_offset, padded) == 0);
+    if (success)
+    {
+        // verify the record so a failed write is reported instead of silently loading an old record
+        uint8_t check[sizeof(record)];
+        flash.read(check, address + next_offset, length);
+        success = (memcmp(check, record, length) == 0);
+        next_offset += padded;
+        save_count++;
+    }
+    flash.deinit();
+    return success;
+}
+
+
+bool ParameterStore::erase(void)
+{
+    flash.init();
+    bool success = (flash.erase(address, size) == 0);
+    flash.deinit();
+
+    next_offset = 0;
+    save_count = 0;
+    return success;
+}
+
+
+int ParameterStore::get_save_count(void)
+{
+    return save_count;
+}
+
+
+int ParameterStore::get_free_count(void)
+{
+    if (record_size == 0)
+    {
+        return -1;
+    }
+    return (next_offset < size) ? (size - next_offset) / record_size : 0;
+}
+
+
+bool ParameterStore::get_erased(void)
+{
+    return erased;
+}
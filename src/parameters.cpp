@@ -0,0 +1,138 @@
+#include <string.h>
+
+#include "parameters.h"
+
+
+ParameterRegistry::ParameterRegistry(const Param_def* defs_, int count_, Apply_callback callback)
+{
+    defs = defs_;
+    count = (count_ < PARAM_MAX_COUNT) ? count_ : PARAM_MAX_COUNT;
+    apply_callback = callback;
+    holding = false;
+
+    for (int i = 0; i < count; i++)
+    {
+        active[i] = defs[i].default_value;
+        pending[i] = defs[i].default_value;
+    }
+    dirty = false;
+}
+
+
+int ParameterRegistry::get_count(void) const
+{
+    return count;
+}
+
+
+const Param_def* ParameterRegistry::get_def(int index) const
+{
+    return (index >= 0 && index < count) ? &defs[index] : NULL;
+}
+
+
+int ParameterRegistry::index_of(int id) const
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (defs[i].id == id)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+int ParameterRegistry::index_of(const char* name) const
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(defs[i].name, name) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+float ParameterRegistry::get(int id) const
+{
+    int index = index_of(id);
+    return (index >= 0) ? active[index] : 0;
+}
+
+
+float ParameterRegistry::get_pending(int id) const
+{
+    int index = index_of(id);
+    return (index >= 0) ? pending[index] : 0;
+}
+
+
+bool ParameterRegistry::set(int id, float value)
+{
+    int index = index_of(id);
+    if (index < 0 || !(value >= defs[index].min && value <= defs[index].max))
+    {
+        return false;
+    }
+
+    switch (defs[index].type)
+    {
+        case param_int:
+            value = (float) (int) (value < 0 ? value - 0.5f : value + 0.5f);
+            break;
+        case param_bool:
+            value = (value != 0) ? 1 : 0;
+            break;
+        default:
+            break;
+    }
+
+    pending[index] = value;
+    dirty = true;
+    return true;
+}
+
+
+void ParameterRegistry::reset_defaults(void)
+{
+    for (int i = 0; i < count; i++)
+    {
+        pending[i] = defs[i].default_value;
+    }
+    dirty = true;
+}
+
+
+void ParameterRegistry::begin_update(void)
+{
+    holding = true;
+}
+
+
+void ParameterRegistry::end_update(void)
+{
+    holding = false;
+}
+
+
+bool ParameterRegistry::apply_pending(void)
+{
+    if (!dirty || holding)
+    {
+        return false;
+    }
+
+    // runs in the ISR so the main loop can not be half way through a set() of the same value
+    dirty = false;
+    memcpy(active, pending, count * sizeof(float));
+
+    if (apply_callback != NULL)
+    {
+        apply_callback(*this);
+    }
+    return true;
+}
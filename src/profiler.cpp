@@ -0,0 +1,136 @@
+#include <string.h>
+
+#include "profiler.h"
+
+
+Profiler::Profiler(const char* const* names_, int scope_count_, Cycle_source read_cycles_, uint32_t cycles_per_us_)
+{
+    names = names_;
+    scope_count = (scope_count_ > PROFILE_MAX_SCOPES) ? PROFILE_MAX_SCOPES : scope_count_;
+    read_cycles = read_cycles_;
+    cycles_per_us = (cycles_per_us_ < 1) ? 1 : cycles_per_us_;
+    memset(budget, 0, sizeof(budget));
+    reset();
+}
+
+
+uint32_t Profiler::start(void)
+{
+    return read_cycles();
+}
+
+
+void Profiler::stop(int scope, uint32_t start_cycles)
+{
+    // unsigned subtraction is correct across a counter wrap
+    record(scope, read_cycles() - start_cycles);
+}
+
+
+void Profiler::record(int scope, uint32_t cycles)
+{
+    if (scope < 0 || scope >= scope_count)
+    {
+        return;
+    }
+    Profile_stats& s = stats[scope];
+    s.count++;
+    s.total += cycles;
+    s.last = cycles;
+    if (cycles < s.min)
+    {
+        s.min = cycles;
+    }
+    if (cycles > s.max)
+    {
+        s.max = cycles;
+    }
+    if (budget[scope] != 0 && cycles > budget[scope])
+    {
+        s.over_budget++;
+    }
+
+    // floor(log2(cycles)), a single instruction on the Cortex-M4
+    int bin = (cycles == 0) ? 0 : 31 - __builtin_clz(cycles);
+    s.bins[(bin < PROFILE_BINS) ? bin : PROFILE_BINS - 1]++;
+}
+
+
+void Profiler::set_budget(int scope, float budget_us)
+{
+    if (scope >= 0 && scope < scope_count)
+    {
+        budget[scope] = (budget_us > 0) ? (uint32_t) (budget_us * cycles_per_us) : 0;
+    }
+}
+
+
+void Profiler::reset(void)
+{
+    memset(stats, 0, sizeof(stats));
+    for (int i = 0; i < PROFILE_MAX_SCOPES; i++)
+    {
+        stats[i].min = UINT32_MAX;
+    }
+}
+
+
+bool Profiler::get_stats(int scope, Profile_stats* copy)
+{
+    if (scope < 0 || scope >= scope_count)
+    {
+        return false;
+    }
+    *copy = stats[scope];
+    if (copy->count == 0)
+    {
+        copy->min = 0;
+    }
+    return true;
+}
+
+
+uint32_t Profiler::get_percentile(int scope, float fraction)
+{
+    if (scope < 0 || scope >= scope_count || stats[scope].count == 0)
+    {
+        return 0;
+    }
+    const Profile_stats& s = stats[scope];
+    uint32_t needed = (uint32_t) (fraction * s.count + 0.5f);
+    uint32_t cumulative = 0;
+    for (int bin = 0; bin < PROFILE_BINS; bin++)
+    {
+        cumulative += s.bins[bin];
+        if (cumulative >= needed && cumulative > 0)
+        {
+            uint32_t upper = (bin >= 31) ? UINT32_MAX : (2u << bin) - 1;
+            return (upper < s.max) ? upper : s.max;
+        }
+    }
+    return s.max;
+}
+
+
+uint32_t Profiler::get_last(int scope)
+{
+    return (scope >= 0 && scope < scope_count) ? stats[scope].last : 0;
+}
+
+
+float Profiler::to_us(uint32_t cycles)
+{
+    return (float) cycles / cycles_per_us;
+}
+
+
+int Profiler::get_scope_count(void)
+{
+    return scope_count;
+}
+
+
+const char* Profiler::get_name(int scope)
+{
+    return (scope >= 0 && scope < scope_count) ? names[scope] : "";
+}
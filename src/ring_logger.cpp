@@ -0,0 +1,348 @@
+#include <math.h>
+
+#include "ring_logger.h"
+
+
+/*  BLOCK FORMAT
+
+    [length u16][sample count u8][first sample: absolute values][next samples: deltas]
+
+    Values and deltas are zigzag encoded varints, one per selected channel. The length includes
+    the header and is updated after each sample, so the block being written can be read too.
+*/
+
+#define LOG_BLOCK_HEADER        3
+#define LOG_MAX_VALUE           (1 << 30)
+
+
+RingLogger::RingLogger(const Log_channel* channels_, int channel_count_, uint8_t* buffer, int size_)
+{
+    channels = channels_;
+    channel_count = channel_count_;
+    ring = buffer;
+    size = size_;
+    selected_count = 0;
+    decimation = 1;
+    pre_samples = 0;
+    post_samples = 0;
+    state = log_stopped;
+    arm();
+    state = log_stopped;
+}
+
+
+bool RingLogger::select(const uint8_t* ids, int count)
+{
+    state = log_stopped;
+    if (count > LOG_MAX_CHANNELS)
+    {
+        return false;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (ids[i] >= channel_count)
+        {
+            return false;
+        }
+    }
+    for (int i = 0; i < count; i++)
+    {
+        selected[i] = ids[i];
+    }
+    selected_count = count;
+    arm();
+    state = log_stopped;
+    return true;
+}
+
+
+void RingLogger::set_decimation(int n)
+{
+    state = log_stopped;
+    decimation = (n < 1) ? 1 : n;
+    arm();
+    state = log_stopped;
+}
+
+
+void RingLogger::set_trigger(int pre, int post)
+{
+    state = log_stopped;
+    pre_samples = (pre < 0) ? 0 : pre;
+    post_samples = (post < 0) ? 0 : post;
+    arm();
+    state = log_stopped;
+}
+
+
+void RingLogger::arm(void)
+{
+    // the ISR does nothing until the state is set back to recording at the end
+    state = log_stopped;
+    head = 0;
+    tail = 0;
+    used = 0;
+    block_start = 0;
+    block_count = 0;
+    sample_index = 0;
+    oldest_index = 0;
+    trigger_index = 0;
+    trigger_cause = 0;
+    post_count = 0;
+    blocks_dropped = 0;
+    decimation_count = 0;
+    state = log_recording;
+}
+
+
+void RingLogger::stop(void)
+{
+    if (state != log_done)
+    {
+        state = log_stopped;
+    }
+}
+
+
+void RingLogger::trigger(int cause)
+{
+    if (state != log_recording)
+    {
+        return;
+    }
+    trigger_index = sample_index;
+    trigger_cause = cause;
+    post_count = post_samples;
+    state = (post_count > 0) ? log_post_trigger : log_done;
+}
+
+
+void RingLogger::put(uint8_t byte)
+{
+    ring[head] = byte;
+    head = (head + 1 == size) ? 0 : head + 1;
+    used++;
+}
+
+
+uint8_t RingLogger::get(int position)
+{
+    return ring[position % size];
+}
+
+
+void RingLogger::drop_oldest_block(void)
+{
+    int length = get(tail) | (get(tail + 1) << 8);
+    oldest_index += get(tail + 2);
+    tail = (tail + length) % size;
+    used -= length;
+    blocks_dropped++;
+}
+
+
+void RingLogger::sample(void)
+{
+    if ((state != log_recording && state != log_post_trigger) || selected_count == 0)
+    {
+        return;
+    }
+    if (++decimation_count < decimation)
+    {
+        return;
+    }
+    decimation_count = 0;
+
+    // encode first, the size is needed to make space
+    uint8_t bytes[LOG_BLOCK_HEADER + LOG_MAX_CHANNELS * 5];
+    bool new_block = (block_count == 0);
+    int length = new_block ? LOG_BLOCK_HEADER : 0;
+    for (int i = 0; i < selected_count; i++)
+    {
+        const Log_channel& channel = channels[selected[i]];
+        float scaled = channel.read() * channel.scale;
+        scaled = (scaled > LOG_MAX_VALUE) ? LOG_MAX_VALUE : ((scaled < -LOG_MAX_VALUE) ? -LOG_MAX_VALUE : scaled);
+        int32_t value = (int32_t) lroundf(scaled);
+        int32_t delta = new_block ? value : value - last[i];
+        last[i] = value;
+
+        uint32_t zigzag = ((uint32_t) delta << 1) ^ (uint32_t) (delta >> 31);
+        while (zigzag >= 0x80)
+        {
+            bytes[length++] = (uint8_t) (zigzag | 0x80);
+            zigzag >>= 7;
+        }
+        bytes[length++] = (uint8_t) zigzag;
+    }
+
+    // the block being written is never dropped, the ring holds many blocks
+    while (used + length > size && used > 0 && !(tail == block_start && !new_block))
+    {
+        drop_oldest_block();
+    }
+    if (used + length > size)
+    {
+        return;
+    }
+
+    if (new_block)
+    {
+        block_start = head;
+    }
+    for (int i = 0; i < length; i++)
+    {
+        put(bytes[i]);
+    }
+    block_count++;
+
+    int block_length = (head - block_start + size) % size;
+    ring[block_start] = (uint8_t) block_length;
+    ring[(block_start + 1) % size] = (uint8_t) (block_length >> 8);
+    ring[(block_start + 2) % size] = (uint8_t) block_count;
+    if (block_count == LOG_BLOCK_SAMPLES)
+    {
+        block_count = 0;
+    }
+
+    sample_index++;
+    if (state == log_post_trigger && --post_count <= 0)
+    {
+        state = log_done;
+    }
+}
+
+
+int RingLogger::get_state(void)
+{
+    return state;
+}
+
+
+int RingLogger::get_trigger_cause(void)
+{
+    return trigger_cause;
+}
+
+
+int RingLogger::get_selected_count(void)
+{
+    return selected_count;
+}
+
+
+const Log_channel* RingLogger::get_selected(int column)
+{
+    return (column >= 0 && column < selected_count) ? &channels[selected[column]] : nullptr;
+}
+
+
+int RingLogger::get_decimation(void)
+{
+    return decimation;
+}
+
+
+int RingLogger::get_pre_samples(void)
+{
+    return pre_samples;
+}
+
+
+int RingLogger::get_post_samples(void)
+{
+    return post_samples;
+}
+
+
+int RingLogger::get_used_bytes(void)
+{
+    return used;
+}
+
+
+int RingLogger::get_sample_count(void)
+{
+    return (int) (sample_index - oldest_index);
+}
+
+
+int RingLogger::get_blocks_dropped(void)
+{
+    return blocks_dropped;
+}
+
+
+bool RingLogger::read_varint(int* position, uint32_t* value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 35; shift += 7)
+    {
+        uint8_t byte = get(*position);
+        *position = (*position + 1) % size;
+        *value |= (uint32_t) (byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void RingLogger::start_read(void)
+{
+    read_pos = tail;
+    read_block_end = tail;
+    read_block_count = 0;
+    read_index = oldest_index;
+}
+
+
+bool RingLogger::read_next(int32_t* offset, float* values)
+{
+    if (state != log_stopped && state != log_done)
+    {
+        return false;
+    }
+
+    // first sample returned and sample at offset 0
+    bool triggered = (trigger_cause != 0 || state == log_done);
+    uint32_t first = oldest_index;
+    if (triggered && pre_samples > 0 && trigger_index - oldest_index > (uint32_t) pre_samples)
+    {
+        first = trigger_index - pre_samples;
+    }
+    uint32_t base = triggered ? trigger_index : first;
+
+    while (read_index != sample_index)
+    {
+        if (read_pos == read_block_end)
+        {
+            int length = get(read_pos) | (get(read_pos + 1) << 8);
+            read_block_end = (read_pos + length) % size;
+            read_pos = (read_pos + LOG_BLOCK_HEADER) % size;
+            read_block_count = 0;
+        }
+
+        for (int i = 0; i < selected_count; i++)
+        {
+            uint32_t zigzag;
+            read_varint(&read_pos, &zigzag);
+            int32_t delta = (int32_t) (zigzag >> 1) ^ -(int32_t) (zigzag & 1);
+            read_last[i] = (read_block_count == 0) ? delta : read_last[i] + delta;
+        }
+        read_block_count++;
+
+        uint32_t index = read_index++;
+        if (index - oldest_index >= first - oldest_index)
+        {
+            *offset = (int32_t) (index - base);
+            for (int i = 0; i < selected_count; i++)
+            {
+                values[i] = read_last[i] / channels[selected[i]].scale;
+            }
+            return true;
+        }
+    }
+    return false;
+}
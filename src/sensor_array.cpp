@@ -163,6 +163,23 @@ float SensorArray::get_filtered_output(void)
     return filtered_output;
 }
 
+void SensorArray::set_detect_range(float detect_range)
+{
+    detect_range_ = detect_range;
+}
+
+void SensorArray::set_angle_coeff(float angle_coefficient)
+{
+    angle_coeff = angle_coefficient;
+}
+
+void SensorArray::set_low_pass(float LowPass_a0, float LowPass_b0, float LowPass_b1)
+{
+    LP_a0 = LowPass_a0;
+    LP_b0 = LowPass_b0;
+    LP_b1 = LowPass_b1;
+}
+
 void SensorArray::calibrate_sensors(void)
 {
     float sample_total[6] = {0};
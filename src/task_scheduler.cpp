@@ -0,0 +1,195 @@
+#include <string.h>
+
+#include "task_scheduler.h"
+
+
+TaskScheduler::TaskScheduler(const Task_def* tasks_, int task_count_, uint32_t base_period_us_, Clock_source read_us_)
+{
+    tasks = tasks_;
+    task_count = (task_count_ > SCHED_MAX_TASKS) ? SCHED_MAX_TASKS : task_count_;
+    base_period_us = base_period_us_;
+    read_us = read_us_;
+    timeout_callback = nullptr;
+    timeout_tick = 0;
+    ticks = 0;
+    start_us = 0;
+    reset_stats();
+}
+
+
+void TaskScheduler::start(void)
+{
+    ticks = 0;
+    start_us = read_us();
+    for (int i = 0; i < task_count; i++)
+    {
+        // the first run gets the nominal period as dt
+        last_start[i] = start_us + base_period_us * (tasks[i].phase + 1) - base_period_us * tasks[i].divider;
+        last_dt[i] = base_period_us * tasks[i].divider;
+    }
+    reset_stats();
+}
+
+
+void TaskScheduler::tick(void)
+{
+    // all the times are relative to the ideal tick time, unsigned differences are correct across a wrap
+    uint32_t tick = ticks;
+    uint32_t ideal = start_us + base_period_us * (tick + 1);
+    uint32_t latency = read_us() - ideal;
+    if ((int32_t) latency > 0)
+    {
+        if (latency > max_latency_us)
+        {
+            max_latency_us = latency;
+        }
+        if (latency >= base_period_us)
+        {
+            late_ticks++;
+        }
+    }
+
+    for (int i = 0; i < task_count; i++)
+    {
+        const Task_def& task = tasks[i];
+        if (tick % task.divider != task.phase)
+        {
+            continue;
+        }
+        Task_stats& s = stats[i];
+        uint32_t task_start = read_us();
+        uint32_t dt = task_start - last_start[i];
+        last_start[i] = task_start;
+        last_dt[i] = dt;
+
+        task.run(dt * 1e-6f);
+
+        uint32_t end = read_us() - ideal;
+        uint32_t deadline = (task.deadline_us != 0) ? task.deadline_us : base_period_us;
+        s.runs++;
+        if ((int32_t) end > (int32_t) deadline)
+        {
+            s.deadline_misses++;
+        }
+        if ((int32_t) end > (int32_t) s.max_end_us)
+        {
+            s.max_end_us = end;
+        }
+        if (s.runs > 1)
+        {
+            s.min_dt_us = (dt < s.min_dt_us) ? dt : s.min_dt_us;
+            s.max_dt_us = (dt > s.max_dt_us) ? dt : s.max_dt_us;
+        }
+    }
+
+    Timeout_callback callback = timeout_callback;
+    if (callback != nullptr && (int32_t) (tick - timeout_tick) >= 0)
+    {
+        timeout_callback = nullptr;
+        callback();
+    }
+
+    if ((int32_t) (read_us() - ideal) > (int32_t) base_period_us)
+    {
+        overruns++;
+    }
+    ticks = tick + 1;
+}
+
+
+void TaskScheduler::set_timeout(Timeout_callback callback, float delay)
+{
+    // the callback is set last, the tick ISR never sees it with the old tick
+    timeout_callback = nullptr;
+    uint32_t delay_ticks = (delay > 0) ? (uint32_t) (delay * 1e6f / base_period_us + 0.999f) : 0;
+    timeout_tick = ticks + delay_ticks;
+    timeout_callback = callback;
+}
+
+
+void TaskScheduler::cancel_timeout(void)
+{
+    timeout_callback = nullptr;
+}
+
+
+void TaskScheduler::reset_stats(void)
+{
+    memset(stats, 0, sizeof(stats));
+    for (int i = 0; i < SCHED_MAX_TASKS; i++)
+    {
+        stats[i].min_dt_us = UINT32_MAX;
+    }
+    overruns = 0;
+    late_ticks = 0;
+    max_latency_us = 0;
+}
+
+
+bool TaskScheduler::get_task_stats(int task, Task_stats* copy)
+{
+    if (task < 0 || task >= task_count)
+    {
+        return false;
+    }
+    *copy = stats[task];
+    if (copy->runs < 2)
+    {
+        copy->min_dt_us = 0;
+    }
+    return true;
+}
+
+
+uint32_t TaskScheduler::get_next_tick_us(void)
+{
+    return start_us + base_period_us * (ticks + 1);
+}
+
+
+uint32_t TaskScheduler::get_ticks(void)
+{
+    return ticks;
+}
+
+
+uint32_t TaskScheduler::get_last_dt_us(int task)
+{
+    return (task >= 0 && task < task_count) ? last_dt[task] : 0;
+}
+
+
+uint32_t TaskScheduler::get_overruns(void)
+{
+    return overruns;
+}
+
+
+uint32_t TaskScheduler::get_late_ticks(void)
+{
+    return late_ticks;
+}
+
+
+uint32_t TaskScheduler::get_max_latency_us(void)
+{
+    return max_latency_us;
+}
+
+
+uint32_t TaskScheduler::get_base_period_us(void)
+{
+    return base_period_us;
+}
+
+
+int TaskScheduler::get_task_count(void)
+{
+    return task_count;
+}
+
+
+const char* TaskScheduler::get_name(int task)
+{
+    return (task >= 0 && task < task_count) ? tasks[task].name : "";
+}
@@ -0,0 +1,502 @@
+#include <string.h>
+
+#include "telemetry.h"
+
+
+/* FIXED FRAME LAYOUTS */
+
+static const Telemetry_field wheel_fields[] = {
+    {"speed_l", 'h', 1000}, {"speed_r", 'h', 1000}, {"set_speed_l", 'h', 1000}, {"set_speed_r", 'h', 1000},
+};
+
+static const Telemetry_field duty_fields[] = {
+    {"duty_l", 'h', 1000}, {"duty_r", 'h', 1000}, {"applied_l", 'h', 1000}, {"applied_r", 'h', 1000},
+};
+
+static const Telemetry_field sensor_fields[] = {
+    {"output", 'h', 1000}, {"filtered", 'h', 1000}, {"line", 'b', 1},
+    {"s0", 'b', 255}, {"s1", 'b', 255}, {"s2", 'b', 255}, {"s3", 'b', 255}, {"s4", 'b', 255}, {"s5", 'b', 255},
+};
+
+static const Telemetry_field pid_fields[] = {
+    {"pid", 'b', 1}, {"set_point", 'h', 1000}, {"measurement", 'h', 1000},
+    {"p", 'h', 1000}, {"i", 'h', 1000}, {"d", 'h', 1000}, {"output", 'h', 1000},
+};
+
+static const Telemetry_field pose_fields[] = {
+    {"x", 'h', 1000}, {"y", 'h', 1000}, {"heading_deg", 'i', 100}, {"distance", 'i', 1000},
+};
+
+static const Telemetry_field battery_fields[] = {
+    {"voltage", 'w', 1000}, {"current", 'h', 1000},
+};
+
+static const Telemetry_field timing_fields[] = {
+    {"isr_us", 'w', 1}, {"loop_us", 'w', 1},
+};
+
+static const Telemetry_field log_fields[] = {
+    {"sample", 'w', 1}, {"set_point", 'h', 1000}, {"measurement", 'h', 1000},
+    {"p", 'h', 1000}, {"i", 'h', 1000}, {"d", 'h', 1000},
+};
+
+static const Telemetry_field log_status_fields[] = {
+    {"samples", 'i', 1}, {"dropped", 'i', 1},
+};
+
+#define FIELDS(arr)     (*count = sizeof(arr) / sizeof(arr[0]), arr)
+
+
+const Telemetry_field* telemetry_frame_fields(uint8_t type, int* count)
+{
+    switch (type)
+    {
+        case tm_wheel:      return FIELDS(wheel_fields);
+        case tm_duty:       return FIELDS(duty_fields);
+        case tm_sensor:     return FIELDS(sensor_fields);
+        case tm_pid:        return FIELDS(pid_fields);
+        case tm_pose:       return FIELDS(pose_fields);
+        case tm_battery:    return FIELDS(battery_fields);
+        case tm_timing:     return FIELDS(timing_fields);
+        case tm_log:        return FIELDS(log_fields);
+        case tm_log_status: return FIELDS(log_status_fields);
+        default:
+            *count = 0;
+            return NULL;
+    }
+}
+
+
+const char* telemetry_frame_name(uint8_t type)
+{
+    switch (type)
+    {
+        case tm_speed_burst:    return "speed_burst";
+        case tm_sensor_burst:   return "sensor_burst";
+        case tm_wheel:          return "wheel";
+        case tm_duty:           return "duty";
+        case tm_sensor:         return "sensor";
+        case tm_pid:            return "pid";
+        case tm_pose:           return "pose";
+        case tm_battery:        return "battery";
+        case tm_timing:         return "timing";
+        case tm_log:            return "log";
+        case tm_log_status:     return "log_status";
+        default:                return "unknown";
+    }
+}
+
+
+/* FRAMING */
+
+uint8_t telemetry_crc8(const uint8_t* data, int length)
+{
+    uint8_t crc = 0;
+    for (int i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x80) ? (uint8_t) ((crc << 1) ^ 0x07) : (uint8_t) (crc << 1);
+        }
+    }
+    return crc;
+}
+
+
+int telemetry_cobs_encode(const uint8_t* in, int length, uint8_t* out)
+{
+    // each zero is replaced by the distance to the next zero, starting with a code byte
+    int code_index = 0;
+    int out_index = 1;
+    uint8_t code = 1;
+
+    for (int i = 0; i < length; i++)
+    {
+        if (in[i] == 0)
+        {
+            out[code_index] = code;
+            code_index = out_index++;
+            code = 1;
+        }
+        else
+        {
+            out[out_index++] = in[i];
+            if (++code == 0xFF)
+            {
+                out[code_index] = code;
+                code_index = out_index++;
+                code = 1;
+            }
+        }
+    }
+    out[code_index] = code;
+    return out_index;
+}
+
+
+int telemetry_cobs_decode(const uint8_t* in, int length, uint8_t* out)
+{
+    int in_index = 0;
+    int out_index = 0;
+
+    while (in_index < length)
+    {
+        uint8_t code = in[in_index++];
+        if (code == 0 || in_index + code - 1 > length)
+        {
+            return -1;
+        }
+        for (int i = 1; i < code; i++)
+        {
+            out[out_index++] = in[in_index++];
+        }
+        if (code != 0xFF && in_index < length)
+        {
+            out[out_index++] = 0;
+        }
+    }
+    return out_index;
+}
+
+
+int telemetry_encode_frame(uint8_t type, uint8_t seq, const uint8_t* payload, int length, uint8_t* out)
+{
+    if (length < 0 || length > TELEMETRY_MAX_PAYLOAD)
+    {
+        return 0;
+    }
+
+    uint8_t raw[TELEMETRY_MAX_RAW];
+    raw[0] = type;
+    raw[1] = seq;
+    memcpy(raw + 2, payload, length);
+    raw[length + 2] = telemetry_crc8(raw, length + 2);
+
+    int encoded = telemetry_cobs_encode(raw, length + 3, out);
+    out[encoded++] = TELEMETRY_DELIMITER;
+    return encoded;
+}
+
+
+bool telemetry_decode_frame(const uint8_t* in, int length, Telemetry_frame* frame)
+{
+    uint8_t raw[TELEMETRY_MAX_ENCODED];
+    if (length > TELEMETRY_MAX_RAW + 1)
+    {
+        return false;
+    }
+
+    int raw_length = telemetry_cobs_decode(in, length, raw);
+    if (raw_length < 3 || raw_length > TELEMETRY_MAX_RAW)
+    {
+        return false;
+    }
+    if (telemetry_crc8(raw, raw_length - 1) != raw[raw_length - 1])
+    {
+        return false;
+    }
+
+    frame->type = raw[0];
+    frame->seq = raw[1];
+    frame->length = raw_length - 3;
+    memcpy(frame->payload, raw + 2, frame->length);
+    return true;
+}
+
+
+/* PAYLOAD WRITER/READER */
+
+TelemetryWriter::TelemetryWriter(void)
+{
+    length = 0;
+}
+
+static int clamp_int(int value, int min, int max)
+{
+    return (value < min) ? min : (value > max) ? max : value;
+}
+
+void TelemetryWriter::put_u8(int value)
+{
+    if (length + 1 <= TELEMETRY_MAX_PAYLOAD)
+    {
+        buffer[length++] = (uint8_t) clamp_int(value, 0, 255);
+    }
+}
+
+void TelemetryWriter::put_i8(int value)
+{
+    if (length + 1 <= TELEMETRY_MAX_PAYLOAD)
+    {
+        buffer[length++] = (uint8_t) (int8_t) clamp_int(value, -128, 127);
+    }
+}
+
+void TelemetryWriter::put_u16(int value)
+{
+    if (length + 2 <= TELEMETRY_MAX_PAYLOAD)
+    {
+        uint16_t v = (uint16_t) clamp_int(value, 0, 65535);
+        buffer[length++] = v & 0xFF;
+        buffer[length++] = v >> 8;
+    }
+}
+
+void TelemetryWriter::put_i16(int value)
+{
+    if (length + 2 <= TELEMETRY_MAX_PAYLOAD)
+    {
+        uint16_t v = (uint16_t) (int16_t) clamp_int(value, -32768, 32767);
+        buffer[length++] = v & 0xFF;
+        buffer[length++] = v >> 8;
+    }
+}
+
+void TelemetryWriter::put_i32(int32_t value)
+{
+    if (length + 4 <= TELEMETRY_MAX_PAYLOAD)
+    {
+        uint32_t v = (uint32_t) value;
+        for (int i = 0; i < 4; i++)
+        {
+            buffer[length++] = (v >> (8 * i)) & 0xFF;
+        }
+    }
+}
+
+void TelemetryWriter::put_fixed(float value, float scale)
+{
+    float scaled = value * scale;
+    // clamp before converting, a float outside the int range is undefined
+    if (scaled > 32767)
+    {
+        scaled = 32767;
+    }
+    else if (scaled < -32768)
+    {
+        scaled = -32768;
+    }
+    put_i16((int) (scaled < 0 ? scaled - 0.5f : scaled + 0.5f));
+}
+
+const uint8_t* TelemetryWriter::data(void)
+{
+    return buffer;
+}
+
+int TelemetryWriter::size(void)
+{
+    return length;
+}
+
+
+TelemetryReader::TelemetryReader(const Telemetry_frame& frame)
+{
+    buffer = frame.payload;
+    length = frame.length;
+    position = 0;
+}
+
+int TelemetryReader::read_u8(void)
+{
+    return (position + 1 <= length) ? buffer[position++] : 0;
+}
+
+int TelemetryReader::read_i8(void)
+{
+    return (int8_t) read_u8();
+}
+
+int TelemetryReader::read_u16(void)
+{
+    if (position + 2 > length)
+    {
+        position = length;
+        return 0;
+    }
+    int value = buffer[position] | (buffer[position + 1] << 8);
+    position += 2;
+    return value;
+}
+
+int TelemetryReader::read_i16(void)
+{
+    return (int16_t) read_u16();
+}
+
+int32_t TelemetryReader::read_i32(void)
+{
+    if (position + 4 > length)
+    {
+        position = length;
+        return 0;
+    }
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        value |= (uint32_t) buffer[position++] << (8 * i);
+    }
+    return (int32_t) value;
+}
+
+int TelemetryReader::remaining(void)
+{
+    return length - position;
+}
+
+
+/* BURST FRAMES */
+
+TelemetryBurst::TelemetryBurst(uint8_t type_, int channels_)
+{
+    type = type_;
+    channels = (channels_ == 2) ? 2 : 1;
+    // first sample int16 per channel, then int8 per channel
+    capacity = 1 + (TELEMETRY_MAX_PAYLOAD - 2 * channels) / channels;
+    clear();
+}
+
+bool TelemetryBurst::add(int value0, int value1)
+{
+    if (count >= capacity)
+    {
+        return true;
+    }
+
+    int values[2] = {value0, value1};
+    for (int c = 0; c < channels; c++)
+    {
+        if (count == 0)
+        {
+            writer.put_i16(values[c]);
+            last[c] = clamp_int(values[c], -32768, 32767);
+        }
+        else
+        {
+            int delta = clamp_int(values[c] - last[c], -128, 127);
+            writer.put_i8(delta);
+            last[c] += delta;
+        }
+    }
+    count++;
+    return count >= capacity;
+}
+
+bool TelemetryBurst::is_full(void)
+{
+    return count >= capacity;
+}
+
+int TelemetryBurst::get_count(void)
+{
+    return count;
+}
+
+int TelemetryBurst::get_capacity(void)
+{
+    return capacity;
+}
+
+uint8_t TelemetryBurst::get_type(void)
+{
+    return type;
+}
+
+const uint8_t* TelemetryBurst::data(void)
+{
+    return writer.data();
+}
+
+int TelemetryBurst::size(void)
+{
+    return writer.size();
+}
+
+void TelemetryBurst::clear(void)
+{
+    writer = TelemetryWriter();
+    count = 0;
+    last[0] = 0;
+    last[1] = 0;
+}
+
+int TelemetryBurst::decode(const Telemetry_frame& frame, int channels, int* samples, int max_samples)
+{
+    TelemetryReader reader(frame);
+    int last_values[2] = {0, 0};
+    int decoded = 0;
+
+    if (reader.remaining() < 2 * channels)
+    {
+        return 0;
+    }
+
+    while (decoded < max_samples && reader.remaining() >= ((decoded == 0) ? 2 * channels : channels))
+    {
+        for (int c = 0; c < channels; c++)
+        {
+            last_values[c] = (decoded == 0) ? reader.read_i16() : last_values[c] + reader.read_i8();
+            samples[decoded * channels + c] = last_values[c];
+        }
+        decoded++;
+    }
+    return decoded;
+}
+
+
+/* STREAM DECODER */
+
+TelemetryStreamDecoder::TelemetryStreamDecoder(void)
+{
+    length = 0;
+    overflow = false;
+    last_seq = -1;
+    frames = 0;
+    crc_errors = 0;
+    length_errors = 0;
+    lost = 0;
+}
+
+bool TelemetryStreamDecoder::feed(uint8_t byte, Telemetry_frame* frame)
+{
+    if (byte != TELEMETRY_DELIMITER)
+    {
+        if (length < (int) sizeof(buffer))
+        {
+            buffer[length++] = byte;
+        }
+        else
+        {
+            overflow = true;
+        }
+        return false;
+    }
+
+    bool valid = false;
+    if (overflow)
+    {
+        length_errors++;
+    }
+    else if (length > 0)
+    {
+        valid = telemetry_decode_frame(buffer, length, frame);
+        if (!valid)
+        {
+            crc_errors++;
+        }
+    }
+    length = 0;
+    overflow = false;
+
+    if (valid)
+    {
+        if (last_seq >= 0)
+        {
+            lost += (uint8_t) (frame->seq - last_seq - 1);
+        }
+        last_seq = frame->seq;
+        frames++;
+    }
+    return valid;
+}
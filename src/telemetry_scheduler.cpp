@@ -0,0 +1,210 @@
+#include <string.h>
+
+#include "telemetry_scheduler.h"
+#include "telemetry.h"
+
+
+TelemetryScheduler::TelemetryScheduler(Stream_sender sender_, int budget_, int burst_)
+{
+    sender = sender_;
+    memset(streams, 0, sizeof(streams));
+    started = false;
+    last_update_us = 0;
+    set_budget(budget_, burst_);
+}
+
+
+bool TelemetryScheduler::subscribe(int stream, float rate, bool pushed)
+{
+    if (stream < 0 || stream >= TELEMETRY_MAX_STREAMS || !(rate >= 0 && rate <= 1000))
+    {
+        return false;
+    }
+
+    Stream& s = streams[stream];
+    s.rate = rate;
+    s.pushed = pushed;
+    s.period_us = (rate > 0) ? (uint32_t) (1e6f / rate) : 0;
+    s.next_due_us = last_update_us;
+    if (s.cost == 0)
+    {
+        s.cost = TELEMETRY_MAX_ENCODED;
+    }
+    return true;
+}
+
+
+void TelemetryScheduler::unsubscribe_all(void)
+{
+    for (int i = 0; i < TELEMETRY_MAX_STREAMS; i++)
+    {
+        streams[i].rate = 0;
+        streams[i].period_us = 0;
+    }
+}
+
+
+void TelemetryScheduler::set_budget(int budget_, int burst_)
+{
+    budget = budget_;
+    burst = (burst_ < TELEMETRY_MAX_ENCODED) ? TELEMETRY_MAX_ENCODED : burst_;
+    tokens_us = (int64_t) burst * 1000000;
+}
+
+
+void TelemetryScheduler::refill(uint32_t now_us)
+{
+    if (!started)
+    {
+        // first update, the streams subscribed before it are due now
+        for (int i = 0; i < TELEMETRY_MAX_STREAMS; i++)
+        {
+            streams[i].next_due_us = now_us;
+        }
+        last_update_us = now_us;
+        started = true;
+        return;
+    }
+
+    uint32_t elapsed = now_us - last_update_us;
+    last_update_us = now_us;
+
+    int64_t max_tokens = (int64_t) burst * 1000000;
+    tokens_us += (int64_t) elapsed * budget;
+    if (tokens_us > max_tokens)
+    {
+        tokens_us = max_tokens;
+    }
+}
+
+
+bool TelemetryScheduler::take(Stream& stream, int bytes)
+{
+    if (tokens_us < (int64_t) bytes * 1000000)
+    {
+        stream.decimated++;
+        return false;
+    }
+    tokens_us -= (int64_t) bytes * 1000000;
+    return true;
+}
+
+
+void TelemetryScheduler::update(uint32_t now_us)
+{
+    refill(now_us);
+
+    while (true)
+    {
+        // most overdue polled stream, signed difference so the time can wrap around
+        int due = -1;
+        int32_t most_late = -1;
+        for (int i = 0; i < TELEMETRY_MAX_STREAMS; i++)
+        {
+            Stream& s = streams[i];
+            int32_t late = (int32_t) (now_us - s.next_due_us);
+            if (s.period_us > 0 && !s.pushed && late >= 0 && late > most_late)
+            {
+                due = i;
+                most_late = late;
+            }
+        }
+        if (due < 0)
+        {
+            return;
+        }
+
+        Stream& s = streams[due];
+        if (tokens_us < (int64_t) s.cost * 1000000)
+        {
+            // out of budget, the due streams wait and the most overdue one goes first next time
+            return;
+        }
+
+        s.next_due_us += s.period_us;
+        if ((int32_t) (now_us - s.next_due_us) >= 0)
+        {
+            // waited more than one period (budget or main loop blocked), the missed samples are decimated
+            uint32_t missed = (now_us - s.next_due_us) / s.period_us + 1;
+            s.decimated += missed;
+            s.next_due_us += missed * s.period_us;
+        }
+
+        int bytes = sender(due);
+        sent(due, bytes);
+        if (bytes > 0)
+        {
+            tokens_us -= (int64_t) bytes * 1000000;
+            s.cost = bytes;
+        }
+    }
+}
+
+
+bool TelemetryScheduler::offer(int stream, int bytes, uint32_t now_us)
+{
+    if (stream < 0 || stream >= TELEMETRY_MAX_STREAMS)
+    {
+        return false;
+    }
+    refill(now_us);
+    return take(streams[stream], bytes);
+}
+
+
+void TelemetryScheduler::sent(int stream, int bytes)
+{
+    if (stream < 0 || stream >= TELEMETRY_MAX_STREAMS)
+    {
+        return;
+    }
+    if (bytes > 0)
+    {
+        streams[stream].sent++;
+    }
+    else
+    {
+        streams[stream].dropped++;
+    }
+}
+
+
+void TelemetryScheduler::reset_counters(void)
+{
+    for (int i = 0; i < TELEMETRY_MAX_STREAMS; i++)
+    {
+        streams[i].sent = 0;
+        streams[i].decimated = 0;
+        streams[i].dropped = 0;
+    }
+}
+
+
+float TelemetryScheduler::get_rate(int stream)
+{
+    return (stream >= 0 && stream < TELEMETRY_MAX_STREAMS) ? streams[stream].rate : 0;
+}
+
+
+int TelemetryScheduler::get_sent(int stream)
+{
+    return (stream >= 0 && stream < TELEMETRY_MAX_STREAMS) ? streams[stream].sent : 0;
+}
+
+
+int TelemetryScheduler::get_decimated(int stream)
+{
+    return (stream >= 0 && stream < TELEMETRY_MAX_STREAMS) ? streams[stream].decimated : 0;
+}
+
+
+int TelemetryScheduler::get_dropped(int stream)
+{
+    return (stream >= 0 && stream < TELEMETRY_MAX_STREAMS) ? streams[stream].dropped : 0;
+}
+
+
+int TelemetryScheduler::get_budget(void)
+{
+    return budget;
+}